@@ -232,6 +232,9 @@ public:
                              sizeof( ZERO_REF ) ) != 0 );
   }
 
+  /* for encoder use, when the quantizer already knows the answer */
+  void set_has_nonzero( const bool has_nonzero ) { has_nonzero_ = has_nonzero; }
+
   void zero_out()
   {
     has_nonzero_ = false;
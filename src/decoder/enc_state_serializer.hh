@@ -31,14 +31,15 @@
 #pragma once
 #include <algorithm>
 #include <cstdio>
-#include <fstream>
-#include <iterator>
+#include <cstring>
+#include <memory>
 #include <string>
 #include <utility>
 #include <vector>
 
 #include "file.hh"
 #include "file_descriptor.hh"
+#include "state_delta.hh"
 
 enum class EncoderSerDesTag : uint8_t
   { PROB_TABLE
@@ -74,21 +75,31 @@ class EncoderStateSerializer {
 
     template <typename T> size_t put(T u) {
       size_t posn = data_.size();
-      for (unsigned i = 0; i < sizeof(u); i++) {
-        data_.push_back((uint8_t) (u & 0xff));
-        u = u >> 8;
-      }
-      return posn;
+      data_.resize(posn + sizeof(u));
+      return put(u, posn);
     }
 
     template<typename T> size_t put(T u, size_t offset) {
+      uint8_t *out = &data_.at(offset + sizeof(u) - 1) - (sizeof(u) - 1);
       for (unsigned i = 0; i < sizeof(u); i++) {
-        data_.at(offset + i) = (uint8_t) (u & 0xff);
+        out[i] = (uint8_t) (u & 0xff);
         u = u >> 8;
       }
       return offset;
     }
 
+    size_t put(const Chunk &bytes) {
+      size_t posn = data_.size();
+      data_.insert(data_.end(), bytes.buffer(), bytes.buffer() + bytes.size());
+      return posn;
+    }
+
+    // the planes of a raster are contiguous, so each is copied whole
+    void put(const TwoD<uint8_t> &plane) {
+      const uint8_t *first = &plane.at(0, 0);
+      data_.insert(data_.end(), first, first + plane.width() * plane.height());
+    }
+
     size_t put(const VP8Raster &ref, EncoderSerDesTag t) {
       unsigned width = ref.width();
       unsigned height = ref.height();
@@ -97,43 +108,80 @@ class EncoderStateSerializer {
       this->put(t);
       this->put(len);
 
-      ref.Y().forall([this](uint8_t &f){ this->put(f); });
-      ref.U().forall([this](uint8_t &f){ this->put(f); });
-      ref.V().forall([this](uint8_t &f){ this->put(f); });
+      this->put(ref.Y());
+      this->put(ref.U());
+      this->put(ref.V());
 
       return len + 5;
     }
 
     void write(const char *filename) {
-      std::ofstream output_file(filename);
-      std::ostream_iterator<uint8_t> output_iter(output_file);
-      std::copy(data_.begin(), data_.end(), output_iter);
+      FileDescriptor output_file(SystemCall(filename,
+        open(filename, O_WRONLY | O_CREAT | O_TRUNC,
+             S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP | S_IROTH | S_IWOTH)));
+      output_file.write(Chunk(data_));
     }
 
     void write(const std::string &filename) {
       this->write(filename.c_str());
     }
 
+    // stores the state as a delta against the state file parent (see state_delta.hh)
+    void write_delta(const std::string &filename, const std::string &parent) {
+      write_state_delta(filename, Chunk(data_), parent);
+    }
+
     void write(FILE *file) {
       std::fwrite(data_.data(), 1, data_.size(), file);
     }
+
+    const std::vector<uint8_t> & data(void) const { return data_; }
+    std::vector<uint8_t> release(void) { return std::move(data_); }
 };
 
-class EncoderStateDeserializer : File {
+class EncoderStateDeserializer {
   private:
+    std::unique_ptr<File> file_;
+    std::vector<uint8_t> delta_state_ {};
+    Chunk chunk_;
     size_t ptr_;
 
+    // a state stored as a delta is rebuilt in memory
+    void resolve_delta(const std::string &filename) {
+      if (is_state_delta(chunk_)) {
+        delta_state_ = read_state_delta(chunk_, filename);
+        chunk_ = Chunk(delta_state_);
+        file_.reset();
+      }
+    }
+
+    const Chunk & chunk(void) const { return chunk_; }
+    const Chunk operator()(const uint64_t &offset, const uint64_t &length) const {
+      return chunk_(offset, length);
+    }
+
   public:
     EncoderStateDeserializer(const char *filename)
-      : File(filename)
-      , ptr_(0) {}
+      : file_(new File(filename))
+      , chunk_(file_->chunk())
+      , ptr_(0) {
+      resolve_delta(filename);
+    }
 
     EncoderStateDeserializer(const std::string &filename)
-      : File(filename.c_str())
-      , ptr_(0) {}
+      : EncoderStateDeserializer(filename.c_str()) {}
 
     EncoderStateDeserializer(FILE *file)
-      : File(std::move(FileDescriptor(file)))
+      : file_(new File(std::move(FileDescriptor(file))))
+      , chunk_(file_->chunk())
+      , ptr_(0) {
+      resolve_delta("");
+    }
+
+    // reads from memory owned by the caller, e.g. an in-memory snapshot
+    EncoderStateDeserializer(const Chunk &chunk)
+      : file_()
+      , chunk_(chunk)
       , ptr_(0) {}
 
     template<typename T, typename F, typename ...Ps> static T build(F f, Ps ...ps) {
@@ -141,6 +189,9 @@ class EncoderStateDeserializer : File {
       return T::deserialize(idata, std::forward<Ps>(ps)...);
     }
 
+    // the serialized state, whichever format it was stored in
+    const Chunk & data(void) const { return chunk_; }
+
     void reset(void) { ptr_ = 0; }
     size_t remaining(void) const { return chunk().size() - ptr_; }
     size_t size(void) const { return chunk().size(); }
@@ -154,15 +205,23 @@ class EncoderStateDeserializer : File {
     }
 
     template<typename T> T get(void) {
+      const uint8_t *in = (*this)(ptr_, sizeof(T)).buffer();
       T ret = (T) 0;
       for (unsigned i = sizeof(ret); i > 0; i--) {
         ret = ret << 8;
-        ret = ret | (*this)(ptr_ + i - 1, 1).octet();
+        ret = ret | in[i - 1];
       }
       ptr_ += sizeof(ret);
       return ret;
     }
 
+    // copies a whole plane straight from the (mapped) input
+    void get(TwoD<uint8_t> &plane) {
+      const size_t len = plane.width() * plane.height();
+      std::memcpy(&plane.at(0, 0), (*this)(ptr_, len).buffer(), len);
+      ptr_ += len;
+    }
+
     MutableRasterHandle get_ref(EncoderSerDesTag t, const uint16_t width, const uint16_t height) {
       MutableRasterHandle raster(width, height);
 
@@ -180,9 +239,9 @@ class EncoderStateDeserializer : File {
         (void) get_len;     // only used in assert
         (void) expect_len;  // only used in assert
 
-        raster.get().Y().forall([this](uint8_t &f){ f = this->get<uint8_t>(); });
-        raster.get().U().forall([this](uint8_t &f){ f = this->get<uint8_t>(); });
-        raster.get().V().forall([this](uint8_t &f){ f = this->get<uint8_t>(); });
+        this->get(raster.get().Y());
+        this->get(raster.get().U());
+        this->get(raster.get().V());
       }
 
       return raster;
@@ -32,6 +32,7 @@
 #include "2d.hh"
 #include "block.hh"
 #include "macroblock.hh"
+#include "serialized_frame.hh"
 
 struct References;
 struct Segmentation;
@@ -65,8 +66,8 @@ class Frame
   ProbabilityArray< num_segments > calculate_mb_segment_tree_probs( void ) const;
   SafeArray< Quantizer, num_segments > calculate_segment_quantizers( const Optional< Segmentation > & segmentation ) const;
 
-  std::vector< uint8_t > serialize_first_partition( const ProbabilityTables & probability_tables ) const;
-  std::vector< std::vector< uint8_t > > serialize_tokens( const ProbabilityTables & probability_tables ) const;
+  ArenaBuffer serialize_first_partition( const ProbabilityTables & probability_tables ) const;
+  std::vector< ArenaBuffer > serialize_tokens( const ProbabilityTables & probability_tables ) const;
 
  public:
   void relink_y2_blocks( void );
@@ -102,7 +103,7 @@ class Frame
 
   std::string stats( void ) const;
 
-  std::vector< uint8_t > serialize( const ProbabilityTables & probability_tables ) const;
+  SerializedFrame serialize( const ProbabilityTables & probability_tables ) const;
 
   uint8_t dct_partition_count( void ) const { return 1 << header_.log2_number_of_dct_partitions; }
 
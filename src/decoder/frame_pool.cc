@@ -28,6 +28,7 @@
 
 #include "exception.hh"
 #include "frame_pool.hh"
+#include "raster_handle.hh"
 
 using namespace std;
 
@@ -53,7 +54,15 @@ typename FramePool<FrameType>::FrameHolder FramePool<FrameType>::make_frame( con
   } else {
     if ( (unused_frames_.front()->display_width() != width )
          or (unused_frames_.front()->display_height() != height ) ) {
-      throw Unsupported( "frame size has changed" );
+      if ( RasterPoolDebug::allow_resize ) {
+        /* same as the raster pools: drop the frames of the old size */
+        while ( not unused_frames_.empty() ) {
+          dequeue( unused_frames_ );
+        }
+        ret.reset( new FrameType( width, height ) );
+      } else {
+        throw Unsupported( "frame size has changed" );
+      }
     } else {
       ret = dequeue( unused_frames_ );
     }
@@ -164,6 +164,10 @@ public:
   bool has_nonzero() const { return has_nonzero_; }
   void calculate_has_nonzero();
 
+  /* like calculate_has_nonzero, but trusts the has_nonzero flags of the
+     blocks instead of scanning their coefficients */
+  void update_has_nonzero();
+
   void zero_out();
 };
 
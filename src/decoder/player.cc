@@ -152,3 +152,63 @@ long unsigned int FilePlayer::original_size( void ) const
 {
   return file_.frame( cur_frame_no() ).size();
 }
+
+StreamPlayer::StreamPlayer( const string & filename, const bool follow )
+  : StreamPlayer( IVFStream( filename, follow ) )
+{}
+
+StreamPlayer::StreamPlayer( IVFStream && stream )
+  : FramePlayer( stream.width(), stream.height() ),
+    stream_( move( stream ) )
+{
+  if ( stream_.fourcc() != "VP80" ) {
+    throw Unsupported( "not a VP8 file" );
+  }
+}
+
+StreamPlayer::StreamPlayer( IVFStream && stream, EncoderStateDeserializer & idata )
+  : FramePlayer( idata ),
+    stream_( move( stream ) ),
+    started_( true )
+{
+  if ( stream_.fourcc() != "VP80" ) {
+    throw Unsupported( "not a VP8 file" );
+  }
+
+  if ( stream_.width() != decoder_.get_width() or stream_.height() != decoder_.get_height() ) {
+    throw Unsupported( "state vs. file dimension mismatch" );
+  }
+
+  if ( not decoder_.minihash_match( stream_.expected_decoder_minihash() ) ) {
+    throw Invalid( "Decoder state / IVF mismatch" );
+  }
+}
+
+StreamPlayer StreamPlayer::deserialize( EncoderStateDeserializer & idata, const string & filename,
+                                        const bool follow )
+{
+  return StreamPlayer( IVFStream( filename, follow ), idata );
+}
+
+Optional<RasterHandle> StreamPlayer::advance()
+{
+  while ( true ) {
+    Optional<Chunk> frame = stream_.next_frame();
+    if ( not frame.initialized() ) {
+      return {};
+    }
+
+    /* like FilePlayer, start at the first key frame */
+    if ( not started_ ) {
+      if ( not decoder_.decompress_frame( frame.get() ).key_frame() ) {
+        continue;
+      }
+      started_ = true;
+    }
+
+    Optional<RasterHandle> raster = decode( frame.get() );
+    if ( raster.initialized() ) {
+      return raster;
+    }
+  }
+}
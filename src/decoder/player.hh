@@ -34,6 +34,7 @@
 #include <memory>
 
 #include "ivf.hh"
+#include "ivf_stream.hh"
 #include "decoder.hh"
 #include "enc_state_serializer.hh"
 
@@ -94,6 +95,27 @@ public:
   static FilePlayer deserialize(EncoderStateDeserializer &idata, const std::string &filename);
 };
 
+/* plays an IVFStream, decoding each frame as soon as it has arrived */
+class StreamPlayer : public FramePlayer
+{
+private:
+  IVFStream stream_;
+  bool started_ { false };
+  StreamPlayer( IVFStream && stream, EncoderStateDeserializer & idata );
+
+public:
+  StreamPlayer( IVFStream && stream );
+  StreamPlayer( const std::string & filename, const bool follow = false );
+
+  /* the next displayed frame, or nothing at the end of the stream */
+  Optional<RasterHandle> advance();
+
+  const IVFStream & stream() const { return stream_; }
+
+  static StreamPlayer deserialize( EncoderStateDeserializer & idata, const std::string & filename,
+                                   const bool follow = false );
+};
+
 using Player = FilePlayer;
 
 #endif
@@ -0,0 +1,288 @@
+/* -*-mode:c++; tab-width: 2; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+
+/* Copyright 2013-2018 the Alfalfa authors
+                       and the Massachusetts Institute of Technology
+
+   Redistribution and use in source and binary forms, with or without
+   modification, are permitted provided that the following conditions are
+   met:
+
+      1. Redistributions of source code must retain the above copyright
+         notice, this list of conditions and the following disclaimer.
+
+      2. Redistributions in binary form must reproduce the above copyright
+         notice, this list of conditions and the following disclaimer in the
+         documentation and/or other materials provided with the distribution.
+
+   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+   "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+   LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+   A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+   HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+   SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+   LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+   DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+   THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+   (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+   OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE. */
+#ifndef STATE_CACHE_HH
+#define STATE_CACHE_HH
+
+/* memory-bounded cache of decoder (or encoder) states, indexed by minihash */
+
+#include <list>
+#include <vector>
+#include <string>
+#include <sstream>
+#include <functional>
+#include <unordered_map>
+
+#include "decoder.hh"
+#include "optional.hh"
+#include "enc_state_serializer.hh"
+
+/* a compact, serialized copy of a Decoder. The golden and alternative
+   references are kept as shared handles: they rarely change between
+   consecutive states, and the serializer doesn't store them. */
+class DecoderSnapshot
+{
+private:
+  std::vector<uint8_t> data_;
+  RasterHandle golden_, alternative_;
+  bool error_concealment_;
+
+public:
+  DecoderSnapshot( const Decoder & decoder );
+
+  Decoder restore() const;
+
+  size_t size() const { return sizeof( DecoderSnapshot ) + data_.size(); }
+};
+
+/* SnapshotType is the compressed form of a cold state: it is built by the
+   export function, turned back into a state by the import function, and
+   reports its footprint with size() */
+template<class StateType, class SnapshotType = DecoderSnapshot>
+class StateCache
+{
+public:
+  struct Stats
+  {
+    uint64_t hits { 0 };
+    uint64_t misses { 0 };
+    uint64_t evictions { 0 };
+    uint64_t compressions { 0 };
+    uint64_t decompressions { 0 };
+  };
+
+  typedef std::function<size_t( const StateType & )> FootprintFunction;
+  typedef std::function<SnapshotType( const StateType & )> ExportFunction;
+  typedef std::function<StateType( const SnapshotType & )> ImportFunction;
+
+private:
+  struct Entry
+  {
+    Optional<StateType> state;
+    Optional<SnapshotType> snapshot {};
+    size_t bytes;
+    unsigned int pins { 0 };
+    std::list<uint32_t>::iterator lru_position;
+
+    Entry( StateType && s_state, const size_t s_bytes,
+           const std::list<uint32_t>::iterator s_lru_position )
+      : state( std::move( s_state ) ), bytes( s_bytes ),
+        lru_position( s_lru_position )
+    {}
+  };
+
+  size_t byte_budget_;
+  bool compress_cold_states_;
+
+  FootprintFunction footprint_;
+  ExportFunction export_;
+  ImportFunction import_;
+
+  /* most recently used state is at the front */
+  std::list<uint32_t> lru_ {};
+  std::unordered_map<uint32_t, Entry> entries_ {};
+  size_t total_bytes_ { 0 };
+
+  Stats stats_ {};
+
+  void touch( Entry & entry )
+  {
+    lru_.splice( lru_.begin(), lru_, entry.lru_position );
+  }
+
+  void compress( Entry & entry )
+  {
+    entry.snapshot.initialize( export_( entry.state.get() ) );
+    entry.state.clear();
+
+    total_bytes_ -= entry.bytes;
+    entry.bytes = entry.snapshot.get().size();
+    total_bytes_ += entry.bytes;
+
+    stats_.compressions++;
+  }
+
+  void decompress( Entry & entry )
+  {
+    entry.state.initialize( import_( entry.snapshot.get() ) );
+    entry.snapshot.clear();
+
+    total_bytes_ -= entry.bytes;
+    entry.bytes = footprint_( entry.state.get() );
+    total_bytes_ += entry.bytes;
+
+    stats_.decompressions++;
+  }
+
+  /* first try to compress the least-recently used states, then evict them.
+     Pinned states and the most recently used state are never touched. */
+  void enforce_budget()
+  {
+    if ( lru_.size() < 2 ) {
+      return;
+    }
+
+    if ( compress_cold_states_ ) {
+      for ( auto it = std::prev( lru_.end() );
+            total_bytes_ > byte_budget_ and it != lru_.begin(); it-- ) {
+        Entry & entry = entries_.at( *it );
+
+        if ( entry.pins == 0 and entry.state.initialized() ) {
+          compress( entry );
+        }
+      }
+    }
+
+    auto it = std::prev( lru_.end() );
+
+    while ( total_bytes_ > byte_budget_ and it != lru_.begin() ) {
+      auto current = it--;
+      const Entry & entry = entries_.at( *current );
+
+      if ( entry.pins == 0 ) {
+        total_bytes_ -= entry.bytes;
+        entries_.erase( *current );
+        lru_.erase( current );
+        stats_.evictions++;
+      }
+    }
+  }
+
+public:
+  StateCache( const size_t byte_budget, const bool compress_cold_states,
+              const FootprintFunction & footprint,
+              const ExportFunction & export_function,
+              const ImportFunction & import_function )
+    : byte_budget_( byte_budget ), compress_cold_states_( compress_cold_states ),
+      footprint_( footprint ), export_( export_function ), import_( import_function )
+  {}
+
+  /* inserts a new state, unless one with the same key is already present */
+  void insert( const uint32_t key, StateType && state )
+  {
+    if ( entries_.count( key ) ) {
+      touch( entries_.at( key ) );
+      return;
+    }
+
+    const size_t bytes = footprint_( state );
+    lru_.push_front( key );
+    entries_.emplace( key, Entry( std::move( state ), bytes, lru_.begin() ) );
+    total_bytes_ += bytes;
+
+    enforce_budget();
+  }
+
+  /* returns nullptr on a miss. The returned pointer is valid until the next
+     call that modifies the cache. */
+  StateType * find( const uint32_t key )
+  {
+    auto entry_it = entries_.find( key );
+
+    if ( entry_it == entries_.end() ) {
+      stats_.misses++;
+      return nullptr;
+    }
+
+    Entry & entry = entry_it->second;
+    stats_.hits++;
+    touch( entry );
+
+    if ( not entry.state.initialized() ) {
+      decompress( entry );
+      enforce_budget();
+    }
+
+    return &entry.state.get();
+  }
+
+  StateType & at( const uint32_t key )
+  {
+    StateType * state = find( key );
+
+    if ( state == nullptr ) {
+      throw std::out_of_range( "state not found in cache: " + std::to_string( key ) );
+    }
+
+    return *state;
+  }
+
+  bool contains( const uint32_t key ) const { return entries_.count( key ) > 0; }
+
+  void erase( const uint32_t key )
+  {
+    auto entry_it = entries_.find( key );
+
+    if ( entry_it != entries_.end() ) {
+      total_bytes_ -= entry_it->second.bytes;
+      lru_.erase( entry_it->second.lru_position );
+      entries_.erase( entry_it );
+    }
+  }
+
+  void pin( const uint32_t key )
+  {
+    auto entry_it = entries_.find( key );
+
+    if ( entry_it != entries_.end() ) {
+      entry_it->second.pins++;
+    }
+  }
+
+  void unpin( const uint32_t key )
+  {
+    auto entry_it = entries_.find( key );
+
+    if ( entry_it != entries_.end() and entry_it->second.pins > 0 ) {
+      entry_it->second.pins--;
+    }
+  }
+
+  void unpin_all()
+  {
+    for ( auto & entry : entries_ ) {
+      entry.second.pins = 0;
+    }
+  }
+
+  size_t size() const { return entries_.size(); }
+  size_t bytes() const { return total_bytes_; }
+  const Stats & stats() const { return stats_; }
+
+  std::string str() const
+  {
+    std::ostringstream out;
+    out << "states=" << entries_.size() << " bytes=" << total_bytes_
+        << " hits=" << stats_.hits << " misses=" << stats_.misses
+        << " evictions=" << stats_.evictions
+        << " compressions=" << stats_.compressions
+        << " decompressions=" << stats_.decompressions;
+    return out.str();
+  }
+};
+
+#endif /* STATE_CACHE_HH */
@@ -0,0 +1,299 @@
+/* -*-mode:c++; tab-width: 2; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+
+/* Copyright 2013-2018 the Alfalfa authors
+                       and the Massachusetts Institute of Technology
+
+   Redistribution and use in source and binary forms, with or without
+   modification, are permitted provided that the following conditions are
+   met:
+
+      1. Redistributions of source code must retain the above copyright
+         notice, this list of conditions and the following disclaimer.
+
+      2. Redistributions in binary form must reproduce the above copyright
+         notice, this list of conditions and the following disclaimer in the
+         documentation and/or other materials provided with the distribution.
+
+   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+   "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+   LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+   A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+   HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+   SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+   LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+   DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+   THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+   (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+   OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE. */
+
+#include <cstdlib>
+#include <zlib.h>
+#include <sys/stat.h>
+
+#include "state_delta.hh"
+#include "decoder.hh"
+#include "enc_state_serializer.hh"
+#include "exception.hh"
+#include "file.hh"
+
+using namespace std;
+
+/* file layout, little-endian:
+   "XCSD", version (u8), chain depth (u8, 0 without a parent),
+   parent name length (u16), parent name, parent checksum (u64),
+   state checksum (u64), state length (u32), block size (u32),
+   one bit per block (set if the block is stored),
+   deflated length (u32), the deflated stored blocks */
+
+static const string delta_magic = "XCSD";
+static constexpr uint8_t delta_version = 1;
+
+namespace {
+
+struct ResolvedState
+{
+  vector<uint8_t> data {};
+  unsigned int depth { 0 };
+};
+
+/* FNV-1a over 64-bit words */
+uint64_t checksum( const Chunk & data )
+{
+  uint64_t hash = 14695981039346656037ULL;
+  size_t i = 0;
+
+  for ( ; i + 8 <= data.size(); i += 8 ) {
+    uint64_t word;
+    memcpy( &word, data.buffer() + i, 8 );
+    hash = ( hash ^ word ) * 1099511628211ULL;
+  }
+
+  for ( ; i < data.size(); i++ ) {
+    hash = ( hash ^ data.buffer()[ i ] ) * 1099511628211ULL;
+  }
+
+  return hash;
+}
+
+string directory_of( const string & filename )
+{
+  const size_t slash = filename.rfind( '/' );
+  return slash == string::npos ? "" : filename.substr( 0, slash + 1 );
+}
+
+/* parent names are stored relative to the delta's directory when they
+   share it, and absolute otherwise */
+string parent_name( const string & parent, const string & filename )
+{
+  if ( directory_of( parent ) == directory_of( filename ) ) {
+    return parent.substr( directory_of( parent ).size() );
+  }
+
+  char * absolute = realpath( parent.c_str(), nullptr );
+  if ( absolute == nullptr ) {
+    throw unix_error( "realpath " + parent );
+  }
+
+  const string name { absolute };
+  free( absolute );
+  return name;
+}
+
+string parent_path( const string & name, const string & filename )
+{
+  return ( not name.empty() and name.front() == '/' ) ? name : directory_of( filename ) + name;
+}
+
+bool same_file( const string & a, const string & b )
+{
+  struct stat a_info, b_info;
+  return stat( a.c_str(), &a_info ) == 0 and stat( b.c_str(), &b_info ) == 0
+    and a_info.st_dev == b_info.st_dev and a_info.st_ino == b_info.st_ino;
+}
+
+ResolvedState decode( const Chunk & contents, const string & filename, const unsigned int links_left );
+
+ResolvedState load( const string & filename, const unsigned int links_left )
+{
+  File file { filename };
+
+  if ( is_state_delta( file.chunk() ) ) {
+    return decode( file.chunk(), filename, links_left );
+  }
+
+  ResolvedState state;
+  state.data.assign( file.chunk().buffer(), file.chunk().buffer() + file.size() );
+  return state;
+}
+
+ResolvedState decode( const Chunk & contents, const string & filename, const unsigned int links_left )
+try {
+  uint64_t offset = delta_magic.size();
+
+  if ( contents( offset, 1 ).octet() != delta_version ) {
+    throw Unsupported( "unknown state delta version" );
+  }
+
+  const uint8_t depth = contents( offset + 1, 1 ).octet();
+  const uint16_t name_length = contents( offset + 2, 2 ).le16();
+  offset += 4;
+
+  const string name = contents( offset, name_length ).to_string();
+  offset += name_length;
+
+  const uint64_t base_checksum = contents( offset, 8 ).le64();
+  const uint64_t state_checksum = contents( offset + 8, 8 ).le64();
+  const uint32_t length = contents( offset + 16, 4 ).le32();
+  const uint32_t block_size = contents( offset + 20, 4 ).le32();
+  offset += 24;
+
+  if ( block_size == 0 ) {
+    throw Invalid( "state delta block size is zero" );
+  }
+
+  const size_t block_count = ( length + block_size - 1 ) / block_size;
+  const Chunk stored = contents( offset, ( block_count + 7 ) / 8 );
+  offset += stored.size();
+
+  const uint32_t deflated_length = contents( offset, 4 ).le32();
+  const Chunk deflated = contents( offset + 4, deflated_length );
+
+  ResolvedState state;
+  state.depth = depth;
+
+  if ( depth > 0 ) {
+    if ( links_left == 0 ) {
+      throw Invalid( "state delta chain too long" );
+    }
+
+    const string path = parent_path( name, filename );
+    state.data = load( path, links_left - 1 ).data;
+
+    if ( checksum( Chunk( state.data ) ) != base_checksum ) {
+      throw runtime_error( "state delta: parent " + path + " has changed" );
+    }
+  }
+
+  state.data.resize( length, 0 );
+
+  /* the stored blocks, XORed with the parent's */
+  size_t stored_length = 0;
+  for ( size_t block = 0; block < block_count; block++ ) {
+    if ( stored.buffer()[ block / 8 ] & ( 1 << ( block % 8 ) ) ) {
+      stored_length += min<size_t>( block_size, length - block * block_size );
+    }
+  }
+
+  vector<uint8_t> changes( stored_length );
+  uLongf inflated_length = changes.size();
+
+  if ( uncompress( changes.data(), &inflated_length, deflated.buffer(), deflated.size() ) != Z_OK
+       or inflated_length != changes.size() ) {
+    throw Invalid( "state delta does not inflate" );
+  }
+
+  const uint8_t * change = changes.data();
+  for ( size_t block = 0; block < block_count; block++ ) {
+    if ( stored.buffer()[ block / 8 ] & ( 1 << ( block % 8 ) ) ) {
+      const size_t first = block * block_size;
+      const size_t last = min<size_t>( first + block_size, length );
+
+      for ( size_t i = first; i < last; i++ ) {
+        state.data[ i ] ^= *change++;
+      }
+    }
+  }
+
+  if ( checksum( Chunk( state.data ) ) != state_checksum ) {
+    throw Invalid( "state delta checksum mismatch" );
+  }
+
+  return state;
+}
+catch ( const out_of_range & )
+{
+  throw Invalid( "state delta truncated" );
+}
+
+}
+
+bool is_state_delta( const Chunk & contents )
+{
+  return contents.size() >= delta_magic.size()
+    and contents( 0, delta_magic.size() ).to_string() == delta_magic;
+}
+
+vector<uint8_t> read_state_delta( const Chunk & contents, const string & filename )
+{
+  return decode( contents, filename, state_delta_max_chain_length ).data;
+}
+
+void write_state_delta( const string & filename, const Chunk & state, const string & parent )
+{
+  ResolvedState base;
+  bool has_parent = false;
+  string name;
+
+  if ( not parent.empty() and not same_file( parent, filename ) ) {
+    base = load( parent, state_delta_max_chain_length );
+
+    if ( base.depth < state_delta_max_chain_length ) {
+      has_parent = true;
+      name = parent_name( parent, filename );
+    }
+  }
+
+  if ( not has_parent ) {
+    base = ResolvedState();
+  }
+
+  /* pick the blocks that differ from the parent's */
+  const size_t block_count = ( state.size() + state_delta_block_size - 1 ) / state_delta_block_size;
+  vector<uint8_t> stored( ( block_count + 7 ) / 8 );
+  vector<uint8_t> changes;
+
+  for ( size_t block = 0; block < block_count; block++ ) {
+    const size_t first = block * state_delta_block_size;
+    const size_t last = min<size_t>( first + state_delta_block_size, state.size() );
+
+    auto base_at = [&] ( const size_t i ) -> uint8_t { return i < base.data.size() ? base.data[ i ] : 0; };
+
+    bool changed = not has_parent;
+    for ( size_t i = first; i < last and not changed; i++ ) {
+      changed = state.buffer()[ i ] != base_at( i );
+    }
+
+    if ( changed ) {
+      stored[ block / 8 ] |= 1 << ( block % 8 );
+      for ( size_t i = first; i < last; i++ ) {
+        changes.push_back( state.buffer()[ i ] ^ base_at( i ) );
+      }
+    }
+  }
+
+  uLongf deflated_length = compressBound( changes.size() );
+  vector<uint8_t> deflated( deflated_length );
+
+  if ( compress2( deflated.data(), &deflated_length, changes.data(), changes.size(), Z_BEST_SPEED ) != Z_OK ) {
+    throw runtime_error( "state delta: deflate failed" );
+  }
+  deflated.resize( deflated_length );
+
+  EncoderStateSerializer odata;
+  odata.reserve( 48 + name.size() + stored.size() + deflated.size() );
+
+  odata.put( Chunk( delta_magic ) );
+  odata.put( delta_version );
+  odata.put( static_cast<uint8_t>( has_parent ? base.depth + 1 : 0 ) );
+  odata.put( static_cast<uint16_t>( name.size() ) );
+  odata.put( Chunk( name ) );
+  odata.put( checksum( Chunk( base.data ) ) );
+  odata.put( checksum( state ) );
+  odata.put( static_cast<uint32_t>( state.size() ) );
+  odata.put( static_cast<uint32_t>( state_delta_block_size ) );
+  odata.put( Chunk( stored ) );
+  odata.put( static_cast<uint32_t>( deflated.size() ) );
+  odata.put( Chunk( deflated ) );
+
+  odata.write( filename );
+}
@@ -0,0 +1,63 @@
+/* -*-mode:c++; tab-width: 2; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+
+/* Copyright 2013-2018 the Alfalfa authors
+                       and the Massachusetts Institute of Technology
+
+   Redistribution and use in source and binary forms, with or without
+   modification, are permitted provided that the following conditions are
+   met:
+
+      1. Redistributions of source code must retain the above copyright
+         notice, this list of conditions and the following disclaimer.
+
+      2. Redistributions in binary form must reproduce the above copyright
+         notice, this list of conditions and the following disclaimer in the
+         documentation and/or other materials provided with the distribution.
+
+   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+   "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+   LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+   A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+   HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+   SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+   LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+   DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+   THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+   (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+   OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE. */
+
+#ifndef STATE_DELTA_HH
+#define STATE_DELTA_HH
+
+/* Serialized decoder states (as written by EncoderStateSerializer) stored
+   as deltas against a parent state file. The state is cut into blocks; only
+   the blocks that differ from the parent's are kept, XORed with the parent's
+   so that unchanged bytes within them are zero, and deflated at zlib's
+   fastest level. Because the serialized layout is fixed for a given frame
+   size, this keeps changed probability tables, the changed parts of the
+   segmentation map and the changed areas of each reference plane. A state
+   written without a parent is the same format with every block kept.
+
+   Loading follows the chain of parents, which is never longer than
+   max_chain_length: a state that would make it longer is stored whole. */
+
+#include <string>
+#include <vector>
+
+#include "chunk.hh"
+
+static constexpr unsigned int state_delta_max_chain_length = 8;
+static constexpr size_t state_delta_block_size = 256;
+
+/* writes `state` to `filename`, as a delta against the state file `parent`
+   (in either format) unless that is empty */
+void write_state_delta( const std::string & filename, const Chunk & state,
+                        const std::string & parent = "" );
+
+bool is_state_delta( const Chunk & contents );
+
+/* the serialized state held by the contents of the delta file `filename`;
+   relative parent names are found next to it */
+std::vector<uint8_t> read_state_delta( const Chunk & contents, const std::string & filename );
+
+#endif /* STATE_DELTA_HH */
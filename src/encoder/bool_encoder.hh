@@ -32,6 +32,7 @@
 #include <vector>
 
 #include "bool_decoder.hh"
+#include "buffer_arena.hh"
 
 /* libvpx lookup table to avoid the need for a loop in
  * BoolEncoder::put. Taken from libvpx/vp8/common/entropy.c
@@ -60,17 +61,17 @@ const uint8_t vp8_norm[ 256 ] = {
 class BoolEncoder
 {
 private:
-  std::vector< uint8_t > output_ {};
+  ArenaBuffer output_;
 
   uint32_t range_ { 255 }, bottom_ { 0 };
   char bit_count_ { -24 };
 
   void add_one_to_output( void )
   {
-    auto it = output_.end();
+    auto it = output_.get().end();
     while ( *--it == 255 ) {
       *it = 0;
-      assert( it != output_.begin() );
+      assert( it != output_.get().begin() );
     }
     ++*it;
   }
@@ -95,17 +96,18 @@ private:
     }
     c = 4;
     while (--c >= 0) {    /* write remaining data, possibly padded */
-      output_.emplace_back( v >> 24 );
+      output_.get().emplace_back( v >> 24 );
       v <<= 8;
     }
 #endif
   }
 
 public:
-  BoolEncoder() 
-  {
-    output_.reserve( 1024 * 1024 ); //allocate a lot of space so we never have to realloc
-  }
+  /* the output buffer is borrowed from the arena, and goes back to it once
+     the finished partition is released */
+  BoolEncoder( BufferArena & arena = BufferArena::global() )
+    : output_( arena )
+  {}
 
   void put( const bool value, const Probability probability = 128 )
   {
@@ -131,7 +133,7 @@ public:
         add_one_to_output();
       }
 
-      output_.push_back( bottom_ >> ( 24 - offset ) );
+      output_.get().push_back( bottom_ >> ( 24 - offset ) );
 
       bottom_ <<= offset;
       shift = bit_count_;
@@ -142,11 +144,16 @@ public:
     bottom_ <<= shift;
   }
 
-  std::vector< uint8_t > finish( void )
+  ArenaBuffer finish( void )
   {
     flush();
-    std::vector< uint8_t > ret( move( output_ ) );
-    *this = BoolEncoder();
+    ArenaBuffer ret( std::move( output_ ) );
+
+    output_ = ArenaBuffer( ret.arena() );
+    range_ = 255;
+    bottom_ = 0;
+    bit_count_ = -24;
+
     return ret;
   }
 };
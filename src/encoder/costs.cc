@@ -239,6 +239,11 @@ uint32_t Costs::sad_motion_vector_cost( const MotionVector & mv,
            + mv_sad_costs.at( 1 ).at( x < 0 ).at( abs( x ) ) ) * weight + 128 ) / 256 ;
 }
 
+uint16_t Costs::bool_cost( const Probability prob, const bool value )
+{
+  return cost_bit( prob, value );
+}
+
 uint8_t Costs::token_for_coeff( int16_t coeff )
 {
   coeff = abs( coeff );
@@ -66,6 +66,9 @@ public:
   template<class Block>
   uint32_t block_cost( const Block & block ) const;
 
+  /* cost of coding a boolean with the given probability of false */
+  static uint16_t bool_cost( const Probability prob, const bool value );
+
   static uint8_t token_for_coeff( int16_t coeff );
   static uint16_t coeff_base_cost( int16_t coeff );
 };
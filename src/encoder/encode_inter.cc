@@ -27,6 +27,7 @@
    OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE. */
 
 #include <limits>
+#include <tuple>
 
 #include "encoder.hh"
 #include "scorer.hh"
@@ -179,6 +180,8 @@ Encoder::MVSearchResult Encoder::diamond_search( const VP8Raster::Macroblock & o
                                                  size_t step_size,
                                                  const size_t y_ac_qi ) const
 {
+  PhaseTimer timer { *this, MOTION_SEARCH };
+
   size_t first_step = step_size / 2;
 
   auto reference_mb = reference.macroblock( original_mb.Y.column(),
@@ -186,6 +189,10 @@ Encoder::MVSearchResult Encoder::diamond_search( const VP8Raster::Macroblock & o
 
   TwoDSubRange<uint8_t, 16, 16> & prediction = temp_mb.Y.mutable_contents();
 
+  /* the check sites are predicted and scored two at a time */
+  TwoD<uint8_t> second_storage( 16, 16 );
+  TwoDSubRange<uint8_t, 16, 16> second_prediction = second_storage.slice<16, 16>( 0, 0 );
+
   base_mv = Scorer::clamp( base_mv, frame_mb.context() );
 
   constexpr array<array<int16_t, 2>, 5> check_sites = {{
@@ -194,21 +201,39 @@ Encoder::MVSearchResult Encoder::diamond_search( const VP8Raster::Macroblock & o
 
   while ( step_size > 1 ) {
     MBPredictionData best_pred;
-    MBPredictionData pred;
+    array<MBPredictionData, check_sites.size()> preds;
+    size_t pred_count = 0;
 
     for ( const auto & check_site : check_sites ) {
-      pred.mv = MotionVector();
       MotionVector direction( step_size * check_site[ 0 ],
                               step_size * check_site[ 1 ] );
 
-      pred.mv += origin + direction;
+      MotionVector mv = origin + direction;
+
+      if ( out_of_bounds( mv ) ) continue;
+
+      preds[ pred_count++ ].mv = mv;
+    }
+
+    for ( size_t i = 0; i < pred_count; i += 2 ) {
+      reference_mb.Y().inter_predict( Scorer::clamp( preds[ i ].mv + base_mv, frame_mb.context() ),
+                                      safe_reference, prediction );
+
+      if ( i + 1 == pred_count ) {
+        preds[ i ].distortion = sad( original_mb.Y, prediction );
+        break;
+      }
 
-      if ( out_of_bounds( pred.mv ) ) continue;
+      reference_mb.Y().inter_predict( Scorer::clamp( preds[ i + 1 ].mv + base_mv, frame_mb.context() ),
+                                      safe_reference, second_prediction );
+
+      tie( preds[ i ].distortion, preds[ i + 1 ].distortion ) =
+        sad_x2( original_mb.Y, prediction, second_prediction );
+    }
 
-      MotionVector this_mv( Scorer::clamp( pred.mv + base_mv, frame_mb.context() ) );
+    for ( size_t i = 0; i < pred_count; i++ ) {
+      MBPredictionData & pred = preds[ i ];
 
-      reference_mb.Y().inter_predict( this_mv, safe_reference, prediction );
-      pred.distortion = sad( original_mb.Y, prediction );
       pred.rate = costs_.sad_motion_vector_cost( pred.mv, MotionVector(), sad_per_bit16lut[ y_ac_qi ] );
       pred.cost = rdcost( pred.rate, pred.distortion, 1, 1 );
 
@@ -228,7 +253,55 @@ Encoder::MVSearchResult Encoder::diamond_search( const VP8Raster::Macroblock & o
   return { origin, first_step };
 }
 
-void Encoder::luma_mb_inter_predict( const VP8Raster::Macroblock & original_mb,
+/*
+ * In REALTIME_QUALITY, a macroblock whose residue against the co-located
+ * macroblock of the last reference quantizes away entirely is coded as
+ * ZEROMV right away, skipping the intra and motion vector searches. This is
+ * typically the case for the static parts of talking-head and screen
+ * content.
+ *
+ * The SSE checks only rule out the macroblocks that obviously changed
+ * (cf. libvpx:vp8/encoder/pickinter.c, check_for_encode_breakout); since the
+ * quantizer truncates, a residue can only vanish if each of its transform
+ * coefficients is smaller than the quantizer step.
+ */
+bool Encoder::luma_mb_early_skip( const VP8Raster::Macroblock & original_mb,
+                                  VP8Raster::Macroblock & reconstructed_mb,
+                                  InterFrameMacroblock & frame_mb,
+                                  const Quantizer & quantizer )
+{
+  const VP8Raster & reference = references_.at( LAST_FRAME );
+  const auto reference_mb = reference.macroblock( original_mb.Y.column(),
+                                                  original_mb.Y.row() );
+
+  const uint32_t luma_threshold = ( uint32_t( quantizer.y_ac ) * quantizer.y_ac ) << 5;
+  const uint32_t chroma_threshold = ( uint32_t( quantizer.uv_ac ) * quantizer.uv_ac ) << 4;
+
+  if ( sse( original_mb.Y, reference_mb.macroblock().Y.contents() ) >= luma_threshold ) {
+    return false;
+  }
+
+  const auto chroma_sse = sse_x2( original_mb.U, reference_mb.macroblock().U.contents(),
+                                  original_mb.V, reference_mb.macroblock().V.contents() );
+
+  if ( chroma_sse.first + chroma_sse.second >= chroma_threshold ) {
+    return false;
+  }
+
+  reconstructed_mb.Y.mutable_contents().copy_from( reference_mb.macroblock().Y.contents() );
+  if ( luma_mb_apply_inter_prediction( original_mb, reconstructed_mb, frame_mb, quantizer,
+                                      ZEROMV, MotionVector() ) ) {
+    /* the full search will overwrite the prediction and the coefficients */
+    return false;
+  }
+
+  frame_mb.mutable_header().is_inter_mb = true;
+  frame_mb.mutable_header().set_reference( LAST_FRAME );
+
+  return true;
+}
+
+bool Encoder::luma_mb_inter_predict( const VP8Raster::Macroblock & original_mb,
                                      VP8Raster::Macroblock & reconstructed_mb,
                                      VP8Raster::Macroblock & temp_mb,
                                      InterFrameMacroblock & frame_mb,
@@ -237,6 +310,11 @@ void Encoder::luma_mb_inter_predict( const VP8Raster::Macroblock & original_mb,
                                      const size_t y_ac_qi,
                                      const EncoderPass encoder_pass )
 {
+  if ( encode_quality_ == REALTIME_QUALITY
+       and luma_mb_early_skip( original_mb, reconstructed_mb, frame_mb, quantizer ) ) {
+    return true;
+  }
+
   MBPredictionData best_pred;
 
   best_pred = luma_mb_best_prediction_mode( original_mb, reconstructed_mb, temp_mb,
@@ -366,71 +444,41 @@ void Encoder::luma_mb_inter_predict( const VP8Raster::Macroblock & original_mb,
                                     quantizer, best_pred.prediction_mode,
                                     best_mv );
   }
+
+  return false;
 }
 
 /*
  * Please refer to luma_mb_apply_intra_prediction for some information
  * about this method.
  */
-void Encoder::luma_mb_apply_inter_prediction( const VP8Raster::Macroblock & original_mb,
-                                              VP8Raster::Macroblock & reconstructed_mb,
-                                              InterFrameMacroblock & frame_mb,
-                                              const Quantizer & quantizer,
-                                              const mbmode best_pred,
-                                              const MotionVector best_mv )
+uint32_t Encoder::luma_mb_apply_inter_prediction( const VP8Raster::Macroblock & original_mb,
+                                                  VP8Raster::Macroblock & reconstructed_mb,
+                                                  InterFrameMacroblock & frame_mb,
+                                                  const Quantizer & quantizer,
+                                                  const mbmode best_pred,
+                                                  const MotionVector best_mv )
 {
   frame_mb.Y2().set_prediction_mode( best_pred );
   frame_mb.set_base_motion_vector( best_mv );
 
   if ( best_pred == SPLITMV ) {
-    frame_mb.Y().forall_ij(
-      [&] ( YBlock & frame_sb, unsigned int sb_column, unsigned int sb_row )
-      {
-        auto & original_sb = original_mb.Y_sub_at( sb_column, sb_row );
-
-        frame_sb.mutable_coefficients().subtract_dct( original_sb,
-          reconstructed_mb.Y_sub_at( sb_column, sb_row ).contents() );
-
-        frame_sb.set_Y_without_Y2();
-        frame_sb.mutable_coefficients() = YBlock::quantize( quantizer, frame_sb.coefficients() );
-        frame_sb.calculate_has_nonzero();
-      }
-    );
+    const uint32_t nonzero_mask = luma_mb_fdct_quantize( original_mb, reconstructed_mb,
+                                                         frame_mb, quantizer, false );
 
     frame_mb.Y2().set_coded( false );
     frame_mb.Y2().calculate_has_nonzero();
 
     frame_mb.calculate_has_nonzero();
+
+    return nonzero_mask;
   }
   else {
     frame_mb.Y().forall(
       [&] ( YBlock & frame_sb ) { frame_sb.set_motion_vector( frame_mb.base_motion_vector() ); }
     );
 
-    SafeArray<int16_t, 16> walsh_input;
-
-    // XXX refactor this and its keyframe counterpart to remove the redundancy.
-    frame_mb.Y().forall_ij(
-      [&] ( YBlock & frame_sb, unsigned int sb_column, unsigned int sb_row )
-      {
-        auto & original_sb = original_mb.Y_sub_at( sb_column, sb_row );
-
-        frame_sb.mutable_coefficients().subtract_dct( original_sb,
-          reconstructed_mb.Y_sub_at( sb_column, sb_row ).contents() );
-
-        walsh_input.at( sb_column + 4 * sb_row ) = frame_sb.coefficients().at( 0 );
-        frame_sb.set_dc_coefficient( 0 );
-        frame_sb.set_Y_after_Y2();
-
-        frame_sb.mutable_coefficients() = YBlock::quantize( quantizer, frame_sb.coefficients() );
-        frame_sb.calculate_has_nonzero();
-      }
-    );
-
-    frame_mb.Y2().set_coded( true );
-    frame_mb.Y2().mutable_coefficients().wht( walsh_input );
-    frame_mb.Y2().mutable_coefficients() = Y2Block::quantize( quantizer, frame_mb.Y2().coefficients() );
-    frame_mb.Y2().calculate_has_nonzero();
+    return luma_mb_fdct_quantize( original_mb, reconstructed_mb, frame_mb, quantizer, true );
   }
 }
 
@@ -477,33 +525,10 @@ void Encoder::chroma_mb_inter_predict( const VP8Raster::Macroblock & original_mb
                                   reference.V(), reconstructed_mb.V.mutable_contents() );
   }
 
-  frame_mb.U().forall_ij(
-    [&] ( UVBlock & frame_sb, unsigned int sb_column, unsigned int sb_row )
-    {
-      auto & original_sb = original_mb.U_sub_at( sb_column, sb_row );
-
-      frame_sb.mutable_coefficients().subtract_dct( original_sb,
-        reconstructed_mb.U_sub_at( sb_column, sb_row ).contents() );
-
-      frame_sb.mutable_coefficients() = UVBlock::quantize( quantizer, frame_sb.coefficients() );
-      frame_sb.calculate_has_nonzero();
-    }
-  );
+  chroma_mb_fdct_quantize( original_mb, reconstructed_mb, frame_mb, quantizer );
 
-  frame_mb.V().forall_ij(
-    [&] ( UVBlock & frame_sb, unsigned int sb_column, unsigned int sb_row )
-    {
-      auto & original_sb = original_mb.V_sub_at( sb_column, sb_row );
-
-      frame_sb.mutable_coefficients().subtract_dct( original_sb,
-        reconstructed_mb.V_sub_at( sb_column, sb_row ).contents() );
-
-      frame_sb.mutable_coefficients() = UVBlock::quantize( quantizer, frame_sb.coefficients() );
-      frame_sb.calculate_has_nonzero();
-    }
-  );
-
-  frame_mb.calculate_has_nonzero();
+  /* the luma blocks are coded at this point, and all the flags are fresh */
+  frame_mb.update_has_nonzero();
 }
 
 void Encoder::optimize_mv_probs( InterFrame & frame, const MVComponentCounts & counts )
@@ -585,6 +610,7 @@ pair<InterFrame &, double> Encoder::encode_raster<InterFrame>( const VP8Raster &
   InterFrame & frame = inter_frame_;
 
   frame.mutable_header().quant_indices = quant_indices;
+  frame.mutable_header().log2_number_of_dct_partitions = log2_dct_partitions_;
   frame.mutable_header().refresh_entropy_probs = true;
   frame.mutable_header().refresh_last = true;
 
@@ -601,6 +627,9 @@ pair<InterFrame &, double> Encoder::encode_raster<InterFrame>( const VP8Raster &
   costs_.fill_mv_component_costs( decoder_state_.probability_tables.motion_vector_probs );
   costs_.fill_mv_sad_costs();
 
+  encode_stats_.macroblocks = 0;
+  encode_stats_.early_skipped_macroblocks = 0;
+
   raster.macroblocks_forall_ij(
     [&] ( VP8Raster::ConstMacroblock original_mb, unsigned int mb_column, unsigned int mb_row )
     {
@@ -609,9 +638,11 @@ pair<InterFrame &, double> Encoder::encode_raster<InterFrame>( const VP8Raster &
       auto & frame_mb = frame.mutable_macroblocks().at( mb_column, mb_row );
 
       // Process Y and Y2
-      luma_mb_inter_predict( original_mb.macroblock(), reconstructed_mb, temp_mb, frame_mb,
-                             quantizer, component_counts,
-                             frame.header().quant_indices.y_ac_qi, FIRST_PASS );
+      encode_stats_.macroblocks++;
+      encode_stats_.early_skipped_macroblocks +=
+        luma_mb_inter_predict( original_mb.macroblock(), reconstructed_mb, temp_mb, frame_mb,
+                               quantizer, component_counts,
+                               frame.header().quant_indices.y_ac_qi, FIRST_PASS );
 
       if ( frame_mb.inter_coded() ) {
         chroma_mb_inter_predict( original_mb.macroblock(), reconstructed_mb, temp_mb,
@@ -622,7 +653,7 @@ pair<InterFrame &, double> Encoder::encode_raster<InterFrame>( const VP8Raster &
                                  frame_mb, quantizer, FIRST_PASS );
       }
 
-      frame_mb.calculate_has_nonzero();
+      frame_mb.update_has_nonzero();
 
       if ( frame_mb.inter_coded() ) {
         frame_mb.reconstruct_inter( quantizer, references_, reconstructed_mb );
@@ -26,7 +26,9 @@
    (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
    OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE. */
 
+#include <algorithm>
 #include <limits>
+#include <tuple>
 #include <typeinfo>
 
 #include "encoder.hh"
@@ -88,11 +90,19 @@ Encoder::MBPredictionData Encoder::luma_mb_best_prediction_mode( const VP8Raster
                                                                  const EncoderPass encoder_pass,
                                                                  const bool interframe ) const
 {
+  PhaseTimer timer { *this, INTRA_SEARCH };
+
   MBPredictionData best_pred;
 
   TwoDSubRange<uint8_t, 16, 16> & prediction = temp_mb.Y.mutable_contents();
   auto predictors = reconstructed_mb.Y.predictors();
 
+  /* the 16x16 modes are predicted and scored in pairs (TM_PRED with H_PRED,
+   * V_PRED with DC_PRED); the second one of each pair is kept here */
+  TwoD<uint8_t> paired_storage( 16, 16 );
+  TwoDSubRange<uint8_t, 16, 16> paired_prediction = paired_storage.slice<16, 16>( 0, 0 );
+  uint32_t paired_distortion = 0;
+
   unsigned int total_modes = B_PRED;
 
   if ( encode_quality_ == REALTIME_QUALITY and typeid( frame_mb ) == typeid( InterFrameMacroblock ) ) {
@@ -100,6 +110,22 @@ Encoder::MBPredictionData Encoder::luma_mb_best_prediction_mode( const VP8Raster
     // macroblocks.
     total_modes = B_PRED - 1;
   }
+  else if ( intra_search_ == FAST_INTRA_SEARCH ) {
+    /* B_PRED is by far the most expensive mode to evaluate; if one of the
+     * 16x16 modes already leaves a residual whose transform coefficients are
+     * on average below half of the quantizer (a DCT coefficient is roughly
+     * half of the Hadamard one), it is very unlikely to lose to B_PRED. */
+    uint32_t best_satd = numeric_limits<uint32_t>::max();
+
+    for ( unsigned int prediction_mode = DC_PRED; prediction_mode < B_PRED; prediction_mode++ ) {
+      reconstructed_mb.Y.intra_predict( ( mbmode )prediction_mode, predictors, prediction );
+      best_satd = min( best_satd, satd( original_mb.Y, prediction ) );
+    }
+
+    if ( best_satd < ( uint32_t( quantizer.y_ac ) << 7 ) ) {
+      total_modes = B_PRED - 1;
+    }
+  }
 
   /* Because of the way that reconstructed_mb is used as a buffer to store the
    * best prediction result, it is necessary to first examine the B_PRED and
@@ -107,6 +133,7 @@ Encoder::MBPredictionData Encoder::luma_mb_best_prediction_mode( const VP8Raster
   for ( unsigned int prediction_mode = total_modes; prediction_mode < num_y_modes; prediction_mode-- ) {
     MBPredictionData pred;
     pred.prediction_mode = ( mbmode )prediction_mode;
+    const TwoDSubRange<uint8_t, 16, 16> * mode_prediction = &prediction;
 
     if ( prediction_mode == B_PRED ) {
       pred.cost = 0;
@@ -125,6 +152,17 @@ Encoder::MBPredictionData Encoder::luma_mb_best_prediction_mode( const VP8Raster
           const auto left_mode = frame_sb.context().left.initialized()
             ? frame_sb.context().left.get()->prediction_mode() : B_DC_PRED;
 
+          if ( intra_search_ == FAST_INTRA_SEARCH ) {
+            uint32_t distortion = 0;
+            bmode sb_prediction_mode = luma_sb_fast_intra_predict( original_sb,
+              reconstructed_sb, temp_sb, frame_sb, quantizer,
+              costs_.bmode_costs.at( above_mode ).at( left_mode ), encoder_pass, distortion );
+
+            pred.rate += costs_.bmode_costs.at( above_mode ).at( left_mode ).at( sb_prediction_mode );
+            pred.distortion += distortion;
+            return;
+          }
+
           bmode sb_prediction_mode = luma_sb_intra_predict( original_sb,
             reconstructed_sb, temp_sb, costs_.bmode_costs.at( above_mode ).at( left_mode ) );
 
@@ -139,12 +177,24 @@ Encoder::MBPredictionData Encoder::luma_mb_best_prediction_mode( const VP8Raster
       pred.cost = rdcost( pred.rate, pred.distortion,
                           RATE_MULTIPLIER, DISTORTION_MULTIPLIER );
     }
+    else if ( prediction_mode % 2 == 0 ) {
+      /* scored along with the previous mode */
+      pred.distortion = paired_distortion;
+      mode_prediction = &paired_prediction;
+
+      pred.rate = costs_.mbmode_costs.at( interframe ? 1 : 0 ).at( prediction_mode );
+      pred.cost = rdcost( pred.rate, pred.distortion, RATE_MULTIPLIER,
+                          DISTORTION_MULTIPLIER );
+    }
     else {
       reconstructed_mb.Y.intra_predict( ( mbmode )prediction_mode, predictors, prediction );
+      reconstructed_mb.Y.intra_predict( ( mbmode )( prediction_mode - 1 ), predictors,
+                                        paired_prediction );
 
       /* Here we compute variance, instead of SSE, because in this case
        * the average will be taken out from Y2 block into the Y2 block. */
-      pred.distortion = variance( original_mb.Y, prediction );
+      tie( pred.distortion, paired_distortion ) = variance_x2( original_mb.Y, prediction,
+                                                               paired_prediction );
 
       pred.rate = costs_.mbmode_costs.at( interframe ? 1 : 0 ).at( prediction_mode );
       pred.cost = rdcost( pred.rate, pred.distortion, RATE_MULTIPLIER,
@@ -152,7 +202,7 @@ Encoder::MBPredictionData Encoder::luma_mb_best_prediction_mode( const VP8Raster
     }
 
     if ( pred.cost < best_pred.cost ) {
-      reconstructed_mb.Y.mutable_contents().copy_from( prediction );
+      reconstructed_mb.Y.mutable_contents().copy_from( *mode_prediction );
       best_pred = pred;
     }
   }
@@ -181,6 +231,21 @@ void Encoder::luma_mb_apply_intra_prediction( const VP8Raster::Macroblock & orig
     return;
   }
 
+  /* without the trellis, the whole macroblock goes through the fused kernel */
+  if ( encoder_pass == FIRST_PASS ) {
+    frame_mb.Y().forall(
+      [&] ( YBlock & frame_sb )
+      {
+        frame_sb.set_prediction_mode( KeyFrameMacroblock::implied_subblock_mode( min_prediction_mode ) );
+      }
+    );
+
+    luma_mb_fdct_quantize( original_mb, reconstructed_mb, frame_mb, quantizer, true );
+    return;
+  }
+
+  PhaseTimer timer { *this, TRELLIS };
+
   SafeArray<int16_t, 16> walsh_input;
 
   frame_mb.Y().forall_ij(
@@ -196,12 +261,7 @@ void Encoder::luma_mb_apply_intra_prediction( const VP8Raster::Macroblock & orig
       frame_sb.set_dc_coefficient( 0 );
       frame_sb.set_Y_after_Y2();
 
-      if ( encoder_pass == FIRST_PASS ) {
-        frame_sb.mutable_coefficients() = YBlock::quantize( quantizer, frame_sb.coefficients() );
-      }
-      else {
-        trellis_quantize( frame_sb, quantizer );
-      }
+      trellis_quantize( frame_sb, quantizer );
 
       frame_sb.calculate_has_nonzero();
     }
@@ -210,13 +270,8 @@ void Encoder::luma_mb_apply_intra_prediction( const VP8Raster::Macroblock & orig
   frame_mb.Y2().set_coded( true );
   frame_mb.Y2().mutable_coefficients().wht( walsh_input );
 
-  if ( encoder_pass == FIRST_PASS ) {
-    frame_mb.Y2().mutable_coefficients() = Y2Block::quantize( quantizer, frame_mb.Y2().coefficients() );
-  }
-  else {
-    check_reset_y2( frame_mb.Y2(), quantizer );
-    trellis_quantize( frame_mb.Y2(), quantizer );
-  }
+  check_reset_y2( frame_mb.Y2(), quantizer );
+  trellis_quantize( frame_mb.Y2(), quantizer );
 
   frame_mb.Y2().calculate_has_nonzero();
 }
@@ -250,6 +305,8 @@ Encoder::MBPredictionData Encoder::chroma_mb_best_prediction_mode( const VP8Rast
                                                                    VP8Raster::Macroblock & temp_mb,
                                                                    const bool interframe ) const
 {
+  PhaseTimer timer { *this, INTRA_SEARCH };
+
   MBPredictionData best_pred;
 
   TwoDSubRange<uint8_t, 8, 8> & u_prediction = temp_mb.U.mutable_contents();
@@ -265,8 +322,9 @@ Encoder::MBPredictionData Encoder::chroma_mb_best_prediction_mode( const VP8Rast
     reconstructed_mb.U.intra_predict( ( mbmode )prediction_mode, u_predictors, u_prediction );
     reconstructed_mb.V.intra_predict( ( mbmode )prediction_mode, v_predictors, v_prediction );
 
-    pred.distortion = sse( original_mb.U, u_prediction )
-                    + sse( original_mb.V, v_prediction );
+    const auto distortion = sse_x2( original_mb.U, u_prediction,
+                                    original_mb.V, v_prediction );
+    pred.distortion = distortion.first + distortion.second;
 
     pred.rate = costs_.intra_uv_mode_costs.at( interframe ).at( prediction_mode );
     pred.cost = rdcost( pred.rate, pred.distortion, RATE_MULTIPLIER,
@@ -294,6 +352,13 @@ void Encoder::chroma_mb_apply_intra_prediction( const VP8Raster::Macroblock & or
 {
   frame_mb.U().at( 0, 0 ).set_prediction_mode( min_prediction_mode );
 
+  if ( encoder_pass == FIRST_PASS ) {
+    chroma_mb_fdct_quantize( original_mb, reconstructed_mb, frame_mb, quantizer );
+    return;
+  }
+
+  PhaseTimer timer { *this, TRELLIS };
+
   frame_mb.U().forall_ij(
     [&] ( UVBlock & frame_sb, unsigned int sb_column, unsigned int sb_row )
     {
@@ -302,12 +367,7 @@ void Encoder::chroma_mb_apply_intra_prediction( const VP8Raster::Macroblock & or
       frame_sb.mutable_coefficients().subtract_dct( original_sb,
         reconstructed_mb.U_sub_at( sb_column, sb_row ).contents() );
 
-      if ( encoder_pass == FIRST_PASS ) {
-        frame_sb.mutable_coefficients() = UVBlock::quantize( quantizer, frame_sb.coefficients() );
-      }
-      else {
-        trellis_quantize( frame_sb, quantizer );
-      }
+      trellis_quantize( frame_sb, quantizer );
 
       frame_sb.calculate_has_nonzero();
     }
@@ -321,12 +381,7 @@ void Encoder::chroma_mb_apply_intra_prediction( const VP8Raster::Macroblock & or
       frame_sb.mutable_coefficients().subtract_dct( original_sb,
         reconstructed_mb.V_sub_at( sb_column, sb_row ).contents() );
 
-      if ( encoder_pass == FIRST_PASS ) {
-        frame_sb.mutable_coefficients() = UVBlock::quantize( quantizer, frame_sb.coefficients() );
-      }
-      else {
-        trellis_quantize( frame_sb, quantizer );
-      }
+      trellis_quantize( frame_sb, quantizer );
 
       frame_sb.calculate_has_nonzero();
     }
@@ -385,6 +440,83 @@ bmode Encoder::luma_sb_intra_predict( const VP8Raster::Block4 & original_sb,
   return min_prediction_mode;
 }
 
+/* Ranks all the bmodes by SATD (plus an estimate of the mode cost) and runs
+ * the actual quantization (trellis in the second pass) only for the best
+ * FAST_INTRA_CANDIDATES of them, picking the one with the lowest rd-cost
+ * after reconstruction.
+ */
+bmode Encoder::luma_sb_fast_intra_predict( const VP8Raster::Block4 & original_sb,
+                                           VP8Raster::Block4 & reconstructed_sb,
+                                           VP8Raster::Block4 & temp_sb,
+                                           YBlock & frame_sb,
+                                           const Quantizer & quantizer,
+                                           const SafeArray<uint16_t, num_intra_b_modes> & mode_costs,
+                                           const EncoderPass encoder_pass,
+                                           uint32_t & prediction_distortion ) const
+{
+  TwoDSubRange<uint8_t, 4, 4> & prediction = temp_sb.mutable_contents();
+  const auto predictors = reconstructed_sb.predictors();
+
+  pair<uint32_t, bmode> ranking[ num_intra_b_modes ];
+
+  for ( unsigned int prediction_mode = 0; prediction_mode < num_intra_b_modes; prediction_mode++ ) {
+    reconstructed_sb.intra_predict( ( bmode )prediction_mode, predictors, prediction );
+
+    /* mode costs are in 1/256 bits, SATD is on the same scale as SAD */
+    ranking[ prediction_mode ] = { satd( original_sb, prediction )
+                                   + ( ( mode_costs.at( prediction_mode ) * quantizer.y_ac ) >> 8 ),
+                                   ( bmode )prediction_mode };
+  }
+
+  partial_sort( ranking, ranking + FAST_INTRA_CANDIDATES, ranking + num_intra_b_modes );
+
+  uint32_t min_cost = numeric_limits<uint32_t>::max();
+  bmode min_prediction_mode = B_DC_PRED;
+  DCTCoefficients best_coefficients;
+
+  frame_sb.set_Y_without_Y2();
+
+  for ( size_t i = 0; i < FAST_INTRA_CANDIDATES; i++ ) {
+    /* a candidate that is clearly behind on SATD is not worth coding */
+    if ( i > 0 and ranking[ i ].first > ranking[ 0 ].first + ( ranking[ 0 ].first >> 3 ) ) {
+      break;
+    }
+
+    const bmode sb_prediction_mode = ranking[ i ].second;
+    reconstructed_sb.intra_predict( sb_prediction_mode, predictors, prediction );
+    const uint32_t distortion = sse( original_sb, prediction );
+
+    frame_sb.mutable_coefficients().subtract_dct( original_sb, prediction );
+
+    if ( encoder_pass == FIRST_PASS ) {
+      frame_sb.mutable_coefficients() = YBlock::quantize( quantizer, frame_sb.coefficients() );
+    }
+    else {
+      trellis_quantize( frame_sb, quantizer );
+    }
+
+    frame_sb.dequantize( quantizer ).idct_add( temp_sb );
+
+    const uint32_t cost = rdcost( mode_costs.at( sb_prediction_mode ) + costs_.block_cost( frame_sb ),
+                                  sse( original_sb, temp_sb.contents() ),
+                                  RATE_MULTIPLIER, DISTORTION_MULTIPLIER );
+
+    if ( cost < min_cost ) {
+      min_cost = cost;
+      min_prediction_mode = sb_prediction_mode;
+      prediction_distortion = distortion;
+      best_coefficients = frame_sb.coefficients();
+      reconstructed_sb.mutable_contents().copy_from( temp_sb.contents() );
+    }
+  }
+
+  frame_sb.mutable_coefficients() = best_coefficients;
+  frame_sb.set_prediction_mode( min_prediction_mode );
+  frame_sb.calculate_has_nonzero();
+
+  return min_prediction_mode;
+}
+
 template<>
 pair<KeyFrame &, double> Encoder::encode_raster<KeyFrame>( const VP8Raster & raster,
                                                            const QuantIndices & quant_indices,
@@ -397,6 +529,7 @@ pair<KeyFrame &, double> Encoder::encode_raster<KeyFrame>( const VP8Raster & ras
   KeyFrame & frame = key_frame_;
 
   frame.mutable_header().quant_indices = quant_indices;
+  frame.mutable_header().log2_number_of_dct_partitions = log2_dct_partitions_;
   frame.mutable_header().refresh_entropy_probs = true;
 
   Quantizer quantizer( frame.header().quant_indices );
@@ -404,6 +537,9 @@ pair<KeyFrame &, double> Encoder::encode_raster<KeyFrame>( const VP8Raster & ras
 
   update_rd_multipliers( quantizer );
 
+  encode_stats_.macroblocks = 0;
+  encode_stats_.early_skipped_macroblocks = 0;
+
   TokenBranchCounts token_branch_counts;
 
   for ( size_t pass = FIRST_PASS;
@@ -414,6 +550,10 @@ pair<KeyFrame &, double> Encoder::encode_raster<KeyFrame>( const VP8Raster & ras
       costs_.fill_token_costs( decoder_state_.probability_tables );
       token_branch_counts = TokenBranchCounts();
     }
+    else if ( intra_search_ == FAST_INTRA_SEARCH ) {
+      /* the candidates are compared by their actual token costs */
+      costs_.fill_token_costs( decoder_state_.probability_tables );
+    }
 
     raster.macroblocks_forall_ij(
       [&] ( VP8Raster::ConstMacroblock original_mb, unsigned int mb_column, unsigned int mb_row )
@@ -428,7 +568,7 @@ pair<KeyFrame &, double> Encoder::encode_raster<KeyFrame>( const VP8Raster & ras
         chroma_mb_intra_predict( original_mb.macroblock(), reconstructed_mb, temp_mb,
                                  frame_mb, quantizer, (EncoderPass)pass );
 
-        frame_mb.calculate_has_nonzero();
+        frame_mb.update_has_nonzero();
         frame_mb.reconstruct_intra( quantizer, reconstructed_mb );
 
         frame_mb.accumulate_token_branches( token_branch_counts );
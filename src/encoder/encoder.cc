@@ -32,6 +32,7 @@
 #include <limits>
 #include <utility>
 #include <chrono>
+#include <type_traits>
 
 #include "block.hh"
 #include "encoder.hh"
@@ -98,7 +99,12 @@ Encoder::Encoder( const Encoder & encoder )
     encode_quality_( encoder.encode_quality_ ),
     loop_filter_level_( encoder.loop_filter_level_ ),
     last_y_ac_qi_( encoder.last_y_ac_qi_ ),
-    encode_stats_( encoder.encode_stats_ )
+    log2_dct_partitions_( encoder.log2_dct_partitions_ ),
+    rate_model_( encoder.rate_model_ ),
+    intra_search_( encoder.intra_search_ ),
+    encode_stats_( encoder.encode_stats_ ),
+    profile_phases_( encoder.profile_phases_ ),
+    phase_seconds_( encoder.phase_seconds_ )
 {}
 
 Encoder::Encoder( Encoder && encoder )
@@ -114,7 +120,12 @@ Encoder::Encoder( Encoder && encoder )
     subsampled_inter_frame_( move( encoder.subsampled_inter_frame_ ) ),
     loop_filter_level_( move( encoder.loop_filter_level_ ) ),
     last_y_ac_qi_( move( encoder.last_y_ac_qi_ ) ),
-    encode_stats_( move( encoder.encode_stats_ ) )
+    log2_dct_partitions_( encoder.log2_dct_partitions_ ),
+    rate_model_( move( encoder.rate_model_ ) ),
+    intra_search_( encoder.intra_search_ ),
+    encode_stats_( move( encoder.encode_stats_ ) ),
+    profile_phases_( encoder.profile_phases_ ),
+    phase_seconds_( encoder.phase_seconds_ )
 {}
 
 Encoder & Encoder::operator=( Encoder && encoder )
@@ -132,7 +143,12 @@ Encoder & Encoder::operator=( Encoder && encoder )
   subsampled_inter_frame_ = move( encoder.subsampled_inter_frame_ );
   loop_filter_level_ = move( encoder.loop_filter_level_ );
   last_y_ac_qi_ = move( encoder.last_y_ac_qi_ );
+  log2_dct_partitions_ = encoder.log2_dct_partitions_;
+  rate_model_ = move( encoder.rate_model_ );
+  intra_search_ = encoder.intra_search_;
   encode_stats_ = move( encoder.encode_stats_ );
+  profile_phases_ = encoder.profile_phases_;
+  phase_seconds_ = encoder.phase_seconds_;
 
   return *this;
 }
@@ -143,8 +159,60 @@ uint32_t Encoder::minihash() const
                                 references_.golden.hash(), references_.alternative.hash() ).hash() );
 }
 
+void Encoder::set_dct_partitions( const unsigned int count )
+{
+  switch ( count ) {
+  case 1: log2_dct_partitions_ = 0; break;
+  case 2: log2_dct_partitions_ = 1; break;
+  case 4: log2_dct_partitions_ = 2; break;
+  case 8: log2_dct_partitions_ = 3; break;
+
+  default:
+    throw Invalid( "number of DCT partitions must be 1, 2, 4 or 8" );
+  }
+}
+
+EncoderSnapshot::EncoderSnapshot( const Encoder & encoder )
+  : decoder_( encoder.export_decoder() ),
+    two_pass_encoder_( encoder.two_pass_encoder_ ),
+    encode_quality_( encoder.encode_quality_ ),
+    loop_filter_level_( encoder.loop_filter_level_ ),
+    last_y_ac_qi_( encoder.last_y_ac_qi_ ),
+    log2_dct_partitions_( encoder.log2_dct_partitions_ ),
+    rate_model_( encoder.rate_model_ ),
+    intra_search_( encoder.intra_search_ ),
+    profile_phases_( encoder.profile_phases_ )
+{}
+
+Encoder EncoderSnapshot::restore() const
+{
+  Encoder encoder { decoder_.restore(), two_pass_encoder_, encode_quality_ };
+
+  encoder.loop_filter_level_ = loop_filter_level_;
+  encoder.last_y_ac_qi_ = last_y_ac_qi_;
+  encoder.log2_dct_partitions_ = log2_dct_partitions_;
+  encoder.rate_model_ = rate_model_;
+  encoder.intra_search_ = intra_search_;
+  encoder.profile_phases_ = profile_phases_;
+
+  return encoder;
+}
+
+size_t Encoder::footprint() const
+{
+  /* the last reference and the three padded luma planes used for motion
+     search are unique to each encoder state; golden and alternative
+     references are usually shared with other states */
+  const VP8Raster & last = references_.last.get();
+  const size_t raster_bytes = last.width() * last.height() * 3 / 2;
+  const size_t safe_raster_bytes = ( last.width() + 2 * SafeRaster::MARGIN_WIDTH )
+                                   * ( last.height() + 2 * SafeRaster::MARGIN_WIDTH );
+
+  return sizeof( Encoder ) + raster_bytes + 3 * safe_raster_bytes;
+}
+
 template<class FrameType>
-vector<uint8_t> Encoder::write_frame( const FrameType & frame,
+SerializedFrame Encoder::write_frame( const FrameType & frame,
                                       const ProbabilityTables & prob_tables )
 {
   // update the state
@@ -153,6 +221,24 @@ vector<uint8_t> Encoder::write_frame( const FrameType & frame,
   // update the references
   MutableRasterHandle raster { width(), height() };
   frame.decode( decoder_state_.segmentation, references_, raster );
+  update_references( frame, move( raster ) );
+
+  SerializedFrame output = [&] ()
+    {
+      PhaseTimer timer { *this, SERIALIZATION };
+      return frame.serialize( prob_tables );
+    } ();
+
+  rate_model_.observe( is_same<FrameType, KeyFrame>::value ? RateModel::KEY_FRAME
+                                                           : RateModel::INTER_FRAME,
+                       frame.header().quant_indices.y_ac_qi, output.size() );
+
+  return output;
+}
+
+template<class FrameType>
+void Encoder::update_references( const FrameType & frame, MutableRasterHandle && raster )
+{
   frame.loopfilter( decoder_state_.segmentation, decoder_state_.filter_adjustments, raster );
   RasterHandle immutable_raster( move( raster ) );
   frame.copy_to( immutable_raster, references_ );
@@ -165,12 +251,10 @@ vector<uint8_t> Encoder::write_frame( const FrameType & frame,
     loop_filter_level_.reset( frame.header().loop_filter_level );
     last_y_ac_qi_.reset( frame.header().quant_indices.y_ac_qi );
   }
-
-  return frame.serialize( prob_tables );
 }
 
 template<class FrameType>
-vector<uint8_t> Encoder::write_frame( const FrameType & frame )
+SerializedFrame Encoder::write_frame( const FrameType & frame )
 {
   return write_frame( frame, decoder_state_.probability_tables );
 }
@@ -461,6 +545,8 @@ void Encoder::apply_best_loopfilter_settings( const VP8Raster & original,
                                               VP8Raster & reconstructed,
                                               FrameType & frame )
 {
+  PhaseTimer timer { *this, LOOPFILTER_SEARCH };
+
   frame.mutable_header().mode_lf_adjustments.reset();
   frame.mutable_header().mode_lf_adjustments.get().initialize();
 
@@ -556,7 +642,7 @@ FrameType & Encoder::encode_with_quantizer_search( const VP8Raster & raster,
   return encode_raster<FrameType>( raster, quant_indices, false ).first;
 }
 
-vector<uint8_t> Encoder::encode_with_quantizer( const VP8Raster & raster, const uint8_t y_ac_qi )
+SerializedFrame Encoder::encode_with_quantizer( const VP8Raster & raster, const uint8_t y_ac_qi )
 {
   if ( width() != raster.display_width() or height() != raster.display_height() ) {
     throw runtime_error( "scaling is not supported" );
@@ -574,7 +660,7 @@ vector<uint8_t> Encoder::encode_with_quantizer( const VP8Raster & raster, const
   }
 }
 
-vector<uint8_t> Encoder::encode_with_minimum_ssim( const VP8Raster & raster, const double minimum_ssim )
+SerializedFrame Encoder::encode_with_minimum_ssim( const VP8Raster & raster, const double minimum_ssim )
 {
   if ( width() != raster.display_width() or height() != raster.display_height() ) {
     throw runtime_error( "scaling is not supported" );
@@ -589,7 +675,7 @@ vector<uint8_t> Encoder::encode_with_minimum_ssim( const VP8Raster & raster, con
   }
 }
 
-vector<uint8_t> Encoder::encode_with_target_size( const VP8Raster & raster, const size_t target_size ) {
+SerializedFrame Encoder::encode_with_target_size( const VP8Raster & raster, const size_t target_size ) {
   if ( width() != raster.display_width() or height() != raster.display_height() ) {
     throw runtime_error( "scaling is not supported" );
   }
@@ -607,25 +693,20 @@ vector<uint8_t> Encoder::encode_with_target_size( const VP8Raster & raster, cons
     y_qi_max = min( y_qi_max, last_y_ac_qi_.get() + radius );
   }
 
-  uint8_t best_y_qi = numeric_limits<uint8_t>::max();
-
-  size_t estimated_size = target_size;
-
-  while ( y_qi_min <= y_qi_max ) {
-    size_t y_qi = ( y_qi_min + y_qi_max ) / 2;
-    estimated_size = estimate_frame_size( raster, y_qi );
+  /* pick the quantizer from the rate model; if the model has been
+     unreliable lately, re-center it with one probe encode */
+  const RateModel::FrameKind kind = has_state_ ? RateModel::INTER_FRAME
+                                               : RateModel::KEY_FRAME;
 
-    if ( estimated_size <= target_size or ( y_qi_min == y_qi_max and best_y_qi == numeric_limits<uint8_t>::max() ) ) {
-      best_y_qi = y_qi;
+  RateModel::Prediction prediction = rate_model_.predict( kind, target_size, y_qi_min, y_qi_max );
 
-      y_qi_max = y_qi - 1;
-    }
-    else if ( estimated_size > target_size ) {
-      y_qi_min = y_qi + 1;
-    }
+  if ( rate_model_.needs_probe( kind ) ) {
+    const size_t probe_size = estimate_frame_size( raster, prediction.y_ac_qi );
+    prediction = rate_model_.predict( kind, target_size, y_qi_min, y_qi_max,
+                                      prediction.y_ac_qi, probe_size );
   }
 
-  return encode_with_quantizer( raster, best_y_qi );
+  return encode_with_quantizer( raster, prediction.y_ac_qi );
 }
 
 template <class FrameHeaderType, class MacroblockHeaderType>
@@ -657,6 +738,96 @@ void Macroblock<FrameHeaderType, MacroblockHeaderType>::calculate_has_nonzero()
   mb_skip_coeff_.reset( not has_nonzero_ );
 }
 
+template <class FrameHeaderType, class MacroblockHeaderType>
+void Macroblock<FrameHeaderType, MacroblockHeaderType>::update_has_nonzero()
+{
+  has_nonzero_ = Y2_.coded() and Y2_.has_nonzero();
+
+  Y_.forall( [&]( const YBlock & block ) { has_nonzero_ |= block.has_nonzero(); } );
+  U_.forall( [&]( const UVBlock & block ) { has_nonzero_ |= block.has_nonzero(); } );
+  V_.forall( [&]( const UVBlock & block ) { has_nonzero_ |= block.has_nonzero(); } );
+
+  mb_skip_coeff_.reset( not has_nonzero_ );
+}
+
+template<class MacroblockType>
+uint32_t Encoder::luma_mb_fdct_quantize( const VP8Raster::Macroblock & original_mb,
+                                         const VP8Raster::Macroblock & prediction_mb,
+                                         MacroblockType & frame_mb,
+                                         const Quantizer & quantizer,
+                                         const bool with_y2 )
+{
+  SafeArray<DCTCoefficients, 16> coefficients;
+  SafeArray<int16_t, 16> walsh_input;
+
+  uint32_t nonzero_mask = fdct_quantize( original_mb.Y, prediction_mb.Y.contents(),
+                                         quantizer.y(), coefficients,
+                                         with_y2 ? &walsh_input : nullptr );
+
+  frame_mb.Y().forall_ij(
+    [&] ( YBlock & frame_sb, unsigned int sb_column, unsigned int sb_row )
+    {
+      const unsigned int index = sb_column + 4 * sb_row;
+
+      frame_sb.mutable_coefficients() = coefficients.at( index );
+      frame_sb.set_has_nonzero( nonzero_mask & ( 1 << index ) );
+
+      if ( with_y2 ) {
+        frame_sb.set_Y_after_Y2();
+      }
+      else {
+        frame_sb.set_Y_without_Y2();
+      }
+    }
+  );
+
+  if ( with_y2 ) {
+    frame_mb.Y2().set_coded( true );
+    frame_mb.Y2().mutable_coefficients().wht( walsh_input );
+    frame_mb.Y2().mutable_coefficients() = Y2Block::quantize( quantizer, frame_mb.Y2().coefficients() );
+    frame_mb.Y2().calculate_has_nonzero();
+
+    nonzero_mask |= uint32_t( frame_mb.Y2().has_nonzero() ) << 24;
+  }
+
+  return nonzero_mask;
+}
+
+template<class MacroblockType>
+uint32_t Encoder::chroma_mb_fdct_quantize( const VP8Raster::Macroblock & original_mb,
+                                           const VP8Raster::Macroblock & prediction_mb,
+                                           MacroblockType & frame_mb,
+                                           const Quantizer & quantizer )
+{
+  SafeArray<DCTCoefficients, 4> u_coefficients;
+  SafeArray<DCTCoefficients, 4> v_coefficients;
+
+  const uint32_t u_mask = fdct_quantize( original_mb.U, prediction_mb.U.contents(),
+                                         quantizer.uv(), u_coefficients );
+  const uint32_t v_mask = fdct_quantize( original_mb.V, prediction_mb.V.contents(),
+                                         quantizer.uv(), v_coefficients );
+
+  frame_mb.U().forall_ij(
+    [&] ( UVBlock & frame_sb, unsigned int sb_column, unsigned int sb_row )
+    {
+      const unsigned int index = sb_column + 2 * sb_row;
+      frame_sb.mutable_coefficients() = u_coefficients.at( index );
+      frame_sb.set_has_nonzero( u_mask & ( 1 << index ) );
+    }
+  );
+
+  frame_mb.V().forall_ij(
+    [&] ( UVBlock & frame_sb, unsigned int sb_column, unsigned int sb_row )
+    {
+      const unsigned int index = sb_column + 2 * sb_row;
+      frame_sb.mutable_coefficients() = v_coefficients.at( index );
+      frame_sb.set_has_nonzero( v_mask & ( 1 << index ) );
+    }
+  );
+
+  return ( u_mask << 16 ) | ( v_mask << 20 );
+}
+
 template <class FrameHeaderType, class MacroblockHeaderType>
 void Macroblock<FrameHeaderType, MacroblockHeaderType>::zero_out()
 {
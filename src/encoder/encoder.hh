@@ -33,6 +33,7 @@
 #include <string>
 #include <tuple>
 #include <limits>
+#include <chrono>
 
 #include "decoder.hh"
 #include "frame.hh"
@@ -44,6 +45,8 @@
 #include "file_descriptor.hh"
 #include "block.hh"
 #include "frame_pool.hh"
+#include "rate_control.hh"
+#include "state_cache.hh"
 
 const uint8_t DEFAULT_QUANTIZER = 64;
 
@@ -59,6 +62,20 @@ enum EncoderQuality
   REALTIME_QUALITY
 };
 
+/* FAST_INTRA_SEARCH ranks the intra modes by SATD and only codes the best
+   few candidates; it also skips B_PRED when a 16x16 mode predicts well */
+enum IntraSearch
+{
+  FULL_INTRA_SEARCH,
+  FAST_INTRA_SEARCH
+};
+
+enum SizeEstimationMethod
+{
+  TOKEN_COST,
+  SERIALIZED_SIZE
+};
+
 enum EncoderMode
 {
   MINIMUM_SSIM,
@@ -67,6 +84,19 @@ enum EncoderMode
   REENCODE
 };
 
+/* the parts of the encoder that can be timed with set_phase_profiling();
+   they don't overlap: TRELLIS is the second-pass quantization of the chosen
+   modes, and the trellis runs of the B_PRED search count as INTRA_SEARCH */
+enum EncoderPhase
+{
+  INTRA_SEARCH,
+  MOTION_SEARCH,
+  TRELLIS,
+  LOOPFILTER_SEARCH,
+  SERIALIZATION,
+  num_encoder_phases
+};
+
 class SafeReferences
 {
 public:
@@ -94,6 +124,8 @@ static FramePool<FrameType> & subsampled_frame_pool()
 
 class Encoder
 {
+  friend class EncoderSnapshot;
+
 private:
   struct MBPredictionData
   {
@@ -148,6 +180,17 @@ private:
      last_y_ac_qi_ - a <= y_ac_qi <= last_y_ac_qi_ + a */
   Optional<uint8_t> last_y_ac_qi_ {};
 
+  /* the encoder emits ( 1 << log2_dct_partitions_ ) DCT token partitions */
+  uint8_t log2_dct_partitions_ { 0 };
+
+  /* predicts the quantizer for encode_with_target_size from past frame sizes */
+  RateModel rate_model_ {};
+
+  IntraSearch intra_search_ { FULL_INTRA_SEARCH };
+
+  /* candidates that FAST_INTRA_SEARCH codes for each 4x4 subblock */
+  static const size_t FAST_INTRA_CANDIDATES { 2 };
+
   // TODO: Where did these come from?
   uint32_t RATE_MULTIPLIER { 300 };
   uint32_t DISTORTION_MULTIPLIER { 1 };
@@ -156,8 +199,47 @@ private:
   struct EncodeStats
   {
     Optional<double> ssim;
+
+    /* inter frames only: macroblocks that matched the last reference closely
+       enough to be coded as ZEROMV without a mode search (REALTIME_QUALITY) */
+    unsigned int macroblocks { 0 };
+    unsigned int early_skipped_macroblocks { 0 };
+
+    double early_skip_rate() const
+    {
+      return macroblocks ? double( early_skipped_macroblocks ) / macroblocks : 0.0;
+    }
   } encode_stats_ {};
 
+  /* seconds spent in each EncoderPhase, accumulated while profile_phases_
+     is set; the searches are const, hence mutable */
+  bool profile_phases_ { false };
+  mutable SafeArray<double, num_encoder_phases> phase_seconds_ {{}};
+
+  /* adds its own lifetime to one of the phase_seconds_ */
+  class PhaseTimer
+  {
+  private:
+    double * total_;
+    std::chrono::steady_clock::time_point start_;
+
+  public:
+    PhaseTimer( const Encoder & encoder, const EncoderPhase phase )
+      : total_( encoder.profile_phases_ ? &encoder.phase_seconds_.at( phase ) : nullptr ),
+        start_( total_ ? std::chrono::steady_clock::now() : std::chrono::steady_clock::time_point() )
+    {}
+
+    ~PhaseTimer()
+    {
+      if ( total_ ) {
+        *total_ += std::chrono::duration<double>( std::chrono::steady_clock::now() - start_ ).count();
+      }
+    }
+
+    PhaseTimer( const PhaseTimer & ) = delete;
+    PhaseTimer & operator=( const PhaseTimer & ) = delete;
+  };
+
   static uint32_t rdcost( uint32_t rate, uint32_t distortion,
                           uint32_t rate_multiplier,
                           uint32_t distortion_multiplier );
@@ -174,6 +256,57 @@ private:
   static uint32_t variance( const VP8Raster::Block<size> & block,
                             const TwoDSubRange<uint8_t, size, size> & prediction );
 
+  /* the same block against two predictions, in one pass where the CPU
+     allows it */
+  static std::pair<uint32_t, uint32_t> sad_x2( const VP8Raster::Block<16> & block,
+                                               const TwoDSubRange<uint8_t, 16, 16> & prediction_0,
+                                               const TwoDSubRange<uint8_t, 16, 16> & prediction_1 );
+
+  static std::pair<uint32_t, uint32_t> variance_x2( const VP8Raster::Block<16> & block,
+                                                    const TwoDSubRange<uint8_t, 16, 16> & prediction_0,
+                                                    const TwoDSubRange<uint8_t, 16, 16> & prediction_1 );
+
+  /* two blocks (the U and V planes of a macroblock) against their own
+     predictions */
+  static std::pair<uint32_t, uint32_t> sse_x2( const VP8Raster::Block<8> & block_0,
+                                               const TwoDSubRange<uint8_t, 8, 8> & prediction_0,
+                                               const VP8Raster::Block<8> & block_1,
+                                               const TwoDSubRange<uint8_t, 8, 8> & prediction_1 );
+
+  /* sum of absolute Hadamard-transformed differences (4x4 and 16x16 only) */
+  template<unsigned int size>
+  static uint32_t satd( const VP8Raster::Block<size> & block,
+                        const TwoDSubRange<uint8_t, size, size> & prediction );
+
+  /* residue, forward DCT and quantization of all the 4x4 blocks of a 16x16
+     or 8x8 region in a single pass. `coefficients` receives the blocks in
+     raster order; if `dc` is given, the DC coefficients are moved there (for
+     the Y2 block) instead of being quantized. Returns a mask with bit i set
+     iff block i has a nonzero coefficient. */
+  template<unsigned int size>
+  static uint32_t fdct_quantize( const VP8Raster::Block<size> & block,
+                                 const TwoDSubRange<uint8_t, size, size> & prediction,
+                                 const std::pair<uint16_t, uint16_t> & factors,
+                                 SafeArray<DCTCoefficients, ( size / 4 ) * ( size / 4 )> & coefficients,
+                                 SafeArray<int16_t, ( size / 4 ) * ( size / 4 )> * dc = nullptr );
+
+  /* code the luma (with or without Y2) or the chroma blocks of `frame_mb`
+     with fdct_quantize, setting their coefficients and has_nonzero flags.
+     These are for the passes that don't run the trellis. The returned mask
+     has the Y blocks in bits 0-15, U in 16-19, V in 20-23 and Y2 in 24. */
+  template<class MacroblockType>
+  static uint32_t luma_mb_fdct_quantize( const VP8Raster::Macroblock & original_mb,
+                                         const VP8Raster::Macroblock & prediction_mb,
+                                         MacroblockType & frame_mb,
+                                         const Quantizer & quantizer,
+                                         const bool with_y2 );
+
+  template<class MacroblockType>
+  static uint32_t chroma_mb_fdct_quantize( const VP8Raster::Macroblock & original_mb,
+                                           const VP8Raster::Macroblock & prediction_mb,
+                                           MacroblockType & frame_mb,
+                                           const Quantizer & quantizer );
+
   MVSearchResult diamond_search( const VP8Raster::Macroblock & original_mb,
                                  VP8Raster::Macroblock & temp_mb,
                                  InterFrameMacroblock & frame_mb,
@@ -184,7 +317,8 @@ private:
                                  size_t step_size,
                                  const size_t y_ac_qi ) const;
 
-  void luma_mb_inter_predict( const VP8Raster::Macroblock & original_mb,
+  /* returns true if the macroblock was taken by luma_mb_early_skip */
+  bool luma_mb_inter_predict( const VP8Raster::Macroblock & original_mb,
                               VP8Raster::Macroblock & constructed_mb,
                               VP8Raster::Macroblock & temp_mb,
                               InterFrameMacroblock & frame_mb,
@@ -193,12 +327,18 @@ private:
                               const size_t y_ac_qi,
                               const EncoderPass encoder_pass );
 
-  void luma_mb_apply_inter_prediction( const VP8Raster::Macroblock & original_mb,
-                                       VP8Raster::Macroblock & reconstructed_mb,
-                                       InterFrameMacroblock & frame_mb,
-                                       const Quantizer & quantizer,
-                                       const mbmode best_pred,
-                                       const MotionVector best_mv );
+  bool luma_mb_early_skip( const VP8Raster::Macroblock & original_mb,
+                           VP8Raster::Macroblock & reconstructed_mb,
+                           InterFrameMacroblock & frame_mb,
+                           const Quantizer & quantizer );
+
+  /* returns the nonzero mask of the luma blocks (see luma_mb_fdct_quantize) */
+  uint32_t luma_mb_apply_inter_prediction( const VP8Raster::Macroblock & original_mb,
+                                           VP8Raster::Macroblock & reconstructed_mb,
+                                           InterFrameMacroblock & frame_mb,
+                                           const Quantizer & quantizer,
+                                           const mbmode best_pred,
+                                           const MotionVector best_mv );
 
   void chroma_mb_inter_predict( const VP8Raster::Macroblock & original_mb,
                                 VP8Raster::Macroblock & constructed_mb,
@@ -262,6 +402,17 @@ private:
                                VP8Raster::Block4 & temp_sb,
                                const SafeArray<uint16_t, num_intra_b_modes> & mode_costs ) const;
 
+  /* FAST_INTRA_SEARCH: picks the bmode and also codes the subblock, leaving
+     the reconstruction in `reconstructed_sb` */
+  bmode luma_sb_fast_intra_predict( const VP8Raster::Block4 & original_sb,
+                                    VP8Raster::Block4 & reconstructed_sb,
+                                    VP8Raster::Block4 & temp_sb,
+                                    YBlock & frame_sb,
+                                    const Quantizer & quantizer,
+                                    const SafeArray<uint16_t, num_intra_b_modes> & mode_costs,
+                                    const EncoderPass encoder_pass,
+                                    uint32_t & prediction_distortion ) const;
+
   void luma_sb_apply_intra_prediction( const VP8Raster::Block4 & original_sb,
                                        VP8Raster::Block4 & reconstructed_sb,
                                        YBlock & frame_sb,
@@ -299,15 +450,42 @@ private:
   static unsigned calc_prob( unsigned false_count, unsigned total );
 
   template<class FrameType>
-  std::vector<uint8_t> write_frame( const FrameType & frame );
+  SerializedFrame write_frame( const FrameType & frame );
 
   template<class FrameType>
-  std::vector<uint8_t> write_frame( const FrameType & frame, const ProbabilityTables & prob_tables );
+  SerializedFrame write_frame( const FrameType & frame, const ProbabilityTables & prob_tables );
 
+  /* loop-filters the decoded `raster` of `frame` and makes it the new
+     reference(s); the decoder state must already be updated for `frame` */
+  template<class FrameType>
+  void update_references( const FrameType & frame, MutableRasterHandle && raster );
 
   /* Encoded frame size estimation */
   template<class FrameType>
-  size_t estimate_size( const VP8Raster & raster, const size_t y_ac_qi );
+  size_t estimate_size( const VP8Raster & raster, const size_t y_ac_qi,
+                        const SizeEstimationMethod method );
+
+  /* bit costs (in 1/256 bits) of a frame, added up macroblock by macroblock
+     as it is encoded, without running the bool encoder */
+  struct RateEstimate
+  {
+    uint64_t modes { 0 };
+    uint64_t tokens { 0 };
+    uint32_t coded_macroblocks { 0 };
+    uint32_t skipped_macroblocks { 0 };
+  };
+
+  template<class MacroblockType>
+  uint32_t token_rate( const MacroblockType & frame_mb ) const;
+
+  uint32_t mode_rate( const KeyFrameMacroblock & frame_mb ) const;
+  uint32_t mode_rate( InterFrameMacroblock & frame_mb ) const;
+
+  template<class MacroblockType>
+  void accumulate_rate( MacroblockType & frame_mb, RateEstimate & estimate ) const;
+
+  template<class FrameType>
+  static size_t estimated_frame_bytes( const FrameType & frame, const RateEstimate & estimate );
 
   /* Convergence-related stuff */
   template<class FrameType>
@@ -315,10 +493,13 @@ private:
                                        const FrameType & original_frame,
                                        const QuantIndices & quant_indices );
 
+  /* also leaves the reconstruction of the new frame (before loop filtering)
+     in `reconstructed_raster`, which is what decoding it would give */
   InterFrame update_residues( const VP8Raster & unfiltered_output,
                                 const InterFrame & original_frame,
                                 const QuantIndices & quant_indices,
-                                const bool last_frame );
+                                const bool last_frame,
+                                VP8Raster & reconstructed_raster );
 
   void update_macroblock( const VP8Raster::Macroblock & original_rmb,
                           VP8Raster::Macroblock & reconstructed_rmb,
@@ -356,16 +537,16 @@ public:
 
   Encoder & operator=( Encoder && encoder );
 
-  std::vector<uint8_t> encode_with_minimum_ssim( const VP8Raster & raster,
-                                                 const double minimum_ssim );
+  SerializedFrame encode_with_minimum_ssim( const VP8Raster & raster,
+                                           const double minimum_ssim );
 
-  std::vector<uint8_t> encode_with_quantizer( const VP8Raster & raster,
-                                              const uint8_t y_ac_qi );
+  SerializedFrame encode_with_quantizer( const VP8Raster & raster,
+                                         const uint8_t y_ac_qi );
 
   /* Tries to encode the given raster with the best possible quality, without
    * exceeding the target size. */
-  std::vector<uint8_t> encode_with_target_size( const VP8Raster & raster,
-                                                const size_t target_size );
+  SerializedFrame encode_with_target_size( const VP8Raster & raster,
+                                           const size_t target_size );
 
   void reencode( const std::vector<RasterHandle> & original_rasters,
                  const std::vector<std::pair<Optional<KeyFrame>, Optional<InterFrame> > > & prediction_frames,
@@ -373,13 +554,59 @@ public:
                  const bool extra_frame_chunk,
                  IVFWriter & ivf_writer );
 
-  size_t estimate_frame_size( const VP8Raster & raster, const size_t y_ac_qi );
+  /* estimates the size of the frame at the given quantizer by encoding a
+     subsampled version of it; TOKEN_COST adds up the bit costs of the
+     chosen modes and tokens, SERIALIZED_SIZE runs the bool encoder */
+  size_t estimate_frame_size( const VP8Raster & raster, const size_t y_ac_qi,
+                              const SizeEstimationMethod method = TOKEN_COST );
+
+  /* number of DCT token partitions (1, 2, 4 or 8); the partitions are
+     serialized in parallel */
+  void set_dct_partitions( const unsigned int count );
+
+  void set_intra_search( const IntraSearch intra_search ) { intra_search_ = intra_search; }
 
   Decoder export_decoder() const { return { decoder_state_, references_ }; }
 
   EncodeStats stats() { return encode_stats_; }
 
+  /* phase_seconds() keeps growing while profiling is on */
+  void set_phase_profiling( const bool enabled ) { profile_phases_ = enabled; }
+
+  const SafeArray<double, num_encoder_phases> & phase_seconds() const { return phase_seconds_; }
+
+  const RateModel & rate_model() const { return rate_model_; }
+
   uint32_t minihash() const;
+
+  /* approximate number of bytes held exclusively by this encoder */
+  size_t footprint() const;
+};
+
+/* a compact copy of an Encoder, for StateCache: the decoder state as a
+   DecoderSnapshot, plus the settings and the per-state history (rate model,
+   last quantizer, loop filter level) that the Decoder doesn't carry, so a
+   restored encoder encodes exactly like the original */
+class EncoderSnapshot
+{
+private:
+  DecoderSnapshot decoder_;
+
+  bool two_pass_encoder_;
+  EncoderQuality encode_quality_;
+  Optional<uint8_t> loop_filter_level_;
+  Optional<uint8_t> last_y_ac_qi_;
+  uint8_t log2_dct_partitions_;
+  RateModel rate_model_;
+  IntraSearch intra_search_;
+  bool profile_phases_;
+
+public:
+  EncoderSnapshot( const Encoder & encoder );
+
+  Encoder restore() const;
+
+  size_t size() const { return sizeof( EncoderSnapshot ) - sizeof( DecoderSnapshot ) + decoder_.size(); }
 };
 
 #endif /* ENCODER_HH */
@@ -0,0 +1,289 @@
+/* -*-mode:c++; tab-width: 2; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+
+/* Copyright 2013-2018 the Alfalfa authors
+                       and the Massachusetts Institute of Technology
+
+   Redistribution and use in source and binary forms, with or without
+   modification, are permitted provided that the following conditions are
+   met:
+
+      1. Redistributions of source code must retain the above copyright
+         notice, this list of conditions and the following disclaimer.
+
+      2. Redistributions in binary form must reproduce the above copyright
+         notice, this list of conditions and the following disclaimer in the
+         documentation and/or other materials provided with the distribution.
+
+   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+   "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+   LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+   A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+   HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+   SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+   LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+   DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+   THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+   (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+   OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE. */
+
+#include "encoder.hh"
+
+#ifdef HAVE_SSE2
+#include <emmintrin.h>
+#endif
+
+using namespace std;
+
+/* Subtracts the prediction from one 4x4 block, transforms the residue with
+ * the VP8 forward DCT and quantizes the result (truncating, like
+ * DCTCoefficients::quantize), all without leaving registers. If `dc` is not
+ * null, the DC coefficient is stored there unquantized (it goes to the Y2
+ * block) and a zero is quantized in its place. Returns true iff any of the
+ * quantized coefficients is nonzero.
+ *
+ * The transform is bit-exact with DCTCoefficients::subtract_dct.
+ */
+#ifndef HAVE_SSE2
+
+static bool fdct_quantize_4x4( const uint8_t * src, const int src_stride,
+                               const uint8_t * pred, const int pred_stride,
+                               const uint16_t dc_factor, const uint16_t ac_factor,
+                               int16_t * output, int16_t * dc )
+{
+  int input[ 16 ];
+  int temp[ 16 ];
+
+  for ( size_t row = 0; row < 4; row++ ) {
+    for ( size_t column = 0; column < 4; column++ ) {
+      input[ row * 4 + column ] = src[ row * src_stride + column ]
+                                  - pred[ row * pred_stride + column ];
+    }
+  }
+
+  /* Taken from: libvpx:vp8/encoder/dct.c:vp8_short_fdct4x4_c */
+  for ( size_t i = 0; i < 4; i++ ) {
+    const int * ip = input + 4 * i;
+    int * op = temp + 4 * i;
+
+    const int a1 = ( ip[ 0 ] + ip[ 3 ] ) * 8;
+    const int b1 = ( ip[ 1 ] + ip[ 2 ] ) * 8;
+    const int c1 = ( ip[ 1 ] - ip[ 2 ] ) * 8;
+    const int d1 = ( ip[ 0 ] - ip[ 3 ] ) * 8;
+
+    op[ 0 ] = a1 + b1;
+    op[ 2 ] = a1 - b1;
+    op[ 1 ] = ( c1 * 2217 + d1 * 5352 + 14500 ) >> 12;
+    op[ 3 ] = ( d1 * 2217 - c1 * 5352 + 7500 ) >> 12;
+  }
+
+  for ( size_t i = 0; i < 4; i++ ) {
+    const int * ip = temp + i;
+    int16_t * op = output + i;
+
+    const int a1 = ip[ 0 ] + ip[ 12 ];
+    const int b1 = ip[ 4 ] + ip[ 8 ];
+    const int c1 = ip[ 4 ] - ip[ 8 ];
+    const int d1 = ip[ 0 ] - ip[ 12 ];
+
+    op[ 0 ] = ( a1 + b1 + 7 ) >> 4;
+    op[ 8 ] = ( a1 - b1 + 7 ) >> 4;
+    op[ 4 ] = ( ( c1 * 2217 + d1 * 5352 + 12000 ) >> 16 ) + ( d1 != 0 );
+    op[ 12 ] = ( d1 * 2217 - c1 * 5352 + 51000 ) >> 16;
+  }
+
+  if ( dc ) {
+    *dc = output[ 0 ];
+    output[ 0 ] = 0;
+  }
+
+  bool has_nonzero = false;
+
+  output[ 0 ] /= dc_factor;
+  has_nonzero |= ( output[ 0 ] != 0 );
+
+  for ( size_t i = 1; i < 16; i++ ) {
+    output[ i ] /= ac_factor;
+    has_nonzero |= ( output[ i ] != 0 );
+  }
+
+  return has_nonzero;
+}
+
+#else // SSE2 is supported
+
+/* x / d for 0 <= x < 32768 - d: ceil( 65536 / d ) overestimates the
+ * quotient by at most one, which the multiply-back corrects. The
+ * coefficients coming out of the 4x4 transform are well inside that range,
+ * and the smallest VP8 quantizer is 4. */
+static inline __m128i divide_epi16( const __m128i x, const __m128i d, const __m128i m )
+{
+  const __m128i sign = _mm_srai_epi16( x, 15 );
+  const __m128i abs_x = _mm_sub_epi16( _mm_xor_si128( x, sign ), sign );
+
+  __m128i q = _mm_mulhi_epu16( abs_x, m );
+  q = _mm_add_epi16( q, _mm_cmpgt_epi16( _mm_mullo_epi16( q, d ), abs_x ) );
+
+  return _mm_sub_epi16( _mm_xor_si128( q, sign ), sign );
+}
+
+/* transposes the 4x4 matrix whose rows are the low halves of r0..r3; the
+   result has rows 0 and 1 in t01 and rows 2 and 3 in t23 */
+static inline void transpose_4x4( const __m128i r0, const __m128i r1,
+                                  const __m128i r2, const __m128i r3,
+                                  __m128i & t01, __m128i & t23 )
+{
+  const __m128i a = _mm_unpacklo_epi16( r0, r1 );
+  const __m128i b = _mm_unpacklo_epi16( r2, r3 );
+
+  t01 = _mm_unpacklo_epi32( a, b );
+  t23 = _mm_unpackhi_epi32( a, b );
+}
+
+static bool fdct_quantize_4x4( const uint8_t * src, const int src_stride,
+                               const uint8_t * pred, const int pred_stride,
+                               const uint16_t dc_factor, const uint16_t ac_factor,
+                               int16_t * output, int16_t * dc )
+{
+  const __m128i zero = _mm_setzero_si128();
+
+  __m128i rows[ 4 ];
+
+  for ( size_t i = 0; i < 4; i++ ) {
+    const __m128i s = _mm_unpacklo_epi8(
+      _mm_cvtsi32_si128( *reinterpret_cast<const int32_t *>( src + i * src_stride ) ), zero );
+    const __m128i p = _mm_unpacklo_epi8(
+      _mm_cvtsi32_si128( *reinterpret_cast<const int32_t *>( pred + i * pred_stride ) ), zero );
+    rows[ i ] = _mm_sub_epi16( s, p );
+  }
+
+  /* first pass works on the rows: one lane per row, one vector per column */
+  __m128i x01, x23;
+  transpose_4x4( rows[ 0 ], rows[ 1 ], rows[ 2 ], rows[ 3 ], x01, x23 );
+
+  const __m128i x0 = x01;
+  const __m128i x1 = _mm_srli_si128( x01, 8 );
+  const __m128i x2 = x23;
+  const __m128i x3 = _mm_srli_si128( x23, 8 );
+
+  const __m128i a1 = _mm_slli_epi16( _mm_add_epi16( x0, x3 ), 3 );
+  const __m128i b1 = _mm_slli_epi16( _mm_add_epi16( x1, x2 ), 3 );
+  const __m128i c1 = _mm_slli_epi16( _mm_sub_epi16( x1, x2 ), 3 );
+  const __m128i d1 = _mm_slli_epi16( _mm_sub_epi16( x0, x3 ), 3 );
+
+  const __m128i k_2217_5352 = _mm_setr_epi16( 2217, 5352, 2217, 5352, 2217, 5352, 2217, 5352 );
+  const __m128i k_2217_m5352 = _mm_setr_epi16( 2217, -5352, 2217, -5352, 2217, -5352, 2217, -5352 );
+
+  const __m128i o0 = _mm_add_epi16( a1, b1 );
+  const __m128i o2 = _mm_sub_epi16( a1, b1 );
+  const __m128i o1 = _mm_srai_epi32( _mm_add_epi32( _mm_madd_epi16( _mm_unpacklo_epi16( c1, d1 ), k_2217_5352 ),
+                                                    _mm_set1_epi32( 14500 ) ), 12 );
+  const __m128i o3 = _mm_srai_epi32( _mm_add_epi32( _mm_madd_epi16( _mm_unpacklo_epi16( d1, c1 ), k_2217_m5352 ),
+                                                    _mm_set1_epi32( 7500 ) ), 12 );
+  const __m128i o13 = _mm_packs_epi32( o1, o3 );
+
+  /* second pass works on the columns: one lane per column, one vector per row */
+  __m128i y01, y23;
+  transpose_4x4( o0, o13, o2, _mm_srli_si128( o13, 8 ), y01, y23 );
+
+  /* [ y3 | y2 ] */
+  const __m128i y32 = _mm_shuffle_epi32( y23, _MM_SHUFFLE( 1, 0, 3, 2 ) );
+  const __m128i ab = _mm_add_epi16( y01, y32 );   /* [ a1 | b1 ] */
+  const __m128i dc1 = _mm_sub_epi16( y01, y32 );  /* [ d1 | c1 ] */
+
+  const __m128i a2 = ab;
+  const __m128i b2 = _mm_srli_si128( ab, 8 );
+  const __m128i d2 = dc1;
+  const __m128i c2 = _mm_srli_si128( dc1, 8 );
+
+  const __m128i seven = _mm_set1_epi16( 7 );
+  const __m128i out0 = _mm_srai_epi16( _mm_add_epi16( _mm_add_epi16( a2, b2 ), seven ), 4 );
+  const __m128i out2 = _mm_srai_epi16( _mm_add_epi16( _mm_sub_epi16( a2, b2 ), seven ), 4 );
+
+  const __m128i out1 = _mm_srai_epi32( _mm_add_epi32( _mm_madd_epi16( _mm_unpacklo_epi16( c2, d2 ), k_2217_5352 ),
+                                                      _mm_set1_epi32( 12000 ) ), 16 );
+  const __m128i out3 = _mm_srai_epi32( _mm_add_epi32( _mm_madd_epi16( _mm_unpacklo_epi16( d2, c2 ), k_2217_m5352 ),
+                                                      _mm_set1_epi32( 51000 ) ), 16 );
+
+  /* + ( d1 != 0 ) on row 1 */
+  const __m128i d_nonzero = _mm_unpacklo_epi64( _mm_add_epi16( _mm_set1_epi16( 1 ),
+                                                               _mm_cmpeq_epi16( d2, zero ) ),
+                                                zero );
+  const __m128i out13 = _mm_add_epi16( _mm_packs_epi32( out1, out3 ), d_nonzero );
+
+  __m128i coeffs_0 = _mm_unpacklo_epi64( out0, out13 );
+  __m128i coeffs_1 = _mm_unpacklo_epi64( out2, _mm_srli_si128( out13, 8 ) );
+
+  if ( dc ) {
+    *dc = static_cast<int16_t>( _mm_extract_epi16( coeffs_0, 0 ) );
+    coeffs_0 = _mm_and_si128( coeffs_0, _mm_setr_epi16( 0, -1, -1, -1, -1, -1, -1, -1 ) );
+  }
+
+  const int16_t dc_multiplier = static_cast<int16_t>( ( 65536 + dc_factor - 1 ) / dc_factor );
+  const int16_t ac_multiplier = static_cast<int16_t>( ( 65536 + ac_factor - 1 ) / ac_factor );
+  const int16_t dc_f = static_cast<int16_t>( dc_factor );
+  const int16_t ac_f = static_cast<int16_t>( ac_factor );
+
+  coeffs_0 = divide_epi16( coeffs_0,
+                           _mm_setr_epi16( dc_f, ac_f, ac_f, ac_f, ac_f, ac_f, ac_f, ac_f ),
+                           _mm_setr_epi16( dc_multiplier, ac_multiplier, ac_multiplier, ac_multiplier,
+                                           ac_multiplier, ac_multiplier, ac_multiplier, ac_multiplier ) );
+  coeffs_1 = divide_epi16( coeffs_1, _mm_set1_epi16( ac_f ), _mm_set1_epi16( ac_multiplier ) );
+
+  _mm_storeu_si128( reinterpret_cast<__m128i *>( output ), coeffs_0 );
+  _mm_storeu_si128( reinterpret_cast<__m128i *>( output + 8 ), coeffs_1 );
+
+  return _mm_movemask_epi8( _mm_cmpeq_epi16( _mm_or_si128( coeffs_0, coeffs_1 ), zero ) ) != 0xffff;
+}
+
+#endif
+
+template<unsigned int size>
+static uint32_t fdct_quantize_blocks( const VP8Raster::Block<size> & block,
+                                      const TwoDSubRange<uint8_t, size, size> & prediction,
+                                      const pair<uint16_t, uint16_t> & factors,
+                                      SafeArray<DCTCoefficients, ( size / 4 ) * ( size / 4 )> & coefficients,
+                                      SafeArray<int16_t, ( size / 4 ) * ( size / 4 )> * dc )
+{
+  const uint8_t * src = &block.contents().at( 0, 0 );
+  const uint8_t * pred = &prediction.at( 0, 0 );
+  const int src_stride = block.contents().stride();
+  const int pred_stride = prediction.stride();
+
+  uint32_t nonzero_mask = 0;
+
+  for ( unsigned int row = 0; row < size / 4; row++ ) {
+    for ( unsigned int column = 0; column < size / 4; column++ ) {
+      const unsigned int index = row * ( size / 4 ) + column;
+
+      if ( fdct_quantize_4x4( src + 4 * ( row * src_stride + column ), src_stride,
+                              pred + 4 * ( row * pred_stride + column ), pred_stride,
+                              factors.first, factors.second,
+                              &coefficients.at( index ).at( 0 ),
+                              dc ? &dc->at( index ) : nullptr ) ) {
+        nonzero_mask |= 1 << index;
+      }
+    }
+  }
+
+  return nonzero_mask;
+}
+
+template<>
+uint32_t Encoder::fdct_quantize( const VP8Raster::Block<16> & block,
+                                 const TwoDSubRange<uint8_t, 16, 16> & prediction,
+                                 const pair<uint16_t, uint16_t> & factors,
+                                 SafeArray<DCTCoefficients, 16> & coefficients,
+                                 SafeArray<int16_t, 16> * dc )
+{
+  return fdct_quantize_blocks( block, prediction, factors, coefficients, dc );
+}
+
+template<>
+uint32_t Encoder::fdct_quantize( const VP8Raster::Block<8> & block,
+                                 const TwoDSubRange<uint8_t, 8, 8> & prediction,
+                                 const pair<uint16_t, uint16_t> & factors,
+                                 SafeArray<DCTCoefficients, 4> & coefficients,
+                                 SafeArray<int16_t, 4> * dc )
+{
+  return fdct_quantize_blocks( block, prediction, factors, coefficients, dc );
+}
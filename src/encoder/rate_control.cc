@@ -0,0 +1,212 @@
+/* -*-mode:c++; tab-width: 2; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+
+/* Copyright 2013-2018 the Alfalfa authors
+                       and the Massachusetts Institute of Technology
+
+   Redistribution and use in source and binary forms, with or without
+   modification, are permitted provided that the following conditions are
+   met:
+
+      1. Redistributions of source code must retain the above copyright
+         notice, this list of conditions and the following disclaimer.
+
+      2. Redistributions in binary form must reproduce the above copyright
+         notice, this list of conditions and the following disclaimer in the
+         documentation and/or other materials provided with the distribution.
+
+   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+   "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+   LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+   A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+   HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+   SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+   LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+   DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+   THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+   (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+   OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE. */
+
+#include <algorithm>
+#include <cmath>
+#include <iomanip>
+#include <sstream>
+
+#include "rate_control.hh"
+#include "frame_header.hh"
+#include "quantization.hh"
+
+using namespace std;
+
+double RateModel::log_qstep( const uint8_t y_ac_qi )
+{
+  QuantIndices quant_indices;
+  quant_indices.y_ac_qi = y_ac_qi;
+
+  return log( static_cast<double>( Quantizer( quant_indices ).y_ac ) );
+}
+
+void RateModel::refit( Model & model )
+{
+  const size_t n = min( model.count, HISTORY_SIZE );
+
+  /* weighted least squares in log space; recent frames weigh more */
+  double weight = 1.0;
+  double sum_w = 0.0, sum_x = 0.0, sum_y = 0.0;
+
+  for ( size_t age = 0; age < n; age++ ) {
+    const Observation & obs = model.history.at( ( model.count - 1 - age ) % HISTORY_SIZE );
+    sum_w += weight;
+    sum_x += weight * obs.log_qstep;
+    sum_y += weight * obs.log_size;
+    weight *= FORGETTING_FACTOR;
+  }
+
+  const double mean_x = sum_x / sum_w;
+  const double mean_y = sum_y / sum_w;
+
+  double var_x = 0.0, cov_xy = 0.0;
+  weight = 1.0;
+
+  for ( size_t age = 0; age < n; age++ ) {
+    const Observation & obs = model.history.at( ( model.count - 1 - age ) % HISTORY_SIZE );
+    var_x += weight * ( obs.log_qstep - mean_x ) * ( obs.log_qstep - mean_x );
+    cov_xy += weight * ( obs.log_qstep - mean_x ) * ( obs.log_size - mean_y );
+    weight *= FORGETTING_FACTOR;
+  }
+
+  /* the slope is only meaningful if the recent quantizers actually differ;
+     otherwise keep the previous exponent and only refresh the scale */
+  if ( var_x / sum_w > 0.01 ) {
+    model.exponent = max( MIN_EXPONENT, min( MAX_EXPONENT, -cov_xy / var_x ) );
+  }
+
+  model.log_scale = mean_y + model.exponent * mean_x;
+}
+
+RateModel::Prediction RateModel::solve( const double log_scale, const double exponent,
+                                        const size_t target_size,
+                                        const uint8_t min_qi, const uint8_t max_qi )
+{
+  Prediction prediction;
+
+  for ( unsigned int qi = min_qi; qi <= max_qi; qi++ ) {
+    prediction.y_ac_qi = qi;
+    prediction.size = llround( exp( log_scale - exponent * log_qstep( qi ) ) );
+
+    if ( prediction.size <= target_size ) {
+      break;
+    }
+  }
+
+  return prediction;
+}
+
+void RateModel::set_pending( const FrameKind kind, const Prediction & prediction,
+                             const size_t model_size )
+{
+  has_pending_ = true;
+  pending_kind_ = kind;
+  pending_ = prediction;
+  pending_model_size_ = model_size;
+}
+
+bool RateModel::needs_probe( const FrameKind kind ) const
+{
+  const Model & model = models_.at( kind );
+  return model.count == 0 or model.mean_abs_error > PROBE_ERROR_THRESHOLD;
+}
+
+RateModel::Prediction RateModel::predict( const FrameKind kind, const size_t target_size,
+                                          const uint8_t min_qi, const uint8_t max_qi )
+{
+  const Model & model = models_.at( kind );
+
+  if ( model.count == 0 ) {
+    /* nothing to go on */
+    Prediction prediction;
+    prediction.y_ac_qi = ( min_qi + max_qi ) / 2;
+    has_pending_ = false;
+    return prediction;
+  }
+
+  const Prediction prediction = solve( model.log_scale, model.exponent,
+                                       target_size, min_qi, max_qi );
+  set_pending( kind, prediction, prediction.size );
+  return prediction;
+}
+
+RateModel::Prediction RateModel::predict( const FrameKind kind, const size_t target_size,
+                                          const uint8_t min_qi, const uint8_t max_qi,
+                                          const uint8_t probe_qi, const size_t probe_size )
+{
+  const Model & model = models_.at( kind );
+  stats_.probes++;
+
+  /* keep the fitted slope, but pass through the probe */
+  const double probe_log_scale = log( max<double>( probe_size, 1.0 ) )
+                                 + model.exponent * log_qstep( probe_qi );
+
+  const Prediction prediction = solve( probe_log_scale, model.exponent,
+                                       target_size, min_qi, max_qi );
+
+  const size_t model_size = ( model.count == 0 )
+                            ? 0
+                            : llround( exp( model.log_scale - model.exponent * log_qstep( prediction.y_ac_qi ) ) );
+
+  set_pending( kind, prediction, model_size );
+  return prediction;
+}
+
+void RateModel::observe( const FrameKind kind, const uint8_t y_ac_qi, const size_t size )
+{
+  Model & model = models_.at( kind );
+  const size_t actual_size = max<size_t>( size, 1 );
+
+  if ( has_pending_ and pending_kind_ == kind and pending_.y_ac_qi == y_ac_qi
+       and pending_.size > 0 ) {
+    const double error = ( static_cast<double>( actual_size ) - pending_.size ) / pending_.size;
+
+    stats_.predicted_frames++;
+    stats_.last_predicted_size = pending_.size;
+    stats_.last_actual_size = actual_size;
+    stats_.last_error = error;
+    stats_.mean_abs_error = ( stats_.predicted_frames == 1 )
+                            ? fabs( error )
+                            : ERROR_SMOOTHING * fabs( error ) + ( 1 - ERROR_SMOOTHING ) * stats_.mean_abs_error;
+
+    /* decides whether the next frame needs a probe: judge the model by
+       what it would have predicted without one */
+    if ( pending_model_size_ > 0 ) {
+      const double model_error = fabs( static_cast<double>( actual_size ) - pending_model_size_ )
+                                 / pending_model_size_;
+      model.mean_abs_error = ERROR_SMOOTHING * model_error
+                             + ( 1 - ERROR_SMOOTHING ) * model.mean_abs_error;
+    }
+  }
+
+  has_pending_ = false;
+
+  Observation & obs = model.history.at( model.count % HISTORY_SIZE );
+  obs.log_qstep = log_qstep( y_ac_qi );
+  obs.log_size = log( static_cast<double>( actual_size ) );
+  model.count++;
+
+  refit( model );
+
+  stats_.frames++;
+}
+
+string RateModel::str() const
+{
+  ostringstream out;
+
+  out << fixed << setprecision( 1 )
+      << "frames=" << stats_.frames
+      << " probes=" << stats_.probes
+      << " predicted=" << stats_.last_predicted_size
+      << " actual=" << stats_.last_actual_size
+      << " error=" << showpos << 100 * stats_.last_error << noshowpos << "%"
+      << " mean_abs_error=" << 100 * stats_.mean_abs_error << "%";
+
+  return out.str();
+}
@@ -0,0 +1,141 @@
+/* -*-mode:c++; tab-width: 2; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+
+/* Copyright 2013-2018 the Alfalfa authors
+                       and the Massachusetts Institute of Technology
+
+   Redistribution and use in source and binary forms, with or without
+   modification, are permitted provided that the following conditions are
+   met:
+
+      1. Redistributions of source code must retain the above copyright
+         notice, this list of conditions and the following disclaimer.
+
+      2. Redistributions in binary form must reproduce the above copyright
+         notice, this list of conditions and the following disclaimer in the
+         documentation and/or other materials provided with the distribution.
+
+   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+   "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+   LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+   A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+   HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+   SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+   LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+   DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+   THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+   (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+   OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE. */
+
+#ifndef RATE_CONTROL_HH
+#define RATE_CONTROL_HH
+
+#include <array>
+#include <cstdint>
+#include <string>
+
+/* Per-stream rate model used by Encoder::encode_with_target_size. The size of
+   a frame is modeled as a power law of the luma AC quantizer step,
+
+     size( q ) = exp( log_scale ) * q ^ -exponent,
+
+   fitted in log space to the actual sizes of the most recently written
+   frames. Key frames and inter frames are modeled separately. When the model
+   has been predicting poorly, a single probe encode ( estimate_frame_size )
+   re-centers it for the current frame. */
+class RateModel
+{
+public:
+  enum FrameKind { KEY_FRAME = 0, INTER_FRAME = 1 };
+
+  struct Prediction
+  {
+    uint8_t y_ac_qi { 0 };
+    size_t size { 0 };
+  };
+
+  struct Stats
+  {
+    unsigned int frames { 0 };          /* frames observed */
+    unsigned int predicted_frames { 0 }; /* frames encoded with a predicted qi */
+    unsigned int probes { 0 };          /* probe encodes requested */
+
+    size_t last_predicted_size { 0 };
+    size_t last_actual_size { 0 };
+
+    /* ( actual - predicted ) / predicted, for the last predicted frame */
+    double last_error { 0.0 };
+
+    /* moving average of | last_error | */
+    double mean_abs_error { 0.0 };
+  };
+
+private:
+  static constexpr size_t HISTORY_SIZE = 8;
+  static constexpr double FORGETTING_FACTOR = 0.7;
+  static constexpr double DEFAULT_EXPONENT = 1.0;
+  static constexpr double MIN_EXPONENT = 0.4;
+  static constexpr double MAX_EXPONENT = 2.5;
+  static constexpr double ERROR_SMOOTHING = 0.5;
+  static constexpr double PROBE_ERROR_THRESHOLD = 0.25;
+
+  struct Observation
+  {
+    double log_qstep { 0.0 };
+    double log_size { 0.0 };
+  };
+
+  struct Model
+  {
+    std::array<Observation, HISTORY_SIZE> history {};
+    size_t count { 0 };
+
+    double log_scale { 0.0 };
+    double exponent { DEFAULT_EXPONENT };
+
+    /* moving average of the relative error of the unprobed model */
+    double mean_abs_error { 1.0 };
+  };
+
+  std::array<Model, 2> models_ {};
+
+  /* the last prediction, waiting for the frame to be written */
+  bool has_pending_ { false };
+  FrameKind pending_kind_ { KEY_FRAME };
+  Prediction pending_ {};
+  size_t pending_model_size_ { 0 };
+
+  Stats stats_ {};
+
+  static double log_qstep( const uint8_t y_ac_qi );
+  static void refit( Model & model );
+
+  static Prediction solve( const double log_scale, const double exponent,
+                           const size_t target_size,
+                           const uint8_t min_qi, const uint8_t max_qi );
+
+  void set_pending( const FrameKind kind, const Prediction & prediction,
+                    const size_t model_size );
+
+public:
+  /* true if the model for this kind of frame is not trusted on its own */
+  bool needs_probe( const FrameKind kind ) const;
+
+  /* the smallest qi in [min_qi, max_qi] that is predicted to fit in
+     target_size bytes (max_qi if none does) */
+  Prediction predict( const FrameKind kind, const size_t target_size,
+                      const uint8_t min_qi, const uint8_t max_qi );
+
+  /* same, with the model re-centered on a probe encode of this frame */
+  Prediction predict( const FrameKind kind, const size_t target_size,
+                      const uint8_t min_qi, const uint8_t max_qi,
+                      const uint8_t probe_qi, const size_t probe_size );
+
+  /* records the actual size of a frame that was just written */
+  void observe( const FrameKind kind, const uint8_t y_ac_qi, const size_t size );
+
+  const Stats & stats() const { return stats_; }
+
+  std::string str() const;
+};
+
+#endif /* RATE_CONTROL_HH */
@@ -28,12 +28,98 @@
 
 #include <limits>
 #include <cmath>
+#include <atomic>
+#include <future>
+#include <memory>
+#include <thread>
 
 #include "encoder.hh"
 #include "scorer.hh"
 
 using namespace std;
 
+/*
+ * Calls f( mb_column, mb_row, worker ) for every macroblock of a frame, on
+ * `worker_count` threads. Worker w takes rows w, w + worker_count, ...,
+ * and starts a macroblock only once the row above is two macroblocks ahead
+ * (wavefront order), so f can rely on its left, above-left, above and
+ * above-right neighbours being done, just as in raster order.
+ */
+template<class Functor>
+static void wavefront_forall( const unsigned int mb_width, const unsigned int mb_height,
+                              const unsigned int worker_count, const Functor & f )
+{
+  if ( worker_count <= 1 ) {
+    for ( unsigned int mb_row = 0; mb_row < mb_height; mb_row++ ) {
+      for ( unsigned int mb_column = 0; mb_column < mb_width; mb_column++ ) {
+        f( mb_column, mb_row, 0 );
+      }
+    }
+
+    return;
+  }
+
+  /* number of finished macroblocks in each row */
+  unique_ptr<atomic<unsigned int>[]> progress { new atomic<unsigned int>[ mb_height ] };
+  for ( unsigned int mb_row = 0; mb_row < mb_height; mb_row++ ) {
+    progress[ mb_row ].store( 0 );
+  }
+
+  /* set if a worker throws, so the others stop waiting on it */
+  atomic<bool> failed { false };
+
+  auto worker = [&] ( const unsigned int w )
+    {
+      try {
+        for ( unsigned int mb_row = w; mb_row < mb_height; mb_row += worker_count ) {
+          for ( unsigned int mb_column = 0; mb_column < mb_width; mb_column++ ) {
+            if ( mb_row > 0 ) {
+              const unsigned int needed = min( mb_column + 2, mb_width );
+
+              while ( progress[ mb_row - 1 ].load( memory_order_acquire ) < needed ) {
+                if ( failed.load() ) { return; }
+                this_thread::yield();
+              }
+            }
+
+            f( mb_column, mb_row, w );
+            progress[ mb_row ].store( mb_column + 1, memory_order_release );
+          }
+        }
+      }
+      catch ( ... ) {
+        failed.store( true );
+        throw;
+      }
+    };
+
+  vector<future<void>> workers;
+
+  for ( unsigned int w = 1; w < worker_count; w++ ) {
+    workers.emplace_back( async( launch::async, worker, w ) );
+  }
+
+  worker( 0 );
+
+  for ( auto & w : workers ) {
+    w.get();
+  }
+}
+
+static void add_token_branch_counts( TokenBranchCounts & total, const TokenBranchCounts & counts )
+{
+  for ( size_t i = 0; i < BLOCK_TYPES; i++ ) {
+    for ( size_t j = 0; j < COEF_BANDS; j++ ) {
+      for ( size_t k = 0; k < PREV_COEF_CONTEXTS; k++ ) {
+        for ( size_t l = 0; l < ENTROPY_NODES; l++ ) {
+          total.at( i ).at( j ).at( k ).at( l ).first += counts.at( i ).at( j ).at( k ).at( l ).first;
+          total.at( i ).at( j ).at( k ).at( l ).second += counts.at( i ).at( j ).at( k ).at( l ).second;
+        }
+      }
+    }
+  }
+}
+
 template<class FrameType>
 InterFrame Encoder::reencode_as_interframe( const VP8Raster & original_raster,
                                             const FrameType & original_frame,
@@ -54,6 +140,7 @@ InterFrame Encoder::reencode_as_interframe( const VP8Raster & original_raster,
   if_header.sharpness_level         = kf_header.sharpness_level;
   if_header.mode_lf_adjustments     = kf_header.mode_lf_adjustments;
   if_header.quant_indices           = quant_indices;
+  if_header.log2_number_of_dct_partitions = log2_dct_partitions_;
   if_header.refresh_last            = true;
   if_header.refresh_golden_frame    = true;
   if_header.refresh_alternate_frame = true;
@@ -236,7 +323,8 @@ void Encoder::update_macroblock( const VP8Raster::Macroblock & original_mb,
 InterFrame Encoder::update_residues( const VP8Raster & original_raster,
                                      const InterFrame & original_frame,
                                      const QuantIndices & quant_indices,
-                                     const bool last_frame )
+                                     const bool last_frame,
+                                     VP8Raster & reconstructed_raster )
 {
   InterFrame frame { width(), height() };
 
@@ -253,6 +341,7 @@ InterFrame Encoder::update_residues( const VP8Raster & original_raster,
   if_header.refresh_entropy_probs    = of_header.refresh_entropy_probs;
   if_header.prob_references_last     = of_header.prob_references_last;
   if_header.prob_references_golden   = of_header.prob_references_golden;
+  if_header.log2_number_of_dct_partitions = log2_dct_partitions_;
 
   if ( last_frame ) {
     if_header.refresh_last            = true;
@@ -272,14 +361,20 @@ InterFrame Encoder::update_residues( const VP8Raster & original_raster,
   if_header.quant_indices = quant_indices;
 
   Quantizer quantizer( frame.header().quant_indices );
-  MutableRasterHandle reconstructed_raster_handle { width(), height() };
-  VP8Raster & reconstructed_raster = reconstructed_raster_handle.get();
 
-  TokenBranchCounts token_branch_counts;
+  /* the macroblocks only depend on their left and upper neighbours, so they
+     are updated in wavefront order on all the cores, each worker with its
+     own token counts */
+  const unsigned int mb_width = frame.macroblocks().width();
+  const unsigned int mb_height = frame.macroblocks().height();
+  const unsigned int worker_count = max( 1u, min( thread::hardware_concurrency(), mb_height ) );
 
-  original_raster.macroblocks_forall_ij(
-    [&] ( VP8Raster::ConstMacroblock original_mb, unsigned int mb_column, unsigned int mb_row )
+  vector<TokenBranchCounts> worker_token_branch_counts( worker_count );
+
+  wavefront_forall( mb_width, mb_height, worker_count,
+    [&] ( const unsigned int mb_column, const unsigned int mb_row, const unsigned int worker )
     {
+      auto original_mb = original_raster.macroblock( mb_column, mb_row );
       auto reconstructed_mb = reconstructed_raster.macroblock( mb_column, mb_row );
       auto temp_mb = temp_raster().macroblock( mb_column, mb_row );
       auto & original_fmb = original_frame.macroblocks().at( mb_column, mb_row );
@@ -289,10 +384,16 @@ InterFrame Encoder::update_residues( const VP8Raster & original_raster,
                          original_fmb, quantizer );
 
       frame_mb.calculate_has_nonzero();
-      frame_mb.accumulate_token_branches( token_branch_counts );
+      frame_mb.accumulate_token_branches( worker_token_branch_counts.at( worker ) );
     }
   );
 
+  TokenBranchCounts token_branch_counts = worker_token_branch_counts.at( 0 );
+
+  for ( unsigned int worker = 1; worker < worker_count; worker++ ) {
+    add_token_branch_counts( token_branch_counts, worker_token_branch_counts.at( worker ) );
+  }
+
   frame.relink_y2_blocks();
 
   optimize_prob_skip( frame );
@@ -316,6 +417,55 @@ void Encoder::reencode( const vector<RasterHandle> & original_rasters,
 
   unsigned int start_frame_index = ( extra_frame_chunk ? 1 : 0 );
 
+  /* The next frame is predicted from the loop-filtered references, so only
+     the serialization of a rebased frame can overlap with the rebasing of
+     the next one; it runs on a worker. The references themselves come from
+     the reconstruction that update_residues() leaves behind, instead of
+     decoding the frame again. */
+  future<SerializedFrame> pending_output;
+
+  auto flush_output = [&] ()
+    {
+      if ( pending_output.valid() ) {
+        ivf_writer.append_frame( pending_output.get() );
+      }
+    };
+
+  auto write_updated_frame = [&] ( const VP8Raster & target_output,
+                                   const InterFrame & prediction_frame,
+                                   const QuantIndices & quant_indices,
+                                   const bool last_frame )
+    {
+      MutableRasterHandle reconstructed_raster { width(), height() };
+      const auto frame = make_shared<InterFrame>( update_residues( target_output, prediction_frame,
+                                                                   quant_indices, last_frame,
+                                                                   reconstructed_raster.get() ) );
+
+      update_decoder_state( *frame );
+
+      if ( decoder_state_.segmentation.initialized() ) {
+        /* the reconstruction does not use the per-segment quantizers */
+        frame->decode( decoder_state_.segmentation, references_, reconstructed_raster );
+      }
+
+      update_references( *frame, move( reconstructed_raster ) );
+
+      flush_output();
+
+      pending_output = async( launch::async,
+        [this, frame, prob_tables = decoder_state_.probability_tables] ()
+        {
+          SerializedFrame output = [&] ()
+            {
+              PhaseTimer timer { *this, SERIALIZATION };
+              return frame->serialize( prob_tables );
+            } ();
+          rate_model_.observe( RateModel::INTER_FRAME, frame->header().quant_indices.y_ac_qi,
+                               output.size() );
+          return output;
+        } );
+    };
+
   for ( unsigned int frame_index = start_frame_index;
         frame_index < original_rasters.size();
         frame_index++ ) {
@@ -347,6 +497,7 @@ void Encoder::reencode( const vector<RasterHandle> & original_rasters,
         }
       }
 
+      flush_output();
       ivf_writer.append_frame( write_frame( reencode_as_interframe( target_output, prediction_frame_ref.first.get(), new_quantizer ) ) );
 
       continue;
@@ -362,20 +513,21 @@ void Encoder::reencode( const vector<RasterHandle> & original_rasters,
       new_quantizer.y_ac_qi = lrint( kf_q_weight *  prediction_frames.at( 0 ).first.get().header().quant_indices.y_ac_qi
                                      + ( 1 - kf_q_weight ) * prediction_frame_ref.second.get().header().quant_indices.y_ac_qi );
 
-      ivf_writer.append_frame( write_frame( update_residues( target_output,
-                                                             prediction_frame_ref.second.get(),
-                                                             new_quantizer, last_frame ) ) );
+      write_updated_frame( target_output, prediction_frame_ref.second.get(),
+                           new_quantizer, last_frame );
     } else if ( prediction_frame_ref.first.initialized() ) {
       /* Option 3: Is this another KeyFrame? Then preserve it. */
+      flush_output();
       ivf_writer.append_frame( write_frame( prediction_frame_ref.first.get() ) );
     } else if ( prediction_frame_ref.second.initialized() ) {
       /* Option 4: Is this an InterFrame? Then update residues. */
-      ivf_writer.append_frame( write_frame( update_residues( target_output,
-                                                             prediction_frame_ref.second.get(),
-                                                             prediction_frame_ref.second.get().header().quant_indices,
-                                                             last_frame ) ) );
+      write_updated_frame( target_output, prediction_frame_ref.second.get(),
+                           prediction_frame_ref.second.get().header().quant_indices,
+                           last_frame );
     } else {
       throw runtime_error( "prediction_frames contained two undefined values" );
     }
   }
+
+  flush_output();
 }
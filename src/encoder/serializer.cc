@@ -26,6 +26,8 @@
    (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
    OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE. */
 
+#include <future>
+
 #include "uncompressed_chunk.hh"
 #include "frame.hh"
 #include "bool_encoder.hh"
@@ -385,7 +387,7 @@ void Macroblock< FrameHeaderType, MacroblockheaderType >::serialize( BoolEncoder
 }
 
 template <class FrameHeaderType, class MacroblockType>
-vector< uint8_t > Frame< FrameHeaderType, MacroblockType >::serialize_first_partition( const ProbabilityTables & probability_tables ) const
+ArenaBuffer Frame< FrameHeaderType, MacroblockType >::serialize_first_partition( const ProbabilityTables & probability_tables ) const
 {
   BoolEncoder encoder;
 
@@ -405,20 +407,46 @@ vector< uint8_t > Frame< FrameHeaderType, MacroblockType >::serialize_first_part
 }
 
 template <class FrameHeaderType, class MacroblockType>
-vector< vector< uint8_t > > Frame< FrameHeaderType, MacroblockType >::serialize_tokens( const ProbabilityTables & probability_tables ) const
+vector< ArenaBuffer > Frame< FrameHeaderType, MacroblockType >::serialize_tokens( const ProbabilityTables & probability_tables ) const
 {
-  vector< BoolEncoder > dct_partitions( dct_partition_count() );
+  const unsigned int partition_count = dct_partition_count();
+  const auto & macroblocks = macroblock_headers_.get();
+
+  vector< BoolEncoder > dct_partitions( partition_count );
+
+  /* serialize every macroblock's tokens. Partition i holds the rows where
+     row % partition_count == i, so the partitions are independent. */
+  auto serialize_partition = [&]( const unsigned int partition )
+    {
+      BoolEncoder & encoder = dct_partitions.at( partition );
+
+      for ( unsigned int row = partition; row < macroblocks.height(); row += partition_count ) {
+        for ( unsigned int column = 0; column < macroblocks.width(); column++ ) {
+          macroblocks.at( column, row ).serialize_tokens( encoder, probability_tables );
+        }
+      }
+    };
+
+  if ( partition_count == 1 ) {
+    serialize_partition( 0 );
+  }
+  else {
+    /* the other partitions get helper threads while this thread does the
+       first one, which saves a thread start per frame */
+    vector< future< void > > workers;
+    for ( unsigned int i = 1; i < partition_count; i++ ) {
+      workers.emplace_back( async( launch::async, serialize_partition, i ) );
+    }
 
-  /* serialize every macroblock's tokens */
-  macroblock_headers_.get().forall_ij( [&]( const MacroblockType & macroblock,
-                                            const unsigned int column __attribute((unused)),
-                                            const unsigned int row )
-                                       {
-                                         macroblock.serialize_tokens( dct_partitions.at( row % dct_partition_count() ),
-                                                                      probability_tables ); } );
+    serialize_partition( 0 );
+
+    for ( auto & worker : workers ) {
+      worker.get();
+    }
+  }
 
   /* finish encoding and return the resulting octet sequences */
-  vector< vector< uint8_t > > ret;
+  vector< ArenaBuffer > ret;
   for ( auto & x : dct_partitions ) {
     ret.emplace_back( x.finish() );
   }
@@ -738,14 +766,14 @@ void Block< initial_block_type,
   }
 }
 
-static vector< uint8_t > make_frame( const bool key_frame,
-                                     const bool show_frame,
-                                     const bool experimental,
-                                     const bool reference_update,
-                                     const uint16_t width,
-                                     const uint16_t height,
-                                     const vector< uint8_t > & first_partition,
-                                     const vector< vector< uint8_t > > & dct_partitions )
+static SerializedFrame make_frame( const bool key_frame,
+                                   const bool show_frame,
+                                   const bool experimental,
+                                   const bool reference_update,
+                                   const uint16_t width,
+                                   const uint16_t height,
+                                   ArenaBuffer && first_partition,
+                                   vector< ArenaBuffer > && dct_partitions )
 {
   if ( width > 16383 or height > 16383 ) {
     throw Invalid( "VP8 frame dimensions too large." );
@@ -755,7 +783,11 @@ static vector< uint8_t > make_frame( const bool key_frame,
     throw Invalid( "at least one DCT partition is required." );
   }
 
-  vector< uint8_t > ret;
+  BufferArena & arena = first_partition.arena();
+
+  SerializedFrame frame;
+  ArenaBuffer header { arena, 16 };
+  vector< uint8_t > & ret = header.get();
 
   const uint32_t first_partition_length = first_partition.size();
 
@@ -780,26 +812,32 @@ static vector< uint8_t > make_frame( const bool key_frame,
     ret.emplace_back( (height & 0x3f00) >> 8 );
   }
 
+  frame.append( move( header ) );
+
   /* first partition */
-  ret.insert( ret.end(), first_partition.begin(), first_partition.end() );
+  frame.append( move( first_partition ) );
 
   /* DCT partition lengths */
+  ArenaBuffer partition_lengths { arena, 3 * dct_partitions.size() };
+
   for ( unsigned int i = 0; i < dct_partitions.size() - 1; i++ ) {
     const uint32_t length = dct_partitions.at( i ).size();
-    ret.emplace_back( length & 0xff );
-    ret.emplace_back( (length & 0xff00) >> 8 );
-    ret.emplace_back( (length & 0xff0000) >> 16 );
+    partition_lengths.get().emplace_back( length & 0xff );
+    partition_lengths.get().emplace_back( (length & 0xff00) >> 8 );
+    partition_lengths.get().emplace_back( (length & 0xff0000) >> 16 );
   }
 
-  for ( const auto & dct_partition : dct_partitions ) {
-    ret.insert( ret.end(), dct_partition.begin(), dct_partition.end() );
+  frame.append( move( partition_lengths ) );
+
+  for ( auto & dct_partition : dct_partitions ) {
+    frame.append( move( dct_partition ) );
   }
 
-  return ret;
+  return frame;
 }
 
 template <>
-vector<uint8_t> KeyFrame::serialize( const ProbabilityTables & probability_tables ) const
+SerializedFrame KeyFrame::serialize( const ProbabilityTables & probability_tables ) const
 {
   ProbabilityTables frame_probability_tables( probability_tables );
   frame_probability_tables.coeff_prob_update( header() );
@@ -814,7 +852,7 @@ vector<uint8_t> KeyFrame::serialize( const ProbabilityTables & probability_table
 }
 
 template <>
-vector<uint8_t> InterFrame::serialize( const ProbabilityTables & probability_tables ) const
+SerializedFrame InterFrame::serialize( const ProbabilityTables & probability_tables ) const
 {
   ProbabilityTables frame_probability_tables( probability_tables );
   frame_probability_tables.update( header() );
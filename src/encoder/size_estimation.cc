@@ -26,14 +26,114 @@
    (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
    OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE. */
 
+#include <type_traits>
 #include <utility>
 
 #include "encoder.hh"
+#include "scorer.hh"
 
 using namespace std;
 
+template<class MacroblockType>
+uint32_t Encoder::token_rate( const MacroblockType & frame_mb ) const
+{
+  uint32_t rate = 0;
+
+  if ( frame_mb.Y2().coded() ) {
+    rate += costs_.block_cost( frame_mb.Y2() );
+  }
+
+  frame_mb.Y().forall( [&]( const YBlock & block ) { rate += costs_.block_cost( block ); } );
+  frame_mb.U().forall( [&]( const UVBlock & block ) { rate += costs_.block_cost( block ); } );
+  frame_mb.V().forall( [&]( const UVBlock & block ) { rate += costs_.block_cost( block ); } );
+
+  return rate;
+}
+
+uint32_t Encoder::mode_rate( const KeyFrameMacroblock & frame_mb ) const
+{
+  uint32_t rate = costs_.mbmode_costs.at( 0 ).at( frame_mb.y_prediction_mode() );
+
+  if ( frame_mb.y_prediction_mode() == B_PRED ) {
+    frame_mb.Y().forall( [&]( const YBlock & block )
+      {
+        const auto above_mode = block.context().above.initialized()
+          ? block.context().above.get()->prediction_mode() : B_DC_PRED;
+        const auto left_mode = block.context().left.initialized()
+          ? block.context().left.get()->prediction_mode() : B_DC_PRED;
+
+        rate += costs_.bmode_costs.at( above_mode ).at( left_mode ).at( block.prediction_mode() );
+      } );
+  }
+
+  return rate + costs_.intra_uv_mode_costs.at( 0 ).at( frame_mb.uv_prediction_mode() );
+}
+
+uint32_t Encoder::mode_rate( InterFrameMacroblock & frame_mb ) const
+{
+  /* mbmode_costs[ 1 ] holds the costs of the inter modes in this
+     macroblock's context (see luma_mb_inter_predict) */
+  uint32_t rate = costs_.mbmode_costs.at( 1 ).at( frame_mb.y_prediction_mode() );
+
+  if ( frame_mb.inter_coded() ) {
+    if ( frame_mb.y_prediction_mode() == NEWMV ) {
+      const MotionVector best_ref = Scorer::clamp( frame_mb.motion_vector_census().best(),
+                                                   frame_mb.context() );
+      rate += costs_.motion_vector_cost( frame_mb.base_motion_vector() - best_ref, 128 );
+    }
+
+    return rate;
+  }
+
+  if ( frame_mb.y_prediction_mode() == B_PRED ) {
+    /* subblock modes in inter frames are coded without context */
+    frame_mb.Y().forall( [&]( const YBlock & block )
+      {
+        rate += costs_.bmode_costs.at( B_DC_PRED ).at( B_DC_PRED ).at( block.prediction_mode() );
+      } );
+  }
+
+  return rate + costs_.intra_uv_mode_costs.at( 1 ).at( frame_mb.uv_prediction_mode() );
+}
+
+template<class MacroblockType>
+void Encoder::accumulate_rate( MacroblockType & frame_mb, RateEstimate & estimate ) const
+{
+  estimate.modes += mode_rate( frame_mb );
+
+  /* macroblocks without coefficients are coded with mb_skip_coeff set and
+     carry no tokens (see optimize_prob_skip) */
+  if ( frame_mb.has_nonzero() ) {
+    estimate.tokens += token_rate( frame_mb );
+    estimate.coded_macroblocks++;
+  }
+  else {
+    estimate.skipped_macroblocks++;
+  }
+}
+
+template<class FrameType>
+size_t Encoder::estimated_frame_bytes( const FrameType & frame, const RateEstimate & estimate )
+{
+  /* frame tag, key frame start code and dimensions, the first partition's
+     header (mostly the "no update" flags for each coefficient probability)
+     and the partition sizes */
+  const size_t header_bytes = 3 + ( is_same<FrameType, KeyFrame>::value ? 7 : 0 ) + 16
+                              + 3 * ( ( 1 << frame.header().log2_number_of_dct_partitions ) - 1 );
+
+  const Probability prob_skip_false = frame.header().prob_skip_false.get_or( 128 );
+
+  const uint64_t cost = estimate.modes + estimate.tokens
+                        + estimate.coded_macroblocks * uint64_t( Costs::bool_cost( prob_skip_false, false ) )
+                        + estimate.skipped_macroblocks * uint64_t( Costs::bool_cost( prob_skip_false, true ) );
+
+  /* costs are in 1/256 bits */
+  return header_bytes + ( cost + 2047 ) / 2048;
+}
+
 template<>
-size_t Encoder::estimate_size<KeyFrame>( const VP8Raster & raster, const size_t y_ac_qi )
+size_t Encoder::estimate_size<KeyFrame>( const VP8Raster & raster, const size_t y_ac_qi,
+                                         const SizeEstimationMethod method )
 {
   auto macroblock_mapper =
     [&]( const unsigned int column, const unsigned int row ) -> pair<unsigned int, unsigned int>
@@ -59,6 +159,11 @@ size_t Encoder::estimate_size<KeyFrame>( const VP8Raster & raster, const size_t
 
   update_rd_multipliers( quantizer );
 
+  /* the tokens will be coded with the default probabilities */
+  const auto token_costs_copy = costs_.token_costs;
+  costs_.fill_token_costs( decoder_state_.probability_tables );
+  RateEstimate rate_estimate;
+
   // TokenBranchCounts token_branch_counts;
 
   frame.mutable_macroblocks().forall_ij(
@@ -81,22 +186,34 @@ size_t Encoder::estimate_size<KeyFrame>( const VP8Raster & raster, const size_t
       frame_mb.calculate_has_nonzero();
       frame_mb.reconstruct_intra( quantizer, reconstructed_mb );
 
+      accumulate_rate( frame_mb, rate_estimate );
+
       //frame_mb.accumulate_token_branches( token_branch_counts );
     }
   );
 
-  frame.relink_y2_blocks();
   optimize_prob_skip( frame );
   // optimize_probability_tables( frame, token_branch_counts );
 
-  size_t size = frame.serialize( decoder_state_.probability_tables ).size();
+  size_t size;
+
+  if ( method == SERIALIZED_SIZE ) {
+    frame.relink_y2_blocks();
+    size = frame.serialize( decoder_state_.probability_tables ).size();
+  }
+  else {
+    size = estimated_frame_bytes( frame, rate_estimate );
+  }
+
   decoder_state_ = decoder_state_copy;
+  costs_.token_costs = token_costs_copy;
 
   return size * WIDTH_SAMPLE_DIMENSION_FACTOR * HEIGHT_SAMPLE_DIMENSION_FACTOR;
 }
 
 template<>
-size_t Encoder::estimate_size<InterFrame>( const VP8Raster & raster, const size_t y_ac_qi )
+size_t Encoder::estimate_size<InterFrame>( const VP8Raster & raster, const size_t y_ac_qi,
+                                           const SizeEstimationMethod method )
 {
   auto macroblock_mapper =
     [&]( const unsigned int column, const unsigned int row )
@@ -124,6 +241,12 @@ size_t Encoder::estimate_size<InterFrame>( const VP8Raster & raster, const size_
 
   update_rd_multipliers( quantizer );
 
+  const auto token_costs_copy = costs_.token_costs;
+  costs_.fill_token_costs( decoder_state_.probability_tables );
+  costs_.fill_mv_component_costs( decoder_state_.probability_tables.motion_vector_probs );
+  costs_.fill_mv_sad_costs();
+  RateEstimate rate_estimate;
+
   frame.mutable_macroblocks().forall_ij(
   [&] ( InterFrameMacroblock & frame_mb, unsigned int mb_column, unsigned int mb_row )
     {
@@ -157,25 +280,37 @@ size_t Encoder::estimate_size<InterFrame>( const VP8Raster & raster, const size_
       else {
         frame_mb.reconstruct_intra( quantizer, reconstructed_mb );
       }
+
+      accumulate_rate( frame_mb, rate_estimate );
     }
   );
 
-  frame.relink_y2_blocks();
   optimize_prob_skip( frame );
-  optimize_interframe_probs( frame );
 
-  size_t size = frame.serialize( decoder_state_.probability_tables ).size();
+  size_t size;
+
+  if ( method == SERIALIZED_SIZE ) {
+    frame.relink_y2_blocks();
+    optimize_interframe_probs( frame );
+    size = frame.serialize( decoder_state_.probability_tables ).size();
+  }
+  else {
+    size = estimated_frame_bytes( frame, rate_estimate );
+  }
+
   decoder_state_ = decoder_state_copy;
+  costs_.token_costs = token_costs_copy;
 
   return size * WIDTH_SAMPLE_DIMENSION_FACTOR * HEIGHT_SAMPLE_DIMENSION_FACTOR;
 }
 
-size_t Encoder::estimate_frame_size( const VP8Raster & raster, const size_t y_ac_qi )
+size_t Encoder::estimate_frame_size( const VP8Raster & raster, const size_t y_ac_qi,
+                                     const SizeEstimationMethod method )
 {
   if ( not has_state_ ) {
-    return estimate_size<KeyFrame>( raster, y_ac_qi );
+    return estimate_size<KeyFrame>( raster, y_ac_qi, method );
   }
   else {
-    return estimate_size<InterFrame>( raster, y_ac_qi );
+    return estimate_size<InterFrame>( raster, y_ac_qi, method );
   }
 }
@@ -27,64 +27,90 @@
    OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE. */
 
 #include "encoder.hh"
-#include "sad_sse.hh"
+#include "variance_kernels.hh"
+
+using namespace std;
 
 #ifndef HAVE_SSE2
 
-template<unsigned int size>
-uint32_t Encoder::sad( const VP8Raster::Block<size> & block,
-                       const TwoDSubRange<uint8_t, size, size> & prediction )
+/* sum of absolute 4x4 Hadamard-transformed differences, halved to keep it
+   on the same scale as SAD */
+static uint32_t satd4x4( const uint8_t * src, const int src_stride,
+                         const uint8_t * ref, const int ref_stride )
 {
+  int32_t diff[ 16 ];
+
+  for ( size_t row = 0; row < 4; row++ ) {
+    const int32_t d0 = src[ row * src_stride + 0 ] - ref[ row * ref_stride + 0 ];
+    const int32_t d1 = src[ row * src_stride + 1 ] - ref[ row * ref_stride + 1 ];
+    const int32_t d2 = src[ row * src_stride + 2 ] - ref[ row * ref_stride + 2 ];
+    const int32_t d3 = src[ row * src_stride + 3 ] - ref[ row * ref_stride + 3 ];
+
+    const int32_t a0 = d0 + d2, a1 = d1 + d3, a2 = d0 - d2, a3 = d1 - d3;
+
+    diff[ row * 4 + 0 ] = a0 + a1;
+    diff[ row * 4 + 1 ] = a0 - a1;
+    diff[ row * 4 + 2 ] = a2 + a3;
+    diff[ row * 4 + 3 ] = a2 - a3;
+  }
+
   uint32_t res = 0;
 
-  for ( size_t i = 0; i < size; i++ ) {
-    for ( size_t j = 0; j < size; j++ ) {
-      res += abs( block.at( i, j ) - prediction.at( i, j ) );
-    }
+  for ( size_t column = 0; column < 4; column++ ) {
+    const int32_t a0 = diff[ column ] + diff[ 8 + column ];
+    const int32_t a1 = diff[ 4 + column ] + diff[ 12 + column ];
+    const int32_t a2 = diff[ column ] - diff[ 8 + column ];
+    const int32_t a3 = diff[ 4 + column ] - diff[ 12 + column ];
+
+    res += abs( a0 + a1 ) + abs( a0 - a1 ) + abs( a2 + a3 ) + abs( a2 - a3 );
   }
 
-  return res;
+  return res >> 1;
 }
 
 template<unsigned int size>
-uint32_t Encoder::sse( const VP8Raster::Block<size> & block,
+uint32_t Encoder::sad( const VP8Raster::Block<size> & block,
                        const TwoDSubRange<uint8_t, size, size> & prediction )
 {
-  uint32_t res = 0;
+  return sad_c<size>( &block.contents().at( 0, 0 ), block.contents().stride(),
+                      &prediction.at( 0, 0 ), prediction.stride() );
+}
 
-  for ( size_t i = 0; i < size; i++ ) {
-    for ( size_t j = 0; j < size; j++ ) {
-      int16_t diff = ( block.at( i, j ) - prediction.at( i, j ) );
-      res += diff * diff;
-    }
-  }
+template<unsigned int size>
+uint32_t Encoder::sse( const VP8Raster::Block<size> & block,
+                       const TwoDSubRange<uint8_t, size, size> & prediction )
+{
+  uint32_t sse;
+  get_var_c<size>( &block.contents().at( 0, 0 ), block.contents().stride(),
+                   &prediction.at( 0, 0 ), prediction.stride(),
+                   &sse, nullptr );
 
-  return res;
+  return sse;
 }
 
 template<unsigned int size>
 uint32_t Encoder::variance( const VP8Raster::Block<size> & block,
                             const TwoDSubRange<uint8_t, size, size> & prediction )
 {
-  uint32_t res = 0;
-  int32_t sum = 0;
+  uint32_t sse;
+  int32_t sum;
+  get_var_c<size>( &block.contents().at( 0, 0 ), block.contents().stride(),
+                   &prediction.at( 0, 0 ), prediction.stride(),
+                   &sse, &sum );
 
-  for ( size_t i = 0; i < size; i++ ) {
-    for ( size_t j = 0; j < size; j++ ) {
-      int16_t diff = ( block.at( i, j ) - prediction.at( i, j ) );
-
-      sum += diff;
-      res += diff * diff;
-    }
-  }
-
-  return res - ( ( int64_t)sum * sum ) / ( size * size );
+  return variance_from<size>( sse, sum );
 }
 
 #else // SSE2 is supported
 
 #include "variance_sse2.cc"
 
+static uint32_t satd4x4( const uint8_t * src, const int src_stride,
+                         const uint8_t * ref, const int ref_stride )
+{
+  return satd4x4_sse2( src, src_stride, ref, ref_stride );
+}
+
 /* SAD() */
 template<>
 uint32_t Encoder::sad( const VP8Raster::Block<16> & block,
@@ -124,6 +150,16 @@ uint32_t Encoder::sse( const VP8Raster::Block<16> & block,
                        const TwoDSubRange<uint8_t, 16, 16> & prediction )
 {
   unsigned int sse;
+
+#ifdef HAVE_AVX2
+  if ( cpu_has_avx2() ) {
+    get16x16var_avx2( &block.contents().at( 0, 0 ), block.contents().stride(),
+                      &prediction.at( 0, 0 ), prediction.stride(),
+                      &sse, nullptr );
+    return sse;
+  }
+#endif
+
   vpx_get16x16var_sse2( &block.contents().at( 0, 0 ), block.contents().stride(),
                         &prediction.at( 0, 0 ), prediction.stride(),
                         &sse, nullptr );
@@ -158,9 +194,106 @@ uint32_t Encoder::variance( const VP8Raster::Block<16> & block,
                             const TwoDSubRange<uint8_t, 16, 16> & prediction )
 {
   unsigned int sse;
+
+#ifdef HAVE_AVX2
+  if ( cpu_has_avx2() ) {
+    int32_t sum;
+    get16x16var_avx2( &block.contents().at( 0, 0 ), block.contents().stride(),
+                      &prediction.at( 0, 0 ), prediction.stride(),
+                      &sse, &sum );
+    return variance_from<16>( sse, sum );
+  }
+#endif
+
   return vpx_variance16x16_sse2( &block.contents().at( 0, 0 ), block.contents().stride(),
                                  &prediction.at( 0, 0 ), prediction.stride(),
                                  &sse );
 }
 
 #endif
+
+/* SAD_X2(), VARIANCE_X2() and SSE_X2() */
+
+pair<uint32_t, uint32_t> Encoder::sad_x2( const VP8Raster::Block<16> & block,
+                                          const TwoDSubRange<uint8_t, 16, 16> & prediction_0,
+                                          const TwoDSubRange<uint8_t, 16, 16> & prediction_1 )
+{
+#ifdef HAVE_AVX2
+  if ( cpu_has_avx2() ) {
+    uint32_t res[ 2 ];
+    sad16x16_x2_avx2( &block.contents().at( 0, 0 ), block.contents().stride(),
+                      &prediction_0.at( 0, 0 ), prediction_0.stride(),
+                      &prediction_1.at( 0, 0 ), prediction_1.stride(), res );
+    return { res[ 0 ], res[ 1 ] };
+  }
+#endif
+
+  return { sad( block, prediction_0 ), sad( block, prediction_1 ) };
+}
+
+pair<uint32_t, uint32_t> Encoder::variance_x2( const VP8Raster::Block<16> & block,
+                                               const TwoDSubRange<uint8_t, 16, 16> & prediction_0,
+                                               const TwoDSubRange<uint8_t, 16, 16> & prediction_1 )
+{
+#ifdef HAVE_AVX2
+  if ( cpu_has_avx2() ) {
+    uint32_t sse[ 2 ];
+    int32_t sum[ 2 ];
+    get16x16var_x2_avx2( &block.contents().at( 0, 0 ), block.contents().stride(),
+                         &prediction_0.at( 0, 0 ), prediction_0.stride(),
+                         &prediction_1.at( 0, 0 ), prediction_1.stride(), sse, sum );
+    return { variance_from<16>( sse[ 0 ], sum[ 0 ] ), variance_from<16>( sse[ 1 ], sum[ 1 ] ) };
+  }
+#endif
+
+  return { variance( block, prediction_0 ), variance( block, prediction_1 ) };
+}
+
+pair<uint32_t, uint32_t> Encoder::sse_x2( const VP8Raster::Block<8> & block_0,
+                                          const TwoDSubRange<uint8_t, 8, 8> & prediction_0,
+                                          const VP8Raster::Block<8> & block_1,
+                                          const TwoDSubRange<uint8_t, 8, 8> & prediction_1 )
+{
+#ifdef HAVE_AVX2
+  if ( cpu_has_avx2() ) {
+    uint32_t res[ 2 ];
+    get8x8sse_x2_avx2( &block_0.contents().at( 0, 0 ), block_0.contents().stride(),
+                       &prediction_0.at( 0, 0 ), prediction_0.stride(),
+                       &block_1.contents().at( 0, 0 ), block_1.contents().stride(),
+                       &prediction_1.at( 0, 0 ), prediction_1.stride(), res );
+    return { res[ 0 ], res[ 1 ] };
+  }
+#endif
+
+  return { sse( block_0, prediction_0 ), sse( block_1, prediction_1 ) };
+}
+
+/* SATD() */
+template<>
+uint32_t Encoder::satd( const VP8Raster::Block<4> & block,
+                        const TwoDSubRange<uint8_t, 4, 4> & prediction )
+{
+  return satd4x4( &block.contents().at( 0, 0 ), block.contents().stride(),
+                  &prediction.at( 0, 0 ), prediction.stride() );
+}
+
+template<>
+uint32_t Encoder::satd( const VP8Raster::Block<16> & block,
+                        const TwoDSubRange<uint8_t, 16, 16> & prediction )
+{
+  const uint8_t * src = &block.contents().at( 0, 0 );
+  const uint8_t * ref = &prediction.at( 0, 0 );
+  const int src_stride = block.contents().stride();
+  const int ref_stride = prediction.stride();
+
+  uint32_t res = 0;
+
+  for ( size_t row = 0; row < 16; row += 4 ) {
+    for ( size_t column = 0; column < 16; column += 4 ) {
+      res += satd4x4( src + row * src_stride + column, src_stride,
+                      ref + row * ref_stride + column, ref_stride );
+    }
+  }
+
+  return res;
+}
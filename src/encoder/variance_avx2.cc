@@ -0,0 +1,197 @@
+/* -*-mode:c++; tab-width: 2; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+
+/* Copyright 2013-2018 the Alfalfa authors
+                       and the Massachusetts Institute of Technology
+
+   Redistribution and use in source and binary forms, with or without
+   modification, are permitted provided that the following conditions are
+   met:
+
+      1. Redistributions of source code must retain the above copyright
+         notice, this list of conditions and the following disclaimer.
+
+      2. Redistributions in binary form must reproduce the above copyright
+         notice, this list of conditions and the following disclaimer in the
+         documentation and/or other materials provided with the distribution.
+
+   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+   "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+   LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+   A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+   HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+   SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+   LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+   DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+   THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+   (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+   OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE. */
+
+/* AVX2 block-distortion kernels. The file is built without -mavx2; each
+   kernel is compiled for AVX2 through the target attribute and only called
+   after cpu_has_avx2() says the CPU can run it. */
+
+#include "variance_kernels.hh"
+
+#ifdef HAVE_AVX2
+
+#include <immintrin.h>
+
+#define TARGET_AVX2 __attribute__(( target( "avx2" ) ))
+
+bool cpu_has_avx2()
+{
+  static const bool supported = __builtin_cpu_supports( "avx2" );
+  return supported;
+}
+
+TARGET_AVX2 static inline __m256i load_rows( const uint8_t * low, const uint8_t * high )
+{
+  return _mm256_inserti128_si256(
+    _mm256_castsi128_si256( _mm_loadu_si128( ( const __m128i * )low ) ),
+    _mm_loadu_si128( ( const __m128i * )high ), 1 );
+}
+
+TARGET_AVX2 static inline uint32_t hsum_epi32( __m128i v )
+{
+  v = _mm_add_epi32( v, _mm_srli_si128( v, 8 ) );
+  v = _mm_add_epi32( v, _mm_srli_si128( v, 4 ) );
+  return _mm_cvtsi128_si32( v );
+}
+
+/* the sums of the low and the high lane, as 32-bit integers */
+TARGET_AVX2 static inline void hsum_lanes_epi32( const __m256i v, uint32_t out[ 2 ] )
+{
+  out[ 0 ] = hsum_epi32( _mm256_castsi256_si128( v ) );
+  out[ 1 ] = hsum_epi32( _mm256_extracti128_si256( v, 1 ) );
+}
+
+/* 16-bit sums of differences, widened to 32 bits before adding up */
+TARGET_AVX2 static inline __m256i widen_sum_epi16( const __m256i v )
+{
+  return _mm256_madd_epi16( v, _mm256_set1_epi16( 1 ) );
+}
+
+TARGET_AVX2
+void sad16x16_x2_avx2( const uint8_t * src, const int src_stride,
+                       const uint8_t * ref_0, const int ref_0_stride,
+                       const uint8_t * ref_1, const int ref_1_stride,
+                       uint32_t sad[ 2 ] )
+{
+  __m256i vsad = _mm256_setzero_si256();
+
+  for ( unsigned int i = 0; i < 16; i++ ) {
+    const __m256i s = _mm256_broadcastsi128_si256( _mm_loadu_si128( ( const __m128i * )src ) );
+    const __m256i r = load_rows( ref_0, ref_1 );
+
+    vsad = _mm256_add_epi64( vsad, _mm256_sad_epu8( s, r ) );
+
+    src += src_stride;
+    ref_0 += ref_0_stride;
+    ref_1 += ref_1_stride;
+  }
+
+  hsum_lanes_epi32( vsad, sad );
+}
+
+TARGET_AVX2
+void get16x16var_avx2( const uint8_t * src, const int src_stride,
+                       const uint8_t * ref, const int ref_stride,
+                       uint32_t * sse, int32_t * sum )
+{
+  __m256i vsum = _mm256_setzero_si256();
+  __m256i vsse = _mm256_setzero_si256();
+
+  for ( unsigned int i = 0; i < 16; i++ ) {
+    const __m256i s = _mm256_cvtepu8_epi16( _mm_loadu_si128( ( const __m128i * )src ) );
+    const __m256i r = _mm256_cvtepu8_epi16( _mm_loadu_si128( ( const __m128i * )ref ) );
+    const __m256i diff = _mm256_sub_epi16( s, r );
+
+    /* at most 16 * 255 in each 16-bit lane */
+    vsum = _mm256_add_epi16( vsum, diff );
+    vsse = _mm256_add_epi32( vsse, _mm256_madd_epi16( diff, diff ) );
+
+    src += src_stride;
+    ref += ref_stride;
+  }
+
+  uint32_t lanes[ 2 ];
+
+  hsum_lanes_epi32( vsse, lanes );
+  *sse = lanes[ 0 ] + lanes[ 1 ];
+
+  if ( sum ) {
+    hsum_lanes_epi32( widen_sum_epi16( vsum ), lanes );
+    *sum = int32_t( lanes[ 0 ] + lanes[ 1 ] );
+  }
+}
+
+TARGET_AVX2
+void get16x16var_x2_avx2( const uint8_t * src, const int src_stride,
+                          const uint8_t * ref_0, const int ref_0_stride,
+                          const uint8_t * ref_1, const int ref_1_stride,
+                          uint32_t sse[ 2 ], int32_t sum[ 2 ] )
+{
+  __m256i vsum_0 = _mm256_setzero_si256(), vsum_1 = _mm256_setzero_si256();
+  __m256i vsse_0 = _mm256_setzero_si256(), vsse_1 = _mm256_setzero_si256();
+
+  for ( unsigned int i = 0; i < 16; i++ ) {
+    const __m256i s = _mm256_cvtepu8_epi16( _mm_loadu_si128( ( const __m128i * )src ) );
+    const __m256i r_0 = _mm256_cvtepu8_epi16( _mm_loadu_si128( ( const __m128i * )ref_0 ) );
+    const __m256i r_1 = _mm256_cvtepu8_epi16( _mm_loadu_si128( ( const __m128i * )ref_1 ) );
+    const __m256i diff_0 = _mm256_sub_epi16( s, r_0 );
+    const __m256i diff_1 = _mm256_sub_epi16( s, r_1 );
+
+    vsum_0 = _mm256_add_epi16( vsum_0, diff_0 );
+    vsum_1 = _mm256_add_epi16( vsum_1, diff_1 );
+    vsse_0 = _mm256_add_epi32( vsse_0, _mm256_madd_epi16( diff_0, diff_0 ) );
+    vsse_1 = _mm256_add_epi32( vsse_1, _mm256_madd_epi16( diff_1, diff_1 ) );
+
+    src += src_stride;
+    ref_0 += ref_0_stride;
+    ref_1 += ref_1_stride;
+  }
+
+  /* fold each accumulator into one lane: low lane for ref_0, high for ref_1 */
+  const __m256i vsse = _mm256_add_epi32( _mm256_permute2x128_si256( vsse_0, vsse_1, 0x20 ),
+                                         _mm256_permute2x128_si256( vsse_0, vsse_1, 0x31 ) );
+  const __m256i vsum = _mm256_add_epi32( widen_sum_epi16( _mm256_permute2x128_si256( vsum_0, vsum_1, 0x20 ) ),
+                                         widen_sum_epi16( _mm256_permute2x128_si256( vsum_0, vsum_1, 0x31 ) ) );
+
+  hsum_lanes_epi32( vsse, sse );
+
+  uint32_t lanes[ 2 ];
+  hsum_lanes_epi32( vsum, lanes );
+  sum[ 0 ] = int32_t( lanes[ 0 ] );
+  sum[ 1 ] = int32_t( lanes[ 1 ] );
+}
+
+TARGET_AVX2
+void get8x8sse_x2_avx2( const uint8_t * src_0, const int src_0_stride,
+                        const uint8_t * ref_0, const int ref_0_stride,
+                        const uint8_t * src_1, const int src_1_stride,
+                        const uint8_t * ref_1, const int ref_1_stride,
+                        uint32_t sse[ 2 ] )
+{
+  __m256i vsse = _mm256_setzero_si256();
+
+  for ( unsigned int i = 0; i < 8; i++ ) {
+    const __m256i s = _mm256_cvtepu8_epi16(
+      _mm_unpacklo_epi64( _mm_loadl_epi64( ( const __m128i * )src_0 ),
+                          _mm_loadl_epi64( ( const __m128i * )src_1 ) ) );
+    const __m256i r = _mm256_cvtepu8_epi16(
+      _mm_unpacklo_epi64( _mm_loadl_epi64( ( const __m128i * )ref_0 ),
+                          _mm_loadl_epi64( ( const __m128i * )ref_1 ) ) );
+    const __m256i diff = _mm256_sub_epi16( s, r );
+
+    vsse = _mm256_add_epi32( vsse, _mm256_madd_epi16( diff, diff ) );
+
+    src_0 += src_0_stride;
+    ref_0 += ref_0_stride;
+    src_1 += src_1_stride;
+    ref_1 += ref_1_stride;
+  }
+
+  hsum_lanes_epi32( vsse, sse );
+}
+
+#endif /* HAVE_AVX2 */
@@ -0,0 +1,136 @@
+/* -*-mode:c++; tab-width: 2; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+
+/* Copyright 2013-2018 the Alfalfa authors
+                       and the Massachusetts Institute of Technology
+
+   Redistribution and use in source and binary forms, with or without
+   modification, are permitted provided that the following conditions are
+   met:
+
+      1. Redistributions of source code must retain the above copyright
+         notice, this list of conditions and the following disclaimer.
+
+      2. Redistributions in binary form must reproduce the above copyright
+         notice, this list of conditions and the following disclaimer in the
+         documentation and/or other materials provided with the distribution.
+
+   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+   "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+   LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+   A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+   HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+   SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+   LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+   DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+   THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+   (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+   OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE. */
+
+#ifndef VARIANCE_KERNELS_HH
+#define VARIANCE_KERNELS_HH
+
+/* The block-distortion kernels behind Encoder::sad(), sse() and variance(),
+   one set per instruction set. The C versions are the reference: every other
+   tier has to give bit-identical results (see tests/variance-benchmark). */
+
+#include <cstdint>
+#include <cstdlib>
+
+#include "config.h"
+
+/* C reference */
+
+template<unsigned int size>
+uint32_t sad_c( const uint8_t * src, const int src_stride,
+                const uint8_t * ref, const int ref_stride )
+{
+  uint32_t res = 0;
+
+  for ( size_t i = 0; i < size; i++ ) {
+    for ( size_t j = 0; j < size; j++ ) {
+      res += abs( src[ i * src_stride + j ] - ref[ i * ref_stride + j ] );
+    }
+  }
+
+  return res;
+}
+
+template<unsigned int size>
+void get_var_c( const uint8_t * src, const int src_stride,
+                const uint8_t * ref, const int ref_stride,
+                uint32_t * sse, int32_t * sum )
+{
+  uint32_t res = 0;
+  int32_t total = 0;
+
+  for ( size_t i = 0; i < size; i++ ) {
+    for ( size_t j = 0; j < size; j++ ) {
+      const int16_t diff = src[ i * src_stride + j ] - ref[ i * ref_stride + j ];
+
+      total += diff;
+      res += diff * diff;
+    }
+  }
+
+  *sse = res;
+  if ( sum ) { *sum = total; }
+}
+
+template<unsigned int size>
+uint32_t variance_from( const uint32_t sse, const int32_t sum )
+{
+  return sse - ( ( int64_t )sum * sum ) / ( size * size );
+}
+
+#ifdef HAVE_SSE2
+
+/* SSE2 (sad_sse2.asm and variance_sse2.cc) */
+
+#include "sad_sse.hh"
+
+void vpx_get8x8var_sse2( const uint8_t *src, int src_stride,
+                         const uint8_t *ref, int ref_stride,
+                         unsigned int *sse, int *sum );
+
+void vpx_get16x16var_sse2( const uint8_t *src, int src_stride,
+                           const uint8_t *ref, int ref_stride,
+                           unsigned int *sse, int *sum );
+
+#endif
+
+#ifdef HAVE_AVX2
+
+/* AVX2 (variance_avx2.cc); only to be called if cpu_has_avx2(). A single
+   16x16 SAD gains nothing over psadbw on 128-bit rows, so there is none. */
+
+bool cpu_has_avx2();
+
+void get16x16var_avx2( const uint8_t * src, const int src_stride,
+                       const uint8_t * ref, const int ref_stride,
+                       uint32_t * sse, int32_t * sum );
+
+/* one 16x16 block against two predictions: each register holds a row of the
+   source in both lanes and the matching rows of the two predictions */
+
+void sad16x16_x2_avx2( const uint8_t * src, const int src_stride,
+                       const uint8_t * ref_0, const int ref_0_stride,
+                       const uint8_t * ref_1, const int ref_1_stride,
+                       uint32_t sad[ 2 ] );
+
+void get16x16var_x2_avx2( const uint8_t * src, const int src_stride,
+                          const uint8_t * ref_0, const int ref_0_stride,
+                          const uint8_t * ref_1, const int ref_1_stride,
+                          uint32_t sse[ 2 ], int32_t sum[ 2 ] );
+
+/* two 8x8 blocks (the U and V planes of a macroblock) against their own
+   predictions, a row of each per register */
+
+void get8x8sse_x2_avx2( const uint8_t * src_0, const int src_0_stride,
+                        const uint8_t * ref_0, const int ref_0_stride,
+                        const uint8_t * src_1, const int src_1_stride,
+                        const uint8_t * ref_1, const int ref_1_stride,
+                        uint32_t sse[ 2 ] );
+
+#endif
+
+#endif /* VARIANCE_KERNELS_HH */
@@ -65,6 +65,57 @@ static void get4x4var_sse2(const uint8_t *src, int src_stride,
   *sse = _mm_cvtsi128_si32(vsum);
 }
 
+/* 4x4 Hadamard transform of the difference, returns the halved sum of the
+   absolute transformed values */
+unsigned int satd4x4_sse2(const uint8_t *src, int src_stride,
+                          const uint8_t *ref, int ref_stride) {
+  const __m128i zero = _mm_setzero_si128();
+  __m128i rows[4];
+  int i;
+
+  for (i = 0; i < 4; i++) {
+    const __m128i s = _mm_unpacklo_epi8(
+        _mm_cvtsi32_si128(*(const uint32_t *)(src + i * src_stride)), zero);
+    const __m128i r = _mm_unpacklo_epi8(
+        _mm_cvtsi32_si128(*(const uint32_t *)(ref + i * ref_stride)), zero);
+    rows[i] = _mm_sub_epi16(s, r);
+  }
+
+  // rows 0 and 1 | rows 2 and 3
+  __m128i r01 = _mm_unpacklo_epi64(rows[0], rows[1]);
+  __m128i r23 = _mm_unpacklo_epi64(rows[2], rows[3]);
+
+  for (i = 0; i < 2; i++) {
+    // butterflies between the four 4-element vectors held in r01 and r23
+    const __m128i s = _mm_add_epi16(r01, r23);
+    const __m128i d = _mm_sub_epi16(r01, r23);
+    const __m128i a = _mm_unpacklo_epi64(s, d);
+    const __m128i b = _mm_unpackhi_epi64(s, d);
+    const __m128i u0 = _mm_add_epi16(a, b);
+    const __m128i u1 = _mm_sub_epi16(a, b);
+
+    if (i == 0) {
+      // transpose, so the second pass works on the other dimension
+      const __m128i x0 = _mm_unpacklo_epi16(u0, u1);
+      const __m128i x1 = _mm_unpackhi_epi16(u0, u1);
+      r01 = _mm_unpacklo_epi16(x0, x1);
+      r23 = _mm_unpackhi_epi16(x0, x1);
+    } else {
+      r01 = u0;
+      r23 = u1;
+    }
+  }
+
+  const __m128i abs0 = _mm_max_epi16(r01, _mm_sub_epi16(zero, r01));
+  const __m128i abs1 = _mm_max_epi16(r23, _mm_sub_epi16(zero, r23));
+  const __m128i ones = _mm_set1_epi16(1);
+  __m128i vsum = _mm_add_epi32(_mm_madd_epi16(abs0, ones),
+                               _mm_madd_epi16(abs1, ones));
+  vsum = _mm_add_epi32(vsum, _mm_srli_si128(vsum, 8));
+  vsum = _mm_add_epi32(vsum, _mm_srli_si128(vsum, 4));
+  return _mm_cvtsi128_si32(vsum) >> 1;
+}
+
 void vpx_get8x8var_sse2(const uint8_t *src, int src_stride, const uint8_t *ref,
                         int ref_stride, unsigned int *sse, int *sum) {
   const __m128i zero = _mm_setzero_si128();
@@ -56,17 +56,17 @@ int main( int argc, char *argv[] )
     string n1(argv[1]);
     string n2(argv[2]);
 
-    // raw bit difference
+    // raw bit difference (of the states, if stored as deltas)
     {
-      File file1(n1);
-      File file2(n2);
+      EncoderStateDeserializer file1(n1);
+      EncoderStateDeserializer file2(n2);
 
       // different file sizes: all bits in larger file are "different"
       unsigned diffs = 8 * abs((int) (file1.size() - file2.size()));
       unsigned lim = min<unsigned>(file1.size(), file2.size());
       for (unsigned i = 0; i < lim; i++) {
-        uint8_t u1 = file1(i, 1).octet();
-        uint8_t u2 = file2(i, 1).octet();
+        uint8_t u1 = file1.data()(i, 1).octet();
+        uint8_t u2 = file2.data()(i, 1).octet();
 
         diffs += set_bits[u1 ^ u2];
       }
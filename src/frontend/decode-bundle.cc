@@ -41,7 +41,8 @@ using namespace std;
 /*
    xc-decode-bundle: decodes a sequence of IVF files whose
    filenames are given on standard input,
-   to a YUV4MPEG video on standard output
+   to a YUV4MPEG video on standard output. Each file is decoded
+   as it is read, so it can be a pipe or still being written.
 */
 
 int main( int argc, char *argv[] )
@@ -65,8 +66,8 @@ int main( int argc, char *argv[] )
 
       /* open file */
       cerr << "Opening " << filename << "... ";
-      IVF ivf { filename };
-      cerr << "done (" << ivf.frame_count() << " frames).\n";
+      IVFStream ivf { filename };
+      cerr << "done.\n";
 
       /* initialize player and output if necessary */
       if ( not player ) {
@@ -91,13 +92,13 @@ int main( int argc, char *argv[] )
 
       /* decode file */
       cerr << filename << " entering state: " << *player << "\n";
-      for ( unsigned int frame_no = 0; frame_no < ivf.frame_count(); frame_no++ ) {
-        Optional<RasterHandle> raster = player->decode( ivf.frame( frame_no ) );
+      for ( Optional<Chunk> frame = ivf.next_frame(); frame.initialized(); frame = ivf.next_frame() ) {
+        Optional<RasterHandle> raster = player->decode( frame.get() );
         if ( raster.initialized() ) {
           YUV4MPEGFrameWriter::write( raster.get(), stdout );
         }
       }
-      cerr << filename << " exiting state: " << *player << "\n";
+      cerr << filename << " exiting state: " << *player << " (" << ivf.frames_read() << " frames)\n";
     }
   } catch ( const exception & e ) {
     print_exception( argv[ 0 ], e );
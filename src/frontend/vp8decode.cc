@@ -49,9 +49,10 @@ int main( int argc, char *argv[] )
 
     Optional<FileDescriptor> y4m_fd;
     char *decoder_state = NULL;
+    bool follow = false;
 
     while (true) {
-      const int opt = getopt(argc, argv, "s:o:");
+      const int opt = getopt(argc, argv, "s:o:f");
 
       if (opt == -1) {
         break;
@@ -66,6 +67,10 @@ int main( int argc, char *argv[] )
           y4m_fd.initialize(fopen(optarg, "wb"));
           break;
 
+        case 'f':
+          follow = true;
+          break;
+
         default:
           return usage(argv[0]);
       }
@@ -75,12 +80,19 @@ int main( int argc, char *argv[] )
       return usage(argv[0]);
     }
 
-    Player player = decoder_state == NULL
-      ? Player( argv[optind] )
-      : EncoderStateDeserializer::build<Player>(decoder_state, argv[optind]);
+    /* frames are decoded as they arrive, so the input can be a pipe ("-" for
+       stdin) or, with -f, a file still being written */
+    StreamPlayer player = decoder_state == NULL
+      ? StreamPlayer( argv[optind], follow )
+      : EncoderStateDeserializer::build<StreamPlayer>(decoder_state, string(argv[optind]), follow);
+
+    while ( true ) {
+      Optional<RasterHandle> next = player.advance();
+      if ( not next.initialized() ) {
+        break;
+      }
 
-    while ( not player.eof() ) {
-      RasterHandle raster = player.advance();
+      const RasterHandle & raster = next.get();
 
       if (y4m_fd.initialized()) {
         if (lseek(y4m_fd.get().fd_num(), 0, SEEK_CUR) == 0) {
@@ -101,6 +113,8 @@ int main( int argc, char *argv[] )
 }
 
 int usage(char *argv0) {
-  cerr << "Usage: " << argv0 << " [-s decoder_state] [-o y4m_output] input_file" << endl;
+  cerr << "Usage: " << argv0 << " [-s decoder_state] [-o y4m_output] [-f] input_file" << endl
+       << endl
+       << "input_file may be - for stdin; -f keeps reading a file as it grows" << endl;
   return EXIT_FAILURE;
 }
@@ -0,0 +1,387 @@
+/* -*-mode:c++; tab-width: 2; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+
+/* Copyright 2013-2018 the Alfalfa authors
+                       and the Massachusetts Institute of Technology
+
+   Redistribution and use in source and binary forms, with or without
+   modification, are permitted provided that the following conditions are
+   met:
+
+      1. Redistributions of source code must retain the above copyright
+         notice, this list of conditions and the following disclaimer.
+
+      2. Redistributions in binary form must reproduce the above copyright
+         notice, this list of conditions and the following disclaimer in the
+         documentation and/or other materials provided with the distribution.
+
+   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+   "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+   LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+   A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+   HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+   SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+   LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+   DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+   THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+   (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+   OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE. */
+
+#include <getopt.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "yuv4mpeg.hh"
+#include "decoder.hh"
+#include "encoder.hh"
+#include "exception.hh"
+
+using namespace std;
+
+/* Runs every encoding mode (fixed quantizer, minimum SSIM, target size) at
+   both quality settings over a set of clips, and prints the speed, size and
+   quality of each run as JSON. The clips are either y4m files or synthetic
+   (a panning texture with a moving, noisy object) at several resolutions. */
+
+void usage_error( const string & program_name )
+{
+  cerr << "Usage: " << program_name << " [options] [input.y4m...]"                          << endl
+                                                                                             << endl
+       << "Options:"                                                                         << endl
+       << " -f <arg>, --frames=<arg>              Frames per clip (default: 20)"             << endl
+       << " -r <arg>, --resolutions=<arg>         Synthetic clip sizes, used when no input"  << endl
+       << "                                         is given (default: 320x180,640x360,"     << endl
+       << "                                         1280x720)"                               << endl
+       << " -y <arg>, --y-ac-qi=<arg>             Quantizer for the quantizer mode (40)"     << endl
+       << " -s <arg>, --ssim=<arg>                SSIM for the SSIM mode (default: 0.99)"    << endl
+       << " -b <arg>, --bits-per-pixel=<arg>      Frame size for the target-size mode"       << endl
+       << "                                         (default: 0.25)"                         << endl
+       << " -2, --two-pass                        Two-pass encoding (with trellis)"          << endl
+       << " -p, --phases                          Also report time per encoder phase"        << endl
+       << endl;
+}
+
+struct Clip
+{
+  string name;
+  vector<RasterHandle> rasters;
+};
+
+Clip synthetic_clip( const uint16_t width, const uint16_t height, const size_t frame_count )
+{
+  Clip clip { "synthetic-" + to_string( width ) + "x" + to_string( height ), {} };
+
+  default_random_engine generator( width * height );
+  normal_distribution<double> noise( 0, 2.0 );
+
+  for ( size_t f = 0; f < frame_count; f++ ) {
+    MutableRasterHandle raster { width, height };
+
+    /* a textured background panning right, and an object moving across it */
+    const double object_x = width * ( 0.2 + 0.6 * f / max<size_t>( frame_count, 1 ) );
+    const double object_y = height * 0.4;
+    const double radius = min( width, height ) * 0.2;
+
+    raster.get().Y().forall_ij(
+      [&] ( uint8_t & pixel, unsigned int column, unsigned int row )
+      {
+        const double x = column + 2.0 * f;
+        double value = 128 + 48 * sin( x / 23.0 ) * cos( row / 17.0 ) + 16 * sin( ( x + row ) / 5.0 );
+
+        const double dx = column - object_x, dy = row - object_y;
+        if ( dx * dx + dy * dy < radius * radius ) {
+          value = 200 - 60 * cos( dx / 6.0 + f * 0.2 ) + noise( generator );
+        }
+
+        pixel = uint8_t( max( 0.0, min( 255.0, value ) ) );
+      } );
+
+    raster.get().U().forall_ij(
+      [&] ( uint8_t & pixel, unsigned int column, unsigned int )
+      { pixel = uint8_t( 96 + ( column + f ) % 64 ); } );
+
+    raster.get().V().forall_ij(
+      [&] ( uint8_t & pixel, unsigned int, unsigned int row )
+      { pixel = uint8_t( 160 - row % 64 ); } );
+
+    clip.rasters.emplace_back( move( raster ) );
+  }
+
+  return clip;
+}
+
+Clip y4m_clip( const string & filename, const size_t frame_count )
+{
+  Clip clip { filename, {} };
+  YUV4MPEGReader input_reader { filename };
+
+  while ( clip.rasters.size() < frame_count ) {
+    auto raster = input_reader.get_next_frame();
+
+    if ( not raster.initialized() ) {
+      break;
+    }
+
+    clip.rasters.emplace_back( raster.get() );
+  }
+
+  if ( clip.rasters.empty() ) {
+    throw runtime_error( filename + ": no frames" );
+  }
+
+  return clip;
+}
+
+struct BenchmarkSettings
+{
+  size_t frames { 20 };
+  uint8_t y_ac_qi { 40 };
+  double ssim { 0.99 };
+  double bits_per_pixel { 0.25 };
+  bool two_pass { false };
+  bool phases { false };
+};
+
+/* s as a JSON string literal */
+string json_string( const string & s )
+{
+  ostringstream out;
+  out << '"';
+
+  for ( const char c : s ) {
+    switch ( c ) {
+    case '"': out << "\\\""; break;
+    case '\\': out << "\\\\"; break;
+    case '\n': out << "\\n"; break;
+    case '\t': out << "\\t"; break;
+    default:
+      if ( static_cast<unsigned char>( c ) < 0x20 ) {
+        out << "\\u" << hex << setw( 4 ) << setfill( '0' ) << int( c ) << dec;
+      }
+      else {
+        out << c;
+      }
+    }
+  }
+
+  out << '"';
+  return out.str();
+}
+
+/* p-th percentile (nearest rank) of sorted values */
+double percentile( const vector<double> & sorted, const double p )
+{
+  const size_t rank = size_t( ceil( p / 100 * sorted.size() ) );
+  return sorted.at( rank ? rank - 1 : 0 );
+}
+
+string run( const Clip & clip, const EncoderMode mode, const EncoderQuality quality,
+            const BenchmarkSettings & settings )
+{
+  const uint16_t width = clip.rasters.front().get().display_width();
+  const uint16_t height = clip.rasters.front().get().display_height();
+  const size_t target_size = max( size_t( 1 ), size_t( settings.bits_per_pixel * width * height / 8 ) );
+
+  Encoder encoder( width, height, settings.two_pass, quality );
+  encoder.set_phase_profiling( settings.phases );
+
+  Decoder decoder( width, height );
+
+  vector<double> frame_ms;
+  size_t total_bytes = 0;
+  double total_ssim = 0;
+
+  for ( const RasterHandle & raster : clip.rasters ) {
+    const auto start = chrono::steady_clock::now();
+
+    vector<uint8_t> output;
+    switch ( mode ) {
+    case CONSTANT_QUANTIZER:
+      output = encoder.encode_with_quantizer( raster.get(), settings.y_ac_qi ).to_vector();
+      break;
+
+    case MINIMUM_SSIM:
+      output = encoder.encode_with_minimum_ssim( raster.get(), settings.ssim ).to_vector();
+      break;
+
+    case TARGET_FRAME_SIZE:
+      output = encoder.encode_with_target_size( raster.get(), target_size ).to_vector();
+      break;
+
+    default:
+      throw runtime_error( "unsupported encoder mode" );
+    }
+
+    frame_ms.push_back( chrono::duration<double, milli>( chrono::steady_clock::now() - start ).count() );
+    total_bytes += output.size();
+
+    /* the quality is that of what a decoder actually sees */
+    Optional<RasterHandle> decoded = decoder.parse_and_decode_frame( Chunk( output.data(), output.size() ) );
+    if ( not decoded.initialized() ) {
+      throw runtime_error( "encoder output is not displayable" );
+    }
+
+    total_ssim += decoded.get().get().quality( raster.get() );
+  }
+
+  const size_t n = frame_ms.size();
+  double total_ms = 0;
+  for ( const double ms : frame_ms ) {
+    total_ms += ms;
+  }
+
+  sort( frame_ms.begin(), frame_ms.end() );
+
+  ostringstream json;
+  json << fixed << setprecision( 3 )
+       << "{ \"clip\": " << json_string( clip.name ) << ", "
+       << "\"width\": " << width << ", \"height\": " << height << ", "
+       << "\"mode\": \"" << ( mode == CONSTANT_QUANTIZER ? "quantizer"
+                            : mode == MINIMUM_SSIM ? "minimum_ssim" : "target_size" ) << "\", "
+       << "\"quality\": \"" << ( quality == BEST_QUALITY ? "best" : "realtime" ) << "\", "
+       << "\"two_pass\": " << ( settings.two_pass ? "true" : "false" ) << ", "
+       << "\"frames\": " << n << ", "
+       << "\"fps\": " << 1000.0 * n / total_ms << ", "
+       << "\"ms_per_frame\": { \"mean\": " << total_ms / n
+       << ", \"p50\": " << percentile( frame_ms, 50 )
+       << ", \"p90\": " << percentile( frame_ms, 90 )
+       << ", \"p99\": " << percentile( frame_ms, 99 )
+       << ", \"max\": " << frame_ms.back() << " }, "
+       << "\"bits_per_frame\": " << 8.0 * total_bytes / n << ", "
+       << setprecision( 5 ) << "\"ssim\": " << total_ssim / n;
+
+  if ( settings.phases ) {
+    const char * phase_names[ num_encoder_phases ] = { "intra_search", "motion_search", "trellis",
+                                                       "loopfilter_search", "serialization" };
+
+    json << setprecision( 3 ) << ", \"phase_ms_per_frame\": { ";
+    for ( unsigned int phase = 0; phase < num_encoder_phases; phase++ ) {
+      json << ( phase ? ", " : "" ) << "\"" << phase_names[ phase ] << "\": "
+           << 1000.0 * encoder.phase_seconds().at( phase ) / n;
+    }
+    json << " }";
+  }
+
+  json << " }";
+  return json.str();
+}
+
+int main( int argc, char *argv[] )
+{
+  try {
+    if ( argc <= 0 ) {
+      abort();
+    }
+
+    BenchmarkSettings settings;
+    vector<pair<uint16_t, uint16_t>> resolutions { { 320, 180 }, { 640, 360 }, { 1280, 720 } };
+
+    const option command_line_options[] = {
+      { "frames",               required_argument, nullptr, 'f' },
+      { "resolutions",          required_argument, nullptr, 'r' },
+      { "y-ac-qi",              required_argument, nullptr, 'y' },
+      { "ssim",                 required_argument, nullptr, 's' },
+      { "bits-per-pixel",       required_argument, nullptr, 'b' },
+      { "two-pass",             no_argument,       nullptr, '2' },
+      { "phases",               no_argument,       nullptr, 'p' },
+      { 0, 0, 0, 0 }
+    };
+
+    while ( true ) {
+      const int opt = getopt_long( argc, argv, "f:r:y:s:b:2ph", command_line_options, nullptr );
+
+      if ( opt == -1 ) {
+        break;
+      }
+
+      switch ( opt ) {
+      case 'f':
+        settings.frames = stoul( optarg );
+        break;
+
+      case 'r':
+      {
+        resolutions.clear();
+        istringstream list { optarg };
+        string resolution;
+        while ( getline( list, resolution, ',' ) ) {
+          const size_t x = resolution.find( 'x' );
+          if ( x == string::npos ) {
+            throw runtime_error( "invalid resolution: " + resolution );
+          }
+          resolutions.emplace_back( stoul( resolution.substr( 0, x ) ), stoul( resolution.substr( x + 1 ) ) );
+        }
+        break;
+      }
+
+      case 'y':
+        settings.y_ac_qi = stoul( optarg );
+        break;
+
+      case 's':
+        settings.ssim = stod( optarg );
+        break;
+
+      case 'b':
+        settings.bits_per_pixel = stod( optarg );
+        break;
+
+      case '2':
+        settings.two_pass = true;
+        break;
+
+      case 'p':
+        settings.phases = true;
+        break;
+
+      case 'h':
+        usage_error( argv[ 0 ] );
+        return EXIT_SUCCESS;
+
+      default:
+        usage_error( argv[ 0 ] );
+        return EXIT_FAILURE;
+      }
+    }
+
+    if ( settings.frames == 0 ) {
+      throw runtime_error( "the number of frames must be positive" );
+    }
+
+    /* the clips can have different sizes */
+    RasterPoolDebug::allow_resize = true;
+
+    const size_t clip_count = ( optind < argc ) ? argc - optind : resolutions.size();
+
+    cout << "{ \"runs\": [" << endl;
+
+    bool first = true;
+    for ( size_t i = 0; i < clip_count; i++ ) {
+      const Clip clip = ( optind < argc )
+        ? y4m_clip( argv[ optind + i ], settings.frames )
+        : synthetic_clip( resolutions[ i ].first, resolutions[ i ].second, settings.frames );
+
+      for ( const EncoderMode mode : { CONSTANT_QUANTIZER, MINIMUM_SSIM, TARGET_FRAME_SIZE } ) {
+        for ( const EncoderQuality quality : { BEST_QUALITY, REALTIME_QUALITY } ) {
+          cout << ( first ? "" : ",\n" ) << "  " << run( clip, mode, quality, settings ) << flush;
+          first = false;
+        }
+      }
+    }
+
+    cout << endl << "] }" << endl;
+
+    return EXIT_SUCCESS;
+  } catch ( const exception &  e ) {
+    print_exception( argv[ 0 ], e );
+    return EXIT_FAILURE;
+  }
+}
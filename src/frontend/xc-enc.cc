@@ -63,6 +63,8 @@ void usage_error( const string & program_name )
        << "                                         encoder state (default: none)"           << endl
        << " -I <arg>, --input-state=<arg>         Input file name for initial"               << endl
        << "                                         encoder state (default: none)"           << endl
+       << " --delta-state=<arg>                   Store the output state as a delta"         << endl
+       << "                                         against this state (e.g. the input)"     << endl
        << " -y, --y-ac-qi=<arg>                   Quantization index for Y"                  << endl
        << " -q, --quality=(best|rt)               Quality setting"                           << endl
        << "                                         best: best quality, slowest (default)"   << endl
@@ -71,6 +73,9 @@ void usage_error( const string & program_name )
        << "                                         Each line specifies the target size"     << endl
        << "                                         in bytes for the corresponding frame."   << endl
        << " --two-pass                            Do the second encoding pass"               << endl
+       << " -P <arg>, --dct-partitions=<arg>      Number of DCT token partitions"            << endl
+       << "                                         1 (default), 2, 4 or 8"                  << endl
+       << " --fast-intra                          SATD-based intra mode decision"            << endl
                                                                                              << endl
        << "Re-encode:"                                                                       << endl
        << " -r, --reencode                        Re-encode"                                 << endl
@@ -109,6 +114,7 @@ int main( int argc, char *argv[] )
     string input_format = "ivf";
     string input_state = "";
     string output_state = "";
+    string delta_state = "";
     string pred_file = "";
     string pred_ivf_initial_state = "";
     string frame_sizes_file = "";
@@ -120,6 +126,8 @@ int main( int argc, char *argv[] )
     bool no_wait = false;
     Optional<uint8_t> y_ac_qi;
     EncoderQuality quality = BEST_QUALITY;
+    unsigned int dct_partitions = 1;
+    IntraSearch intra_search = FULL_INTRA_SEARCH;
 
     EncoderMode encoder_mode = MINIMUM_SSIM;
 
@@ -140,11 +148,14 @@ int main( int argc, char *argv[] )
       { "quality",              required_argument, nullptr, 'q' },
       { "frame-sizes",          required_argument, nullptr, 'F' },
       { "no-wait",              no_argument,       nullptr, 'W' },
+      { "dct-partitions",       required_argument, nullptr, 'P' },
+      { "fast-intra",           no_argument,       nullptr, 'X' },
+      { "delta-state",          required_argument, nullptr, 'D' },
       { 0, 0, 0, 0 }
     };
 
     while ( true ) {
-      const int opt = getopt_long( argc, argv, "o:s:i:O:I:2y:p:S:rw:eq:F:W", command_line_options, nullptr );
+      const int opt = getopt_long( argc, argv, "o:s:i:O:I:2y:p:S:rw:eq:F:WP:", command_line_options, nullptr );
 
       if ( opt == -1 ) {
         break;
@@ -172,6 +183,10 @@ int main( int argc, char *argv[] )
         input_state = optarg;
         break;
 
+      case 'D':
+        delta_state = optarg;
+        break;
+
       case '2':
         two_pass = true;
         break;
@@ -218,6 +233,14 @@ int main( int argc, char *argv[] )
         encoder_mode = TARGET_FRAME_SIZE;
         break;
 
+      case 'P':
+        dct_partitions = stoul( optarg );
+        break;
+
+      case 'X':
+        intra_search = FAST_INTRA_SEARCH;
+        break;
+
       default:
         throw runtime_error( "getopt_long: unexpected return value." );
       }
@@ -258,6 +281,7 @@ int main( int argc, char *argv[] )
     }
 
     IVFWriter output { output_file, "VP80", input_reader->display_width(), input_reader->display_height(), 1, 1 };
+    output.set_buffered();
 
     if ( re_encode_only ) {
       /* re-encoding */
@@ -313,6 +337,9 @@ int main( int argc, char *argv[] )
       Encoder encoder( EncoderStateDeserializer::build<Decoder>( input_state ),
                        two_pass, quality );
 
+      encoder.set_dct_partitions( dct_partitions );
+      encoder.set_intra_search( intra_search );
+
       output.set_expected_decoder_entry_hash( encoder.export_decoder().get_hash().hash() );
 
       encoder.reencode( original_rasters, prediction_frames, kf_q_weight,
@@ -321,7 +348,11 @@ int main( int argc, char *argv[] )
       if (output_state != "") {
         EncoderStateSerializer odata = {};
         encoder.export_decoder().serialize(odata);
-        odata.write(output_state);
+        if (delta_state.empty()) {
+          odata.write(output_state);
+        } else {
+          odata.write_delta(output_state, delta_state);
+        }
       }
     }
     else {
@@ -332,6 +363,9 @@ int main( int argc, char *argv[] )
         : Encoder( EncoderStateDeserializer::build<Decoder>( input_state ),
                    two_pass, quality );
 
+      encoder.set_dct_partitions( dct_partitions );
+      encoder.set_intra_search( intra_search );
+
       if ( not input_state.empty() ) {
         output.set_expected_decoder_entry_hash( encoder.export_decoder().get_hash().hash() );
       }
@@ -369,7 +403,8 @@ int main( int argc, char *argv[] )
         {
           size_t target_size = read_next_frame_size( frame_sizes );
           output.append_frame( encoder.encode_with_target_size( raster.get(), target_size ) );
-          cerr << " [target_size=" << target_size << "] ";
+          cerr << " [target_size=" << target_size << ", rate model: "
+               << encoder.rate_model().str() << "] ";
           break;
         }
 
@@ -379,6 +414,11 @@ int main( int argc, char *argv[] )
 
         const auto encode_ending = chrono::system_clock::now();
         const int ms_elapsed = chrono::duration_cast<chrono::milliseconds>( encode_ending - encode_beginning ).count();
+
+        if ( quality == REALTIME_QUALITY ) {
+          cerr << " [early skip=" << 100 * encoder.stats().early_skip_rate() << "%] ";
+        }
+
         cerr << "done (" << ms_elapsed << " ms)." << endl;
       }
 
@@ -386,6 +426,8 @@ int main( int argc, char *argv[] )
         throw runtime_error( "unsupported: primary encode with output state" );
       }
     }
+
+    output.flush();
   } catch ( const exception &  e ) {
     print_exception( argv[ 0 ], e );
     return EXIT_FAILURE;
@@ -65,6 +65,7 @@ int main( int argc, char *argv[] )
   }
 
   IVFWriter output_ivf( output_file, "VP80", ivf1.width(), ivf1.height(), 1, 1 );
+  output_ivf.set_buffered();
 
   for ( size_t i = 0; i < ivf1.frame_count(); i++ ) {
     output_ivf.append_frame( ivf1.frame( i ) );
@@ -74,5 +75,7 @@ int main( int argc, char *argv[] )
     output_ivf.append_frame( ivf2.frame( i ) );
   }
 
+  output_ivf.flush();
+
   return EXIT_SUCCESS;
 }
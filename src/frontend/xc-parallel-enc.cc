@@ -0,0 +1,348 @@
+/* -*-mode:c++; tab-width: 2; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+
+/* Copyright 2013-2018 the Alfalfa authors
+                       and the Massachusetts Institute of Technology
+
+   Redistribution and use in source and binary forms, with or without
+   modification, are permitted provided that the following conditions are
+   met:
+
+      1. Redistributions of source code must retain the above copyright
+         notice, this list of conditions and the following disclaimer.
+
+      2. Redistributions in binary form must reproduce the above copyright
+         notice, this list of conditions and the following disclaimer in the
+         documentation and/or other materials provided with the distribution.
+
+   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+   "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+   LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+   A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+   HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+   SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+   LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+   DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+   THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+   (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+   OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE. */
+
+#include <getopt.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <deque>
+#include <future>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "yuv4mpeg.hh"
+#include "frame.hh"
+#include "decoder.hh"
+#include "encoder.hh"
+#include "ivf_writer.hh"
+#include "uncompressed_chunk.hh"
+
+using namespace std;
+
+/* ExCamera-style parallel encoding in a single process: the input is read
+   in fixed-size chunks that are encoded independently (each starting with a
+   keyframe) on their own threads, then every chunk is rebased, in order, onto
+   the final decoder state of the one before it and streamed into one IVF.
+   Only the chunks in flight are held in memory. */
+
+void usage_error( const string & program_name )
+{
+  cerr << "Usage: " << program_name << " [options] <input.y4m>"                              << endl
+                                                                                             << endl
+       << "Options:"                                                                         << endl
+       << " -o <arg>, --output=<arg>              Output file name (default: output.ivf)"    << endl
+       << " -c <arg>, --chunk-size=<arg>          Frames per chunk (default: 24)"            << endl
+       << " -j <arg>, --threads=<arg>             Encoding threads (default: one per core)"  << endl
+       << " -s <arg>, --ssim=<arg>                SSIM for the output (default: 0.99)"       << endl
+       << " -y, --y-ac-qi=<arg>                   Quantization index for Y"                  << endl
+       << " -q, --quality=(best|rt)               Quality setting"                           << endl
+       << "                                         best: best quality, slowest (default)"   << endl
+       << "                                         rt:   real-time"                         << endl
+       << " -w <arg>, --kf-q-weight <arg>         Keyframe quantizer weight when rebasing"   << endl
+       << "                                         (default: 1.0)"                          << endl
+       << " -P <arg>, --dct-partitions=<arg>      Number of DCT token partitions"            << endl
+       << "                                         1 (default), 2, 4 or 8"                  << endl
+       << " --fast-intra                          SATD-based intra mode decision"            << endl
+       << endl;
+}
+
+struct EncoderSettings
+{
+  EncoderQuality quality { BEST_QUALITY };
+  Optional<uint8_t> y_ac_qi {};
+  double ssim { 0.99 };
+  unsigned int dct_partitions { 1 };
+  IntraSearch intra_search { FULL_INTRA_SEARCH };
+
+  void apply( Encoder & encoder ) const
+  {
+    encoder.set_dct_partitions( dct_partitions );
+    encoder.set_intra_search( intra_search );
+  }
+};
+
+/* a chunk as encoded on its own: its output, the same frames parsed back
+   (to be rebased), and the decoder state at its end */
+struct EncodedChunk
+{
+  vector<vector<uint8_t>> output {};
+  vector<pair<Optional<KeyFrame>, Optional<InterFrame>>> frames {};
+  Decoder final_state;
+
+  EncodedChunk( const uint16_t width, const uint16_t height )
+    : final_state( width, height )
+  {}
+};
+
+EncodedChunk encode_chunk( const vector<RasterHandle> & rasters,
+                           const EncoderSettings & settings )
+{
+  const VP8Raster & first = rasters.front().get();
+  EncodedChunk chunk( first.display_width(), first.display_height() );
+
+  Encoder encoder( first.display_width(), first.display_height(), false, settings.quality );
+  settings.apply( encoder );
+
+  Decoder parser( first.display_width(), first.display_height() );
+
+  for ( const RasterHandle & raster : rasters ) {
+    chunk.output.emplace_back( settings.y_ac_qi.initialized()
+      ? encoder.encode_with_quantizer( raster.get(), settings.y_ac_qi.get() ).to_vector()
+      : encoder.encode_with_minimum_ssim( raster.get(), settings.ssim ).to_vector() );
+
+    const vector<uint8_t> & output = chunk.output.back();
+    UncompressedChunk unch { Chunk( output.data(), output.size() ),
+                             first.display_width(), first.display_height(), false };
+
+    if ( unch.key_frame() ) {
+      KeyFrame frame = parser.parse_frame<KeyFrame>( unch );
+      parser.decode_frame( frame );
+      chunk.frames.emplace_back( move( frame ), Optional<InterFrame>() );
+    }
+    else {
+      InterFrame frame = parser.parse_frame<InterFrame>( unch );
+      parser.decode_frame( frame );
+      chunk.frames.emplace_back( Optional<KeyFrame>(), move( frame ) );
+    }
+  }
+
+  chunk.final_state = encoder.export_decoder();
+  return chunk;
+}
+
+/* a chunk that has been read but not yet written out; the rasters are
+   kept for rebasing */
+struct PendingChunk
+{
+  size_t first_frame;
+  vector<RasterHandle> rasters;
+  future<EncodedChunk> encoded;
+};
+
+int main( int argc, char *argv[] )
+{
+  try {
+    if ( argc <= 0 ) {
+      abort();
+    }
+
+    if ( argc < 2 ) {
+      usage_error( argv[ 0 ] );
+      return EXIT_FAILURE;
+    }
+
+    string output_file = "output.ivf";
+    unsigned int thread_count = max( 1u, thread::hardware_concurrency() );
+    size_t chunk_size = 24;
+    double kf_q_weight = 1.0;
+    EncoderSettings settings;
+
+    const option command_line_options[] = {
+      { "output",               required_argument, nullptr, 'o' },
+      { "chunk-size",           required_argument, nullptr, 'c' },
+      { "threads",              required_argument, nullptr, 'j' },
+      { "ssim",                 required_argument, nullptr, 's' },
+      { "y-ac-qi",              required_argument, nullptr, 'y' },
+      { "quality",              required_argument, nullptr, 'q' },
+      { "kf-q-weight",          required_argument, nullptr, 'w' },
+      { "dct-partitions",       required_argument, nullptr, 'P' },
+      { "fast-intra",           no_argument,       nullptr, 'X' },
+      { 0, 0, 0, 0 }
+    };
+
+    while ( true ) {
+      const int opt = getopt_long( argc, argv, "o:c:j:s:y:q:w:P:", command_line_options, nullptr );
+
+      if ( opt == -1 ) {
+        break;
+      }
+
+      switch ( opt ) {
+      case 'o':
+        output_file = optarg;
+        break;
+
+      case 'c':
+        chunk_size = stoul( optarg );
+        break;
+
+      case 'j':
+        thread_count = stoul( optarg );
+        break;
+
+      case 's':
+        settings.ssim = stod( optarg );
+        break;
+
+      case 'y':
+        settings.y_ac_qi.reset( stoul( optarg ) );
+        break;
+
+      case 'q':
+        if ( strcmp( optarg, "rt" ) == 0 ) {
+          settings.quality = REALTIME_QUALITY;
+        }
+
+        break;
+
+      case 'w':
+        kf_q_weight = stod( optarg );
+        break;
+
+      case 'P':
+        settings.dct_partitions = stoul( optarg );
+        break;
+
+      case 'X':
+        settings.intra_search = FAST_INTRA_SEARCH;
+        break;
+
+      default:
+        throw runtime_error( "getopt_long: unexpected return value." );
+      }
+    }
+
+    if ( optind >= argc ) {
+      usage_error( argv[ 0 ] );
+      return EXIT_FAILURE;
+    }
+
+    if ( thread_count == 0 or chunk_size == 0 ) {
+      throw runtime_error( "chunk size and thread count must be positive" );
+    }
+
+    const string input_file = argv[ optind ];
+    YUV4MPEGReader input_reader = ( input_file == "-" )
+      ? YUV4MPEGReader( FileDescriptor( STDIN_FILENO ) )
+      : YUV4MPEGReader( input_file );
+
+    const uint16_t width = input_reader.display_width();
+    const uint16_t height = input_reader.display_height();
+
+    size_t frames_read = 0;
+    auto read_chunk = [&] ()
+      {
+        PendingChunk chunk { frames_read, {}, {} };
+        while ( chunk.rasters.size() < chunk_size ) {
+          Optional<RasterHandle> raster = input_reader.get_next_frame();
+          if ( not raster.initialized() ) {
+            break;
+          }
+          chunk.rasters.emplace_back( raster.get() );
+        }
+
+        frames_read += chunk.rasters.size();
+
+        if ( not chunk.rasters.empty() ) {
+          chunk.encoded = async( launch::async, encode_chunk, chunk.rasters, cref( settings ) );
+        }
+
+        return chunk;
+      };
+
+    const auto beginning = chrono::steady_clock::now();
+    auto seconds_elapsed = [&beginning] ()
+      { return chrono::duration<double>( chrono::steady_clock::now() - beginning ).count(); };
+
+    /* up to thread_count chunks are encoded at once; the main thread rebases
+       each one, in order, while the next chunks are being encoded */
+    deque<PendingChunk> in_flight;
+    bool input_done = false;
+
+    auto fill_window = [&] ()
+      {
+        while ( not input_done and in_flight.size() < thread_count ) {
+          PendingChunk chunk = read_chunk();
+          if ( chunk.rasters.empty() ) {
+            input_done = true;
+          }
+          else {
+            in_flight.push_back( move( chunk ) );
+          }
+        }
+      };
+
+    fill_window();
+
+    if ( in_flight.empty() ) {
+      throw runtime_error( "no frames to encode" );
+    }
+
+    IVFWriter output { output_file, "VP80", width, height, 1, 1 };
+    output.set_buffered();
+
+    Decoder state( width, height );
+    size_t chunks = 0;
+
+    while ( not in_flight.empty() ) {
+      PendingChunk pending = move( in_flight.front() );
+      in_flight.pop_front();
+
+      EncodedChunk chunk = pending.encoded.get();
+
+      /* keep the encoding threads busy while this chunk is rebased */
+      fill_window();
+
+      if ( chunks == 0 ) {
+        /* the first chunk is kept as it is */
+        for ( const auto & frame : chunk.output ) {
+          output.append_frame( Chunk( frame.data(), frame.size() ) );
+        }
+
+        state = move( chunk.final_state );
+      }
+      else {
+        Encoder encoder( state, false, settings.quality );
+        settings.apply( encoder );
+
+        encoder.reencode( pending.rasters, chunk.frames, kf_q_weight, false, output );
+        state = encoder.export_decoder();
+      }
+
+      cerr << "Chunk #" << chunks << " (frames " << pending.first_frame << "-"
+           << pending.first_frame + pending.rasters.size() - 1
+           << ") written after " << seconds_elapsed() << " s." << endl;
+
+      chunks++;
+    }
+
+    output.flush();
+
+    cerr << frames_read << " frames in " << chunks << " chunks on "
+         << thread_count << " threads: "
+         << frames_read / seconds_elapsed() << " fps." << endl;
+
+    return EXIT_SUCCESS;
+  } catch ( const exception &  e ) {
+    print_exception( argv[ 0 ], e );
+    return EXIT_FAILURE;
+  }
+}
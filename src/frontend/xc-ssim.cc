@@ -17,6 +17,9 @@ void usage_error( const string & program_name )
        << endl
        << "Options:" << endl
        << " -a,       --all-planes                Output SSIM for all planes" << endl
+       << " -f,       --fast                      Approximate SSIM at half resolution" << endl
+       << " -m,       --map                       Also output the luma SSIM of each"  << endl
+       << "                                         macroblock"                       << endl
        << " -1 <arg>, --video1-format=<arg>       First video input format"   << endl
        << " -2 <arg>, --video2-format=<arg>       Second video input format"  << endl
        << "                                         ivf (default), y4m"       << endl;
@@ -36,16 +39,20 @@ int main( int argc, char *argv[] )
 
   string video_format[ 2 ];
   bool all_planes = false;
+  bool fast = false;
+  bool map = false;
 
   const option command_line_options[] = {
     { "all-planes",                no_argument, nullptr, 'a' },
+    { "fast",                      no_argument, nullptr, 'f' },
+    { "map",                       no_argument, nullptr, 'm' },
     { "video1-format",       required_argument, nullptr, '1' },
     { "video2-format",       required_argument, nullptr, '2' },
     { 0, 0, nullptr, 0 }
   };
 
   while ( true ) {
-    const int opt = getopt_long( argc, argv, "1:2:a", command_line_options, nullptr );
+    const int opt = getopt_long( argc, argv, "1:2:afm", command_line_options, nullptr );
 
     if ( opt == -1 ) {
       break;
@@ -64,6 +71,14 @@ int main( int argc, char *argv[] )
       all_planes = true;
       break;
 
+    case 'f':
+      fast = true;
+      break;
+
+    case 'm':
+      map = true;
+      break;
+
     default:
       throw runtime_error( "getopt_long: unexpected return value." );
     }
@@ -94,17 +109,33 @@ int main( int argc, char *argv[] )
                                       video_reader[ 1 ]->get_next_frame() };
 
   while ( raster[ 0 ].initialized() and raster[ 1 ].initialized() ) {
-    double y_ssim = ssim( raster[ 0 ].get().get().Y(), raster[ 1 ].get().get().Y() );
+    auto plane_ssim = fast ? fast_ssim : ssim;
+
+    double y_ssim = plane_ssim( raster[ 0 ].get().get().Y(), raster[ 1 ].get().get().Y() );
     cout << y_ssim;
 
     if ( all_planes ) {
-      double u_ssim = ssim( raster[ 0 ].get().get().U(), raster[ 1 ].get().get().U() );
-      double v_ssim = ssim( raster[ 0 ].get().get().V(), raster[ 1 ].get().get().V() );
+      double u_ssim = plane_ssim( raster[ 0 ].get().get().U(), raster[ 1 ].get().get().U() );
+      double v_ssim = plane_ssim( raster[ 0 ].get().get().V(), raster[ 1 ].get().get().V() );
       cout << "\t" << u_ssim << "\t" << v_ssim;
     }
 
     cout << endl;
 
+    if ( map ) {
+      /* one line per row of macroblocks, then an empty line */
+      const SSIMMap mb_ssim = ssim_map( raster[ 0 ].get().get().Y(), raster[ 1 ].get().get().Y() );
+
+      for ( unsigned int row = 0; row < mb_ssim.height; row++ ) {
+        for ( unsigned int column = 0; column < mb_ssim.width; column++ ) {
+          cout << ( column ? "\t" : "" ) << mb_ssim.at( column, row );
+        }
+        cout << endl;
+      }
+
+      cout << endl;
+    }
+
     for ( size_t i = 0; i < 2; i++ ) {
       raster[ i ] = video_reader[ i ]->get_next_frame();
     }
@@ -30,13 +30,16 @@
 #include <memory>
 #include <unordered_set>
 #include <cstdio>
+#include <cstring>
 #include <fcntl.h>
+#include <poll.h>
 #include <sys/ioctl.h>
 #include <sys/mman.h>
 
 #include "camera.hh"
 #include "exception.hh"
 #include "jpeg.hh"
+#include "pixel_format.hh"
 
 using namespace std;
 
@@ -106,102 +109,154 @@ Camera::Camera( const uint16_t width, const uint16_t height,
   }
 
   SystemCall( "stream on", ioctl( camera_fd_.fd_num(), VIDIOC_STREAMON, &capture_type ) );
+
+  if ( pixel_format_ == V4L2_PIX_FMT_MJPEG ) {
+    decoder_thread_ = thread( [this] () { decode_mjpeg(); } );
+  }
 }
 
 Camera::~Camera()
 {
+  {
+    unique_lock<mutex> lock { decoded_mutex_ };
+    stopping_ = true;
+    decoded_changed_.notify_all();
+  }
+
+  if ( decoder_thread_.joinable() ) {
+    decoder_thread_.join();
+  }
+
   SystemCall( "stream off", ioctl( camera_fd_.fd_num(), VIDIOC_STREAMOFF, &capture_type ) );
 }
 
-Optional<RasterHandle> Camera::get_next_frame()
+v4l2_buffer Camera::dequeue_buffer()
 {
-  MutableRasterHandle raster_handle { width_, height_ };
-  auto & raster = raster_handle.get();
-
   v4l2_buffer buffer_info;
+  memset( &buffer_info, 0, sizeof( buffer_info ) );
   buffer_info.type = capture_type;
   buffer_info.memory = V4L2_MEMORY_MMAP;
-  buffer_info.index = next_buffer_index;
 
   SystemCall( "dequeue buffer", ioctl( camera_fd_.fd_num(), VIDIOC_DQBUF, &buffer_info ) );
 
-  const MMap_Region * const mmap_region_ = &kernel_v4l2_buffers_.at( next_buffer_index );
+  return buffer_info;
+}
 
-  switch( pixel_format_ ) {
-  case V4L2_PIX_FMT_YUYV:
-    {
-    uint8_t * src = mmap_region_->addr();
-    uint8_t * dst_y_start  = &raster.Y().at( 0, 0 );
-    uint8_t * dst_cb_start = &raster.U().at( 0, 0 );
-    uint8_t * dst_cr_start = &raster.V().at( 0, 0 );
+void Camera::enqueue_buffer( v4l2_buffer & buffer_info )
+{
+  SystemCall( "enqueue buffer", ioctl( camera_fd_.fd_num(), VIDIOC_QBUF, &buffer_info ) );
+}
 
-    const size_t y_plane_lenght = width_ * height_;
+/* runs on decoder_thread_: waits (with a timeout, to notice the destructor)
+   for the camera, decodes straight into a pooled raster and hands it over,
+   replacing a frame that get_next_frame() hasn't taken yet. A frame that
+   fails to decode is dropped; only V4L2 errors end the capture. */
+void Camera::decode_mjpeg()
+{
+  try {
+    pollfd camera_poll { camera_fd_.fd_num(), POLLIN, 0 };
 
-    for ( size_t i = 0; i < y_plane_lenght; i++ ) {
-      dst_y_start[ i ] = src[ i << 1 ];
-    }
+    while ( not stopping_ ) {
+      if ( SystemCall( "poll", poll( &camera_poll, 1, 100 ) ) == 0 ) {
+        continue;
+      }
 
-    size_t i = 0;
+      v4l2_buffer buffer_info = dequeue_buffer();
+
+      if ( not jpegdec_.initialized() ) {
+        /* ignore first frame as can contain invalid JPEG data */
+        jpegdec_.initialize();
+        enqueue_buffer( buffer_info );
+        continue;
+      }
+
+      MutableRasterHandle raster_handle { width_, height_ };
+      bool decoded = false;
+
+      try {
+        jpegdec_.get().begin_decoding( { kernel_v4l2_buffers_.at( buffer_info.index ).addr(),
+                                         buffer_info.bytesused } );
+        if ( jpegdec_.get().width() != width_ or jpegdec_.get().height() != height_ ) {
+          throw runtime_error( "size mismatch" );
+        }
+        jpegdec_.get().decode( raster_handle.get() );
+        decoded = true;
+      }
+      catch ( const exception & e ) {
+        jpegdec_.get().abort_decoding();
+        cerr << "Camera: dropping an MJPEG frame: " << e.what() << endl;
+      }
 
-    for ( size_t row = 0; row < height_; row++ ) {
-      if ( row % 2 == 1 ) { continue; }
+      enqueue_buffer( buffer_info );
 
-      for ( size_t column = 0; column < width_ / 2; column++ ) {
-        dst_cb_start[ i ] = src[ row * width_ * 2 + column * 4 + 1 ];
-        dst_cr_start[ i ] = src[ row * width_ * 2 + column * 4 + 3 ];
-        i++;
+      if ( not decoded ) {
+        continue;
       }
+
+      unique_lock<mutex> lock { decoded_mutex_ };
+      decoded_frame_.clear();
+      decoded_frame_.initialize( move( raster_handle ) );
+      decoded_changed_.notify_all();
     }
   }
+  catch ( ... ) {
+    unique_lock<mutex> lock { decoded_mutex_ };
+    decoder_error_ = current_exception();
+    decoded_changed_.notify_all();
+  }
+}
 
-  break;
+Optional<RasterHandle> Camera::get_next_frame()
+{
+  if ( pixel_format_ == V4L2_PIX_FMT_MJPEG ) {
+    unique_lock<mutex> lock { decoded_mutex_ };
+    decoded_changed_.wait( lock, [this] () { return decoded_frame_.initialized() or decoder_error_; } );
 
-  case V4L2_PIX_FMT_NV12:
-    {
-      memcpy( &raster.Y().at( 0, 0 ), mmap_region_->addr(), width_ * height_ );
+    if ( not decoded_frame_.initialized() ) {
+      rethrow_exception( decoder_error_ );
+    }
 
-      uint8_t * src_chroma_start = mmap_region_->addr() + width_ * height_;
-      uint8_t * dst_cb_start = &raster.U().at( 0, 0 );
-      uint8_t * dst_cr_start = &raster.V().at( 0, 0 );
+    RasterHandle frame = move( decoded_frame_.get() );
+    decoded_frame_.clear();
 
-      size_t chroma_length = width_ * height_ / 4;
+    return frame;
+  }
 
-      for ( size_t i = 0; i < chroma_length; i++ ) {
-        dst_cb_start[ i ] = src_chroma_start[ 2 * i ];
-        dst_cr_start[ i ] = src_chroma_start[ 2 * i + 1 ];
-      }
-    }
+  MutableRasterHandle raster_handle { width_, height_ };
+  auto & raster = raster_handle.get();
+
+  v4l2_buffer buffer_info = dequeue_buffer();
+  const uint8_t * src = kernel_v4l2_buffers_.at( buffer_info.index ).addr();
 
+  switch( pixel_format_ ) {
+  case V4L2_PIX_FMT_YUYV:
+    yuyv_to_i420( src, raster );
+    break;
+
+  case V4L2_PIX_FMT_NV12:
+    nv12_to_i420( src, raster );
     break;
 
   case V4L2_PIX_FMT_YUV420:
     {
-      memcpy( &raster.Y().at( 0, 0 ), mmap_region_->addr(), width_ * height_ );
-      memcpy( &raster.U().at( 0, 0 ), mmap_region_->addr() + width_ * height_, width_ * height_ / 4 );
-      memcpy( &raster.V().at( 0, 0 ), mmap_region_->addr() + width_ * height_ * 5 / 4, width_ * height_ / 4 );
-    }
+      const size_t chroma_width = width_ / 2;
+      const uint8_t * src_cb = src + width_ * height_;
+      const uint8_t * src_cr = src_cb + chroma_width * ( height_ / 2 );
 
-    break;
+      for ( unsigned int row = 0; row < height_; row++ ) {
+        memcpy( &raster.Y().at( 0, row ), src + row * width_, width_ );
+      }
 
-  case V4L2_PIX_FMT_MJPEG:
-    {
-      if ( jpegdec_.initialized() ) {
-        jpegdec_.get().begin_decoding( { mmap_region_->addr(), buffer_info.bytesused } );
-        if ( jpegdec_.get().width() != width_ or jpegdec_.get().height() != height_ ) {
-          throw runtime_error( "size mismatch" );
-        }
-        jpegdec_.get().decode( raster );
-      } else {
-        jpegdec_.initialize();
-        /* ignore first frame as can contain invalid JPEG data */
+      for ( unsigned int row = 0; row < height_ / 2u; row++ ) {
+        memcpy( &raster.U().at( 0, row ), src_cb + row * chroma_width, chroma_width );
+        memcpy( &raster.V().at( 0, row ), src_cr + row * chroma_width, chroma_width );
       }
     }
+
     break;
   }
 
-  SystemCall( "enqueue buffer", ioctl( camera_fd_.fd_num(), VIDIOC_QBUF, &buffer_info ) );
-
-  next_buffer_index = (next_buffer_index + 1) % NUM_BUFFERS;
+  enqueue_buffer( buffer_info );
 
   return RasterHandle{ move( raster_handle ) };
 }
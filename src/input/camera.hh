@@ -31,6 +31,11 @@
 
 #include <linux/videodev2.h>
 
+#include <atomic>
+#include <condition_variable>
+#include <exception>
+#include <mutex>
+#include <thread>
 #include <unordered_map>
 
 #include "optional.hh"
@@ -57,12 +62,25 @@ private:
 
   FileDescriptor camera_fd_;
   std::vector<MMap_Region> kernel_v4l2_buffers_;
-  unsigned int next_buffer_index = 0;
 
   uint32_t pixel_format_;
 
+  /* MJPEG frames are decoded on their own thread, one frame ahead of
+     get_next_frame() */
   Optional<JPEGDecompresser> jpegdec_ {};
 
+  std::atomic<bool> stopping_ { false };
+  std::mutex decoded_mutex_ {};
+  std::condition_variable decoded_changed_ {};
+  Optional<RasterHandle> decoded_frame_ {};
+  std::exception_ptr decoder_error_ {};
+  std::thread decoder_thread_ {};
+
+  v4l2_buffer dequeue_buffer();
+  void enqueue_buffer( v4l2_buffer & buffer_info );
+
+  void decode_mjpeg();
+
 public:
   Camera( const uint16_t width, const uint16_t height,
           const uint32_t pixel_format = V4L2_PIX_FMT_YUV420,
@@ -70,6 +88,9 @@ public:
 
   ~Camera();
 
+  Camera( const Camera & ) = delete;
+  Camera & operator=( const Camera & ) = delete;
+
   Optional<RasterHandle> get_next_frame() override;
 
   uint16_t display_width() { return width_; }
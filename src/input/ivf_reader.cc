@@ -40,3 +40,12 @@ Optional<RasterHandle> IVFReader::get_next_frame()
 
   return make_optional<RasterHandle>( true, player_.advance() );
 }
+
+IVFStreamReader::IVFStreamReader( const std::string & filename, const bool follow )
+  : player_( filename, follow )
+{}
+
+Optional<RasterHandle> IVFStreamReader::get_next_frame()
+{
+  return player_.advance();
+}
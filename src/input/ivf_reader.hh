@@ -44,4 +44,18 @@ public:
   uint16_t display_height() override { return player_.height(); }
 };
 
+/* decodes frames as they arrive on a pipe, or on a file still being
+   written (with follow) */
+class IVFStreamReader : public FrameInput
+{
+private:
+  StreamPlayer player_;
+
+public:
+  IVFStreamReader( const std::string & filename, const bool follow = false );
+  Optional<RasterHandle> get_next_frame() override;
+  uint16_t display_width() override { return player_.width(); }
+  uint16_t display_height() override { return player_.height(); }
+};
+
 #endif /* IVF_READER_HH */
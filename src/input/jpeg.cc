@@ -27,6 +27,7 @@
    OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE. */
 
 #include <array>
+#include <cstring>
 #include <iostream>
 
 #include "jpeg.hh"
@@ -139,12 +140,19 @@ void JPEGDecompresser::decode( BaseRaster & r )
 
   jpeg_finish_decompress( &decompresser_ );
 
-  memcpy( &r.Y().at( 0, 0 ), &Y_.get().at( 0, 0 ), width() * height() );
+  /* row by row: the raster's rows can be longer than the image's */
+  for ( size_t row = 0; row < height(); row++ ) {
+    memcpy( &r.Y().at( 0, row ), &Y_.get().at( 0, row ), width() );
+  }
 
+  /* 4:2:2 to 4:2:0, keeping the even rows */
   for ( size_t row = 0; row < height() / 2; row++ ) {
-    for ( size_t column = 0; column < width() / 2; column++ ) {
-      r.U().at( column, row ) = U_.get().at( column, row * 2 );
-      r.V().at( column, row ) = V_.get().at( column, row * 2 );
-    }
+    memcpy( &r.U().at( 0, row ), &U_.get().at( 0, row * 2 ), width() / 2 );
+    memcpy( &r.V().at( 0, row ), &V_.get().at( 0, row * 2 ), width() / 2 );
   }
 }
+
+void JPEGDecompresser::abort_decoding()
+{
+  jpeg_abort_decompress( &decompresser_ );
+}
@@ -56,6 +56,9 @@ public:
 
   void decode( BaseRaster & r );
 
+  /* drops a frame that failed in begin_decoding() or decode() */
+  void abort_decoding();
+
   unsigned int width() const;
   unsigned int height() const;
 };
@@ -0,0 +1,295 @@
+/* -*-mode:c++; tab-width: 2; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+
+/* Copyright 2013-2018 the Alfalfa authors
+                       and the Massachusetts Institute of Technology
+
+   Redistribution and use in source and binary forms, with or without
+   modification, are permitted provided that the following conditions are
+   met:
+
+      1. Redistributions of source code must retain the above copyright
+         notice, this list of conditions and the following disclaimer.
+
+      2. Redistributions in binary form must reproduce the above copyright
+         notice, this list of conditions and the following disclaimer in the
+         documentation and/or other materials provided with the distribution.
+
+   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+   "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+   LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+   A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+   HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+   SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+   LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+   DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+   THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+   (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+   OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE. */
+
+#include <cstring>
+
+#include "pixel_format.hh"
+
+#ifdef HAVE_SSE2
+#include <emmintrin.h>
+#endif
+
+#ifdef HAVE_AVX2
+#include <immintrin.h>
+#define TARGET_AVX2 __attribute__(( target( "avx2" ) ))
+#endif
+
+using namespace std;
+
+/* C reference */
+
+static void yuyv_row_c( const uint8_t * line, const unsigned int first_column, const unsigned int width,
+                        uint8_t * y, uint8_t * u, uint8_t * v )
+{
+  for ( unsigned int column = first_column; column < width; column++ ) {
+    y[ column ] = line[ 2 * column ];
+  }
+
+  if ( u ) {
+    for ( unsigned int column = first_column / 2; column < width / 2; column++ ) {
+      u[ column ] = line[ 4 * column + 1 ];
+      v[ column ] = line[ 4 * column + 3 ];
+    }
+  }
+}
+
+static void deinterleave_c( const uint8_t * uv, const unsigned int first_pair, const unsigned int pairs,
+                            uint8_t * u, uint8_t * v )
+{
+  for ( unsigned int i = first_pair; i < pairs; i++ ) {
+    u[ i ] = uv[ 2 * i ];
+    v[ i ] = uv[ 2 * i + 1 ];
+  }
+}
+
+/* the chroma of the even rows goes to the chroma planes, the rest only has
+   its luma taken */
+template<class RowFunction>
+static void forall_yuyv_rows( const uint8_t * src, const unsigned int width, const unsigned int height,
+                              const PlanarImage & dst, RowFunction && convert_row )
+{
+  for ( unsigned int row = 0; row < height; row++ ) {
+    const bool chroma_row = ( row % 2 == 0 ) and ( row / 2 < height / 2 );
+
+    convert_row( src + size_t( row ) * width * 2, width,
+                 dst.y + row * dst.y_stride,
+                 chroma_row ? dst.u + ( row / 2 ) * dst.uv_stride : nullptr,
+                 chroma_row ? dst.v + ( row / 2 ) * dst.uv_stride : nullptr );
+  }
+}
+
+template<class DeinterleaveFunction>
+static void forall_nv12_rows( const uint8_t * src, const unsigned int width, const unsigned int height,
+                              const PlanarImage & dst, DeinterleaveFunction && deinterleave )
+{
+  for ( unsigned int row = 0; row < height; row++ ) {
+    memcpy( dst.y + row * dst.y_stride, src + size_t( row ) * width, width );
+  }
+
+  const uint8_t * chroma = src + size_t( width ) * height;
+
+  for ( unsigned int row = 0; row < height / 2; row++ ) {
+    deinterleave( chroma + size_t( row ) * width, width / 2,
+                  dst.u + row * dst.uv_stride, dst.v + row * dst.uv_stride );
+  }
+}
+
+void yuyv_to_i420_c( const uint8_t * src, const unsigned int width, const unsigned int height,
+                     const PlanarImage & dst )
+{
+  forall_yuyv_rows( src, width, height, dst,
+    [] ( const uint8_t * line, const unsigned int w, uint8_t * y, uint8_t * u, uint8_t * v )
+    { yuyv_row_c( line, 0, w, y, u, v ); } );
+}
+
+void nv12_to_i420_c( const uint8_t * src, const unsigned int width, const unsigned int height,
+                     const PlanarImage & dst )
+{
+  forall_nv12_rows( src, width, height, dst,
+    [] ( const uint8_t * uv, const unsigned int pairs, uint8_t * u, uint8_t * v )
+    { deinterleave_c( uv, 0, pairs, u, v ); } );
+}
+
+#ifdef HAVE_SSE2
+
+/* 16 pixels at a time; the odd bytes of YUYV are the chroma */
+static void yuyv_row_sse2( const uint8_t * line, const unsigned int width,
+                           uint8_t * y, uint8_t * u, uint8_t * v )
+{
+  const __m128i low_bytes = _mm_set1_epi16( 0x00FF );
+  unsigned int column = 0;
+
+  for ( ; column + 16 <= width; column += 16 ) {
+    const __m128i x0 = _mm_loadu_si128( reinterpret_cast<const __m128i *>( line + 2 * column ) );
+    const __m128i x1 = _mm_loadu_si128( reinterpret_cast<const __m128i *>( line + 2 * column + 16 ) );
+
+    _mm_storeu_si128( reinterpret_cast<__m128i *>( y + column ),
+                      _mm_packus_epi16( _mm_and_si128( x0, low_bytes ), _mm_and_si128( x1, low_bytes ) ) );
+
+    if ( u ) {
+      /* U0 V0 U1 V1 ..., then U0 ... U7 V0 ... V7 */
+      const __m128i uv = _mm_packus_epi16( _mm_srli_epi16( x0, 8 ), _mm_srli_epi16( x1, 8 ) );
+      const __m128i planar = _mm_packus_epi16( _mm_and_si128( uv, low_bytes ), _mm_srli_epi16( uv, 8 ) );
+
+      _mm_storel_epi64( reinterpret_cast<__m128i *>( u + column / 2 ), planar );
+      _mm_storel_epi64( reinterpret_cast<__m128i *>( v + column / 2 ), _mm_srli_si128( planar, 8 ) );
+    }
+  }
+
+  yuyv_row_c( line, column, width, y, u, v );
+}
+
+static void deinterleave_sse2( const uint8_t * uv, const unsigned int pairs, uint8_t * u, uint8_t * v )
+{
+  const __m128i low_bytes = _mm_set1_epi16( 0x00FF );
+  unsigned int i = 0;
+
+  for ( ; i + 16 <= pairs; i += 16 ) {
+    const __m128i x0 = _mm_loadu_si128( reinterpret_cast<const __m128i *>( uv + 2 * i ) );
+    const __m128i x1 = _mm_loadu_si128( reinterpret_cast<const __m128i *>( uv + 2 * i + 16 ) );
+
+    _mm_storeu_si128( reinterpret_cast<__m128i *>( u + i ),
+                      _mm_packus_epi16( _mm_and_si128( x0, low_bytes ), _mm_and_si128( x1, low_bytes ) ) );
+    _mm_storeu_si128( reinterpret_cast<__m128i *>( v + i ),
+                      _mm_packus_epi16( _mm_srli_epi16( x0, 8 ), _mm_srli_epi16( x1, 8 ) ) );
+  }
+
+  deinterleave_c( uv, i, pairs, u, v );
+}
+
+void yuyv_to_i420_sse2( const uint8_t * src, const unsigned int width, const unsigned int height,
+                        const PlanarImage & dst )
+{
+  forall_yuyv_rows( src, width, height, dst, yuyv_row_sse2 );
+}
+
+void nv12_to_i420_sse2( const uint8_t * src, const unsigned int width, const unsigned int height,
+                        const PlanarImage & dst )
+{
+  forall_nv12_rows( src, width, height, dst, deinterleave_sse2 );
+}
+
+#endif /* HAVE_SSE2 */
+
+#ifdef HAVE_AVX2
+
+/* the file is built without -mavx2: these are compiled for AVX2 through the
+   target attribute and only called when cpu_supports_avx2() */
+
+static bool cpu_supports_avx2()
+{
+  static const bool supported = __builtin_cpu_supports( "avx2" );
+  return supported;
+}
+
+/* packs the 16-bit lanes of a and b into bytes, in order (the AVX2 pack
+   works within 128-bit lanes) */
+TARGET_AVX2 static inline __m256i pack_in_order( const __m256i a, const __m256i b )
+{
+  return _mm256_permute4x64_epi64( _mm256_packus_epi16( a, b ), 0xD8 );
+}
+
+TARGET_AVX2 static void yuyv_row_avx2( const uint8_t * line, const unsigned int width,
+                                       uint8_t * y, uint8_t * u, uint8_t * v )
+{
+  const __m256i low_bytes = _mm256_set1_epi16( 0x00FF );
+  unsigned int column = 0;
+
+  for ( ; column + 32 <= width; column += 32 ) {
+    const __m256i x0 = _mm256_loadu_si256( reinterpret_cast<const __m256i *>( line + 2 * column ) );
+    const __m256i x1 = _mm256_loadu_si256( reinterpret_cast<const __m256i *>( line + 2 * column + 32 ) );
+
+    _mm256_storeu_si256( reinterpret_cast<__m256i *>( y + column ),
+                         pack_in_order( _mm256_and_si256( x0, low_bytes ), _mm256_and_si256( x1, low_bytes ) ) );
+
+    if ( u ) {
+      const __m256i uv = pack_in_order( _mm256_srli_epi16( x0, 8 ), _mm256_srli_epi16( x1, 8 ) );
+      const __m256i planar = pack_in_order( _mm256_and_si256( uv, low_bytes ), _mm256_srli_epi16( uv, 8 ) );
+
+      _mm_storeu_si128( reinterpret_cast<__m128i *>( u + column / 2 ), _mm256_castsi256_si128( planar ) );
+      _mm_storeu_si128( reinterpret_cast<__m128i *>( v + column / 2 ), _mm256_extracti128_si256( planar, 1 ) );
+    }
+  }
+
+  yuyv_row_c( line, column, width, y, u, v );
+}
+
+TARGET_AVX2 static void deinterleave_avx2( const uint8_t * uv, const unsigned int pairs,
+                                           uint8_t * u, uint8_t * v )
+{
+  const __m256i low_bytes = _mm256_set1_epi16( 0x00FF );
+  unsigned int i = 0;
+
+  for ( ; i + 32 <= pairs; i += 32 ) {
+    const __m256i x0 = _mm256_loadu_si256( reinterpret_cast<const __m256i *>( uv + 2 * i ) );
+    const __m256i x1 = _mm256_loadu_si256( reinterpret_cast<const __m256i *>( uv + 2 * i + 32 ) );
+
+    _mm256_storeu_si256( reinterpret_cast<__m256i *>( u + i ),
+                         pack_in_order( _mm256_and_si256( x0, low_bytes ), _mm256_and_si256( x1, low_bytes ) ) );
+    _mm256_storeu_si256( reinterpret_cast<__m256i *>( v + i ),
+                         pack_in_order( _mm256_srli_epi16( x0, 8 ), _mm256_srli_epi16( x1, 8 ) ) );
+  }
+
+  deinterleave_c( uv, i, pairs, u, v );
+}
+
+void yuyv_to_i420_avx2( const uint8_t * src, const unsigned int width, const unsigned int height,
+                        const PlanarImage & dst )
+{
+  forall_yuyv_rows( src, width, height, dst, yuyv_row_avx2 );
+}
+
+void nv12_to_i420_avx2( const uint8_t * src, const unsigned int width, const unsigned int height,
+                        const PlanarImage & dst )
+{
+  forall_nv12_rows( src, width, height, dst, deinterleave_avx2 );
+}
+
+#endif /* HAVE_AVX2 */
+
+static PlanarImage planes_of( BaseRaster & raster )
+{
+  return { &raster.Y().at( 0, 0 ), &raster.U().at( 0, 0 ), &raster.V().at( 0, 0 ),
+           raster.Y().width(), raster.U().width() };
+}
+
+void yuyv_to_i420( const uint8_t * src, BaseRaster & raster )
+{
+  const PlanarImage dst = planes_of( raster );
+
+#ifdef HAVE_AVX2
+  if ( cpu_supports_avx2() ) {
+    yuyv_to_i420_avx2( src, raster.display_width(), raster.display_height(), dst );
+    return;
+  }
+#endif
+
+#ifdef HAVE_SSE2
+  yuyv_to_i420_sse2( src, raster.display_width(), raster.display_height(), dst );
+#else
+  yuyv_to_i420_c( src, raster.display_width(), raster.display_height(), dst );
+#endif
+}
+
+void nv12_to_i420( const uint8_t * src, BaseRaster & raster )
+{
+  const PlanarImage dst = planes_of( raster );
+
+#ifdef HAVE_AVX2
+  if ( cpu_supports_avx2() ) {
+    nv12_to_i420_avx2( src, raster.display_width(), raster.display_height(), dst );
+    return;
+  }
+#endif
+
+#ifdef HAVE_SSE2
+  nv12_to_i420_sse2( src, raster.display_width(), raster.display_height(), dst );
+#else
+  nv12_to_i420_c( src, raster.display_width(), raster.display_height(), dst );
+#endif
+}
@@ -0,0 +1,75 @@
+/* -*-mode:c++; tab-width: 2; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+
+/* Copyright 2013-2018 the Alfalfa authors
+                       and the Massachusetts Institute of Technology
+
+   Redistribution and use in source and binary forms, with or without
+   modification, are permitted provided that the following conditions are
+   met:
+
+      1. Redistributions of source code must retain the above copyright
+         notice, this list of conditions and the following disclaimer.
+
+      2. Redistributions in binary form must reproduce the above copyright
+         notice, this list of conditions and the following disclaimer in the
+         documentation and/or other materials provided with the distribution.
+
+   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+   "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+   LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+   A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+   HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+   SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+   LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+   DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+   THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+   (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+   OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE. */
+
+#ifndef PIXEL_FORMAT_HH
+#define PIXEL_FORMAT_HH
+
+/* Conversions from the packed (YUYV) and semi-planar (NV12) formats that
+   cameras deliver to the planar 4:2:0 of our rasters, one set per
+   instruction set. The C versions are the reference: the others give the
+   same bytes (see tests/pixel-format-benchmark). YUYV is 4:2:2; its chroma
+   is taken from the even rows. */
+
+#include <cstdint>
+#include <cstddef>
+
+#include "config.h"
+#include "raster.hh"
+
+/* where the planes of the converted image go */
+struct PlanarImage
+{
+  uint8_t * y, * u, * v;
+  size_t y_stride, uv_stride;
+};
+
+void yuyv_to_i420_c( const uint8_t * src, const unsigned int width, const unsigned int height,
+                     const PlanarImage & dst );
+void nv12_to_i420_c( const uint8_t * src, const unsigned int width, const unsigned int height,
+                     const PlanarImage & dst );
+
+#ifdef HAVE_SSE2
+void yuyv_to_i420_sse2( const uint8_t * src, const unsigned int width, const unsigned int height,
+                        const PlanarImage & dst );
+void nv12_to_i420_sse2( const uint8_t * src, const unsigned int width, const unsigned int height,
+                        const PlanarImage & dst );
+#endif
+
+/* only to be called if the CPU has AVX2 */
+#ifdef HAVE_AVX2
+void yuyv_to_i420_avx2( const uint8_t * src, const unsigned int width, const unsigned int height,
+                        const PlanarImage & dst );
+void nv12_to_i420_avx2( const uint8_t * src, const unsigned int width, const unsigned int height,
+                        const PlanarImage & dst );
+#endif
+
+/* the fastest version the CPU runs, into the display area of the raster */
+void yuyv_to_i420( const uint8_t * src, BaseRaster & raster );
+void nv12_to_i420( const uint8_t * src, BaseRaster & raster );
+
+#endif /* PIXEL_FORMAT_HH */
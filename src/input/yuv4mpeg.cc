@@ -29,9 +29,21 @@
 #include "yuv4mpeg.hh"
 
 #include <fcntl.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <mutex>
 #include <sstream>
+#include <thread>
 #include <utility>
-#include <algorithm>
+
+#include "mmap_region.hh"
 
 using namespace std;
 
@@ -144,88 +156,177 @@ pair< size_t, size_t > YUV4MPEGReader::parse_fraction( const string & fraction_s
   return make_pair( numerator, denominator );
 }
 
-YUV4MPEGReader::YUV4MPEGReader( const string & filename )
-  : YUV4MPEGReader( SystemCall( filename,
-                    open( filename.c_str(),
-                          O_RDONLY, 0 ) ) )
-{}
+namespace {
 
-YUV4MPEGReader::YUV4MPEGReader( FileDescriptor && fd )
-  : header_(),
-    fd_( move( fd ) )
+/* where the bytes of the stream come from */
+class ByteSource
 {
-  string header_str = fd_.getline();
-  istringstream ssin( header_str );
+public:
+  /* the next line, without its newline; nothing at the end of the stream */
+  virtual Optional<string> getline() = 0;
 
-  string token;
-  ssin >> token;
+  /* the next `length` bytes, valid until the next call */
+  virtual const uint8_t * take( const size_t length ) = 0;
 
-  if ( token != "YUV4MPEG2" ) {
-    throw runtime_error( "invalid yuv4mpeg2 magic code" );
+  virtual ~ByteSource() = default;
+};
+
+/* a regular file, mapped whole; frames are copied straight from the mapping */
+class MappedSource : public ByteSource
+{
+private:
+  FileDescriptor fd_;
+  MMap_Region region_;
+  size_t offset_;
+
+public:
+  MappedSource( FileDescriptor && fd, const size_t offset )
+    : fd_( move( fd ) ),
+      region_( fd_.size(), PROT_READ, MAP_SHARED, fd_.fd_num() ),
+      offset_( offset )
+  {
+    /* only a hint */
+    madvise( region_.addr(), region_.length(), MADV_SEQUENTIAL );
   }
 
-  while ( ssin >> token ) {
-    if ( token.length() == 0 ) {
-      break;
+  Optional<string> getline() override
+  {
+    if ( offset_ >= region_.length() ) {
+      return {};
     }
 
-    switch ( token[0] ) {
-    case 'W': // width
-      header_.width = stoi( token.substr( 1 ) );
-      break;
+    const uint8_t * begin = region_.addr() + offset_;
+    const void * newline = memchr( begin, '\n', region_.length() - offset_ );
+    if ( not newline ) {
+      throw runtime_error( "yuv4mpeg2: truncated line" );
+    }
 
-    case 'H': // height
-      header_.height = stoi( token.substr( 1 ) );
-      break;
+    const size_t length = static_cast<const uint8_t *>( newline ) - begin;
+    offset_ += length + 1;
 
-    case 'F': // framerate
-    {
-      pair< size_t, size_t > fps = YUV4MPEGReader::parse_fraction( token.substr( 1 ) );
-      header_.fps_numerator = fps.first;
-      header_.fps_denominator = fps.second;
-      break;
+    return string( reinterpret_cast<const char *>( begin ), length );
+  }
+
+  const uint8_t * take( const size_t length ) override
+  {
+    if ( region_.length() - offset_ < length ) {
+      throw runtime_error( "yuv4mpeg2: truncated frame" );
     }
 
-    case 'I':
-      if ( token.length() < 2 ) {
-        throw runtime_error( "invalid interlacing mode" );
-      }
+    const uint8_t * ret = region_.addr() + offset_;
+    offset_ += length;
+    return ret;
+  }
+};
 
-      switch ( token[ 1 ] ) {
-      case 'p': header_.interlacing_mode = YUV4MPEGHeader::InterlacingMode::PROGRESSIVE; break;
-      case 't': header_.interlacing_mode = YUV4MPEGHeader::InterlacingMode::TOP_FIELD_FIRST; break;
-      case 'b': header_.interlacing_mode = YUV4MPEGHeader::InterlacingMode::BOTTOM_FIELD_FIRST; break;
-      case 'm': header_.interlacing_mode = YUV4MPEGHeader::InterlacingMode::MIXED_MODES; break;
-      default: throw runtime_error( "invalid interlacing mode" );
+/* thrown out of a blocked read when the reader is being destroyed */
+struct ReaderStopped {};
+
+/* a pipe or anything else that cannot be mapped, read in large blocks */
+class BufferedSource : public ByteSource
+{
+private:
+  static constexpr size_t BLOCK_SIZE = 1 << 20;
+  static constexpr size_t MAX_LINE_LENGTH = 4096;
+
+  FileDescriptor fd_;
+  const atomic<bool> & stopping_;
+
+  vector<uint8_t> buffer_;
+  size_t begin_ { 0 }, end_ { 0 };
+  bool eof_ { false };
+
+  /* reads until at least `wanted` bytes are buffered; false on EOF */
+  bool fill( const size_t wanted )
+  {
+    if ( begin_ > 0 ) {
+      memmove( buffer_.data(), buffer_.data() + begin_, end_ - begin_ );
+      end_ -= begin_;
+      begin_ = 0;
+    }
+
+    if ( buffer_.size() < wanted ) {
+      buffer_.resize( wanted + BLOCK_SIZE );
+    }
+
+    while ( end_ < wanted and not eof_ ) {
+      /* wake up now and then to see if the reader is going away */
+      pollfd readable { fd_.fd_num(), POLLIN, 0 };
+      while ( SystemCall( "poll", ::poll( &readable, 1, 100 ) ) == 0 ) {
+        if ( stopping_ ) {
+          throw ReaderStopped();
+        }
       }
-      break;
 
-    case 'A': // pixel aspect ratio
-    {
-      pair< size_t, size_t > aspect_ratio = YUV4MPEGReader::parse_fraction( token.substr( 1 ) );
-      header_.pixel_aspect_ratio_numerator = aspect_ratio.first;
-      header_.pixel_aspect_ratio_denominator = aspect_ratio.second;
-      break;
+      const size_t bytes_read = SystemCall( "read", ::read( fd_.fd_num(), buffer_.data() + end_,
+                                                            buffer_.size() - end_ ) );
+      eof_ = ( bytes_read == 0 );
+      end_ += bytes_read;
     }
 
-    case 'C': // color space
-        if ( token.substr( 0, 4 ) != "C420" ) {
-          throw runtime_error( "only yuv420 color space is supported" );
+    return end_ >= wanted;
+  }
+
+public:
+  BufferedSource( FileDescriptor && fd, const atomic<bool> & stopping )
+    : fd_( move( fd ) ), stopping_( stopping ), buffer_( BLOCK_SIZE )
+  {}
+
+  Optional<string> getline() override
+  {
+    size_t scanned = 0;
+
+    while ( true ) {
+      const uint8_t * begin = buffer_.data() + begin_;
+      const void * newline = memchr( begin + scanned, '\n', end_ - begin_ - scanned );
+
+      if ( newline ) {
+        const size_t length = static_cast<const uint8_t *>( newline ) - begin;
+        begin_ += length + 1;
+        return string( reinterpret_cast<const char *>( begin ), length );
+      }
+
+      scanned = end_ - begin_;
+
+      if ( scanned > MAX_LINE_LENGTH ) {
+        throw runtime_error( "yuv4mpeg2: line too long" );
+      }
+
+      if ( not fill( scanned + 1 ) ) {
+        if ( scanned == 0 ) {
+          return {};
         }
-        header_.color_space = YUV4MPEGHeader::ColorSpace::C420;
-        break;
 
-    case 'X': // comment
-      break;
+        throw runtime_error( "yuv4mpeg2: truncated line" );
+      }
+    }
+  }
 
-    default:
-      throw runtime_error( "invalid yuv4mpeg2 input format" );
+  const uint8_t * take( const size_t length ) override
+  {
+    if ( end_ - begin_ < length and not fill( length ) ) {
+      throw runtime_error( "yuv4mpeg2: truncated frame" );
     }
+
+    const uint8_t * ret = buffer_.data() + begin_;
+    begin_ += length;
+    return ret;
   }
+};
 
-  if ( header_.width == 0 or header_.height == 0 ) {
-    throw runtime_error( "width or height missing" );
+void copy_plane( const uint8_t * source, TwoD<uint8_t> & plane,
+                 const unsigned int width, const unsigned int height )
+{
+  if ( plane.width() == width ) {
+    memcpy( &plane.at( 0, 0 ), source, width * height );
+    return;
   }
+
+  for ( unsigned int row = 0; row < height; row++ ) {
+    memcpy( &plane.at( 0, row ), source + row * width, width );
+  }
+}
+
 }
 
 void edge_extend_component( TwoD<uint8_t> & component,
@@ -270,40 +371,273 @@ void edge_extend( BaseRaster & raster )
   edge_extend_component( raster.V(), raster.chroma_display_width(), raster.chroma_display_height() );
 }
 
-Optional<RasterHandle> YUV4MPEGReader::get_next_frame()
+Optional<RasterHandle> read_frame( ByteSource & bytes, const uint16_t width, const uint16_t height )
 {
-  MutableRasterHandle raster { header_.width, header_.height };
-
-  string frame_header = fd_.getline();
-  if ( fd_.eof() ) {
+  const Optional<string> frame_header = bytes.getline();
+  if ( not frame_header.initialized() ) {
     return {};
   }
 
-  if ( frame_header != "FRAME" ) {
+  /* the frame header may carry parameters, which we ignore */
+  if ( frame_header.get().compare( 0, 5, "FRAME" ) != 0
+       or ( frame_header.get().size() > 5 and frame_header.get()[ 5 ] != ' ' ) ) {
     throw runtime_error( "invalid yuv4mpeg2 input format" );
   }
 
-  string read_data;
+  MutableRasterHandle raster { width, height };
+
+  copy_plane( bytes.take( width * height ), raster.get().Y(), width, height );
+  copy_plane( bytes.take( ( width / 2 ) * ( height / 2 ) ), raster.get().U(), width / 2, height / 2 );
+  copy_plane( bytes.take( ( width / 2 ) * ( height / 2 ) ), raster.get().V(), width / 2, height / 2 );
+
+  /* edge-extend the raster */
+  edge_extend( raster.get() );
+
+  return { move( raster ) };
+}
+
+/* the byte source, and the thread that reads frames ahead into a queue */
+class YUV4MPEGReader::Source
+{
+private:
+  atomic<bool> stopping_ { false };
+  unique_ptr<ByteSource> bytes_;
+
+  size_t depth_;
+  uint16_t width_ { 0 }, height_ { 0 };
+
+  mutable mutex mutex_ {};
+  condition_variable changed_ {};
+  deque<Optional<RasterHandle>> queue_ {};
+  exception_ptr error_ {};
+  bool finished_ { false };
+
+  thread reader_ {};
 
-  for ( size_t row = 0; row < display_height(); row++ ) {
-    read_data = fd_.read_exactly( display_width() );
-    memcpy( &raster.get().Y().storage()->at( 0, row ), &read_data[ 0 ], read_data.length() );
+  void read_ahead()
+  {
+    try {
+      while ( true ) {
+        Optional<RasterHandle> frame = read_frame( *bytes_, width_, height_ );
+        const bool end_of_stream = not frame.initialized();
+
+        unique_lock<mutex> lock { mutex_ };
+        changed_.wait( lock, [this] () { return stopping_ or queue_.size() < depth_; } );
+
+        if ( stopping_ ) {
+          return;
+        }
+
+        queue_.push_back( move( frame ) );
+        changed_.notify_all();
+
+        if ( end_of_stream ) {
+          return;
+        }
+      }
+    }
+    catch ( const ReaderStopped & ) {}
+    catch ( ... ) {
+      unique_lock<mutex> lock { mutex_ };
+      error_ = current_exception();
+      changed_.notify_all();
+    }
   }
 
-  for ( size_t row = 0; row < display_height() / 2; row++ ) {
-    read_data = fd_.read_exactly( display_width() / 2 );
-    memcpy( &raster.get().U().storage()->at( 0, row ), &read_data[ 0 ], read_data.length() );
+public:
+  Source( FileDescriptor && fd, const size_t depth )
+    : bytes_(), depth_( depth )
+  {
+    struct stat info;
+    SystemCall( "fstat", fstat( fd.fd_num(), &info ) );
+
+    if ( S_ISREG( info.st_mode ) and info.st_size > 0 ) {
+      const off_t offset = lseek( fd.fd_num(), 0, SEEK_CUR );
+      if ( offset < 0 ) {
+        throw unix_error( "lseek" );
+      }
+
+      bytes_.reset( new MappedSource( move( fd ), offset ) );
+    }
+    else {
+      bytes_.reset( new BufferedSource( move( fd ), stopping_ ) );
+    }
   }
 
-  for ( size_t row = 0; row < display_height() / 2; row++ ) {
-    read_data = fd_.read_exactly( display_width() / 2 );
-    memcpy( &raster.get().V().storage()->at( 0, row ), &read_data[ 0 ], read_data.length() );
+  ~Source()
+  {
+    {
+      unique_lock<mutex> lock { mutex_ };
+      stopping_ = true;
+      changed_.notify_all();
+    }
+
+    if ( reader_.joinable() ) {
+      reader_.join();
+    }
   }
 
-  /* edge-extend the raster */
-  edge_extend( raster.get() );
+  Source( const Source & ) = delete;
+  Source & operator=( const Source & ) = delete;
 
-  return { move( raster ) };
+  Optional<string> getline() { return bytes_->getline(); }
+
+  void start( const uint16_t width, const uint16_t height )
+  {
+    width_ = width;
+    height_ = height;
+
+    if ( depth_ > 0 ) {
+      reader_ = thread( [this] () { read_ahead(); } );
+    }
+  }
+
+  Optional<RasterHandle> next()
+  {
+    if ( depth_ == 0 ) {
+      return read_frame( *bytes_, width_, height_ );
+    }
+
+    unique_lock<mutex> lock { mutex_ };
+    changed_.wait( lock, [this] () { return finished_ or not queue_.empty() or error_; } );
+
+    if ( finished_ ) {
+      return {};
+    }
+
+    if ( queue_.empty() ) {
+      rethrow_exception( error_ );
+    }
+
+    if ( not queue_.front().initialized() ) {
+      /* the reader reached the end of the file */
+      queue_.pop_front();
+      changed_.notify_all();
+
+      finished_ = true;
+      return {};
+    }
+
+    RasterHandle frame = move( queue_.front().get() );
+    queue_.pop_front();
+    changed_.notify_all();
+
+    return frame;
+  }
+
+  size_t queued() const
+  {
+    unique_lock<mutex> lock { mutex_ };
+    return queue_.size();
+  }
+};
+
+YUV4MPEGReader::YUV4MPEGReader( const string & filename, const size_t prefetch_depth )
+  : YUV4MPEGReader( SystemCall( filename,
+                    open( filename.c_str(),
+                          O_RDONLY, 0 ) ), prefetch_depth )
+{}
+
+YUV4MPEGReader::YUV4MPEGReader( FileDescriptor && fd, const size_t prefetch_depth )
+  : header_(),
+    source_( new Source( move( fd ), prefetch_depth ) )
+{
+  const Optional<string> header_str = source_->getline();
+  if ( not header_str.initialized() ) {
+    throw runtime_error( "empty yuv4mpeg2 input" );
+  }
+
+  parse_header( header_str.get() );
+  source_->start( header_.width, header_.height );
+}
+
+YUV4MPEGReader::~YUV4MPEGReader() = default;
+YUV4MPEGReader::YUV4MPEGReader( YUV4MPEGReader && other ) = default;
+YUV4MPEGReader & YUV4MPEGReader::operator=( YUV4MPEGReader && other ) = default;
+
+void YUV4MPEGReader::parse_header( const string & header_str )
+{
+  istringstream ssin( header_str );
+
+  string token;
+  ssin >> token;
+
+  if ( token != "YUV4MPEG2" ) {
+    throw runtime_error( "invalid yuv4mpeg2 magic code" );
+  }
+
+  while ( ssin >> token ) {
+    if ( token.length() == 0 ) {
+      break;
+    }
+
+    switch ( token[0] ) {
+    case 'W': // width
+      header_.width = stoi( token.substr( 1 ) );
+      break;
+
+    case 'H': // height
+      header_.height = stoi( token.substr( 1 ) );
+      break;
+
+    case 'F': // framerate
+    {
+      pair< size_t, size_t > fps = YUV4MPEGReader::parse_fraction( token.substr( 1 ) );
+      header_.fps_numerator = fps.first;
+      header_.fps_denominator = fps.second;
+      break;
+    }
+
+    case 'I':
+      if ( token.length() < 2 ) {
+        throw runtime_error( "invalid interlacing mode" );
+      }
+
+      switch ( token[ 1 ] ) {
+      case 'p': header_.interlacing_mode = YUV4MPEGHeader::InterlacingMode::PROGRESSIVE; break;
+      case 't': header_.interlacing_mode = YUV4MPEGHeader::InterlacingMode::TOP_FIELD_FIRST; break;
+      case 'b': header_.interlacing_mode = YUV4MPEGHeader::InterlacingMode::BOTTOM_FIELD_FIRST; break;
+      case 'm': header_.interlacing_mode = YUV4MPEGHeader::InterlacingMode::MIXED_MODES; break;
+      default: throw runtime_error( "invalid interlacing mode" );
+      }
+      break;
+
+    case 'A': // pixel aspect ratio
+    {
+      pair< size_t, size_t > aspect_ratio = YUV4MPEGReader::parse_fraction( token.substr( 1 ) );
+      header_.pixel_aspect_ratio_numerator = aspect_ratio.first;
+      header_.pixel_aspect_ratio_denominator = aspect_ratio.second;
+      break;
+    }
+
+    case 'C': // color space
+        if ( token.substr( 0, 4 ) != "C420" ) {
+          throw runtime_error( "only yuv420 color space is supported" );
+        }
+        header_.color_space = YUV4MPEGHeader::ColorSpace::C420;
+        break;
+
+    case 'X': // comment
+      break;
+
+    default:
+      throw runtime_error( "invalid yuv4mpeg2 input format" );
+    }
+  }
+
+  if ( header_.width == 0 or header_.height == 0 ) {
+    throw runtime_error( "width or height missing" );
+  }
+}
+
+Optional<RasterHandle> YUV4MPEGReader::get_next_frame()
+{
+  return source_->next();
+}
+
+size_t YUV4MPEGReader::prefetched_frames() const
+{
+  return source_->queued();
 }
 
 void YUV4MPEGFrameWriter::write( const BaseRaster &rh, FileDescriptor &fd )
@@ -29,6 +29,7 @@
 #ifndef YUV4MPEG_HH
 #define YUV4MPEG_HH
 
+#include <memory>
 #include <string>
 
 #include "frame_input.hh"
@@ -64,17 +65,31 @@ public:
   std::string to_string();
 };
 
+/* Reads YUV4MPEG2 (4:2:0) streams. Regular files are memory-mapped; other
+   inputs (pipes, stdin) are read in large blocks. Unless prefetch_depth is
+   zero, a thread reads ahead up to that many frames into pooled rasters. */
 class YUV4MPEGReader : public FrameInput
 {
+public:
+  static constexpr size_t DEFAULT_PREFETCH_DEPTH = 4;
+
 private:
+  class Source;
+
   YUV4MPEGHeader header_;
-  FileDescriptor fd_;
+  std::unique_ptr<Source> source_;
 
   static std::pair< size_t, size_t > parse_fraction( const std::string & fraction_str );
+  void parse_header( const std::string & header_str );
 
 public:
-  YUV4MPEGReader( FileDescriptor && fd );
-  YUV4MPEGReader( const std::string & filename );
+  YUV4MPEGReader( FileDescriptor && fd, const size_t prefetch_depth = DEFAULT_PREFETCH_DEPTH );
+  YUV4MPEGReader( const std::string & filename, const size_t prefetch_depth = DEFAULT_PREFETCH_DEPTH );
+  ~YUV4MPEGReader();
+
+  YUV4MPEGReader( YUV4MPEGReader && other );
+  YUV4MPEGReader & operator=( YUV4MPEGReader && other );
+
   Optional<RasterHandle> get_next_frame() override;
 
   uint16_t display_width() override { return header_.width; }
@@ -86,7 +101,8 @@ public:
 
   YUV4MPEGHeader header() const { return header_; }
 
-  FileDescriptor & fd() { return fd_; }
+  /* frames read ahead and waiting in the queue (at most prefetch_depth) */
+  size_t prefetched_frames() const;
 };
 
 class YUV4MPEGFrameWriter
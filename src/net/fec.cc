@@ -0,0 +1,161 @@
+/* -*-mode:c++; tab-width: 2; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+
+/* Copyright 2013-2018 the Alfalfa authors
+                       and the Massachusetts Institute of Technology
+
+   Redistribution and use in source and binary forms, with or without
+   modification, are permitted provided that the following conditions are
+   met:
+
+      1. Redistributions of source code must retain the above copyright
+         notice, this list of conditions and the following disclaimer.
+
+      2. Redistributions in binary form must reproduce the above copyright
+         notice, this list of conditions and the following disclaimer in the
+         documentation and/or other materials provided with the distribution.
+
+   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+   "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+   LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+   A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+   HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+   SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+   LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+   DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+   THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+   (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+   OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE. */
+
+#include <array>
+#include <stdexcept>
+
+#include "fec.hh"
+
+using namespace std;
+
+namespace {
+
+/* log and antilog tables of GF(2^8) with the polynomial x^8+x^4+x^3+x^2+1 */
+struct GaloisField
+{
+  array<uint8_t, 512> exp {};
+  array<uint8_t, 256> log {};
+
+  GaloisField()
+  {
+    unsigned int x = 1;
+    for ( unsigned int i = 0; i < 255; i++ ) {
+      exp[ i ] = x;
+      log[ x ] = i;
+
+      x <<= 1;
+      if ( x & 0x100 ) {
+        x ^= 0x11d;
+      }
+    }
+
+    /* so that exp[ log[ a ] + log[ b ] ] needs no modulo */
+    for ( unsigned int i = 255; i < exp.size(); i++ ) {
+      exp[ i ] = exp[ i - 255 ];
+    }
+  }
+
+  uint8_t multiply( const uint8_t a, const uint8_t b ) const
+  {
+    return ( a == 0 or b == 0 ) ? 0 : exp[ log[ a ] + log[ b ] ];
+  }
+
+  uint8_t inverse( const uint8_t a ) const
+  {
+    if ( a == 0 ) {
+      throw runtime_error( "GF(2^8): zero has no inverse" );
+    }
+
+    return exp[ 255 - log[ a ] ];
+  }
+};
+
+const GaloisField & gf()
+{
+  static const GaloisField field;
+  return field;
+}
+
+}
+
+/* Cauchy matrix: 1 / ( x_j + y_i ), with the data fragments at y_i = i and
+   the parity at x_j = MAX_FEC_GROUP + j, so every square submatrix (one row
+   per parity fragment used, one column per missing fragment) is invertible */
+uint8_t fec_coefficient( const uint16_t parity_index, const uint16_t data_index )
+{
+  if ( data_index >= MAX_FEC_GROUP or parity_index >= MAX_FEC_PARITY ) {
+    throw out_of_range( "fec_coefficient: index out of range" );
+  }
+
+  return gf().inverse( ( MAX_FEC_GROUP + parity_index ) ^ data_index );
+}
+
+void fec_multiply_add( uint8_t * dest, const Chunk & src, const uint8_t coefficient )
+{
+  if ( coefficient == 0 ) {
+    return;
+  }
+
+  const GaloisField & field = gf();
+  const unsigned int log_coefficient = field.log[ coefficient ];
+
+  for ( size_t i = 0; i < src.size(); i++ ) {
+    const uint8_t x = src.buffer()[ i ];
+    if ( x ) {
+      dest[ i ] ^= field.exp[ field.log[ x ] + log_coefficient ];
+    }
+  }
+}
+
+vector<uint8_t> fec_invert( vector<uint8_t> matrix, const size_t n )
+{
+  const GaloisField & field = gf();
+
+  /* Gauss-Jordan elimination, applying the same row operations to the
+     identity */
+  vector<uint8_t> inverse( n * n, 0 );
+  for ( size_t i = 0; i < n; i++ ) {
+    inverse[ i * n + i ] = 1;
+  }
+
+  for ( size_t column = 0; column < n; column++ ) {
+    size_t pivot = column;
+    while ( pivot < n and matrix[ pivot * n + column ] == 0 ) {
+      pivot++;
+    }
+
+    if ( pivot == n ) {
+      throw runtime_error( "fec_invert: singular matrix" );
+    }
+
+    for ( size_t j = 0; j < n; j++ ) {
+      swap( matrix[ pivot * n + j ], matrix[ column * n + j ] );
+      swap( inverse[ pivot * n + j ], inverse[ column * n + j ] );
+    }
+
+    const uint8_t scale = field.inverse( matrix[ column * n + column ] );
+    for ( size_t j = 0; j < n; j++ ) {
+      matrix[ column * n + j ] = field.multiply( matrix[ column * n + j ], scale );
+      inverse[ column * n + j ] = field.multiply( inverse[ column * n + j ], scale );
+    }
+
+    for ( size_t row = 0; row < n; row++ ) {
+      const uint8_t factor = matrix[ row * n + column ];
+      if ( row == column or factor == 0 ) {
+        continue;
+      }
+
+      for ( size_t j = 0; j < n; j++ ) {
+        matrix[ row * n + j ] ^= field.multiply( factor, matrix[ column * n + j ] );
+        inverse[ row * n + j ] ^= field.multiply( factor, inverse[ column * n + j ] );
+      }
+    }
+  }
+
+  return inverse;
+}
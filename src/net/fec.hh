@@ -0,0 +1,127 @@
+/* -*-mode:c++; tab-width: 2; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+
+/* Copyright 2013-2018 the Alfalfa authors
+                       and the Massachusetts Institute of Technology
+
+   Redistribution and use in source and binary forms, with or without
+   modification, are permitted provided that the following conditions are
+   met:
+
+      1. Redistributions of source code must retain the above copyright
+         notice, this list of conditions and the following disclaimer.
+
+      2. Redistributions in binary form must reproduce the above copyright
+         notice, this list of conditions and the following disclaimer in the
+         documentation and/or other materials provided with the distribution.
+
+   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+   "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+   LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+   A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+   HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+   SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+   LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+   DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+   THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+   (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+   OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE. */
+
+#ifndef FEC_HH
+#define FEC_HH
+
+/* forward error correction for video fragments: a frame's k data fragments
+   are split into groups of at most MAX_FEC_GROUP consecutive fragments, and
+   each group is followed by p parity fragments of a systematic Cauchy
+   Reed-Solomon code over GF(2^8), so the receiver can rebuild any p lost
+   fragments of a group (from any of its members and parity) without a
+   round trip */
+
+#include <cmath>
+#include <cstdint>
+#include <algorithm>
+#include <vector>
+
+#include "chunk.hh"
+
+/* data fragments per group, and parity fragments per group, at most */
+static constexpr uint16_t MAX_FEC_GROUP = 64;
+static constexpr uint16_t MAX_FEC_PARITY = 256 - MAX_FEC_GROUP;
+
+/* data fragments per group for a frame of k data fragments: the groups are
+   as even as possible (only the last one may be shorter) */
+inline uint16_t fec_group_size( const uint16_t data_fragments )
+{
+  const uint16_t groups = ( data_fragments + MAX_FEC_GROUP - 1 ) / MAX_FEC_GROUP;
+  return ( data_fragments + groups - 1 ) / groups;
+}
+
+/* fraction of parity fragments to add for a given loss rate: none below
+   0.1% loss, then three times the loss rate (at most half) */
+inline double parity_ratio( const double loss_rate )
+{
+  if ( loss_rate < 0.001 ) {
+    return 0;
+  }
+
+  return std::min( 0.5, 3 * loss_rate );
+}
+
+/* number of parity fragments for a group of k data fragments: one more than
+   the ratio asks for, so that short groups survive a loss as well */
+inline uint16_t parity_fragments( const uint16_t data_fragments, const double ratio )
+{
+  if ( ratio <= 0 ) {
+    return 0;
+  }
+
+  return std::min<uint16_t>( MAX_FEC_PARITY, std::ceil( data_fragments * ratio ) + 1 );
+}
+
+/* coefficient of a group's data fragment in one of its parity fragments */
+uint8_t fec_coefficient( const uint16_t parity_index, const uint16_t data_index );
+
+/* dest ^= coefficient * src, over GF(2^8) */
+void fec_multiply_add( uint8_t * dest, const Chunk & src, const uint8_t coefficient );
+
+/* invert an n x n matrix over GF(2^8), stored by rows; the Cauchy
+   submatrices that recovery uses are always invertible */
+std::vector<uint8_t> fec_invert( std::vector<uint8_t> matrix, const size_t n );
+
+/* estimates the packet loss rate from the sequence numbers of the acks the
+   sender gets back (an exponentially-weighted average over packets). Feed it
+   data fragments only, numbered consecutively: parity that arrives after
+   its frame is complete is never acked, and would read as loss. */
+class LossRateEstimator
+{
+private:
+  static constexpr double ALPHA = 0.01;
+
+  double loss_rate_ { 0 };
+  uint64_t last_seq_ { 0 };
+  bool started_ { false };
+
+public:
+  void add_ack( const uint64_t seq )
+  {
+    if ( started_ and seq <= last_seq_ ) {
+      /* reordered or duplicate */
+      return;
+    }
+
+    if ( started_ ) {
+      /* the packets in between were lost (or their acks were) */
+      const uint64_t lost = std::min<uint64_t>( seq - last_seq_ - 1, 1000 );
+      for ( uint64_t i = 0; i < lost; i++ ) {
+        loss_rate_ = ALPHA + ( 1 - ALPHA ) * loss_rate_;
+      }
+    }
+
+    loss_rate_ = ( 1 - ALPHA ) * loss_rate_;
+    last_seq_ = seq;
+    started_ = true;
+  }
+
+  double loss_rate() const { return loss_rate_; }
+};
+
+#endif /* FEC_HH */
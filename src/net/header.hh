@@ -2,10 +2,14 @@
 #define HEADER_HH
 
 #include <cstdio>
+#include <cstring>
+#include <endian.h>
 // #include <stdint.h>
 
 /* total length of a data packet header is 24 bytes */
 struct Header{
+  static constexpr size_t SIZE = 24;
+
   uint16_t connection_id_;
   uint32_t source_state_;
   uint32_t target_state_;
@@ -71,6 +75,28 @@ struct Header{
   {}
 
   void set_payload_length( uint16_t payload_length ){payload_length_ = payload_length;}
+
+  /* write the header, little-endian, into SIZE bytes at dest */
+  void serialize( uint8_t * dest ) const
+  {
+    const uint16_t connection_id = htole16( connection_id_ );
+    const uint32_t source_state = htole32( source_state_ );
+    const uint32_t target_state = htole32( target_state_ );
+    const uint32_t frame_no = htole32( frame_no_ );
+    const uint16_t fragment_no = htole16( fragment_no_ );
+    const uint16_t fragments_in_this_frame = htole16( fragments_in_this_frame_ );
+    const uint32_t time_since_last = htole32( time_since_last_ );
+    const uint16_t payload_length = htole16( payload_length_ );
+
+    memcpy( dest + 0, &connection_id, 2 );
+    memcpy( dest + 2, &source_state, 4 );
+    memcpy( dest + 6, &target_state, 4 );
+    memcpy( dest + 10, &frame_no, 4 );
+    memcpy( dest + 14, &fragment_no, 2 );
+    memcpy( dest + 16, &fragments_in_this_frame, 2 );
+    memcpy( dest + 18, &time_since_last, 4 );
+    memcpy( dest + 22, &payload_length, 2 );
+  }
   // void set_fragments_in_this_frame( const uint16_t x ) {fragments_in_this_frame_ = x}
 };
 
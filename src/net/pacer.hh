@@ -30,48 +30,113 @@
 #define PACER_HH
 
 #include <deque>
+#include <algorithm>
 #include <chrono>
 #include <string>
+#include <stdexcept>
 
-/* pace outgoing packets */
+/* pace outgoing packets with a token bucket: tokens (bytes) accrue at the
+   current rate up to the burst size, and the packet at the head of the
+   queue is due once there are enough tokens for it (or a full bucket, for
+   packets larger than the burst); Datagram needs only a size() */
+template <class Datagram = std::string>
 class Pacer
 {
+public:
+  typedef std::chrono::steady_clock Clock;
+
 private:
-  struct ScheduledPacket {
-    std::chrono::system_clock::time_point when; /* scheduled outgoing time of packet */
-    std::string what; /* serialized packet contents */
-  };
+  double rate_ {}; /* bytes per microsecond */
+  double burst_ {}; /* bytes */
+
+  /* tokens in the bucket at last_update_ */
+  double tokens_;
+  Clock::time_point last_update_ { Clock::now() };
+
+  std::deque<Datagram> queue_ {};
 
-  std::deque<ScheduledPacket> queue_ {};
+  double tokens_at( const Clock::time_point & now ) const
+  {
+    const double elapsed = std::chrono::duration<double, std::micro>( now - last_update_ ).count();
+    return std::min( burst_, tokens_ + elapsed * rate_ );
+  }
+
+  void update( const Clock::time_point & now )
+  {
+    tokens_ = tokens_at( now );
+    last_update_ = now;
+  }
+
+  /* tokens the packet at the head of the queue needs */
+  double cost( void ) const
+  {
+    return std::min( burst_, double( queue_.front().size() ) );
+  }
 
 public:
-  int ms_until_due() const
+  /* rate in bytes per second, burst in bytes; the bucket starts full */
+  Pacer( const double rate, const size_t burst )
+    : burst_( burst ), tokens_( burst )
+  {
+    set_rate( rate );
+    set_burst( burst );
+  }
+
+  /* feed a new rate from the congestion controller; tokens already
+     earned at the old rate are kept */
+  void set_rate( const double rate )
+  {
+    if ( not ( rate > 0 ) ) {
+      throw std::runtime_error( "Pacer: rate must be positive" );
+    }
+
+    update( Clock::now() );
+    rate_ = rate / 1e6;
+  }
+
+  void set_burst( const size_t burst )
+  {
+    if ( burst == 0 ) {
+      throw std::runtime_error( "Pacer: burst must be positive" );
+    }
+
+    update( Clock::now() );
+    burst_ = burst;
+    tokens_ = std::min( tokens_, burst_ );
+  }
+
+  double rate( void ) const { return rate_ * 1e6; }
+  size_t burst( void ) const { return burst_; }
+
+  /* time until the packet at the head of the queue may leave */
+  std::chrono::microseconds us_until_due() const
   {
     if ( queue_.empty() ) {
-      return 1000; /* could be infinite, but if there's a bug I'd rather we find it in the first second */
+      return std::chrono::seconds( 1 ); /* could be infinite, but if there's a bug I'd rather we find it in the first second */
     }
 
-    int millis = std::chrono::duration_cast<std::chrono::milliseconds>( queue_.front().when - std::chrono::system_clock::now() ).count();
-    if ( millis < 0 ) {
-      millis = 0;
+    const double deficit = cost() - tokens_at( Clock::now() );
+    if ( deficit <= 0 ) {
+      return std::chrono::microseconds( 0 );
     }
 
-    return millis;
+    /* round up, so a wake-up at the deadline finds the packet due */
+    return std::chrono::microseconds( static_cast<int64_t>( deficit / rate_ ) + 1 );
   }
 
   bool empty() const { return queue_.empty(); }
-  void push( const std::string & payload, const int delay_microseconds )
+  void push( const Datagram & datagram ) { queue_.push_back( datagram ); }
+
+  const Datagram & front() const { return queue_.front(); }
+
+  /* send the head of the queue: spend its tokens */
+  void pop()
   {
-    if ( empty() ) {
-      queue_.push_back( { std::chrono::system_clock::now(), payload } );
-    } else {
-      queue_.push_back( { queue_.back().when + std::chrono::microseconds( delay_microseconds ),
-                          payload } );
-    }
+    update( Clock::now() );
+    tokens_ -= cost();
+    queue_.pop_front();
   }
 
-  const std::string & front() const { return queue_.front().what; }
-  void pop() { queue_.pop_front(); }
   size_t size() const { return queue_.size(); }
 };
 
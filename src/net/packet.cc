@@ -34,6 +34,7 @@
 #include <spdlog/spdlog.h>
 
 #include "packet.hh"
+#include "fec.hh"
 
 using namespace std;
 
@@ -58,53 +59,6 @@ string Packet::put_header_field( const uint64_t n )
                  sizeof( network_order ) );
 }
 
-Packet::Packet( const vector<uint8_t> & whole_frame,
-                const uint16_t connection_id,
-                const uint32_t source_state,
-                const uint32_t target_state,
-                const uint32_t frame_no,
-                const uint16_t fragment_no,
-                const uint16_t time_since_last,
-                size_t & next_fragment_start )
-  : valid_( true ), 
-  header_(connection_id, source_state, 
-  target_state, frame_no, fragment_no,
-  time_since_last),
-    // connection_id_( connection_id ),
-    // source_state_( source_state ),
-    // target_state_( target_state ),
-    // frame_no_( frame_no ),
-    // fragment_no_( fragment_no ),
-    // fragments_in_this_frame_( 0 ), /* temp value */
-    // time_since_last_( time_since_last ),
-    payload_()
-{
-  assert( not whole_frame.empty() );
-
-  size_t first_byte = MAXIMUM_PAYLOAD * fragment_no;
-  assert( first_byte < whole_frame.size() );
-
-  size_t length = min( whole_frame.size() - first_byte, MAXIMUM_PAYLOAD );
-  assert( first_byte + length <= whole_frame.size() );
-
-  payload_ = string( reinterpret_cast<const char*>( &whole_frame.at( first_byte ) ), length );
-
-  header_.set_payload_length(length);
-
-  // spdlog::info("Create packet with payload length is {}, ", length);
-
-  // spdlog::info("connection id {}, source state {}, target_state {}, frame_no {}, fragement_number {}, fragements in this frame {}, time since last {}",
-  //   header_.connection_id_, header_.source_state_, header_.target_state_, header_.fragment_no_, header_.fragment_no_,
-  //   header_.fragments_in_this_frame_, header_.time_since_last_
-  // );
-  // printf("Payload is: ");
-  // for (char& c : payload_)
-  //   printf("%x", c);
-  // printf("\n");
-
-  next_fragment_start = first_byte + length;
-}
-
 /* construct incoming Packet from a header and string*/
 Packet::Packet( const Header & header, const Chunk & str )
   : valid_( true ),
@@ -157,15 +111,10 @@ string Packet::to_string() const
 {
   assert( header_.fragments_in_this_frame_ > 0 );
 
-  return put_header_field( header_.connection_id_ )
-       + put_header_field( header_.source_state_ )
-       + put_header_field( header_.target_state_ )
-       + put_header_field( header_.frame_no_ )
-       + put_header_field( header_.fragment_no_ )
-       + put_header_field( header_.fragments_in_this_frame_ )
-       + put_header_field( header_.time_since_last_ )
-       + put_header_field( header_.payload_length_ )
-       + payload_;
+  string ret( Header::SIZE, 0 );
+  header_.serialize( reinterpret_cast<uint8_t *>( &ret[ 0 ] ) );
+  ret.append( payload_ );
+  return ret;
 }
 
 void Packet::set_fragments_in_this_frame( const uint16_t x )
@@ -174,13 +123,57 @@ void Packet::set_fragments_in_this_frame( const uint16_t x )
   assert( header_.fragment_no_ < header_.fragments_in_this_frame_ );
 }
 
+OutgoingFragment::OutgoingFragment( const shared_ptr<const SerializedFrame> & frame,
+                                    const Header & header, const size_t first_byte )
+  : frame_( frame ),
+    payload_( frame->slices( first_byte, header.payload_length_ ) ),
+    payload_length_( header.payload_length_ )
+{
+  assert( header.fragments_in_this_frame_ > 0 );
+  header.serialize( header_.data() );
+}
+
+OutgoingFragment::OutgoingFragment( const shared_ptr<const vector<uint8_t>> & parity,
+                                    const Header & header )
+  : parity_( parity ),
+    payload_( { Chunk( *parity ) } ),
+    payload_length_( parity->size() )
+{
+  assert( header.payload_length_ == parity->size() );
+  header.serialize( header_.data() );
+}
+
+vector<Chunk> OutgoingFragment::gather() const
+{
+  vector<Chunk> ret;
+  ret.reserve( 1 + payload_.size() );
+
+  ret.emplace_back( header_.data(), header_.size() );
+  ret.insert( ret.end(), payload_.begin(), payload_.end() );
+
+  return ret;
+}
+
+string OutgoingFragment::to_string() const
+{
+  string ret;
+  ret.reserve( size() );
+
+  for ( const Chunk & piece : gather() ) {
+    ret.append( reinterpret_cast<const char *>( piece.buffer() ), piece.size() );
+  }
+
+  return ret;
+}
+
 /* construct outgoing FragmentedFrame */
 FragmentedFrame::FragmentedFrame( const uint16_t connection_id,
                                   const uint32_t source_state,
                                   const uint32_t target_state,
                                   const uint32_t frame_no,
                                   const uint32_t time_since_last,
-                                  const vector<uint8_t> & whole_frame )
+                                  const shared_ptr<const SerializedFrame> & whole_frame,
+                                  const double parity_ratio )
   : connection_id_( connection_id ),
     source_state_( source_state ),
     target_state_( target_state ),
@@ -189,21 +182,65 @@ FragmentedFrame::FragmentedFrame( const uint16_t connection_id,
     fragments_(),
     remaining_fragments_( 0 )
 {
-  size_t next_fragment_start = 0;
+  assert( not whole_frame->empty() );
 
-  for ( uint16_t fragment_no = 0; next_fragment_start < whole_frame.size();
-        fragment_no++ ) {
-    fragments_.emplace_back( whole_frame, connection_id, source_state_, target_state_,
-                             frame_no, fragment_no, 0, next_fragment_start );
-  }
+  fragments_in_this_frame_ = ( whole_frame->size() + Packet::MAXIMUM_PAYLOAD - 1 ) / Packet::MAXIMUM_PAYLOAD;
+
+  const uint16_t group_size = fec_group_size( fragments_in_this_frame_ );
+  const uint16_t groups = ( fragments_in_this_frame_ + group_size - 1 ) / group_size;
+  const uint16_t parity_count = parity_fragments( group_size, parity_ratio );
+  outgoing_.reserve( fragments_in_this_frame_ + groups * parity_count );
+
+  const size_t last_length = whole_frame->size() - Packet::MAXIMUM_PAYLOAD * ( fragments_in_this_frame_ - 1 );
 
-  fragments_.front().set_time_to_next( time_since_last );
+  /* each group's parity goes out right after its last member, so a loss
+     early in the frame can be repaired before the rest has been sent */
+  for ( uint16_t group = 0; group < groups; group++ ) {
+    const uint16_t group_begin = group * group_size;
+    const uint16_t group_end = min<uint16_t>( fragments_in_this_frame_, group_begin + group_size );
 
-  fragments_in_this_frame_ = fragments_.size();
-  remaining_fragments_ = 0;
+    for ( uint16_t fragment_no = group_begin; fragment_no < group_end; fragment_no++ ) {
+      const size_t first_byte = Packet::MAXIMUM_PAYLOAD * fragment_no;
 
-  for ( Packet & packet : fragments_ ) {
-    packet.set_fragments_in_this_frame( fragments_in_this_frame_ );
+      Header header { connection_id, source_state, target_state, frame_no, fragment_no, 0 };
+      header.fragments_in_this_frame_ = fragments_in_this_frame_;
+      header.set_payload_length( min( whole_frame->size() - first_byte, Packet::MAXIMUM_PAYLOAD ) );
+
+      if ( fragment_no == 0 ) {
+        header.time_since_last_ = time_since_last;
+      }
+
+      outgoing_.emplace_back( whole_frame, header, first_byte );
+    }
+
+    for ( uint16_t j = 0; j < parity_count; j++ ) {
+      auto parity = make_shared<vector<uint8_t>>( Packet::PARITY_PAYLOAD, 0 );
+
+      const uint16_t parity_count_le = htole16( parity_count );
+      const uint16_t last_length_le = htole16( last_length );
+      memcpy( parity->data(), &parity_count_le, 2 );
+      memcpy( parity->data() + 2, &last_length_le, 2 );
+
+      /* shorter members count as zero-padded */
+      for ( uint16_t i = group_begin; i < group_end; i++ ) {
+        const size_t first_byte = Packet::MAXIMUM_PAYLOAD * i;
+        const size_t length = min( whole_frame->size() - first_byte, Packet::MAXIMUM_PAYLOAD );
+        const uint8_t coefficient = fec_coefficient( j, i - group_begin );
+
+        uint8_t * dest = parity->data() + Packet::PARITY_HEADER_SIZE;
+        for ( const Chunk & slice : whole_frame->slices( first_byte, length ) ) {
+          fec_multiply_add( dest, slice, coefficient );
+          dest += slice.size();
+        }
+      }
+
+      Header header { connection_id, source_state, target_state, frame_no,
+                      static_cast<uint16_t>( fragments_in_this_frame_ + group * parity_count + j ), 0 };
+      header.fragments_in_this_frame_ = fragments_in_this_frame_;
+      header.set_payload_length( Packet::PARITY_PAYLOAD );
+
+      outgoing_.emplace_back( parity, header );
+    }
   }
 }
 
@@ -264,15 +301,18 @@ void FragmentedFrame::add_packet( const Packet & packet )
 /* send */
 void FragmentedFrame::send( UDPSocket & socket )
 {
-  if ( fragments_.size() != fragments_in_this_frame_ ) {
+  if ( outgoing_.size() < fragments_in_this_frame_ ) {
     throw runtime_error( "attempt to send unfinished FragmentedFrame" );
   }
 
-  assert( complete() );
+  vector<vector<Chunk>> datagrams;
+  datagrams.reserve( outgoing_.size() );
 
-  for ( const Packet & packet : fragments_ ) {
-    socket.send( packet.to_string() );
+  for ( const OutgoingFragment & fragment : outgoing_ ) {
+    datagrams.push_back( fragment.gather() );
   }
+
+  socket.send_batch( datagrams );
 }
 
 bool FragmentedFrame::complete() const
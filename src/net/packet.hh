@@ -31,9 +31,12 @@
 
 #include <vector>
 #include <deque>
+#include <array>
+#include <memory>
 #include <cassert>
 
 #include "chunk.hh"
+#include "serialized_frame.hh"
 #include "socket.hh"
 #include "exception.hh"
 #include "pacer.hh"
@@ -57,6 +60,13 @@ private:
 public:
   static constexpr size_t MAXIMUM_PAYLOAD = 1400;
 
+  /* parity fragments (fragment_no >= fragments_in_this_frame) start with the
+     number of parity fragments per group and the length of the frame's last
+     data fragment (u16 each), followed by MAXIMUM_PAYLOAD bytes of
+     Reed-Solomon parity (see fec.hh) */
+  static constexpr size_t PARITY_HEADER_SIZE = 4;
+  static constexpr size_t PARITY_PAYLOAD = PARITY_HEADER_SIZE + MAXIMUM_PAYLOAD;
+
   static std::string put_header_field( const uint16_t n );
   static std::string put_header_field( const uint32_t n );
   static std::string put_header_field( const uint64_t n );
@@ -72,16 +82,6 @@ public:
   uint32_t time_since_last() const { return header_.time_since_last_; }
   const std::string & payload() const { return payload_; }
 
-  /* construct outgoing Packet */
-  Packet( const std::vector<uint8_t> & whole_frame,
-          const uint16_t connection_id,
-          const uint32_t source_state,
-          const uint32_t target_state,
-          const uint32_t frame_no,
-          const uint16_t fragment_no,
-          const uint16_t time_to_next,
-          size_t & next_fragment_start );
-
   /* construct incoming Packet */
   Packet( const Header & headder, const Chunk & str );
 
@@ -95,6 +95,37 @@ public:
   void set_time_to_next( const uint32_t val ) { header_.time_since_last_ = val; }
 };
 
+/* an outgoing fragment: its serialized header and the slices of the frame
+   that make its payload; the frame is shared by all of its fragments, so no
+   payload byte is copied on the way to the socket */
+class OutgoingFragment
+{
+private:
+  std::shared_ptr<const SerializedFrame> frame_ {};
+  std::shared_ptr<const std::vector<uint8_t>> parity_ {};
+  std::array<uint8_t, Header::SIZE> header_ {};
+  std::vector<Chunk> payload_;
+  size_t payload_length_;
+
+public:
+  /* data fragment */
+  OutgoingFragment( const std::shared_ptr<const SerializedFrame> & frame,
+                    const Header & header, const size_t first_byte );
+
+  /* parity fragment, whose payload is owned by the fragment */
+  OutgoingFragment( const std::shared_ptr<const std::vector<uint8_t>> & parity,
+                    const Header & header );
+
+  size_t size() const { return Header::SIZE + payload_length_; }
+
+  /* header, then payload slices, for UDPSocket::send_batch(); they point
+     into this fragment, which must outlive them */
+  std::vector<Chunk> gather() const;
+
+  /* serialize (copying the payload), for stream sockets */
+  std::string to_string() const;
+};
+
 class FragmentedFrame
 {
 private:
@@ -104,18 +135,25 @@ private:
   uint32_t frame_no_;
   uint16_t fragments_in_this_frame_;
 
+  /* incoming frames */
   std::vector<Packet> fragments_;
 
+  /* outgoing frames */
+  std::vector<OutgoingFragment> outgoing_ {};
+
   uint32_t remaining_fragments_;
 
 public:
-  /* construct outgoing FragmentedFrame */
+  /* construct outgoing FragmentedFrame; with a parity_ratio, each group of
+     data fragments is followed by its parity fragments (see fec.hh), which
+     are numbered after all of the data fragments */
   FragmentedFrame( const uint16_t connection_id,
                    const uint32_t source_state,
                    const uint32_t target_state,
                    const uint32_t frame_no,
                    const uint32_t time_to_next_frame,
-                   const std::vector<uint8_t> & whole_frame );
+                   const std::shared_ptr<const SerializedFrame> & whole_frame,
+                   const double parity_ratio = 0 );
 
   /* construct incoming FragmentedFrame from a Packet */
   FragmentedFrame( const uint16_t connection_id,
@@ -140,6 +178,7 @@ public:
   std::string frame() const;
   std::string partial_frame() const;
   const std::vector<Packet> & packets() const;
+  const std::vector<OutgoingFragment> & outgoing() const { return outgoing_; }
 
   /* delete copy-constructor and copy-assign operator */
   FragmentedFrame( const FragmentedFrame & other ) = delete;
@@ -153,6 +192,7 @@ public:
       frame_no_( other.frame_no_ ),
       fragments_in_this_frame_( other.fragments_in_this_frame_ ),
       fragments_( move( other.fragments_ ) ),
+      outgoing_( move( other.outgoing_ ) ),
       remaining_fragments_( other.remaining_fragments_ )
   {}
 };
@@ -29,16 +29,105 @@
 #include <algorithm>
 #include <numeric>
 #include <string>
+#include <cstring>
+#include <limits>
+
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <sys/timerfd.h>
+
 #include "poller.hh"
 #include "exception.hh"
 
 using namespace std;
+using namespace std::chrono;
 using namespace PollerShortNames;
 
+/* epoll data of the timerfd; registrations are tagged with their index */
+static const uint64_t TIMER_TAG = numeric_limits<uint64_t>::max();
+
+/* epoll_pwait2() through syscall(2), since only recent libcs wrap it */
+static int epoll_pwait2_syscall( const int epfd, epoll_event * events, const int maxevents,
+                                 const timespec * timeout )
+{
+#if defined( SYS_epoll_pwait2 ) && defined( __LP64__ )
+    return syscall( SYS_epoll_pwait2, epfd, events, maxevents, timeout, nullptr, 0 );
+#else
+    (void) epfd; (void) events; (void) maxevents; (void) timeout;
+    errno = ENOSYS;
+    return -1;
+#endif
+}
+
+static bool have_epoll_pwait2( const FileDescriptor & epoll_fd )
+{
+    if ( epoll_fd.fd_num() < 0 ) {
+        return false;
+    }
+
+    timespec no_wait { 0, 0 };
+    epoll_event event;
+    return epoll_pwait2_syscall( epoll_fd.fd_num(), &event, 1, &no_wait ) >= 0;
+}
+
+static timespec to_timespec( const microseconds & duration )
+{
+    return { static_cast<time_t>( duration.count() / 1000000 ),
+             static_cast<long>( duration.count() % 1000000 ) * 1000 };
+}
+
+Poller::Poller( const Backend backend )
+    : backend_( backend ), actions_(), pollfds_(),
+      epoll_fd_( backend == Backend::Epoll
+                 ? SystemCall( "epoll_create1", epoll_create1( EPOLL_CLOEXEC ) ) : -1 ),
+      registrations_(),
+      have_epoll_pwait2_( have_epoll_pwait2( epoll_fd_ ) ),
+      timer_fd_( ( backend == Backend::Epoll and not have_epoll_pwait2_ )
+                 ? SystemCall( "timerfd_create", timerfd_create( CLOCK_MONOTONIC, TFD_CLOEXEC ) ) : -1 )
+{
+    if ( timer_fd_.fd_num() >= 0 ) {
+        epoll_event event;
+        memset( &event, 0, sizeof( event ) );
+        event.events = EPOLLIN;
+        event.data.u64 = TIMER_TAG;
+        SystemCall( "epoll_ctl", epoll_ctl( epoll_fd_.fd_num(), EPOLL_CTL_ADD,
+                                            timer_fd_.fd_num(), &event ) );
+    }
+}
+
 void Poller::add_action( Poller::Action action )
 {
     actions_.push_back( action );
     pollfds_.push_back( { action.fd.fd_num(), 0, 0 } );
+
+    if ( backend_ != Backend::Epoll ) {
+        return;
+    }
+
+    auto registration = find_if( registrations_.begin(), registrations_.end(),
+                                 [&action] ( const Registration & x )
+                                 { return x.fd == action.fd.fd_num(); } );
+
+    if ( registration == registrations_.end() ) {
+        epoll_event event;
+        memset( &event, 0, sizeof( event ) );
+        event.data.u64 = registrations_.size();
+
+        bool always_ready = false;
+        if ( epoll_ctl( epoll_fd_.fd_num(), EPOLL_CTL_ADD, action.fd.fd_num(), &event ) < 0 ) {
+            if ( errno != EPERM ) {
+                throw unix_error( "epoll_ctl" );
+            }
+
+            /* regular files can't be watched, but poll() would report them ready */
+            always_ready = true;
+        }
+
+        registrations_.push_back( { action.fd.fd_num(), 0, always_ready, {} } );
+        registration = registrations_.end() - 1;
+    }
+
+    registration->actions.push_back( actions_.size() - 1 );
 }
 
 unsigned int Poller::Action::service_count( void ) const
@@ -46,22 +135,66 @@ unsigned int Poller::Action::service_count( void ) const
     return direction == Direction::In ? fd.read_count() : fd.write_count();
 }
 
+bool Poller::interested( const size_t i )
+{
+    Action & action = actions_.at( i );
+
+    /* don't poll in on fds that have had EOF */
+    if ( action.direction == Direction::In and action.fd.eof() ) {
+        cerr << "fd: " << action.fd.fd_num() << " eof!" << endl;
+        return false;
+    }
+
+    return action.active and action.when_interested();
+}
+
+bool Poller::service( const size_t i, const short revents, Action::Result & exit_result )
+{
+    if ( not ( revents & pollfds_.at( i ).events ) ) {
+        /* we only want to call callback if revents includes
+           the event we asked for */
+        return true;
+    }
+
+    const auto count_before = actions_.at( i ).service_count();
+    auto result = actions_.at( i ).callback();
+
+    switch ( result.result ) {
+    case ResultType::Exit:
+        exit_result = result;
+        return false;
+    case ResultType::Cancel:
+        actions_.at( i ).active = false;
+        break;
+    case ResultType::Continue:
+        break;
+    }
+
+    if ( count_before == actions_.at( i ).service_count() ) {
+        throw runtime_error( "Poller: busy wait detected: callback did not read/write fd" );
+    }
+
+    return true;
+}
+
 Poller::Result Poller::poll( const int & timeout_ms )
+{
+    return poll( microseconds( int64_t( timeout_ms ) * 1000 ) );
+}
+
+Poller::Result Poller::poll( const microseconds & timeout )
+{
+    return backend_ == Backend::Epoll ? poll_epoll( timeout ) : poll_poll( timeout );
+}
+
+Poller::Result Poller::poll_poll( const microseconds & timeout )
 {
     assert( pollfds_.size() == actions_.size() );
 
     /* tell poll whether we care about each fd */
     for ( unsigned int i = 0; i < actions_.size(); i++ ) {
         assert( pollfds_.at( i ).fd == actions_.at( i ).fd.fd_num() );
-        pollfds_.at( i ).events = (actions_.at( i ).active and actions_.at( i ).when_interested())
-            ? actions_.at( i ).direction : 0;
-
-        /* don't poll in on fds that have had EOF */
-        if ( actions_.at( i ).direction == Direction::In
-             and actions_.at( i ).fd.eof() ) {
-            cerr << "fd: " << pollfds_.at(i).fd << " eof!" << endl;
-            pollfds_.at( i ).events = 0;
-        }
+        pollfds_.at( i ).events = interested( i ) ? actions_.at( i ).direction : 0;
     }
 
     /* Quit if no member in pollfds_ has a non-zero direction */
@@ -71,8 +204,10 @@ Poller::Result Poller::poll( const int & timeout_ms )
         return Result::Type::Exit;
     }
 
-    if ( 0 == SystemCall( "poll", ::poll( &pollfds_[ 0 ], pollfds_.size(), timeout_ms ) ) ) {
-        cerr << " POLL Timeout !" << endl;
+    const timespec timeout_ts = to_timespec( timeout );
+    if ( 0 == SystemCall( "ppoll", ::ppoll( &pollfds_[ 0 ], pollfds_.size(),
+                                            timeout.count() < 0 ? nullptr : &timeout_ts,
+                                            nullptr ) ) ) {
         return Result::Type::Timeout;
     }
 
@@ -93,25 +228,140 @@ Poller::Result Poller::poll( const int & timeout_ms )
             return { Result::Type::Exit, EXIT_FAILURE };
         }
 
-        if ( pollfds_[ i ].revents & pollfds_[ i ].events ) {
-            /* we only want to call callback if revents includes
-               the event we asked for */
-            const auto count_before = actions_.at( i ).service_count();
-            // cerr << "fd " << pollfds_.at(i).fd << " ready!" << endl;
-            auto result = actions_.at( i ).callback();
-
-            switch ( result.result ) {
-            case ResultType::Exit:
-                return Result( Result::Type::Exit, result.exit_status );
-            case ResultType::Cancel:
-                actions_.at( i ).active = false;
-                break;
-            case ResultType::Continue:
-                break;
+        Action::Result exit_result;
+        if ( not service( i, pollfds_[ i ].revents, exit_result ) ) {
+            return Result( Result::Type::Exit, exit_result.exit_status );
+        }
+    }
+
+    return Result::Type::Success;
+}
+
+bool Poller::update_registrations( void )
+{
+    bool any_interest = false;
+
+    for ( size_t r = 0; r < registrations_.size(); r++ ) {
+        Registration & registration = registrations_[ r ];
+        uint32_t events = 0;
+
+        for ( const size_t i : registration.actions ) {
+            pollfds_.at( i ).events = interested( i ) ? actions_.at( i ).direction : 0;
+
+            if ( pollfds_.at( i ).events ) {
+                /* POLLIN and POLLOUT have the values of EPOLLIN and EPOLLOUT */
+                events |= pollfds_.at( i ).events;
+
+                if ( actions_.at( i ).trigger == Action::Edge ) {
+                    events |= EPOLLET;
+                }
+            }
+        }
+
+        any_interest = any_interest or events;
+
+        if ( events != registration.events and not registration.always_ready ) {
+            epoll_event event;
+            memset( &event, 0, sizeof( event ) );
+            event.events = events;
+            event.data.u64 = r;
+            SystemCall( "epoll_ctl", epoll_ctl( epoll_fd_.fd_num(), EPOLL_CTL_MOD,
+                                                registration.fd, &event ) );
+        }
+
+        registration.events = events;
+    }
+
+    return any_interest;
+}
+
+int Poller::wait( vector< epoll_event > & events, const microseconds & timeout )
+{
+    /* whole milliseconds (or none at all) don't need a finer timer */
+    if ( timeout.count() <= 0 or timeout.count() % 1000 == 0 ) {
+        return SystemCall( "epoll_wait", epoll_wait( epoll_fd_.fd_num(), events.data(), events.size(),
+                                                     timeout.count() < 0 ? -1 : timeout.count() / 1000 ) );
+    }
+
+    const timespec timeout_ts = to_timespec( timeout );
+
+    if ( have_epoll_pwait2_ ) {
+        return SystemCall( "epoll_pwait2", epoll_pwait2_syscall( epoll_fd_.fd_num(), events.data(),
+                                                                 events.size(), &timeout_ts ) );
+    }
+
+    itimerspec timer;
+    memset( &timer, 0, sizeof( timer ) );
+    timer.it_value = timeout_ts;
+    SystemCall( "timerfd_settime", timerfd_settime( timer_fd_.fd_num(), 0, &timer, nullptr ) );
+
+    const int ready = SystemCall( "epoll_wait", epoll_wait( epoll_fd_.fd_num(), events.data(),
+                                                            events.size(), -1 ) );
+
+    /* disarm the timer (and forget any expiration), so it can't wake a later wait */
+    timer.it_value = { 0, 0 };
+    SystemCall( "timerfd_settime", timerfd_settime( timer_fd_.fd_num(), 0, &timer, nullptr ) );
+
+    return ready;
+}
+
+Poller::Result Poller::poll_epoll( const microseconds & timeout )
+{
+    assert( pollfds_.size() == actions_.size() );
+
+    /* tell epoll whether we care about each fd */
+    if ( not update_registrations() ) {
+        cerr << " No member has direction" << endl;
+        return Result::Type::Exit;
+    }
+
+    /* fds that can't be watched are always ready, so don't wait for the others */
+    const bool any_always_ready = any_of( registrations_.begin(), registrations_.end(),
+                                          [] ( const Registration & x )
+                                          { return x.always_ready and x.events; } );
+
+    vector< epoll_event > events( registrations_.size() + 1 );
+    const int ready = wait( events, any_always_ready ? microseconds( 0 ) : timeout );
+
+    bool any_fd_ready = any_always_ready;
+
+    for ( int e = 0; e < ready; e++ ) {
+        if ( events[ e ].data.u64 == TIMER_TAG ) {
+            continue;
+        }
+
+        any_fd_ready = true;
+
+        /* by index, since callbacks may add actions */
+        const size_t r = events[ e ].data.u64;
+
+        if ( events[ e ].events & (EPOLLERR | EPOLLHUP) ) {
+            cerr << "fd " << registrations_.at( r ).fd << " "
+                 << ( ( events[ e ].events & EPOLLERR ) ? "POLLERR" : "POLLHUP" ) << "!" << endl;
+            return { Result::Type::Exit, EXIT_FAILURE };
+        }
+
+        for ( size_t k = 0; k < registrations_.at( r ).actions.size(); k++ ) {
+            Action::Result exit_result;
+            if ( not service( registrations_.at( r ).actions[ k ], events[ e ].events, exit_result ) ) {
+                return Result( Result::Type::Exit, exit_result.exit_status );
             }
+        }
+    }
+
+    if ( not any_fd_ready ) {
+        return Result::Type::Timeout;
+    }
+
+    for ( size_t r = 0; r < registrations_.size(); r++ ) {
+        if ( not registrations_[ r ].always_ready ) {
+            continue;
+        }
 
-            if ( count_before == actions_.at( i ).service_count() ) {
-                throw runtime_error( "Poller: busy wait detected: callback did not read/write fd" );
+        for ( size_t k = 0; k < registrations_[ r ].actions.size(); k++ ) {
+            Action::Result exit_result;
+            if ( not service( registrations_[ r ].actions[ k ], POLLIN | POLLOUT, exit_result ) ) {
+                return Result( Result::Type::Exit, exit_result.exit_status );
             }
         }
     }
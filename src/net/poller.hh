@@ -31,9 +31,11 @@
 
 #include <functional>
 #include <vector>
+#include <chrono>
 #include <cassert>
 
 #include <poll.h>
+#include <sys/epoll.h>
 
 #include "file_descriptor.hh"
 
@@ -58,20 +60,61 @@ public:
         std::function<bool(void)> when_interested;
         bool active;
 
+        /* with the epoll backend, an edge-triggered action is only called
+           when the fd becomes ready again, so its callback must drain it */
+        enum Trigger { Level, Edge } trigger;
+
         Action( FileDescriptor & s_fd,
                 const PollDirection & s_direction,
                 const CallbackType & s_callback,
-                const std::function<bool(void)> & s_when_interested = [] () { return true; } )
+                const std::function<bool(void)> & s_when_interested = [] () { return true; },
+                const Trigger s_trigger = Level )
             : fd( s_fd ), direction( s_direction ), callback( s_callback ),
-              when_interested( s_when_interested ), active( true ) {}
+              when_interested( s_when_interested ), active( true ), trigger( s_trigger ) {}
 
         unsigned int service_count( void ) const;
     };
 
+    enum class Backend { Poll, Epoll };
+
 private:
+    Backend backend_;
     std::vector< Action > actions_;
+
+    /* Backend::Poll: one pollfd per action, rebuilt on every call */
     std::vector< pollfd > pollfds_;
 
+    /* Backend::Epoll: each fd is registered once and only modified when the
+       interest of its actions changes */
+    struct Registration
+    {
+        int fd;
+        uint32_t events;
+        bool always_ready; /* regular files, which epoll refuses */
+        std::vector< size_t > actions;
+    };
+
+    FileDescriptor epoll_fd_;
+    std::vector< Registration > registrations_;
+
+    /* timeouts below a millisecond need epoll_pwait2(), or a timerfd on
+       kernels before 5.11 */
+    bool have_epoll_pwait2_;
+    FileDescriptor timer_fd_;
+
+    /* whether action i wants its direction polled right now */
+    bool interested( const size_t i );
+
+    /* bring the epoll registrations in line with the actions' interest;
+       false if no action is interested in anything */
+    bool update_registrations( void );
+
+    /* wait for events on the epoll fd */
+    int wait( std::vector< epoll_event > & events, const std::chrono::microseconds & timeout );
+
+    /* call action i if revents includes its direction */
+    bool service( const size_t i, const short revents, Action::Result & exit_result );
+
 public:
     struct Result
     {
@@ -81,9 +124,17 @@ public:
             : result( s_result ), exit_status( s_status ) {}
     };
 
-    Poller() : actions_(), pollfds_() {}
+private:
+    Result poll_poll( const std::chrono::microseconds & timeout );
+    Result poll_epoll( const std::chrono::microseconds & timeout );
+
+public:
+    Poller( const Backend backend = Backend::Epoll );
     void add_action( Action action );
+
+    /* a negative timeout waits forever */
     Result poll( const int & timeout_ms );
+    Result poll( const std::chrono::microseconds & timeout );
 };
 
 namespace PollerShortNames {
@@ -0,0 +1,326 @@
+/* -*-mode:c++; tab-width: 2; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+
+/* Copyright 2013-2018 the Alfalfa authors
+                       and the Massachusetts Institute of Technology
+
+   Redistribution and use in source and binary forms, with or without
+   modification, are permitted provided that the following conditions are
+   met:
+
+      1. Redistributions of source code must retain the above copyright
+         notice, this list of conditions and the following disclaimer.
+
+      2. Redistributions in binary form must reproduce the above copyright
+         notice, this list of conditions and the following disclaimer in the
+         documentation and/or other materials provided with the distribution.
+
+   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+   "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+   LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+   A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+   HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+   SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+   LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+   DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+   THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+   (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+   OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE. */
+
+#include <algorithm>
+#include <stdexcept>
+#include <iostream>
+#include <cstring>
+
+#include "reassembly_buffer.hh"
+#include "packet.hh"
+#include "fec.hh"
+
+using namespace std;
+
+ReassemblyBuffer::ReassemblyBuffer( const uint16_t connection_id,
+                                    const size_t ring_size,
+                                    const size_t slab_capacity )
+  : connection_id_( connection_id ),
+    ring_( ring_size )
+{
+  if ( ring_size == 0 ) {
+    throw runtime_error( "ReassemblyBuffer: ring must have at least one slab" );
+  }
+
+  for ( Slab & slab : ring_ ) {
+    slab.data.resize( slab_capacity );
+  }
+}
+
+const ReassemblyBuffer::Slab * ReassemblyBuffer::find( const uint32_t frame_no ) const
+{
+  const Slab & slab = ring_[ frame_no % ring_.size() ];
+  return ( slab.in_use and slab.frame_no == frame_no ) ? &slab : nullptr;
+}
+
+const ReassemblyBuffer::Slab & ReassemblyBuffer::at( const uint32_t frame_no ) const
+{
+  const Slab * slab = find( frame_no );
+
+  if ( slab == nullptr ) {
+    throw out_of_range( "ReassemblyBuffer: frame #" + to_string( frame_no ) + " is not being reassembled" );
+  }
+
+  return *slab;
+}
+
+bool ReassemblyBuffer::add_packet( const Header & header, const Chunk & payload )
+{
+  if ( header.connection_id_ != connection_id_ ) {
+    cerr << header.connection_id_ << " vs. " << connection_id_ << "\n";
+    throw runtime_error( "invalid packet, connection_id mismatch" );
+  }
+
+  if ( header.fragments_in_this_frame_ == 0 ) {
+    throw runtime_error( "invalid packet: no fragments in this frame" );
+  }
+
+  const bool is_parity = header.fragment_no_ >= header.fragments_in_this_frame_;
+
+  /* every data fragment but the last one is full */
+  const bool last_fragment = header.fragment_no_ + 1 == header.fragments_in_this_frame_;
+
+  const uint16_t group_size = fec_group_size( header.fragments_in_this_frame_ );
+  const uint16_t groups = ( header.fragments_in_this_frame_ + group_size - 1 ) / group_size;
+
+  uint16_t parity_per_group = 0;
+  size_t last_length = 0;
+
+  if ( is_parity ) {
+    if ( payload.size() != Packet::PARITY_PAYLOAD ) {
+      throw runtime_error( "invalid packet: bad parity payload length" );
+    }
+
+    parity_per_group = payload( 0, 2 ).le16();
+    last_length = payload( 2, 2 ).le16();
+
+    if ( parity_per_group == 0 or parity_per_group > MAX_FEC_PARITY
+         or size_t( header.fragment_no_ - header.fragments_in_this_frame_ ) >= size_t( groups ) * parity_per_group ) {
+      throw runtime_error( "invalid packet: bad parity fragment_no" );
+    }
+
+    if ( last_length == 0 or last_length > Packet::MAXIMUM_PAYLOAD ) {
+      throw runtime_error( "invalid packet: bad parity last fragment length" );
+    }
+  } else if ( payload.size() == 0 or payload.size() > Packet::MAXIMUM_PAYLOAD
+              or ( not last_fragment and payload.size() != Packet::MAXIMUM_PAYLOAD ) ) {
+    throw runtime_error( "invalid packet: bad payload length" );
+  }
+
+  Slab & slab = ring_[ header.frame_no_ % ring_.size() ];
+
+  if ( slab.in_use and slab.frame_no != header.frame_no_ ) {
+    if ( slab.frame_no > header.frame_no_ ) {
+      /* a newer frame has taken this slab */
+      return false;
+    }
+
+    /* this frame supersedes the one in the slab */
+    slab.in_use = false;
+  }
+
+  if ( not slab.in_use ) {
+    slab.in_use = true;
+    slab.frame_no = header.frame_no_;
+    slab.source_state = header.source_state_;
+    slab.target_state = header.target_state_;
+    slab.fragments_in_this_frame = header.fragments_in_this_frame_;
+    slab.remaining_fragments = header.fragments_in_this_frame_;
+    slab.length = 0;
+    slab.arrived.assign( header.fragments_in_this_frame_, false );
+    slab.parity_per_group = 0;
+    slab.parity_arrived.clear();
+
+    /* slabs only grow, so they keep their size for later frames */
+    const size_t capacity = size_t( header.fragments_in_this_frame_ ) * Packet::MAXIMUM_PAYLOAD;
+    if ( slab.data.size() < capacity ) {
+      slab.data.resize( capacity );
+    }
+  } else {
+    if ( header.source_state_ != slab.source_state ) {
+      throw runtime_error( "invalid packet, source_state mismatch" );
+    }
+
+    if ( header.target_state_ != slab.target_state ) {
+      throw runtime_error( "invalid packet, target_state mismatch" );
+    }
+
+    if ( header.fragments_in_this_frame_ != slab.fragments_in_this_frame ) {
+      throw runtime_error( "invalid packet, fragments_in_this_frame mismatch" );
+    }
+  }
+
+  if ( is_parity ) {
+    if ( slab.parity_per_group == 0 ) {
+      slab.parity_per_group = parity_per_group;
+      slab.last_length = last_length;
+      slab.parity_arrived.assign( size_t( groups ) * parity_per_group, false );
+
+      const size_t capacity = slab.parity_arrived.size() * Packet::MAXIMUM_PAYLOAD;
+      if ( slab.parity.size() < capacity ) {
+        slab.parity.resize( capacity );
+      }
+    } else if ( parity_per_group != slab.parity_per_group or last_length != slab.last_length ) {
+      throw runtime_error( "invalid packet, parity header mismatch" );
+    }
+
+    const size_t parity_no = header.fragment_no_ - header.fragments_in_this_frame_;
+
+    if ( slab.parity_arrived[ parity_no ] ) {
+      return false;
+    }
+
+    const Chunk parity = payload( Packet::PARITY_HEADER_SIZE, Packet::MAXIMUM_PAYLOAD );
+    memcpy( slab.parity.data() + parity_no * Packet::MAXIMUM_PAYLOAD,
+            parity.buffer(), parity.size() );
+
+    slab.parity_arrived[ parity_no ] = true;
+    recover( slab, parity_no / parity_per_group );
+
+    return true;
+  }
+
+  if ( slab.arrived[ header.fragment_no_ ] ) {
+    return false;
+  }
+
+  const size_t offset = size_t( header.fragment_no_ ) * Packet::MAXIMUM_PAYLOAD;
+  memcpy( slab.data.data() + offset, payload.buffer(), payload.size() );
+
+  slab.arrived[ header.fragment_no_ ] = true;
+  slab.remaining_fragments--;
+
+  if ( last_fragment ) {
+    slab.length = offset + payload.size();
+  }
+
+  if ( slab.parity_per_group > 0 ) {
+    recover( slab, header.fragment_no_ / group_size );
+  }
+
+  return true;
+}
+
+void ReassemblyBuffer::recover( Slab & slab, const uint16_t group )
+{
+  if ( slab.remaining_fragments == 0 ) {
+    return;
+  }
+
+  const size_t k = slab.fragments_in_this_frame;
+  const size_t group_size = fec_group_size( k );
+  const size_t group_begin = group * group_size;
+  const size_t group_end = min( k, group_begin + group_size );
+
+  vector<size_t> missing;
+  for ( size_t i = group_begin; i < group_end; i++ ) {
+    if ( not slab.arrived[ i ] ) {
+      missing.push_back( i );
+    }
+  }
+
+  /* one parity fragment per missing data fragment */
+  vector<size_t> parity_used;
+  for ( size_t j = 0; j < slab.parity_per_group and parity_used.size() < missing.size(); j++ ) {
+    if ( slab.parity_arrived[ group * slab.parity_per_group + j ] ) {
+      parity_used.push_back( j );
+    }
+  }
+
+  if ( missing.empty() or parity_used.size() < missing.size() ) {
+    return;
+  }
+
+  const size_t n = missing.size();
+
+  /* take the members that arrived out of each parity fragment; shorter
+     members count as zero-padded, which is how the sender computed it */
+  vector<uint8_t> syndromes( n * Packet::MAXIMUM_PAYLOAD );
+  for ( size_t r = 0; r < n; r++ ) {
+    const size_t parity_no = group * slab.parity_per_group + parity_used[ r ];
+    uint8_t * syndrome = syndromes.data() + r * Packet::MAXIMUM_PAYLOAD;
+    memcpy( syndrome, slab.parity.data() + parity_no * Packet::MAXIMUM_PAYLOAD, Packet::MAXIMUM_PAYLOAD );
+
+    for ( size_t i = group_begin; i < group_end; i++ ) {
+      if ( not slab.arrived[ i ] ) {
+        continue;
+      }
+
+      const size_t length = ( i + 1 == k ) ? slab.last_length : Packet::MAXIMUM_PAYLOAD;
+      fec_multiply_add( syndrome, Chunk( slab.data.data() + i * Packet::MAXIMUM_PAYLOAD, length ),
+                        fec_coefficient( parity_used[ r ], i - group_begin ) );
+    }
+  }
+
+  /* what is left is the missing members through an n x n Cauchy matrix */
+  vector<uint8_t> matrix( n * n );
+  for ( size_t r = 0; r < n; r++ ) {
+    for ( size_t c = 0; c < n; c++ ) {
+      matrix[ r * n + c ] = fec_coefficient( parity_used[ r ], missing[ c ] - group_begin );
+    }
+  }
+
+  const vector<uint8_t> inverse = fec_invert( move( matrix ), n );
+
+  for ( size_t c = 0; c < n; c++ ) {
+    const size_t i = missing[ c ];
+    uint8_t * dest = slab.data.data() + i * Packet::MAXIMUM_PAYLOAD;
+    memset( dest, 0, Packet::MAXIMUM_PAYLOAD );
+
+    for ( size_t r = 0; r < n; r++ ) {
+      fec_multiply_add( dest, Chunk( syndromes.data() + r * Packet::MAXIMUM_PAYLOAD, Packet::MAXIMUM_PAYLOAD ),
+                        inverse[ c * n + r ] );
+    }
+
+    slab.arrived[ i ] = true;
+    slab.remaining_fragments--;
+
+    if ( i + 1 == k ) {
+      slab.length = i * Packet::MAXIMUM_PAYLOAD + slab.last_length;
+    }
+  }
+}
+
+bool ReassemblyBuffer::complete( const uint32_t frame_no ) const
+{
+  const Slab * slab = find( frame_no );
+  return slab != nullptr and slab->remaining_fragments == 0;
+}
+
+Chunk ReassemblyBuffer::frame( const uint32_t frame_no ) const
+{
+  const Slab & slab = at( frame_no );
+
+  if ( slab.remaining_fragments != 0 ) {
+    throw runtime_error( "attempt to build frame from unfinished frame #" + to_string( frame_no ) );
+  }
+
+  return Chunk( slab.data.data(), slab.length );
+}
+
+Chunk ReassemblyBuffer::partial_frame( const uint32_t frame_no ) const
+{
+  const Slab & slab = at( frame_no );
+
+  size_t fragments = 0;
+  while ( fragments < slab.fragments_in_this_frame and slab.arrived[ fragments ] ) {
+    fragments++;
+  }
+
+  if ( fragments == slab.fragments_in_this_frame ) {
+    return Chunk( slab.data.data(), slab.length );
+  }
+
+  return Chunk( slab.data.data(), fragments * Packet::MAXIMUM_PAYLOAD );
+}
+
+void ReassemblyBuffer::release( const uint32_t frame_no )
+{
+  const Slab & slab = at( frame_no );
+  ring_[ slab.frame_no % ring_.size() ].in_use = false;
+}
@@ -0,0 +1,109 @@
+/* -*-mode:c++; tab-width: 2; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+
+/* Copyright 2013-2018 the Alfalfa authors
+                       and the Massachusetts Institute of Technology
+
+   Redistribution and use in source and binary forms, with or without
+   modification, are permitted provided that the following conditions are
+   met:
+
+      1. Redistributions of source code must retain the above copyright
+         notice, this list of conditions and the following disclaimer.
+
+      2. Redistributions in binary form must reproduce the above copyright
+         notice, this list of conditions and the following disclaimer in the
+         documentation and/or other materials provided with the distribution.
+
+   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+   "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+   LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+   A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+   HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+   SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+   LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+   DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+   THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+   (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+   OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE. */
+
+#ifndef REASSEMBLY_BUFFER_HH
+#define REASSEMBLY_BUFFER_HH
+
+#include <vector>
+#include <cstdint>
+
+#include "chunk.hh"
+#include "header.hh"
+
+/* reassembles incoming frames in place: each fragment's payload is written
+   straight to its offset in a preallocated per-frame slab, arrivals are
+   tracked in a bitmap, and a finished frame is handed out as a Chunk of the
+   slab. Slabs are recycled through a ring indexed by frame number, so a
+   frame's Chunk stays valid until release() or until a frame ring_size
+   numbers later takes its slab.
+
+   Parity fragments (see fec.hh) are kept alongside the data; as soon as a
+   group has as many parity fragments as it is missing data fragments, the
+   missing ones are rebuilt in place without waiting for a retransmission. */
+class ReassemblyBuffer
+{
+private:
+  struct Slab
+  {
+    bool in_use { false };
+    uint32_t frame_no { 0 };
+    uint32_t source_state { 0 };
+    uint32_t target_state { 0 };
+    uint16_t fragments_in_this_frame { 0 };
+    uint16_t remaining_fragments { 0 };
+
+    /* length of the whole frame, known once its last fragment has arrived */
+    size_t length { 0 };
+
+    std::vector<uint8_t> data {};
+    std::vector<bool> arrived {};
+
+    /* known once the first parity fragment has arrived */
+    uint16_t parity_per_group { 0 };
+    size_t last_length { 0 };
+
+    std::vector<uint8_t> parity {};
+    std::vector<bool> parity_arrived {};
+  };
+
+  uint16_t connection_id_;
+  std::vector<Slab> ring_;
+
+  /* the slab holding frame_no, or nullptr */
+  const Slab * find( const uint32_t frame_no ) const;
+  const Slab & at( const uint32_t frame_no ) const;
+
+  /* rebuild the missing data fragments of a group, if possible */
+  static void recover( Slab & slab, const uint16_t group );
+
+public:
+  ReassemblyBuffer( const uint16_t connection_id,
+                    const size_t ring_size = 16,
+                    const size_t slab_capacity = 256 * 1024 );
+
+  /* store a data or parity fragment's payload; false if it is a duplicate,
+     or its frame is older than the one now using its slab */
+  bool add_packet( const Header & header, const Chunk & payload );
+
+  bool contains( const uint32_t frame_no ) const { return find( frame_no ) != nullptr; }
+  bool complete( const uint32_t frame_no ) const;
+
+  uint32_t source_state( const uint32_t frame_no ) const { return at( frame_no ).source_state; }
+  uint32_t target_state( const uint32_t frame_no ) const { return at( frame_no ).target_state; }
+
+  /* the whole frame; throws if it is not complete */
+  Chunk frame( const uint32_t frame_no ) const;
+
+  /* the fragments that have arrived in order from the first one */
+  Chunk partial_frame( const uint32_t frame_no ) const;
+
+  /* hand the frame's slab back to the ring */
+  void release( const uint32_t frame_no );
+};
+
+#endif /* REASSEMBLY_BUFFER_HH */
@@ -29,10 +29,14 @@
 #include <sys/socket.h>
 #include <sys/types.h>
 #include <netinet/in.h>
+#include <netinet/udp.h>
 #include <linux/tcp.h>
 #include <linux/netfilter_ipv4.h>
 #include "socket.hh"
 #include <ctime>
+#include <cerrno>
+#include <cstring>
+#include <algorithm>
 #include "exception.hh"
 
 #include <spdlog/spdlog.h>
@@ -42,6 +46,21 @@ using namespace std;
 /* max name length of congestion control algorithm */
 static const size_t TCP_CC_NAME_MAX = 16;
 
+/* UDP offloads, in case the libc headers predate them (Linux 4.18 and 5.0) */
+#ifndef SOL_UDP
+#define SOL_UDP 17
+#endif
+#ifndef UDP_SEGMENT
+#define UDP_SEGMENT 103
+#endif
+#ifndef UDP_GRO
+#define UDP_GRO 104
+#endif
+
+/* the kernel's limits on one GSO message */
+static const size_t UDP_MAX_SEGMENTS = 64;
+static const size_t UDP_MAX_PAYLOAD = 65507;
+
 
 /* default constructor for socket of (subclassed) domain and type */
 Socket::Socket( const int domain, const int type )
@@ -218,6 +237,217 @@ void UDPSocket::send( const string & payload )
   register_write();
 }
 
+/* receive the datagrams already queued on the socket */
+vector<UDPSocket::received_datagram> UDPSocket::recv_batch( const size_t max_datagrams )
+{
+  static const size_t RECEIVE_MTU = 65536;
+  static const size_t CONTROL_SIZE = 256;
+  static const size_t SLOT_SIZE = CONTROL_SIZE + RECEIVE_MTU;
+
+  if ( max_datagrams == 0 ) {
+    throw runtime_error( "recv_batch: max_datagrams must be positive" );
+  }
+
+  if ( batch_buffer_.size() < max_datagrams * SLOT_SIZE ) {
+    batch_buffer_.resize( max_datagrams * SLOT_SIZE );
+  }
+
+  vector<mmsghdr> messages( max_datagrams );
+  vector<iovec> msg_iovecs( max_datagrams );
+  vector<Address::raw> source_addresses( max_datagrams );
+
+  for ( size_t i = 0; i < max_datagrams; i++ ) {
+    /* the control buffer leads each slot, so it stays aligned */
+    char * const slot = batch_buffer_.data() + i * SLOT_SIZE;
+
+    msg_iovecs[ i ].iov_base = slot + CONTROL_SIZE;
+    msg_iovecs[ i ].iov_len = RECEIVE_MTU;
+
+    msghdr & header = messages[ i ].msg_hdr;
+    zero( header );
+    header.msg_name = &source_addresses[ i ];
+    header.msg_namelen = sizeof( source_addresses[ i ] );
+    header.msg_iov = &msg_iovecs[ i ];
+    header.msg_iovlen = 1;
+    header.msg_control = slot;
+    header.msg_controllen = CONTROL_SIZE;
+    messages[ i ].msg_len = 0;
+  }
+
+  /* block for the first datagram only */
+  const int received = SystemCall( "recvmmsg",
+                                   recvmmsg( fd_num(), messages.data(), max_datagrams,
+                                             MSG_WAITFORONE, nullptr ) );
+
+  vector<received_datagram> ret;
+  ret.reserve( received );
+
+  for ( int i = 0; i < received; i++ ) {
+    msghdr & header = messages[ i ].msg_hdr;
+
+    /* make sure we got the whole datagram */
+    if ( header.msg_flags & MSG_TRUNC ) {
+      throw runtime_error( "recvmmsg (oversized datagram)" );
+    } else if ( header.msg_flags ) {
+      throw runtime_error( "recvmmsg (unhandled flag)" );
+    }
+
+    uint64_t timestamp_us = -1;
+    size_t segment_size = 0;
+
+    /* find the timestamp and GRO segment size (if there are any) */
+    for ( cmsghdr * hdr = CMSG_FIRSTHDR( &header ); hdr; hdr = CMSG_NXTHDR( &header, hdr ) ) {
+      if ( hdr->cmsg_level == SOL_SOCKET and hdr->cmsg_type == SO_TIMESTAMPNS ) {
+        timespec kernel_time;
+        memcpy( &kernel_time, CMSG_DATA( hdr ), sizeof( kernel_time ) );
+        timestamp_us = timestamp_us_raw( kernel_time );
+      } else if ( hdr->cmsg_level == SOL_UDP and hdr->cmsg_type == UDP_GRO ) {
+        int gro_size;
+        memcpy( &gro_size, CMSG_DATA( hdr ), sizeof( gro_size ) );
+        segment_size = gro_size;
+      }
+    }
+
+    const Address source_address( source_addresses[ i ], header.msg_namelen );
+    const char * const payload = static_cast<const char *>( msg_iovecs[ i ].iov_base );
+    const size_t length = messages[ i ].msg_len;
+
+    if ( segment_size == 0 ) {
+      segment_size = max( length, size_t( 1 ) );
+    }
+
+    /* split datagrams the kernel coalesced */
+    for ( size_t offset = 0; offset < length or offset == 0; offset += segment_size ) {
+      ret.push_back( { source_address, timestamp_us,
+                       string( payload + offset, min( segment_size, length - offset ) ) } );
+    }
+  }
+
+  register_read();
+
+  return ret;
+}
+
+/* send datagrams in order to connected address */
+void UDPSocket::send_batch( const vector<string> & payloads )
+{
+  vector<vector<Chunk>> datagrams;
+  datagrams.reserve( payloads.size() );
+
+  for ( const string & payload : payloads ) {
+    datagrams.push_back( { Chunk( payload ) } );
+  }
+
+  send_batch( datagrams );
+}
+
+/* send datagrams, each gathered from its pieces, in order to connected address */
+void UDPSocket::send_batch( const vector<vector<Chunk>> & datagrams )
+{
+  /* UDP_SEGMENT control message, aligned for cmsghdr */
+  union SegmentControl {
+    char buffer[ CMSG_SPACE( sizeof( uint16_t ) ) ];
+    cmsghdr align;
+  };
+
+  /* one iovec per piece; datagram i starts at msg_iovecs[ first_iovec[ i ] ] */
+  vector<iovec> msg_iovecs;
+  vector<size_t> first_iovec;
+  vector<size_t> sizes;
+
+  for ( const auto & datagram : datagrams ) {
+    first_iovec.push_back( msg_iovecs.size() );
+    sizes.push_back( 0 );
+
+    for ( const Chunk & piece : datagram ) {
+      iovec piece_iovec;
+      piece_iovec.iov_base = const_cast<uint8_t *>( piece.buffer() );
+      piece_iovec.iov_len = piece.size();
+      msg_iovecs.push_back( piece_iovec );
+      sizes.back() += piece.size();
+    }
+  }
+
+  first_iovec.push_back( msg_iovecs.size() );
+
+  vector<SegmentControl> controls( datagrams.size() );
+  vector<mmsghdr> messages;
+  vector<size_t> first_datagram;
+
+  for ( size_t i = 0; i < datagrams.size(); ) {
+    /* with GSO, gather a run of datagrams the size of the first; the last may be shorter */
+    size_t count = 1;
+    size_t total = sizes[ i ];
+
+    if ( segmentation_offload_ ) {
+      const size_t segment_size = sizes[ i ];
+
+      while ( i + count < datagrams.size()
+              and count < UDP_MAX_SEGMENTS
+              and segment_size > 0
+              and sizes[ i + count ] <= segment_size
+              and total + sizes[ i + count ] <= UDP_MAX_PAYLOAD ) {
+        total += sizes[ i + count ];
+        count++;
+
+        if ( sizes[ i + count - 1 ] < segment_size ) {
+          break;
+        }
+      }
+    }
+
+    mmsghdr message;
+    zero( message );
+    message.msg_hdr.msg_iov = msg_iovecs.data() + first_iovec[ i ];
+    message.msg_hdr.msg_iovlen = first_iovec[ i + count ] - first_iovec[ i ];
+
+    if ( count > 1 ) {
+      SegmentControl & control = controls[ messages.size() ];
+      message.msg_hdr.msg_control = control.buffer;
+      message.msg_hdr.msg_controllen = sizeof( control.buffer );
+
+      cmsghdr * const hdr = CMSG_FIRSTHDR( &message.msg_hdr );
+      hdr->cmsg_level = SOL_UDP;
+      hdr->cmsg_type = UDP_SEGMENT;
+      hdr->cmsg_len = CMSG_LEN( sizeof( uint16_t ) );
+      const uint16_t segment_size = sizes[ i ];
+      memcpy( CMSG_DATA( hdr ), &segment_size, sizeof( segment_size ) );
+    }
+
+    messages.push_back( message );
+    first_datagram.push_back( i );
+    i += count;
+  }
+
+  size_t sent = 0;
+  while ( sent < messages.size() ) {
+    const int ret = ::sendmmsg( fd_num(), &messages[ sent ], messages.size() - sent, 0 );
+
+    if ( ret < 0 and segmentation_offload_ and ( errno == EIO or errno == EINVAL ) ) {
+      /* the outgoing device can't segment after all; send the rest one by one */
+      segmentation_offload_ = false;
+      send_batch( vector<vector<Chunk>>( datagrams.begin() + first_datagram[ sent ], datagrams.end() ) );
+      return;
+    }
+
+    const size_t count = SystemCall( "sendmmsg", ret );
+
+    for ( size_t i = sent; i < sent + count; i++ ) {
+      size_t expected = 0;
+      for ( size_t j = 0; j < messages[ i ].msg_hdr.msg_iovlen; j++ ) {
+        expected += messages[ i ].msg_hdr.msg_iov[ j ].iov_len;
+      }
+
+      if ( messages[ i ].msg_len != expected ) {
+        throw runtime_error( "datagram payload too big for sendmmsg()" );
+      }
+    }
+
+    sent += count;
+    register_write();
+  }
+}
+
 /* allow local address to be reused sooner, at the cost of some robustness */
 void Socket::set_reuseaddr( void )
 {
@@ -230,6 +460,25 @@ void UDPSocket::set_timestamps( void )
   setsockopt( SOL_SOCKET, SO_TIMESTAMPNS, int( true ) );
 }
 
+/* use UDP_SEGMENT in send_batch() if the kernel supports it */
+bool UDPSocket::set_segmentation_offload( void )
+{
+  int segment_size = 0;
+  socklen_t len = sizeof( segment_size );
+  segmentation_offload_ = ::getsockopt( fd_num(), SOL_UDP, UDP_SEGMENT,
+                                        &segment_size, &len ) == 0;
+  return segmentation_offload_;
+}
+
+/* let the kernel coalesce received datagrams if it supports it */
+bool UDPSocket::set_receive_offload( void )
+{
+  const int enable = 1;
+  receive_offload_ = ::setsockopt( fd_num(), SOL_UDP, UDP_GRO,
+                                   &enable, sizeof( enable ) ) == 0;
+  return receive_offload_;
+}
+
 void TCPSocket::listen( const int backlog )
 {
   SystemCall("listen", ::listen( fd_num(), backlog ) );
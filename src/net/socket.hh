@@ -30,9 +30,12 @@
 #define SOCKET_HH
 
 #include <functional>
+#include <vector>
+#include <string>
 
 #include "address.hh"
 #include "file_descriptor.hh"
+#include "chunk.hh"
 #include "header.hh"
 
 /* class for network sockets (UDP, TCP, etc.) */
@@ -75,6 +78,14 @@ public:
 /* UDP socket */
 class UDPSocket : public Socket
 {
+private:
+  /* kernel offloads, turned on by set_segmentation_offload()/set_receive_offload() */
+  bool segmentation_offload_ { false };
+  bool receive_offload_ { false };
+
+  /* payload and control buffers for recv_batch(), allocated on first use */
+  std::vector<char> batch_buffer_ {};
+
 public:
   UDPSocket() : Socket( AF_INET, SOCK_DGRAM ) {}
 
@@ -93,8 +104,27 @@ public:
   /* send datagram to connected address */
   void send( const std::string & payload );
 
+  /* receive the datagrams already queued on the socket (at least one, at most
+     max_datagrams) with one recvmmsg(); datagrams coalesced by GRO are split */
+  std::vector<received_datagram> recv_batch( const size_t max_datagrams = 32 );
+
+  /* send datagrams in order to connected address with as few syscalls as
+     possible: sendmmsg(), and UDP GSO for runs of equal-size datagrams */
+  void send_batch( const std::vector<std::string> & payloads );
+
+  /* as above, with each datagram gathered from its pieces (sendmsg()-style,
+     without copying them into one buffer first) */
+  void send_batch( const std::vector<std::vector<Chunk>> & datagrams );
+
   /* turn on timestamps on receipt */
   void set_timestamps( void );
+
+  /* use UDP_SEGMENT in send_batch() if the kernel supports it; returns whether it does */
+  bool set_segmentation_offload( void );
+
+  /* let the kernel coalesce received datagrams (UDP_GRO) if it supports it;
+     only recv_batch() should be used to receive afterwards */
+  bool set_receive_offload( void );
 };
 
 /* TCP socket */
@@ -29,6 +29,7 @@
 #include <getopt.h>
 
 #include <cstdlib>
+#include <algorithm>
 #include <random>
 #include <unordered_map>
 #include <utility>
@@ -41,12 +42,14 @@
 
 #include "socket.hh"
 #include "packet.hh"
+#include "reassembly_buffer.hh"
 #include "poller.hh"
 #include "optional.hh"
 #include "player.hh"
 #include "display.hh"
 #include "paranoid.hh"
 #include "procinfo.hh"
+#include "state_cache.hh"
 
 using namespace std;
 using namespace std::chrono;
@@ -84,7 +87,8 @@ public:
 
 void usage( const char *argv0 )
 {
-  cerr << "Usage: " << argv0 << " [-f, --fullscreen] [--verbose] PORT WIDTH HEIGHT" << endl;
+  cerr << "Usage: " << argv0 << " [-f, --fullscreen] [--verbose]"
+       << " [-c, --state-cache-size MiB] PORT WIDTH HEIGHT" << endl;
 }
 
 uint16_t ezrand()
@@ -145,14 +149,18 @@ int main( int argc, char *argv[] )
   bool fullscreen = false;
   bool verbose = false;
 
+  /* decoder state cache settings */
+  size_t state_cache_size = 256 * 1024 * 1024;
+
   const option command_line_options[] = {
-    { "fullscreen", no_argument, nullptr, 'f' },
-    { "verbose",    no_argument, nullptr, 'v' },
+    { "fullscreen",       no_argument,       nullptr, 'f' },
+    { "verbose",          no_argument,       nullptr, 'v' },
+    { "state-cache-size", required_argument, nullptr, 'c' },
     { 0, 0, 0, 0 }
   };
 
   while ( true ) {
-    const int opt = getopt_long( argc, argv, "f", command_line_options, nullptr );
+    const int opt = getopt_long( argc, argv, "fc:", command_line_options, nullptr );
 
     if ( opt == -1 ) {
       break;
@@ -167,6 +175,10 @@ int main( int argc, char *argv[] )
       verbose = true;
       break;
 
+    case 'c':
+      state_cache_size = paranoid::stoul( optarg ) * 1024 * 1024;
+      break;
+
     default:
       usage( argv[ 0 ] );
       return EXIT_FAILURE;
@@ -186,6 +198,7 @@ int main( int argc, char *argv[] )
   UDPSocket socket;
   socket.bind( Address( "0", argv[ optind ] ) );
   socket.set_timestamps();
+  socket.set_receive_offload();
 
   /* construct FramePlayer */
   FramePlayer player( paranoid::stoul( argv[ optind + 1 ] ), paranoid::stoul( argv[ optind + 2 ] ) );
@@ -194,8 +207,8 @@ int main( int argc, char *argv[] )
   /* construct display thread */
   thread( [&player, fullscreen]() { display_task( player.example_raster(), fullscreen ); } ).detach();
 
-  /* frame no => FragmentedFrame; used when receiving packets out of order */
-  unordered_map<size_t, FragmentedFrame> fragmented_frames;
+  /* frames being reassembled; used when receiving packets out of order */
+  ReassemblyBuffer fragmented_frames { connection_id };
   size_t next_frame_no = 0;
 
   /* EWMA */
@@ -205,7 +218,21 @@ int main( int argc, char *argv[] )
   uint32_t current_state = player.current_decoder().get_hash().hash();
   const uint32_t initial_state = current_state;
   deque<uint32_t> complete_states;
-  unordered_map<uint32_t, Decoder> decoders { { current_state, player.current_decoder() } };
+  StateCache<Decoder> decoders {
+    /* a decoder is little more than its references, which a snapshot would
+       have to copy out of the shared rasters, so cold decoders are evicted
+       rather than compressed */
+    state_cache_size, false,
+    []( const Decoder & decoder ) {
+      const VP8Raster & last = decoder.example_raster();
+      return sizeof( Decoder ) + last.width() * last.height() * 3 / 2;
+    },
+    []( const Decoder & decoder ) { return DecoderSnapshot( decoder ); },
+    []( const DecoderSnapshot & snapshot ) { return snapshot.restore(); }
+  };
+
+  decoders.insert( initial_state, Decoder( player.current_decoder() ) );
+  decoders.pin( initial_state );
 
   /* memory usage logs */
   system_clock::time_point next_mem_usage_report = system_clock::now();
@@ -214,115 +241,124 @@ int main( int argc, char *argv[] )
   poller.add_action( Poller::Action( socket, Direction::In,
     [&]()
     {
-      /* wait for next UDP datagram */
-      const auto new_fragment = socket.recv();
+      /* drain the datagrams that have arrived */
+      for ( const auto & new_fragment : socket.recv_batch() ) {
+        /* parse the header; the payload follows it */
+        const Chunk datagram { new_fragment.payload };
+
+        if ( datagram.size() < Header::SIZE ) {
+          cerr << "dropping a truncated datagram (" << datagram.size() << " bytes)" << endl;
+          continue;
+        }
 
-      /* parse into Packet */
-      const Packet packet { new_fragment.payload };
+        const Header packet { datagram };
 
-      if ( packet.frame_no() < next_frame_no ) {
-        /* we're not interested in this anymore */
-        return ResultType::Continue;
-      }
-      else if ( packet.frame_no() > next_frame_no ) {
-        /* current frame is not finished yet, but we just received a packet
-           for the next frame, so here we just encode the partial frame and
-           display it and move on to the next frame */
-        cerr << "got a packet for frame #" << packet.frame_no()
-             << ", display previous frame(s)." << endl;
-
-        for ( size_t i = next_frame_no; i < packet.frame_no(); i++ ) {
-          if ( fragmented_frames.count( i ) == 0 ) continue;
-
-          enqueue_frame( player, fragmented_frames.at( i ).partial_frame() );
-          fragmented_frames.erase( i );
+        if ( datagram.size() < Header::SIZE + packet.payload_length_ ) {
+          cerr << "dropping a truncated datagram (" << datagram.size() << " bytes, "
+               << "payload length " << packet.payload_length_ << ")" << endl;
+          continue;
         }
 
-        next_frame_no = packet.frame_no();
-        current_state = player.current_decoder().minihash();
-      }
+        const Chunk payload = datagram( Header::SIZE, packet.payload_length_ );
 
-      /* add to current frame */
-      if ( fragmented_frames.count( packet.frame_no() ) ) {
-        fragmented_frames.at( packet.frame_no() ).add_packet( packet );
-      } else {
-        /*
-          This was judged "too fancy" by the Code Review Board of Dec. 29, 2016.
+        if ( packet.frame_no_ < next_frame_no ) {
+          /* we're not interested in this anymore */
+          continue;
+        }
+        else if ( packet.frame_no_ > next_frame_no ) {
+          /* current frame is not finished yet, but we just received a packet
+             for the next frame, so here we just encode the partial frame and
+             display it and move on to the next frame */
+          cerr << "got a packet for frame #" << packet.frame_no_
+               << ", display previous frame(s)." << endl;
+
+          for ( size_t i = next_frame_no; i < packet.frame_no_; i++ ) {
+            if ( not fragmented_frames.contains( i ) ) continue;
+
+            enqueue_frame( player, fragmented_frames.partial_frame( i ) );
+            fragmented_frames.release( i );
+          }
 
-          fragmented_frames.emplace( std::piecewise_construct,
-                                     forward_as_tuple( packet.frame_no() ),
-                                     forward_as_tuple( connection_id, packet ) );
-        */
+          next_frame_no = packet.frame_no_;
+          current_state = player.current_decoder().minihash();
+        }
 
-        fragmented_frames.insert( make_pair( packet.frame_no(),
-                                             FragmentedFrame( connection_id, packet ) ) );
-      }
+        /* add to current frame */
+        fragmented_frames.add_packet( packet, payload );
 
-      /* is the next frame ready to be decoded? */
-      if ( fragmented_frames.count( next_frame_no ) > 0 and fragmented_frames.at( next_frame_no ).complete() ) {
-        auto & fragment = fragmented_frames.at( next_frame_no );
+        /* is the next frame ready to be decoded? */
+        if ( fragmented_frames.complete( next_frame_no ) ) {
+          uint32_t expected_source_state = fragmented_frames.source_state( next_frame_no );
 
-        uint32_t expected_source_state = fragment.source_state();
+          if ( current_state != expected_source_state ) {
+            Decoder * stored_decoder = decoders.find( expected_source_state );
 
-        if ( current_state != expected_source_state ) {
-          if ( decoders.count( expected_source_state ) ) {
-            /* we have this state! let's load it */
-            player.set_decoder( decoders.at( expected_source_state ) );
-            current_state = expected_source_state;
+            if ( stored_decoder != nullptr ) {
+              /* we have this state! let's load it */
+              player.set_decoder( *stored_decoder );
+              current_state = expected_source_state;
+            }
           }
-        }
 
-        if ( current_state == expected_source_state and
-             expected_source_state != initial_state ) {
-          /* sender won't refer to any decoder older than this, so let's get
-             rid of them */
+          if ( current_state == expected_source_state and
+               expected_source_state != initial_state ) {
+            /* sender won't refer to any decoder older than this, so let's get
+               rid of them */
 
-          auto it = complete_states.begin();
+            auto it = complete_states.begin();
 
-          for ( ; it != complete_states.end(); it++ ) {
-            if ( *it != expected_source_state ) {
-              decoders.erase( *it );
-            }
-            else {
-              break;
+            for ( ; it != complete_states.end(); it++ ) {
+              if ( *it != expected_source_state ) {
+                decoders.erase( *it );
+              }
+              else {
+                break;
+              }
             }
+
+            assert( it != complete_states.end() );
+            complete_states.erase( complete_states.begin(), it );
           }
 
-          assert( it != complete_states.end() );
-          complete_states.erase( complete_states.begin(), it );
-        }
+          // here we apply the frame
+          enqueue_frame( player, fragmented_frames.frame( next_frame_no ) );
 
-        // here we apply the frame
-        enqueue_frame( player, fragment.frame() );
+          // state "after" applying the frame
+          current_state = player.current_decoder().minihash();
 
-        // state "after" applying the frame
-        current_state = player.current_decoder().minihash();
+          if ( current_state == fragmented_frames.target_state( next_frame_no ) and
+               current_state != initial_state ) {
+            /* this is a full state. let's save it */
+            decoders.insert( current_state, Decoder( player.current_decoder() ) );
+            complete_states.push_back( current_state );
+          }
 
-        if ( current_state == fragment.target_state() and
-             current_state != initial_state ) {
-          /* this is a full state. let's save it */
-          decoders.insert( make_pair( current_state, player.current_decoder() ) );
-          complete_states.push_back( current_state );
+          fragmented_frames.release( next_frame_no );
+          next_frame_no++;
         }
 
-        fragmented_frames.erase( next_frame_no );
-        next_frame_no++;
-      }
+        avg_delay.add( new_fragment.timestamp_us, packet.time_since_last_ );
 
-      avg_delay.add( new_fragment.timestamp_us, packet.time_since_last() );
+        /* only advertise the states that survived the cache budget */
+        complete_states.erase( remove_if( complete_states.begin(), complete_states.end(),
+                                          [&decoders]( const uint32_t state )
+                                          { return not decoders.contains( state ); } ),
+                               complete_states.end() );
 
-      AckPacket( connection_id, packet.frame_no(), packet.fragment_no(),
-                 avg_delay.int_value(), current_state,
-                 complete_states ).sendto( socket, new_fragment.source_address );
+        AckPacket( connection_id, packet.frame_no_, packet.fragment_no_,
+                   avg_delay.int_value(), current_state,
+                   complete_states ).sendto( socket, new_fragment.source_address );
 
-      auto now = system_clock::now();
+        auto now = system_clock::now();
 
-      if ( verbose and next_mem_usage_report < now ) {
-        cerr << "["
-             << duration_cast<milliseconds>( now.time_since_epoch() ).count()
-             << "] "
-             << " <mem = " << procinfo::memory_usage() << ">\n";
-        next_mem_usage_report = now + 5s;
+        if ( verbose and next_mem_usage_report < now ) {
+          cerr << "["
+               << duration_cast<milliseconds>( now.time_since_epoch() ).count()
+               << "] "
+               << " <mem = " << procinfo::memory_usage() << ">"
+               << " <decoders: " << decoders.str() << ">\n";
+          next_mem_usage_report = now + 5s;
+        }
       }
 
       return ResultType::Continue;
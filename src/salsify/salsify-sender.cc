@@ -52,7 +52,9 @@
 #include "socketpair.hh"
 #include "camera.hh"
 #include "pacer.hh"
+#include "fec.hh"
 #include "procinfo.hh"
+#include "state_cache.hh"
 
 using namespace std;
 using namespace std::chrono;
@@ -110,13 +112,13 @@ struct EncodeJob
 struct EncodeOutput
 {
   Encoder encoder;
-  vector<uint8_t> frame;
+  SerializedFrame frame;
   uint32_t source_minihash;
   milliseconds encode_time;
   string job_name;
   uint8_t y_ac_qi;
 
-  EncodeOutput( Encoder && encoder, vector<uint8_t> && frame,
+  EncodeOutput( Encoder && encoder, SerializedFrame && frame,
                 const uint32_t source_minihash, const milliseconds encode_time,
                 const string & job_name, const uint8_t y_ac_qi )
     : encoder( move( encoder ) ), frame( move( frame ) ),
@@ -127,7 +129,7 @@ struct EncodeOutput
 
 EncodeOutput do_encode_job( EncodeJob && encode_job )
 {
-  vector<uint8_t> output;
+  SerializedFrame output;
 
   uint32_t source_minihash = encode_job.encoder.minihash();
 
@@ -169,13 +171,26 @@ size_t target_size( uint32_t avg_delay, const uint64_t last_acked, const uint64_
   return 1400 * max( 0l, static_cast<int64_t>( max_delay / avg_delay - ( last_sent - last_acked ) ) );
 }
 
+/* a full fragment as it goes on the wire (and is charged by the Pacer) */
+const size_t FULL_DATAGRAM_SIZE = Header::SIZE + Packet::MAXIMUM_PAYLOAD;
+
+/* pacing rate (bytes/s) for the receiver's inter-packet delay: send a full
+   fragment 5x faster than packets are being received, every 0.5 to 2 ms */
+double pacing_rate( const uint32_t avg_delay )
+{
+  const unsigned int inter_send_delay = min( 2000u, max( 500u, avg_delay / 5 ) );
+  return 1e6 * FULL_DATAGRAM_SIZE / inter_send_delay;
+}
+
 void usage( const char *argv0 )
 {
   cerr << "Usage: " << argv0
        << " [-m,--mode MODE] [-d, --device CAMERA] [-p, --pixfmt PIXEL_FORMAT]"
-       << " [-u,--update-rate RATE] [--log-mem-usage] HOST PORT CONNECTION_ID" << endl
+       << " [-u,--update-rate RATE] [-c,--state-cache-size MiB] [--compress-states]"
+       << " [--log-mem-usage] [--fec] HOST PORT CONNECTION_ID" << endl
        << endl
-       << "Accepted MODEs are s1, s2 (default), conventional." << endl;
+       << "Accepted MODEs are s1, s2 (default), conventional." << endl
+       << "--fec adds Reed-Solomon parity fragments to each frame, scaled to the observed loss rate." << endl;
 }
 
 uint64_t ack_seq_no( const AckPacket & ack,
@@ -204,18 +219,26 @@ int main( int argc, char *argv[] )
   size_t update_rate __attribute__((unused)) = 1;
   OperationMode operation_mode = OperationMode::S2;
   bool log_mem_usage = false;
+  bool fec = false;
+
+  /* encoder state cache settings */
+  size_t state_cache_size = 512 * 1024 * 1024;
+  bool compress_states = false;
 
   const option command_line_options[] = {
-    { "mode",          required_argument, nullptr, 'm' },
-    { "device",        required_argument, nullptr, 'd' },
-    { "pixfmt",        required_argument, nullptr, 'p' },
-    { "update-rate",   required_argument, nullptr, 'u' },
-    { "log-mem-usage", no_argument,       nullptr, 'M' },
+    { "mode",             required_argument, nullptr, 'm' },
+    { "device",           required_argument, nullptr, 'd' },
+    { "pixfmt",           required_argument, nullptr, 'p' },
+    { "update-rate",      required_argument, nullptr, 'u' },
+    { "state-cache-size", required_argument, nullptr, 'c' },
+    { "compress-states",  no_argument,       nullptr, 'C' },
+    { "log-mem-usage",    no_argument,       nullptr, 'M' },
+    { "fec",              no_argument,       nullptr, 'F' },
     { 0, 0, 0, 0 }
   };
 
   while ( true ) {
-    const int opt = getopt_long( argc, argv, "d:p:m:u:", command_line_options, nullptr );
+    const int opt = getopt_long( argc, argv, "d:p:m:u:c:", command_line_options, nullptr );
 
     if ( opt == -1 ) { break; }
 
@@ -239,10 +262,22 @@ int main( int argc, char *argv[] )
       update_rate = paranoid::stoul( optarg );
       break;
 
+    case 'c':
+      state_cache_size = paranoid::stoul( optarg ) * 1024 * 1024;
+      break;
+
+    case 'C':
+      compress_states = true;
+      break;
+
     case 'M':
       log_mem_usage = true;
       break;
 
+    case 'F':
+      fec = true;
+      break;
+
     default:
       usage( argv[ 0 ] );
       return EXIT_FAILURE;
@@ -258,9 +293,7 @@ int main( int argc, char *argv[] )
   UDPSocket socket;
   socket.connect( Address( argv[ optind ], argv[ optind + 1 ] ) );
   socket.set_timestamps();
-
-  /* make pacer to smooth out outgoing packets */
-  Pacer pacer;
+  socket.set_segmentation_offload();
 
   /* get connection_id */
   const uint16_t connection_id = paranoid::stoul( argv[ optind + 2 ] );
@@ -268,8 +301,19 @@ int main( int argc, char *argv[] )
   /* average inter-packet delay, reported by receiver */
   uint32_t avg_delay = numeric_limits<uint32_t>::max();
 
-  /* keep the number of fragments per frame */
+  /* make pacer to smooth out outgoing packets, allowing two fragments back to back */
+  Pacer<OutgoingFragment> pacer { pacing_rate( avg_delay ), 2 * FULL_DATAGRAM_SIZE };
+
+  /* loss rate seen in the acks, to size the parity */
+  LossRateEstimator loss_rate;
+
+  /* keep the number of fragments (data and parity) per frame */
   vector<uint64_t> cumulative_fpf;
+
+  /* and of data fragments only: the receiver doesn't ack the parity that
+     trails a frame it has already completed, so the loss estimate skips
+     parity altogether */
+  vector<uint64_t> cumulative_data_fpf;
   uint64_t last_acked = numeric_limits<uint64_t>::max();
 
   /* maximum number of frames to be skipped in a row */
@@ -307,7 +351,14 @@ int main( int argc, char *argv[] )
 
   /* decoder hash => encoder object */
   deque<uint32_t> encoder_states;
-  unordered_map<uint32_t, Encoder> encoders { { initial_state, base_encoder } };
+  StateCache<Encoder, EncoderSnapshot> encoders {
+    state_cache_size, compress_states,
+    []( const Encoder & encoder ) { return encoder.footprint(); },
+    []( const Encoder & encoder ) { return EncoderSnapshot( encoder ); },
+    []( const EncoderSnapshot & snapshot ) { return snapshot.restore(); }
+  };
+
+  encoders.insert( initial_state, Encoder( base_encoder ) );
 
   /* latest state of the receiver, based on ack packets */
   Optional<uint32_t> receiver_last_acked_state;
@@ -357,7 +408,7 @@ int main( int argc, char *argv[] )
       /* let's cleanup the stored encoders based on the lastest ack */
       if ( receiver_last_acked_state.initialized() and
            receiver_last_acked_state.get() != initial_state and
-           encoders.count( receiver_last_acked_state.get() ) ) {
+           encoders.contains( receiver_last_acked_state.get() ) ) {
         // cleaning up
         auto it = encoder_states.begin();
 
@@ -378,6 +429,22 @@ int main( int argc, char *argv[] )
         encoder_states.erase( encoder_states.begin(), it );
       }
 
+      /* the states the receiver might refer to must survive the cache budget */
+      encoders.unpin_all();
+      encoders.pin( initial_state );
+
+      if ( receiver_last_acked_state.initialized() ) {
+        encoders.pin( receiver_last_acked_state.get() );
+      }
+
+      if ( receiver_assumed_state.initialized() ) {
+        encoders.pin( receiver_assumed_state.get() );
+      }
+
+      for ( const uint32_t state : receiver_complete_states ) {
+        encoders.pin( state );
+      }
+
       RasterHandle raster = last_raster.get();
 
       uint32_t selected_source_hash = initial_state;
@@ -412,7 +479,7 @@ int main( int argc, char *argv[] )
         }
       }
       else {
-        if ( encoders.count( receiver_last_acked_state.get() ) == 0 ) {
+        if ( not encoders.contains( receiver_last_acked_state.get() ) ) {
           /* it seems that the receiver is in an invalid state */
 
           /* step 1: let's go into 'conservative' mode; just encode based on a
@@ -439,6 +506,13 @@ int main( int argc, char *argv[] )
         }
       }
       /* end of encoder selection logic */
+
+      if ( not encoders.contains( selected_source_hash ) ) {
+        /* the cache budget evicted this state before the receiver reported
+           it; the initial state is always pinned */
+        selected_source_hash = initial_state;
+      }
+
       const Encoder & encoder = encoders.at( selected_source_hash );
 
       const static auto increment_quantizer = []( const uint16_t q, const int8_t inc ) -> uint8_t
@@ -610,12 +684,11 @@ int main( int argc, char *argv[] )
       FragmentedFrame ff { connection_id, output.source_minihash, target_minihash,
                            frame_no,
                            static_cast<uint32_t>( duration_cast<microseconds>( system_clock::now() - last_sent ).count() ),
-                           output.frame };
+                           make_shared<const SerializedFrame>( move( output.frame ) ),
+                           fec ? parity_ratio( loss_rate.loss_rate() ) : 0 };
       /* enqueue the packets to be sent */
-      /* send 5x faster than packets are being received */
-      const unsigned int inter_send_delay = min( 2000u, max( 500u, avg_delay / 5 ) );
-      for ( const auto & packet : ff.packets() ) {
-        pacer.push( packet.to_string(), inter_send_delay );
+      for ( const auto & fragment : ff.outgoing() ) {
+        pacer.push( fragment );
       }
 
       last_sent = system_clock::now();
@@ -629,23 +702,28 @@ int main( int argc, char *argv[] )
            << avg_encoding_time.int_value()/1000 << " ms, ssim="
            << output.encoder.stats().ssim.get_or( -1.0 )
            << ") {" << output.source_minihash << " -> " << target_minihash << "}"
-           << " intersend_delay = " << inter_send_delay << " us"; */
+           << " pacing rate = " << pacer.rate() << " B/s"; */
 
       if ( log_mem_usage and next_mem_usage_report < last_sent ) {
-        cerr << " <mem = " << procinfo::memory_usage() << ">";
+        cerr << " <mem = " << procinfo::memory_usage() << ">"
+             << " <encoders: " << encoders.str() << ">";
         next_mem_usage_report = last_sent + 5s;
       }
 
       // cerr << "\n";
 
       cumulative_fpf.push_back( ( frame_no > 0 )
-                                ? ( cumulative_fpf[ frame_no - 1 ] + ff.fragments_in_this_frame() )
-                                : ff.fragments_in_this_frame() );
+                                ? ( cumulative_fpf[ frame_no - 1 ] + ff.outgoing().size() )
+                                : ff.outgoing().size() );
+
+      cumulative_data_fpf.push_back( ( frame_no > 0 )
+                                     ? ( cumulative_data_fpf[ frame_no - 1 ] + ff.fragments_in_this_frame() )
+                                     : ff.fragments_in_this_frame() );
 
       /* now we assume that the receiver will successfully get this */
       receiver_assumed_state.reset( target_minihash );
 
-      encoders.insert( make_pair( target_minihash, move( output.encoder ) ) );
+      encoders.insert( target_minihash, move( output.encoder ) );
       encoder_states.push_back( target_minihash );
 
       skipped_count = 0;
@@ -675,8 +753,17 @@ int main( int argc, char *argv[] )
         return ResultType::Continue;
       }
 
+      const uint64_t data_fragments = ( ack.frame_no() > 0 )
+        ? ( cumulative_data_fpf[ ack.frame_no() ] - cumulative_data_fpf[ ack.frame_no() - 1 ] )
+        : cumulative_data_fpf[ 0 ];
+
+      if ( ack.fragment_no() < data_fragments ) {
+        loss_rate.add_ack( ack_seq_no( ack, cumulative_data_fpf ) );
+      }
+
       last_acked = this_ack_seq;
       avg_delay = ack.avg_delay();
+      pacer.set_rate( pacing_rate( avg_delay ) );
       receiver_last_acked_state.reset( ack.current_state() );
       receiver_complete_states = move( ack.complete_states() );
 
@@ -686,24 +773,35 @@ int main( int argc, char *argv[] )
 
   /* outgoing packet ready to leave the pacer */
   poller.add_action( Poller::Action( socket, Direction::Out, [&]() {
-        assert( pacer.ms_until_due() == 0 );
+        assert( pacer.us_until_due().count() == 0 );
 
-        while ( pacer.ms_until_due() == 0 ) {
+        /* everything that is due leaves in one batch; the gathered chunks
+           point into the fragments, which are kept until it is sent */
+        vector<OutgoingFragment> leaving;
+
+        while ( pacer.us_until_due().count() == 0 ) {
           assert( not pacer.empty() );
 
-          socket.send( pacer.front() );
+          leaving.push_back( pacer.front() );
           pacer.pop();
         }
 
+        vector<vector<Chunk>> due;
+        for ( const auto & fragment : leaving ) {
+          due.push_back( fragment.gather() );
+        }
+
+        socket.send_batch( due );
+
         return ResultType::Continue;
-      }, [&]() { return pacer.ms_until_due() == 0; } ) );
+      }, [&]() { return pacer.us_until_due().count() == 0; } ) );
 
   /* kick off the first encode */
   encode_start_pipe.first.write( "1" );
 
   /* handle events */
   while ( true ) {
-    const auto poll_result = poller.poll( pacer.ms_until_due() );
+    const auto poll_result = poller.poll( pacer.us_until_due() );
     if ( poll_result.result == Poller::Result::Type::Exit ) {
       if ( poll_result.exit_status ) {
         cerr << "Connection error." << endl;
@@ -113,13 +113,13 @@ struct EncodeJob
 struct EncodeOutput
 {
   Encoder encoder;
-  vector<uint8_t> frame;
+  SerializedFrame frame;
   uint32_t source_minihash;
   milliseconds encode_time;
   string job_name;
   uint8_t y_ac_qi;
 
-  EncodeOutput( Encoder && encoder, vector<uint8_t> && frame,
+  EncodeOutput( Encoder && encoder, SerializedFrame && frame,
                 const uint32_t source_minihash, const milliseconds encode_time,
                 const string & job_name, const uint8_t y_ac_qi )
     : encoder( move( encoder ) ), frame( move( frame ) ),
@@ -130,7 +130,7 @@ struct EncodeOutput
 
 EncodeOutput do_encode_job( EncodeJob && encode_job )
 {
-  vector<uint8_t> output;
+  SerializedFrame output;
 
   uint32_t source_minihash = encode_job.encoder.minihash();
 
@@ -623,16 +623,16 @@ int main( int argc, char *argv[] )
       FragmentedFrame ff { connection_id, output.source_minihash, target_minihash,
                            frame_no,
                            static_cast<uint32_t>( duration_cast<microseconds>( system_clock::now() - last_sent ).count() ),
-                           output.frame };
+                           make_shared<const SerializedFrame>( move( output.frame ) ) };
       /* enqueue the packets to be sent */
       /* send 5x faster than packets are being received */
       const unsigned int __attribute__((unused)) inter_send_delay = min( 2000u, max( 500u, avg_delay / 5 ) );
 
       // spdlog::info( "Push encoded frame to send buffer");
-      for ( const auto & packet : ff.packets() ) {
+      for ( const auto & fragment : ff.outgoing() ) {
         /* we don't need pacer since we send the packet with TCP*/
-        spdlog::info( "Push encoded frame to send buffer: {}, segment num: {}", packet.frame_no(), packet.fragment_no());
-        queue_.push_back( packet.to_string() );
+        spdlog::info( "Push encoded frame to send buffer: {}, segment size: {}", frame_no, fragment.size());
+        queue_.push_back( fragment.to_string() );
       }
 
       last_sent = system_clock::now();
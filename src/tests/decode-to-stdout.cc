@@ -40,12 +40,16 @@ int main( int argc, char *argv[] )
       return EXIT_FAILURE;
     }
 
-    Player player( argv[ 1 ] );
+    /* "-" reads from stdin */
+    StreamPlayer player( argv[ 1 ] );
 
-    while ( not player.eof() ) {
-      RasterHandle raster = player.advance();
+    while ( true ) {
+      Optional<RasterHandle> raster = player.advance();
+      if ( not raster.initialized() ) {
+        break;
+      }
 
-      raster.get().dump( stdout );
+      raster.get().get().dump( stdout );
     }
   } catch ( const exception & e ) {
     print_exception( argv[ 0 ], e );
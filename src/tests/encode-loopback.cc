@@ -47,7 +47,7 @@ vector< uint8_t > encode( const vector< pair< Probability, bool > > & bitlist )
     encoder.put( x.second, x.first );
   }
 
-  return encoder.finish();
+  return encoder.finish().get();
 }
 
 int main( int argc, char *argv[] )
@@ -100,7 +100,7 @@ int main( int argc, char *argv[] )
 
         const auto encoded_string = encoder.finish();
 
-        BoolDecoder decoder( Chunk( &encoded_string.front(), encoded_string.size() ) );
+        BoolDecoder decoder( encoded_string.chunk() );
 
         const decltype( test_mode ) decoded_id = { decoder, probabilities };
 
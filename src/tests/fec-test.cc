@@ -0,0 +1,328 @@
+/* -*-mode:c++; tab-width: 2; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+
+/* Copyright 2013-2018 the Alfalfa authors
+                       and the Massachusetts Institute of Technology
+
+   Redistribution and use in source and binary forms, with or without
+   modification, are permitted provided that the following conditions are
+   met:
+
+      1. Redistributions of source code must retain the above copyright
+         notice, this list of conditions and the following disclaimer.
+
+      2. Redistributions in binary form must reproduce the above copyright
+         notice, this list of conditions and the following disclaimer in the
+         documentation and/or other materials provided with the distribution.
+
+   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+   "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+   LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+   A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+   HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+   SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+   LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+   DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+   THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+   (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+   OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE. */
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+#include <iomanip>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "packet.hh"
+#include "reassembly_buffer.hh"
+#include "fec.hh"
+#include "exception.hh"
+
+using namespace std;
+
+/* sends random frames through FragmentedFrame and a lossy link into a
+   ReassemblyBuffer, with and without parity, and reports how many frames
+   could not be rebuilt and the frame latency percentiles at each loss rate.
+   The receiver acks the way salsify-receiver does (nothing for a frame it
+   has completed), and the parity ratio follows the loss rate the sender
+   estimates from the acks of data fragments. */
+
+const uint16_t connection_id = 1337;
+const unsigned int frame_count = 2000;
+
+/* timing model: one fragment every 0.5 ms, a frame every 33 ms, 20 ms one-way
+   delay, and a frame that cannot be rebuilt waits a round trip for repair */
+const double packet_interval_ms = 0.5;
+const double frame_interval_ms = 33;
+const double one_way_delay_ms = 20;
+const double round_trip_ms = 2 * one_way_delay_ms;
+
+/* drops each datagram independently with a fixed probability */
+class LossEmulator
+{
+private:
+  mt19937 prng_;
+  bernoulli_distribution drop_;
+
+public:
+  LossEmulator( const double loss_rate, const unsigned int seed )
+    : prng_( seed ), drop_( loss_rate )
+  {}
+
+  bool deliver() { return not drop_( prng_ ); }
+};
+
+struct RunResult
+{
+  vector<double> latencies_ms {};
+  unsigned int unrecovered { 0 };
+  uint64_t data_packets { 0 };
+  uint64_t parity_packets { 0 };
+  double mean_loss_estimate { 0 };
+};
+
+shared_ptr<const SerializedFrame> make_frame( const string & contents )
+{
+  auto frame = make_shared<SerializedFrame>();
+
+  /* split it over two buffers, like the encoder's output */
+  const size_t split = contents.size() / 3;
+  for ( const string & part : { contents.substr( 0, split ), contents.substr( split ) } ) {
+    if ( part.empty() ) { continue; }
+    ArenaBuffer buffer;
+    buffer.get().assign( part.begin(), part.end() );
+    frame->append( move( buffer ) );
+  }
+
+  return frame;
+}
+
+string concatenate( const vector<Chunk> & chunks )
+{
+  string ret;
+  for ( const Chunk & chunk : chunks ) {
+    ret.append( reinterpret_cast<const char *>( chunk.buffer() ), chunk.size() );
+  }
+  return ret;
+}
+
+RunResult run( const double loss, const bool fec )
+{
+  /* same frames and same loss pattern for every configuration */
+  mt19937 prng( 1 );
+  uniform_int_distribution<size_t> frame_size( 500, 30 * Packet::MAXIMUM_PAYLOAD );
+  LossEmulator link { loss, 2 };
+
+  ReassemblyBuffer buffer { connection_id };
+  LossRateEstimator loss_rate;
+
+  RunResult result;
+
+  /* sequence number of the frame's first data fragment */
+  uint64_t data_seq = 0;
+
+  for ( uint32_t frame_no = 0; frame_no < frame_count; frame_no++ ) {
+    string contents( frame_size( prng ), 0 );
+    for ( char & c : contents ) { c = static_cast<char>( prng() ); }
+
+    FragmentedFrame ff { connection_id, 0, 1, frame_no, 0, make_frame( contents ),
+                         fec ? parity_ratio( loss_rate.loss_rate() ) : 0 };
+
+    result.data_packets += ff.fragments_in_this_frame();
+    result.parity_packets += ff.outgoing().size() - ff.fragments_in_this_frame();
+
+    const double frame_start = frame_no * frame_interval_ms;
+    double completed_at = -1;
+
+    for ( size_t i = 0; i < ff.outgoing().size(); i++ ) {
+      if ( not link.deliver() or completed_at >= 0 ) {
+        /* lost, or the receiver has moved on from this frame */
+        continue;
+      }
+
+      const string datagram_str = concatenate( ff.outgoing()[ i ].gather() );
+      const Chunk datagram { datagram_str };
+      const Header header { datagram };
+
+      /* the parity is sent between the data fragments */
+      if ( header.fragment_no_ < ff.fragments_in_this_frame() ) {
+        loss_rate.add_ack( data_seq + header.fragment_no_ );
+      }
+
+      buffer.add_packet( header, datagram( Header::SIZE, header.payload_length_ ) );
+
+      if ( completed_at < 0 and buffer.complete( frame_no ) ) {
+        completed_at = frame_start + i * packet_interval_ms + one_way_delay_ms;
+
+        if ( buffer.frame( frame_no ).to_string() != contents ) {
+          throw runtime_error( "frame #" + to_string( frame_no ) + " was rebuilt incorrectly" );
+        }
+      }
+    }
+
+    data_seq += ff.fragments_in_this_frame();
+    result.mean_loss_estimate += loss_rate.loss_rate() / frame_count;
+
+    if ( completed_at < 0 ) {
+      /* the missing fragments arrive after a round trip */
+      result.unrecovered++;
+      completed_at = frame_start + ff.outgoing().size() * packet_interval_ms
+                     + one_way_delay_ms + round_trip_ms;
+    }
+
+    if ( buffer.contains( frame_no ) ) {
+      buffer.release( frame_no );
+    }
+
+    result.latencies_ms.push_back( completed_at - frame_start );
+  }
+
+  return result;
+}
+
+double percentile( vector<double> values, const double p )
+{
+  sort( values.begin(), values.end() );
+  return values.at( min( values.size() - 1, static_cast<size_t>( p * values.size() ) ) );
+}
+
+/* parity that arrives before the data, and two losses in one group, one of
+   them the last (short) fragment */
+bool check_reordered()
+{
+  string contents( 3 * Packet::MAXIMUM_PAYLOAD + 123, 0 );
+  for ( size_t i = 0; i < contents.size(); i++ ) {
+    contents[ i ] = static_cast<char>( i * 7 + i / 11 );
+  }
+
+  FragmentedFrame ff { connection_id, 5, 6, 7, 0, make_frame( contents ), 0.5 };
+
+  ReassemblyBuffer buffer { connection_id };
+
+  vector<OutgoingFragment> fragments = ff.outgoing();
+  reverse( fragments.begin(), fragments.end() );
+
+  for ( const OutgoingFragment & fragment : fragments ) {
+    const string datagram_str = concatenate( fragment.gather() );
+    const Chunk datagram { datagram_str };
+    const Header header { datagram };
+
+    if ( header.fragment_no_ == 3 or header.fragment_no_ == 0 ) {
+      continue;
+    }
+
+    buffer.add_packet( header, datagram( Header::SIZE, header.payload_length_ ) );
+  }
+
+  return buffer.complete( 7 ) and buffer.frame( 7 ).to_string() == contents;
+}
+
+/* a frame of several groups: each group's parity follows its last member,
+   and a group can lose as many data fragments as it has parity */
+bool check_groups()
+{
+  string contents( 150 * Packet::MAXIMUM_PAYLOAD, 0 );
+  for ( size_t i = 0; i < contents.size(); i++ ) {
+    contents[ i ] = static_cast<char>( i * 13 + i / 7 );
+  }
+
+  FragmentedFrame ff { connection_id, 5, 6, 8, 0, make_frame( contents ), 0.1 };
+
+  const uint16_t group_size = fec_group_size( ff.fragments_in_this_frame() );
+  const uint16_t parity_count = parity_fragments( group_size, 0.1 );
+
+  ReassemblyBuffer buffer { connection_id };
+
+  for ( size_t i = 0; i < ff.outgoing().size(); i++ ) {
+    const string datagram_str = concatenate( ff.outgoing()[ i ].gather() );
+    const Chunk datagram { datagram_str };
+    const Header header { datagram };
+
+    const bool parity = header.fragment_no_ >= ff.fragments_in_this_frame();
+    if ( parity != ( i % ( group_size + parity_count ) >= group_size ) ) {
+      cerr << "parity is not sent right after its group" << endl;
+      return false;
+    }
+
+    if ( header.fragment_no_ >= group_size and header.fragment_no_ < group_size + parity_count ) {
+      /* as many losses as the second group has parity */
+      continue;
+    }
+
+    buffer.add_packet( header, datagram( Header::SIZE, header.payload_length_ ) );
+  }
+
+  return buffer.complete( 8 ) and buffer.frame( 8 ).to_string() == contents;
+}
+
+int main( int argc, char *argv[] )
+{
+  try {
+    if ( argc != 1 ) {
+      cerr << "Usage: " << argv[ 0 ] << endl;
+      return EXIT_FAILURE;
+    }
+
+    if ( not check_reordered() ) {
+      cerr << "could not rebuild a frame from out-of-order parity" << endl;
+      return EXIT_FAILURE;
+    }
+
+    if ( not check_groups() ) {
+      cerr << "could not rebuild a frame of several parity groups" << endl;
+      return EXIT_FAILURE;
+    }
+
+    bool ok = true;
+
+    cerr << fixed << setprecision( 1 );
+
+    for ( const double loss : { 0.01, 0.05, 0.10 } ) {
+      const RunResult without_fec = run( loss, false );
+      const RunResult with_fec = run( loss, true );
+
+      for ( const RunResult * result : { &without_fec, &with_fec } ) {
+        cerr << "loss " << 100 * loss << "% "
+             << ( result == &with_fec ? "with FEC:    " : "without FEC: " )
+             << "estimated loss " << 100 * result->mean_loss_estimate << "%, "
+             << "overhead " << 100.0 * result->parity_packets / result->data_packets << "%, "
+             << "unrecovered " << result->unrecovered << "/" << frame_count << ", "
+             << "latency p50/p95/p99 "
+             << percentile( result->latencies_ms, 0.50 ) << "/"
+             << percentile( result->latencies_ms, 0.95 ) << "/"
+             << percentile( result->latencies_ms, 0.99 ) << " ms" << endl;
+      }
+
+      /* parity has to rebuild most of the frames that would have waited a
+         round trip */
+      if ( with_fec.unrecovered * 2 > without_fec.unrecovered ) {
+        cerr << "FEC did not help enough at " << 100 * loss << "% loss" << endl;
+        ok = false;
+      }
+
+      /* nor may it make the tail latency worse than waiting for repairs */
+      for ( const double p : { 0.95, 0.99 } ) {
+        if ( percentile( with_fec.latencies_ms, p ) > percentile( without_fec.latencies_ms, p ) ) {
+          cerr << "FEC made the p" << 100 * p << " latency worse at " << 100 * loss << "% loss" << endl;
+          ok = false;
+        }
+      }
+
+      /* the parity must not inflate the loss estimate it is sized from */
+      for ( const RunResult * result : { &without_fec, &with_fec } ) {
+        if ( abs( result->mean_loss_estimate - loss ) > 0.25 * loss ) {
+          cerr << "loss estimate is off at " << 100 * loss << "% loss" << endl;
+          ok = false;
+        }
+      }
+    }
+
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+  } catch ( const exception & e ) {
+    print_exception( argv[ 0 ], e );
+    return EXIT_FAILURE;
+  }
+}
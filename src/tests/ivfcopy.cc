@@ -46,8 +46,11 @@ int main( int argc, char *argv[] )
                       old_file.height(),
                       old_file.frame_rate(),
                       old_file.time_scale() );
-  
+  new_file.set_buffered();
+
   for ( unsigned int i = 0; i < old_file.frame_count(); i++ ) {
     new_file.append_frame( old_file.frame( i ) );
   }
+
+  new_file.flush();
 }
@@ -0,0 +1,187 @@
+/* -*-mode:c++; tab-width: 2; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+
+/* Copyright 2013-2018 the Alfalfa authors
+                       and the Massachusetts Institute of Technology
+
+   Redistribution and use in source and binary forms, with or without
+   modification, are permitted provided that the following conditions are
+   met:
+
+      1. Redistributions of source code must retain the above copyright
+         notice, this list of conditions and the following disclaimer.
+
+      2. Redistributions in binary form must reproduce the above copyright
+         notice, this list of conditions and the following disclaimer in the
+         documentation and/or other materials provided with the distribution.
+
+   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+   "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+   LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+   A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+   HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+   SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+   LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+   DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+   THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+   (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+   OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE. */
+
+#include <algorithm>
+#include <cstdlib>
+#include <iostream>
+#include <numeric>
+#include <vector>
+
+#include "pacer.hh"
+#include "poller.hh"
+#include "socket.hh"
+#include "exception.hh"
+
+using namespace std;
+using namespace std::chrono;
+using namespace PollerShortNames;
+
+/* checks that a new Pacer starts with a full bucket, then sends full-size
+   packets through it over loopback and checks the inter-departure times (as
+   seen by the receiving socket's timestamps) against the configured rate,
+   before and after a rate update */
+
+const size_t packet_size = 1400;
+const unsigned int packets_per_phase = 200;
+
+/* checks the gaps of one phase against the expected inter-departure time */
+bool check_phase( const string & name, vector<double> gaps, const double expected_us )
+{
+  sort( gaps.begin(), gaps.end() );
+
+  const double mean = accumulate( gaps.begin(), gaps.end(), 0.0 ) / gaps.size();
+  const double p10 = gaps.at( gaps.size() / 10 );
+  const double median = gaps.at( gaps.size() / 2 );
+  const double p90 = gaps.at( gaps.size() * 9 / 10 );
+
+  cerr << name << ": expected " << expected_us << " us, mean " << mean << " us, "
+       << "p10/p50/p90 " << p10 << "/" << median << "/" << p90 << " us" << endl;
+
+  /* the long-run rate must match, and packets must not leave in bursts */
+  if ( abs( mean - expected_us ) > 0.1 * expected_us ) {
+    cerr << name << ": mean inter-departure time is off" << endl;
+    return false;
+  }
+
+  if ( abs( median - expected_us ) > 0.2 * expected_us ) {
+    cerr << name << ": packets are not evenly spaced" << endl;
+    return false;
+  }
+
+  return true;
+}
+
+/* a burst's worth of packets is due at once, and the next one is not */
+bool check_initial_burst()
+{
+  const unsigned int burst_packets = 4;
+  Pacer pacer { 1e6 * packet_size / 500, burst_packets * packet_size };
+
+  for ( unsigned int i = 0; i <= burst_packets; i++ ) {
+    pacer.push( string( packet_size, 'x' ) );
+  }
+
+  for ( unsigned int i = 0; i < burst_packets; i++ ) {
+    if ( pacer.us_until_due().count() != 0 ) {
+      cerr << "initial burst: packet " << i << " was not due immediately" << endl;
+      return false;
+    }
+
+    pacer.pop();
+  }
+
+  if ( pacer.us_until_due().count() == 0 ) {
+    cerr << "initial burst: the bucket held more than the burst" << endl;
+    return false;
+  }
+
+  return true;
+}
+
+int main( int argc, char *argv[] )
+{
+  try {
+    if ( argc != 1 ) {
+      cerr << "Usage: " << argv[ 0 ] << endl;
+      return EXIT_FAILURE;
+    }
+
+    if ( not check_initial_burst() ) {
+      return EXIT_FAILURE;
+    }
+
+    UDPSocket receiver;
+    receiver.bind( Address( "127.0.0.1", "0" ) );
+    receiver.set_timestamps();
+
+    UDPSocket sender;
+    sender.connect( receiver.local_address() );
+
+    /* one packet every 500 us, then every 1200 us; room for a few packets
+       so that a late wake-up is caught up rather than lost */
+    const double first_interval = 500, second_interval = 1200;
+    Pacer pacer { 1e6 * packet_size / first_interval, 4 * packet_size };
+
+    for ( unsigned int i = 0; i < 2 * packets_per_phase; i++ ) {
+      pacer.push( string( packet_size, 'x' ) );
+    }
+
+    unsigned int sent = 0;
+    vector<uint64_t> arrivals;
+
+    Poller poller;
+    poller.add_action( Poller::Action( sender, Direction::Out,
+      [&]()
+      {
+        sender.send( pacer.front() );
+        pacer.pop();
+
+        if ( ++sent == packets_per_phase ) {
+          pacer.set_rate( 1e6 * packet_size / second_interval );
+        }
+
+        return ResultType::Continue;
+      },
+      [&]() { return pacer.us_until_due().count() == 0; } ) );
+
+    poller.add_action( Poller::Action( receiver, Direction::In,
+      [&]()
+      {
+        arrivals.push_back( receiver.recv().timestamp_us );
+        return ResultType::Continue;
+      } ) );
+
+    while ( arrivals.size() < 2 * packets_per_phase ) {
+      if ( poller.poll( pacer.us_until_due() ).result == Poller::Result::Type::Exit ) {
+        throw runtime_error( "unexpected exit from poll" );
+      }
+    }
+
+    /* skip the bucket's initial burst and the gap across the rate change */
+    const unsigned int skip = 8;
+    vector<double> first_gaps, second_gaps;
+
+    for ( unsigned int i = skip; i < packets_per_phase; i++ ) {
+      first_gaps.push_back( arrivals.at( i ) - arrivals.at( i - 1 ) );
+    }
+
+    for ( unsigned int i = packets_per_phase + skip; i < 2 * packets_per_phase; i++ ) {
+      second_gaps.push_back( arrivals.at( i ) - arrivals.at( i - 1 ) );
+    }
+
+    if ( not check_phase( "initial rate", first_gaps, first_interval )
+         or not check_phase( "updated rate", second_gaps, second_interval ) ) {
+      return EXIT_FAILURE;
+    }
+  } catch ( const exception & e ) {
+    print_exception( argv[ 0 ], e );
+    return EXIT_FAILURE;
+  }
+
+  return EXIT_SUCCESS;
+}
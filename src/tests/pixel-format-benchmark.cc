@@ -0,0 +1,292 @@
+/* -*-mode:c++; tab-width: 2; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+
+/* Copyright 2013-2018 the Alfalfa authors
+                       and the Massachusetts Institute of Technology
+
+   Redistribution and use in source and binary forms, with or without
+   modification, are permitted provided that the following conditions are
+   met:
+
+      1. Redistributions of source code must retain the above copyright
+         notice, this list of conditions and the following disclaimer.
+
+      2. Redistributions in binary form must reproduce the above copyright
+         notice, this list of conditions and the following disclaimer in the
+         documentation and/or other materials provided with the distribution.
+
+   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+   "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+   LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+   A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+   HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+   SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+   LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+   DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+   THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+   (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+   OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE. */
+
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <iterator>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "exception.hh"
+#include "pixel_format.hh"
+#include "raster_handle.hh"
+
+using namespace std;
+
+/* compares every tier of the camera pixel-format converters with the C
+   reference on recorded frame buffers, so it runs without a camera: exits
+   with an error if any output differs, and prints the time per frame.
+
+   usage: pixel-format-benchmark [YUYV|NV12 WIDTH HEIGHT RAW-FILE]
+   where RAW-FILE holds frames as the camera delivered them, back to back;
+   without arguments, synthetic frames are used. */
+
+static const unsigned int repetitions = 20;
+
+typedef void ( *Converter )( const uint8_t *, const unsigned int, const unsigned int, const PlanarImage & );
+
+enum class Format { YUYV, NV12 };
+
+size_t frame_size( const Format format, const unsigned int width, const unsigned int height )
+{
+  return format == Format::YUYV ? size_t( width ) * height * 2 : size_t( width ) * height * 3 / 2;
+}
+
+/* a planar image with padding at the end of each row, as in a raster */
+class Output
+{
+private:
+  size_t y_stride_, uv_stride_;
+  vector<uint8_t> y_, u_, v_;
+
+public:
+  Output( const unsigned int width, const unsigned int height )
+    : y_stride_( width + 32 ), uv_stride_( width / 2 + 16 ),
+      y_( y_stride_ * height ), u_( uv_stride_ * ( height / 2 ) ), v_( uv_stride_ * ( height / 2 ) )
+  {}
+
+  PlanarImage image() { return { y_.data(), u_.data(), v_.data(), y_stride_, uv_stride_ }; }
+
+  bool operator==( const Output & other ) const
+  {
+    return y_ == other.y_ and u_ == other.u_ and v_ == other.v_;
+  }
+};
+
+/* keeps the conversions from being optimized away */
+volatile uint8_t sink;
+
+struct Recording
+{
+  Format format;
+  string name;
+  unsigned int width, height;
+  vector<vector<uint8_t>> frames;
+};
+
+Recording synthetic( const Format format, const unsigned int width, const unsigned int height )
+{
+  Recording recording { format, format == Format::YUYV ? "YUYV" : "NV12", width, height, {} };
+
+  default_random_engine gen( width * height );
+  uniform_int_distribution<int> pixel( 0, 255 );
+
+  for ( unsigned int i = 0; i < 4; i++ ) {
+    recording.frames.emplace_back( frame_size( format, width, height ) );
+    for ( uint8_t & byte : recording.frames.back() ) {
+      byte = pixel( gen );
+    }
+  }
+
+  return recording;
+}
+
+Recording recorded( const string & format_name, const unsigned int width, const unsigned int height,
+                    const string & filename )
+{
+  Format format;
+  if ( format_name == "YUYV" ) {
+    format = Format::YUYV;
+  }
+  else if ( format_name == "NV12" ) {
+    format = Format::NV12;
+  }
+  else {
+    throw runtime_error( "unsupported pixel format: " + format_name );
+  }
+
+  ifstream file { filename, ios::binary };
+  if ( not file.good() ) {
+    throw runtime_error( "cannot open " + filename );
+  }
+
+  const vector<uint8_t> contents { istreambuf_iterator<char>( file ), istreambuf_iterator<char>() };
+  const size_t size = frame_size( format, width, height );
+
+  if ( contents.size() < size ) {
+    throw runtime_error( filename + " does not hold a whole frame" );
+  }
+
+  Recording recording { format, format_name, width, height, {} };
+
+  for ( size_t offset = 0; offset + size <= contents.size(); offset += size ) {
+    recording.frames.emplace_back( contents.begin() + offset, contents.begin() + offset + size );
+  }
+
+  return recording;
+}
+
+double milliseconds_per_frame( const Recording & recording, const Converter converter )
+{
+  Output output { recording.width, recording.height };
+  const PlanarImage image = output.image();
+
+  const auto start = chrono::steady_clock::now();
+
+  for ( unsigned int i = 0; i < repetitions; i++ ) {
+    for ( const auto & frame : recording.frames ) {
+      converter( frame.data(), recording.width, recording.height, image );
+      sink = image.y[ 0 ];
+    }
+  }
+
+  const auto end = chrono::steady_clock::now();
+
+  return chrono::duration<double, milli>( end - start ).count()
+         / ( repetitions * recording.frames.size() );
+}
+
+bool failed = false;
+
+void compare( const Recording & recording, const string & tier,
+              const Converter reference, const Converter converter )
+{
+  bool exact = true;
+
+  for ( const auto & frame : recording.frames ) {
+    Output expected { recording.width, recording.height }, actual { recording.width, recording.height };
+    reference( frame.data(), recording.width, recording.height, expected.image() );
+    converter( frame.data(), recording.width, recording.height, actual.image() );
+
+    if ( not ( expected == actual ) ) {
+      exact = false;
+      break;
+    }
+  }
+
+  const double reference_ms = milliseconds_per_frame( recording, reference );
+  const double converter_ms = milliseconds_per_frame( recording, converter );
+
+  cout << left << setw( 5 ) << recording.name << right << setw( 5 ) << recording.width << "x"
+       << left << setw( 5 ) << recording.height << setw( 6 ) << tier << right << fixed
+       << setprecision( 3 ) << setw( 8 ) << converter_ms << " ms/frame  " << setprecision( 2 )
+       << setw( 5 ) << reference_ms / converter_ms << "x vs C  " << ( exact ? "exact" : "MISMATCH" ) << endl;
+
+  if ( not exact ) {
+    failed = true;
+  }
+}
+
+/* the converter the camera uses, straight into a pooled raster */
+void check_raster( const Recording & recording, const Converter reference )
+{
+  MutableRasterHandle raster { uint16_t( recording.width ), uint16_t( recording.height ) };
+  const auto & frame = recording.frames.front();
+
+  if ( recording.format == Format::YUYV ) {
+    yuyv_to_i420( frame.data(), raster.get() );
+  }
+  else {
+    nv12_to_i420( frame.data(), raster.get() );
+  }
+
+  Output expected { recording.width, recording.height };
+  const PlanarImage image = expected.image();
+  reference( frame.data(), recording.width, recording.height, image );
+
+  bool exact = true;
+
+  for ( unsigned int row = 0; row < recording.height; row++ ) {
+    exact &= not memcmp( &raster.get().Y().at( 0, row ), image.y + row * image.y_stride, recording.width );
+  }
+
+  for ( unsigned int row = 0; row < recording.height / 2; row++ ) {
+    exact &= not memcmp( &raster.get().U().at( 0, row ), image.u + row * image.uv_stride, recording.width / 2 );
+    exact &= not memcmp( &raster.get().V().at( 0, row ), image.v + row * image.uv_stride, recording.width / 2 );
+  }
+
+  if ( not exact ) {
+    cout << recording.name << " " << recording.width << "x" << recording.height
+         << ": conversion into a raster MISMATCH" << endl;
+    failed = true;
+  }
+}
+
+void benchmark( const Recording & recording )
+{
+  const bool yuyv = recording.format == Format::YUYV;
+  const Converter reference = yuyv ? yuyv_to_i420_c : nv12_to_i420_c;
+
+#ifdef HAVE_SSE2
+  compare( recording, "sse2", reference, yuyv ? yuyv_to_i420_sse2 : nv12_to_i420_sse2 );
+#else
+  cout << "sse2: not built" << endl;
+#endif
+
+#ifdef HAVE_AVX2
+  if ( __builtin_cpu_supports( "avx2" ) ) {
+    compare( recording, "avx2", reference, yuyv ? yuyv_to_i420_avx2 : nv12_to_i420_avx2 );
+  }
+  else {
+    cout << "avx2: not supported by this CPU" << endl;
+  }
+#else
+  cout << "avx2: not built" << endl;
+#endif
+
+  check_raster( recording, reference );
+}
+
+int main( int argc, char *argv[] )
+{
+  try {
+    if ( argc == 5 ) {
+      benchmark( recorded( argv[ 1 ], stoul( argv[ 2 ] ), stoul( argv[ 3 ] ), argv[ 4 ] ) );
+    }
+    else if ( argc == 1 ) {
+      RasterPoolDebug::allow_resize = true;
+
+      /* the camera sizes, then one whose rows end partway through a vector */
+      for ( const Format format : { Format::YUYV, Format::NV12 } ) {
+        benchmark( synthetic( format, 640, 480 ) );
+        benchmark( synthetic( format, 1280, 720 ) );
+        benchmark( synthetic( format, 350, 198 ) );
+      }
+    }
+    else {
+      cerr << "Usage: " << argv[ 0 ] << " [YUYV|NV12 WIDTH HEIGHT RAW-FILE]" << endl;
+      return EXIT_FAILURE;
+    }
+  }
+  catch ( const exception & e ) {
+    print_exception( argv[ 0 ], e );
+    return EXIT_FAILURE;
+  }
+
+  if ( failed ) {
+    cerr << "pixel-format-benchmark: some converters differ from the C reference" << endl;
+    return EXIT_FAILURE;
+  }
+
+  return EXIT_SUCCESS;
+}
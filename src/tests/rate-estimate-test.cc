@@ -0,0 +1,134 @@
+/* -*-mode:c++; tab-width: 2; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+
+/* Copyright 2013-2018 the Alfalfa authors
+                       and the Massachusetts Institute of Technology
+
+   Redistribution and use in source and binary forms, with or without
+   modification, are permitted provided that the following conditions are
+   met:
+
+      1. Redistributions of source code must retain the above copyright
+         notice, this list of conditions and the following disclaimer.
+
+      2. Redistributions in binary form must reproduce the above copyright
+         notice, this list of conditions and the following disclaimer in the
+         documentation and/or other materials provided with the distribution.
+
+   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+   "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+   LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+   A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+   HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+   SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+   LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+   DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+   THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+   (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+   OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE. */
+
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+#include <random>
+
+#include "encoder.hh"
+#include "raster_handle.hh"
+#include "exception.hh"
+
+using namespace std;
+
+/* compares the token-cost size estimate with the size of the serialized
+   frame on a synthetic sequence (textured gradients panning over noise) */
+
+const uint16_t width = 352;
+const uint16_t height = 288;
+
+MutableRasterHandle make_frame( const unsigned int frame_no, default_random_engine & gen )
+{
+  MutableRasterHandle raster { width, height };
+  normal_distribution<double> noise( 0, 4 );
+
+  auto clamp_pixel = [] ( const double x ) { return uint8_t( max( 0.0, min( 255.0, x ) ) ); };
+
+  raster.get().Y().forall_ij(
+    [&] ( uint8_t & pixel, unsigned int column, unsigned int row )
+    {
+      const double x = column + 3.0 * frame_no;
+      const double y = row + 1.0 * frame_no;
+      pixel = clamp_pixel( 128 + 60 * sin( x / 17.0 ) * cos( y / 11.0 )
+                           + 40 * sin( ( x + y ) / 5.0 ) + noise( gen ) );
+    } );
+
+  raster.get().U().forall_ij(
+    [&] ( uint8_t & pixel, unsigned int column, unsigned int row )
+    {
+      pixel = clamp_pixel( 128 + 30 * sin( ( column + 1.5 * frame_no ) / 13.0 ) + 0.25 * row );
+    } );
+
+  raster.get().V().forall_ij(
+    [&] ( uint8_t & pixel, unsigned int column, unsigned int row )
+    {
+      pixel = clamp_pixel( 128 + 30 * cos( row / 9.0 ) - 0.25 * column );
+    } );
+
+  return raster;
+}
+
+int main( int argc, char *argv[] )
+{
+  try {
+    if ( argc != 1 ) {
+      cerr << "Usage: " << argv[ 0 ] << endl;
+      return EXIT_FAILURE;
+    }
+
+    default_random_engine gen( 0 );
+
+    Encoder encoder( width, height, false, REALTIME_QUALITY );
+
+    /* the estimates are within about 4% of the serialized size per sample
+       and 2% on average; leave a small margin */
+    const double max_error = 0.06;
+    const double max_mean_error = 0.03;
+
+    double total_error = 0;
+    unsigned int samples = 0;
+
+    for ( unsigned int frame_no = 0; frame_no < 6; frame_no++ ) {
+      RasterHandle raster( make_frame( frame_no, gen ) );
+
+      for ( const uint8_t y_ac_qi : { 8, 32, 64, 100 } ) {
+        const size_t token_cost_size = encoder.estimate_frame_size( raster.get(), y_ac_qi, TOKEN_COST );
+        const size_t serialized_size = encoder.estimate_frame_size( raster.get(), y_ac_qi, SERIALIZED_SIZE );
+
+        const double error = ( double( token_cost_size ) - serialized_size ) / serialized_size;
+
+        cerr << "frame " << frame_no << ", qi " << int( y_ac_qi ) << ": token cost = "
+             << token_cost_size << ", serialized = " << serialized_size
+             << " (" << 100 * error << "%)" << endl;
+
+        if ( fabs( error ) > max_error ) {
+          cerr << "token-cost estimate is too far off" << endl;
+          return EXIT_FAILURE;
+        }
+
+        total_error += fabs( error );
+        samples++;
+      }
+
+      encoder.encode_with_quantizer( raster.get(), 40 );
+    }
+
+    cerr << "mean error: " << 100 * total_error / samples << "%" << endl;
+
+    if ( total_error / samples > max_mean_error ) {
+      cerr << "token-cost estimates are too far off on average" << endl;
+      return EXIT_FAILURE;
+    }
+  } catch ( const exception & e ) {
+    print_exception( argv[ 0 ], e );
+    return EXIT_FAILURE;
+  }
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,157 @@
+/* -*-mode:c++; tab-width: 2; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+
+/* Copyright 2013-2018 the Alfalfa authors
+                       and the Massachusetts Institute of Technology
+
+   Redistribution and use in source and binary forms, with or without
+   modification, are permitted provided that the following conditions are
+   met:
+
+      1. Redistributions of source code must retain the above copyright
+         notice, this list of conditions and the following disclaimer.
+
+      2. Redistributions in binary form must reproduce the above copyright
+         notice, this list of conditions and the following disclaimer in the
+         documentation and/or other materials provided with the distribution.
+
+   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+   "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+   LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+   A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+   HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+   SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+   LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+   DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+   THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+   (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+   OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE. */
+
+#include <cstdlib>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+
+#include "reassembly_buffer.hh"
+#include "packet.hh"
+#include "exception.hh"
+
+using namespace std;
+
+/* feeds fragments to a ReassemblyBuffer out of order, twice, with holes and
+   with frames competing for a slab, and checks what it hands back */
+
+#define CHECK( condition )                                              \
+  if ( not ( condition ) ) {                                            \
+    throw runtime_error( "check failed at line " + to_string( __LINE__ ) + ": " #condition ); \
+  }
+
+const uint16_t connection_id = 7;
+
+/* contents of a frame of the given size */
+string make_frame( const uint32_t frame_no, const size_t size )
+{
+  string frame( size, 0 );
+  for ( size_t i = 0; i < size; i++ ) {
+    frame[ i ] = static_cast<char>( i * 31 + frame_no );
+  }
+  return frame;
+}
+
+/* adds fragment_no of frame (split into MAXIMUM_PAYLOAD fragments) */
+bool add_fragment( ReassemblyBuffer & buffer, const uint32_t frame_no,
+                   const string & frame, const uint16_t fragment_no )
+{
+  const size_t fragments = ( frame.size() + Packet::MAXIMUM_PAYLOAD - 1 ) / Packet::MAXIMUM_PAYLOAD;
+  const size_t first_byte = fragment_no * Packet::MAXIMUM_PAYLOAD;
+  const size_t length = min( frame.size() - first_byte, Packet::MAXIMUM_PAYLOAD );
+
+  Header header { connection_id, 11, 22, frame_no, fragment_no, 0 };
+  header.fragments_in_this_frame_ = fragments;
+  header.set_payload_length( length );
+
+  return buffer.add_packet( header, Chunk( reinterpret_cast<const uint8_t *>( frame.data() ) + first_byte, length ) );
+}
+
+int main( int argc, char *argv[] )
+{
+  try {
+    if ( argc != 1 ) {
+      cerr << "Usage: " << argv[ 0 ] << endl;
+      return EXIT_FAILURE;
+    }
+
+    /* four slabs, smaller than the frames, so they have to grow */
+    ReassemblyBuffer buffer { connection_id, 4, 1000 };
+
+    /* out of order, with every fragment delivered twice */
+    const string frame5 = make_frame( 5, 3 * Packet::MAXIMUM_PAYLOAD + 200 );
+    CHECK( not buffer.contains( 5 ) );
+
+    for ( const uint16_t fragment_no : { 3, 1, 0, 2 } ) {
+      CHECK( not buffer.complete( 5 ) );
+      CHECK( add_fragment( buffer, 5, frame5, fragment_no ) );
+      CHECK( not add_fragment( buffer, 5, frame5, fragment_no ) );
+    }
+
+    CHECK( buffer.contains( 5 ) and buffer.complete( 5 ) );
+    CHECK( buffer.frame( 5 ).to_string() == frame5 );
+    CHECK( buffer.partial_frame( 5 ).to_string() == frame5 );
+    CHECK( buffer.source_state( 5 ) == 11 and buffer.target_state( 5 ) == 22 );
+
+    /* a hole: the partial frame is the prefix before it */
+    const string frame6 = make_frame( 6, 4 * Packet::MAXIMUM_PAYLOAD );
+    CHECK( add_fragment( buffer, 6, frame6, 0 ) );
+    CHECK( add_fragment( buffer, 6, frame6, 1 ) );
+    CHECK( add_fragment( buffer, 6, frame6, 3 ) );
+    CHECK( not buffer.complete( 6 ) );
+    CHECK( buffer.partial_frame( 6 ).to_string() == frame6.substr( 0, 2 * Packet::MAXIMUM_PAYLOAD ) );
+
+    bool threw = false;
+    try {
+      buffer.frame( 6 );
+    } catch ( const runtime_error & ) {
+      threw = true;
+    }
+    CHECK( threw );
+
+    /* frame 9 uses frame 5's slab and takes it over */
+    const string frame9 = make_frame( 9, 100 );
+    CHECK( add_fragment( buffer, 9, frame9, 0 ) );
+    CHECK( not buffer.contains( 5 ) );
+    CHECK( buffer.complete( 9 ) and buffer.frame( 9 ).to_string() == frame9 );
+
+    /* ...and a late fragment of the older frame is turned away */
+    CHECK( not add_fragment( buffer, 5, frame5, 0 ) );
+    CHECK( not buffer.contains( 5 ) and buffer.contains( 9 ) );
+
+    /* the other slabs are untouched */
+    CHECK( buffer.contains( 6 ) and not buffer.complete( 6 ) );
+
+    /* once released, a slab is free for the next frame */
+    buffer.release( 9 );
+    CHECK( not buffer.contains( 9 ) );
+
+    threw = false;
+    try {
+      buffer.partial_frame( 9 );
+    } catch ( const out_of_range & ) {
+      threw = true;
+    }
+    CHECK( threw );
+
+    const string frame13 = make_frame( 13, 2 * Packet::MAXIMUM_PAYLOAD + 1 );
+    for ( const uint16_t fragment_no : { 2, 0, 1 } ) {
+      CHECK( add_fragment( buffer, 13, frame13, fragment_no ) );
+    }
+    CHECK( buffer.frame( 13 ).to_string() == frame13 );
+
+    /* filling the hole completes frame 6 */
+    CHECK( add_fragment( buffer, 6, frame6, 2 ) );
+    CHECK( buffer.complete( 6 ) and buffer.frame( 6 ).to_string() == frame6 );
+  } catch ( const exception & e ) {
+    print_exception( argv[ 0 ], e );
+    return EXIT_FAILURE;
+  }
+
+  return EXIT_SUCCESS;
+}
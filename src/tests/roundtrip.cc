@@ -94,10 +94,10 @@ int main( int argc, char *argv[] )
 
       if ( whole_frame.key_frame() ) {
         const KeyFrame parsed_frame = decoder_state.parse_and_apply<KeyFrame>( whole_frame );
-        serialized_frame = parsed_frame.serialize( decoder_state.probability_tables );
+        serialized_frame = parsed_frame.serialize( decoder_state.probability_tables ).to_vector();
       } else {
         const InterFrame parsed_frame = decoder_state.parse_and_apply<InterFrame>( whole_frame );
-        serialized_frame = parsed_frame.serialize( decoder_state.probability_tables );
+        serialized_frame = parsed_frame.serialize( decoder_state.probability_tables ).to_vector();
       }
 
       /* verify equality of original and re-encoded frame */
@@ -29,6 +29,8 @@
 #include <cstdio>
 #include <cstdlib>
 #include <iostream>
+#include <sys/stat.h>
+#include <unistd.h>
 #include <random>
 #include <utility>
 
@@ -64,6 +66,7 @@ Decoder random_decoder(default_random_engine &rng);
 Encoder random_encoder(default_random_engine &rng);
 
 template<typename T> void run_one_test(T (*gen)(default_random_engine &), default_random_engine &rng, string tname);
+void run_delta_test(default_random_engine &rng, const string &dir);
 
 int main( int argc, char *argv[] ) {
   unsigned num_tests = 16;
@@ -119,6 +122,18 @@ int main( int argc, char *argv[] ) {
       run_one_test(random_decoder, rng, "Decoder");
     }
 
+    // Decoder states stored as deltas
+    cout << "\nStateDelta:        " << flush;
+    char dir[] = "/tmp/serdes-test.XXXXXX";
+    if (mkdtemp(dir) == nullptr) {
+      throw unix_error("mkdtemp");
+    }
+    for (unsigned i = 0; i < num_tests; i++) {
+      progress(i, num_tests);
+      run_delta_test(rng, dir);
+    }
+    SystemCall("rmdir", rmdir(dir));
+
     cout << '\n';
   } catch ( const exception & e ) {
     print_exception( argv[ 0 ], e );
@@ -149,6 +164,57 @@ void run_one_test(T (*gen)(default_random_engine &), default_random_engine &rng,
   }
 }
 
+// a chain of states, each changing part of the one before, stored as deltas
+// one past the chain length limit
+void run_delta_test(default_random_engine &rng, const string &dir) {
+  Decoder state = random_decoder(rng);
+  vector<string> files { dir + "/state0" };
+
+  {
+    EncoderStateSerializer odata = {};
+    state.serialize(odata);
+    odata.write_delta(files.back(), "");
+  }
+
+  struct stat whole;
+  SystemCall("stat", stat(files.back().c_str(), &whole));
+
+  for (unsigned link = 1; link <= state_delta_max_chain_length + 1; link++) {
+    // new probabilities and a new top strip of the picture, as an inter frame would
+    DecoderState decoder_state = state.get_state();
+    decoder_state.probability_tables = random_probability_tables(rng);
+
+    MutableRasterHandle raster(state.get_width(), state.get_height());
+    raster.get().copy_from(state.get_references().last.get());
+    raster.get().Y().forall_ij([&](uint8_t &f, unsigned, unsigned row){
+        if (row < 16) { f = rng(); }
+      });
+
+    state = Decoder(move(decoder_state), References(move(raster)));
+
+    files.push_back(dir + "/state" + to_string(link));
+
+    EncoderStateSerializer odata = {};
+    state.serialize(odata);
+    odata.write_delta(files.back(), files.at(link - 1));
+
+    Decoder loaded = EncoderStateDeserializer::build<Decoder>(files.back());
+    if (loaded != state) {
+      throw runtime_error("StateDelta failed: state " + to_string(link) + " does not match");
+    }
+
+    struct stat delta;
+    SystemCall("stat", stat(files.back().c_str(), &delta));
+    if (link <= state_delta_max_chain_length and delta.st_size >= whole.st_size * 3 / 4) {
+      throw runtime_error("StateDelta failed: delta " + to_string(link) + " is not smaller");
+    }
+  }
+
+  for (const auto &file : files) {
+    SystemCall("unlink", unlink(file.c_str()));
+  }
+}
+
 EncoderStateDeserializer deser_from_ser(EncoderStateSerializer &&odata) {
   FILE *f = tmpfile();
   odata.write(f);
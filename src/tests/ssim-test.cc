@@ -0,0 +1,155 @@
+/* -*-mode:c++; tab-width: 2; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+
+/* Copyright 2013-2018 the Alfalfa authors
+                       and the Massachusetts Institute of Technology
+
+   Redistribution and use in source and binary forms, with or without
+   modification, are permitted provided that the following conditions are
+   met:
+
+      1. Redistributions of source code must retain the above copyright
+         notice, this list of conditions and the following disclaimer.
+
+      2. Redistributions in binary form must reproduce the above copyright
+         notice, this list of conditions and the following disclaimer in the
+         documentation and/or other materials provided with the distribution.
+
+   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+   "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+   LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+   A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+   HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+   SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+   LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+   DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+   THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+   (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+   OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE. */
+
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+#include <random>
+
+#include "raster.hh"
+#include "ssim.hh"
+#include "exception.hh"
+
+using namespace std;
+
+/* checks ssim(), ssim_map() and fast_ssim() against a plain floating-point
+   evaluation of the same windows, on noisy copies of a synthetic image */
+
+double reference_ssim( const TwoD<uint8_t> & a, const TwoD<uint8_t> & b,
+                       const unsigned int x, const unsigned int y )
+{
+  const double C1 = 416, C2 = 235963;
+  double s1 = 0, s2 = 0, ss = 0, s12 = 0;
+
+  for ( unsigned int row = y; row < y + 8; row++ ) {
+    for ( unsigned int column = x; column < x + 8; column++ ) {
+      const double pa = a.at( column, row ), pb = b.at( column, row );
+      s1 += pa;
+      s2 += pb;
+      ss += pa * pa + pb * pb;
+      s12 += pa * pb;
+    }
+  }
+
+  const double vars = ss * 64 - s1 * s1 - s2 * s2;
+  const double covar = s12 * 64 - s1 * s2;
+
+  return ( 2 * s1 * s2 + C1 ) * ( 2 * covar + C2 ) / ( ( s1 * s1 + s2 * s2 + C1 ) * ( vars + C2 ) );
+}
+
+double reference_mean_ssim( const TwoD<uint8_t> & a, const TwoD<uint8_t> & b )
+{
+  double total = 0;
+  unsigned int windows = 0;
+  for ( unsigned int y = 0; y + 8 <= a.height(); y += 4 ) {
+    for ( unsigned int x = 0; x + 8 <= a.width(); x += 4 ) {
+      total += reference_ssim( a, b, x, y );
+      windows++;
+    }
+  }
+
+  return total / windows;
+}
+
+/* what fast_ssim() is expected to compare: a 2x2 average, rounded up */
+TwoD<uint8_t> downscale( const TwoD<uint8_t> & image )
+{
+  TwoD<uint8_t> output( image.width() / 2, image.height() / 2 );
+  output.forall_ij(
+    [&] ( uint8_t & pixel, unsigned int column, unsigned int row )
+    {
+      const unsigned int left = ( image.at( 2 * column, 2 * row ) + image.at( 2 * column, 2 * row + 1 ) + 1 ) / 2;
+      const unsigned int right = ( image.at( 2 * column + 1, 2 * row ) + image.at( 2 * column + 1, 2 * row + 1 ) + 1 ) / 2;
+      pixel = ( left + right + 1 ) / 2;
+    } );
+
+  return output;
+}
+
+bool check( const unsigned int width, const unsigned int height, const double noise_level )
+{
+  default_random_engine gen( width * height );
+  normal_distribution<double> noise( 0, noise_level );
+
+  TwoD<uint8_t> original( width, height ), distorted( width, height );
+  original.forall_ij(
+    [&] ( uint8_t & pixel, unsigned int column, unsigned int row )
+    { pixel = uint8_t( 128 + 60 * sin( column / 9.0 ) * cos( row / 13.0 ) + 30 * sin( ( column + row ) / 4.0 ) ); } );
+  distorted.forall_ij(
+    [&] ( uint8_t & pixel, unsigned int column, unsigned int row )
+    { pixel = uint8_t( max( 0.0, min( 255.0, original.at( column, row ) + noise( gen ) ) ) ); } );
+
+  const unsigned int windows = ( width / 4 - 1 ) * ( height / 4 - 1 );
+  const double expected = reference_mean_ssim( original, distorted );
+  const double expected_fast = reference_mean_ssim( downscale( original ), downscale( distorted ) );
+  const double full = ssim( original, distorted );
+  const double fast = fast_ssim( original, distorted );
+  const double identical = ssim( original, original );
+
+  const SSIMMap map = ssim_map( original, distorted );
+  double map_total = 0;
+  for ( unsigned int row = 0; row < map.height; row++ ) {
+    for ( unsigned int column = 0; column < map.width; column++ ) {
+      /* macroblocks on the right and bottom edges hold fewer windows */
+      const unsigned int window_columns = min( 4u, ( width / 4 - 1 ) - 4 * column );
+      const unsigned int window_rows = min( 4u, ( height / 4 - 1 ) - 4 * row );
+      map_total += map.at( column, row ) * window_columns * window_rows;
+    }
+  }
+
+  cerr << width << "x" << height << ", noise " << noise_level << ": ssim = " << full
+       << " (reference " << expected << "), map = " << map_total / windows
+       << ", fast = " << fast << " (reference " << expected_fast << ")" << endl;
+
+  return fabs( full - expected ) < 1e-5
+    and fabs( map_total / windows - expected ) < 1e-5
+    and fabs( fast - expected_fast ) < 1e-5
+    and identical == 1.0;
+}
+
+int main( int argc, char *argv[] )
+{
+  try {
+    if ( argc != 1 ) {
+      cerr << "Usage: " << argv[ 0 ] << endl;
+      return EXIT_FAILURE;
+    }
+
+    /* odd numbers of blocks, and enough rows to be split across threads */
+    if ( not ( check( 36, 28, 4 ) and check( 352, 288, 2 ) and check( 352, 288, 12 )
+               and check( 1284, 724, 6 ) ) ) {
+      cerr << "SSIM differs from the reference" << endl;
+      return EXIT_FAILURE;
+    }
+  } catch ( const exception & e ) {
+    print_exception( argv[ 0 ], e );
+    return EXIT_FAILURE;
+  }
+
+  return EXIT_SUCCESS;
+}
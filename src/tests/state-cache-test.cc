@@ -0,0 +1,171 @@
+/* -*-mode:c++; tab-width: 2; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+
+/* Copyright 2013-2018 the Alfalfa authors
+                       and the Massachusetts Institute of Technology
+
+   Redistribution and use in source and binary forms, with or without
+   modification, are permitted provided that the following conditions are
+   met:
+
+      1. Redistributions of source code must retain the above copyright
+         notice, this list of conditions and the following disclaimer.
+
+      2. Redistributions in binary form must reproduce the above copyright
+         notice, this list of conditions and the following disclaimer in the
+         documentation and/or other materials provided with the distribution.
+
+   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+   "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+   LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+   A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+   HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+   SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+   LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+   DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+   THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+   (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+   OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE. */
+
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+#include <stdexcept>
+
+#include "state_cache.hh"
+#include "encoder.hh"
+#include "raster_handle.hh"
+#include "exception.hh"
+
+using namespace std;
+
+/* fills a StateCache past its byte budget and checks which states survive:
+   least-recently used ones go first, pinned ones and the most recent one
+   stay, and evicted states are gone from contains() and at(). Then checks
+   that an encoder compressed by the cache encodes exactly like the original */
+
+#define CHECK( condition )                                              \
+  if ( not ( condition ) ) {                                            \
+    throw runtime_error( "check failed at line " + to_string( __LINE__ ) + ": " #condition ); \
+  }
+
+RasterHandle make_frame( const unsigned int frame_no )
+{
+  MutableRasterHandle raster { 128, 96 };
+
+  raster.get().Y().forall_ij(
+    [&] ( uint8_t & pixel, unsigned int column, unsigned int row )
+    {
+      pixel = 128 + 100 * sin( ( column + 3.0 * frame_no ) / 7.0 ) * cos( row / 5.0 );
+    } );
+  raster.get().U().forall( [] ( uint8_t & pixel ) { pixel = 100; } );
+  raster.get().V().forall( [] ( uint8_t & pixel ) { pixel = 150; } );
+
+  return RasterHandle( move( raster ) );
+}
+
+/* encodes a few frames at a target size (so the rate model and last
+   quantizer have history), compresses the state and checks that the
+   restored encoder produces the same next frame */
+bool check_encoder_snapshot()
+{
+  Encoder encoder { 128, 96, false, REALTIME_QUALITY };
+
+  for ( unsigned int frame_no = 0; frame_no < 3; frame_no++ ) {
+    encoder.encode_with_target_size( make_frame( frame_no ).get(), 1500 );
+  }
+
+  /* room for one full encoder and one compressed one */
+  StateCache<Encoder, EncoderSnapshot> encoders {
+    encoder.footprint() + EncoderSnapshot( encoder ).size(), true,
+    []( const Encoder & e ) { return e.footprint(); },
+    []( const Encoder & e ) { return EncoderSnapshot( e ); },
+    []( const EncoderSnapshot & snapshot ) { return snapshot.restore(); }
+  };
+
+  encoders.insert( 1, Encoder( encoder ) );
+  encoders.insert( 2, Encoder( encoder ) );
+  if ( encoders.stats().compressions != 1 ) {
+    return false;
+  }
+
+  const RasterHandle next = make_frame( 3 );
+  Encoder never_evicted { encoder };
+  const vector<uint8_t> expected = never_evicted.encode_with_target_size( next.get(), 1500 ).to_vector();
+  const vector<uint8_t> restored = encoders.at( 1 ).encode_with_target_size( next.get(), 1500 ).to_vector();
+
+  return encoders.stats().decompressions == 1 and restored == expected;
+}
+
+int main( int argc, char *argv[] )
+{
+  try {
+    if ( argc != 1 ) {
+      cerr << "Usage: " << argv[ 0 ] << endl;
+      return EXIT_FAILURE;
+    }
+
+    /* every state costs 100 bytes; room for three */
+    StateCache<int> cache { 300, false,
+                            []( const int & ) { return 100; },
+                            []( const int & ) -> DecoderSnapshot { throw runtime_error( "unexpected export" ); },
+                            []( const DecoderSnapshot & ) -> int { throw runtime_error( "unexpected import" ); } };
+
+    cache.insert( 1, 10 );
+    cache.insert( 2, 20 );
+    cache.insert( 3, 30 );
+    CHECK( cache.size() == 3 and cache.bytes() == 300 );
+    CHECK( cache.stats().evictions == 0 );
+
+    /* 1 is pinned, and touching 2 makes 3 the least recently used */
+    cache.pin( 1 );
+    CHECK( cache.at( 2 ) == 20 );
+
+    cache.insert( 4, 40 );
+    CHECK( cache.size() == 3 and cache.bytes() == 300 );
+    CHECK( cache.stats().evictions == 1 );
+    CHECK( cache.contains( 1 ) and cache.contains( 2 ) and cache.contains( 4 ) );
+    CHECK( not cache.contains( 3 ) );
+    CHECK( cache.find( 3 ) == nullptr );
+
+    bool threw = false;
+    try {
+      cache.at( 3 );
+    } catch ( const out_of_range & ) {
+      threw = true;
+    }
+    CHECK( threw );
+
+    /* re-inserting an evicted state works, and evicts the next-oldest
+       unpinned one (2) */
+    cache.insert( 3, 31 );
+    CHECK( cache.at( 3 ) == 31 );
+    CHECK( not cache.contains( 2 ) );
+    CHECK( cache.at( 1 ) == 10 and cache.at( 4 ) == 40 );
+
+    /* once unpinned, 1 can go too */
+    cache.unpin_all();
+    cache.insert( 5, 50 );
+    cache.insert( 6, 60 );
+    CHECK( cache.size() == 3 );
+    CHECK( cache.contains( 5 ) and cache.contains( 6 ) );
+    CHECK( cache.stats().evictions == 4 );
+
+    /* the most recent state stays even if it alone is over the budget */
+    StateCache<int> tiny { 50, false,
+                           []( const int & ) { return 100; },
+                           []( const int & ) -> DecoderSnapshot { throw runtime_error( "unexpected export" ); },
+                           []( const DecoderSnapshot & ) -> int { throw runtime_error( "unexpected import" ); } };
+    tiny.insert( 1, 10 );
+    tiny.insert( 2, 20 );
+    CHECK( tiny.size() == 1 and tiny.contains( 2 ) and tiny.at( 2 ) == 20 );
+
+    CHECK( check_encoder_snapshot() );
+
+    cerr << cache.str() << endl;
+  } catch ( const exception & e ) {
+    print_exception( argv[ 0 ], e );
+    return EXIT_FAILURE;
+  }
+
+  return EXIT_SUCCESS;
+}
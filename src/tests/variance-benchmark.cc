@@ -0,0 +1,304 @@
+/* -*-mode:c++; tab-width: 2; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+
+/* Copyright 2013-2018 the Alfalfa authors
+                       and the Massachusetts Institute of Technology
+
+   Redistribution and use in source and binary forms, with or without
+   modification, are permitted provided that the following conditions are
+   met:
+
+      1. Redistributions of source code must retain the above copyright
+         notice, this list of conditions and the following disclaimer.
+
+      2. Redistributions in binary form must reproduce the above copyright
+         notice, this list of conditions and the following disclaimer in the
+         documentation and/or other materials provided with the distribution.
+
+   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+   "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+   LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+   A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+   HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+   SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+   LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+   DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+   THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+   (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+   OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE. */
+
+#include <array>
+#include <chrono>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "variance_kernels.hh"
+
+using namespace std;
+
+/* compares every tier of the block-distortion kernels with the C reference:
+   exits with an error if any result differs, and prints the time per call */
+
+static const int stride = 64;
+static const unsigned int block_count = 512;
+static const unsigned int repetitions = 400;
+
+/* up to two source blocks (the two-block kernels use both) and two
+   predictions, at unaligned offsets in 64x64 planes */
+struct Blocks
+{
+  const uint8_t * src_0, * src_1;
+  const uint8_t * ref_0, * ref_1;
+};
+
+typedef array<uint32_t, 4> Result;
+
+/* keeps the timed calls from being optimized away */
+volatile uint32_t sink;
+
+class Planes
+{
+private:
+  vector<uint8_t> src_0_ = vector<uint8_t>( stride * stride ),
+                  src_1_ = vector<uint8_t>( stride * stride ),
+                  ref_0_ = vector<uint8_t>( stride * stride ),
+                  ref_1_ = vector<uint8_t>( stride * stride );
+
+public:
+  vector<Blocks> blocks {};
+
+  Planes( default_random_engine & gen )
+  {
+    uniform_int_distribution<int> pixel( 0, 255 );
+    uniform_int_distribution<int> noise( -3, 3 );
+    uniform_int_distribution<int> offset( 0, stride - 16 - 1 );
+
+    auto clamp_pixel = [] ( const int x ) { return uint8_t( max( 0, min( 255, x ) ) ); };
+
+    /* the first rows are unrelated noise, then come close predictions (the
+       common case in motion search), then saturated blocks for the extremes
+       of every accumulator */
+    for ( int i = 0; i < stride * stride; i++ ) {
+      const int row = i / stride;
+
+      if ( row < stride / 3 ) {
+        src_0_[ i ] = pixel( gen ); src_1_[ i ] = pixel( gen );
+        ref_0_[ i ] = pixel( gen ); ref_1_[ i ] = pixel( gen );
+      }
+      else if ( row < 2 * stride / 3 ) {
+        src_0_[ i ] = pixel( gen ); src_1_[ i ] = pixel( gen );
+        ref_0_[ i ] = clamp_pixel( src_0_[ i ] + noise( gen ) );
+        ref_1_[ i ] = clamp_pixel( src_1_[ i ] + noise( gen ) );
+      }
+      else {
+        src_0_[ i ] = src_1_[ i ] = ( i % 3 ) ? 255 : 0;
+        ref_0_[ i ] = ref_1_[ i ] = ( i % 3 ) ? 0 : 255;
+      }
+    }
+
+    for ( unsigned int i = 0; i < block_count; i++ ) {
+      const int position = offset( gen ) * stride + offset( gen );
+      blocks.push_back( { &src_0_[ position ], &src_1_[ position ],
+                          &ref_0_[ position ], &ref_1_[ position ] } );
+    }
+  }
+
+  /* forbid copying */
+  Planes( const Planes & other ) = delete;
+  Planes & operator=( const Planes & other ) = delete;
+};
+
+template<class Kernel>
+double nanoseconds_per_call( const Planes & planes, const Kernel & kernel )
+{
+  uint32_t checksum = 0;
+
+  const auto start = chrono::steady_clock::now();
+
+  for ( unsigned int i = 0; i < repetitions; i++ ) {
+    for ( const Blocks & blocks : planes.blocks ) {
+      const Result result = kernel( blocks );
+      checksum += result[ 0 ] ^ result[ 1 ] ^ result[ 2 ] ^ result[ 3 ];
+    }
+  }
+
+  const auto end = chrono::steady_clock::now();
+
+  sink = checksum;
+
+  return chrono::duration<double, nano>( end - start ).count()
+         / ( repetitions * planes.blocks.size() );
+}
+
+bool failed = false;
+
+template<class Reference, class Kernel>
+void compare( const Planes & planes, const string & name, const string & tier,
+              const Reference & reference, const Kernel & kernel )
+{
+  bool exact = true;
+
+  for ( const Blocks & blocks : planes.blocks ) {
+    if ( reference( blocks ) != kernel( blocks ) ) {
+      exact = false;
+      break;
+    }
+  }
+
+  const double reference_ns = nanoseconds_per_call( planes, reference );
+  const double kernel_ns = nanoseconds_per_call( planes, kernel );
+
+  cout << left << setw( 18 ) << name << setw( 6 ) << tier << right << fixed << setprecision( 1 )
+       << setw( 8 ) << kernel_ns << " ns/call  " << setw( 5 ) << setprecision( 2 )
+       << reference_ns / kernel_ns << "x vs C  " << ( exact ? "exact" : "MISMATCH" ) << endl;
+
+  if ( not exact ) {
+    failed = true;
+  }
+}
+
+/* C reference of each kernel */
+
+Result sad16x16_ref( const Blocks & b )
+{
+  return {{ sad_c<16>( b.src_0, stride, b.ref_0, stride ), 0, 0, 0 }};
+}
+
+template<unsigned int size>
+Result var_ref( const Blocks & b )
+{
+  uint32_t sse;
+  int32_t sum;
+  get_var_c<size>( b.src_0, stride, b.ref_0, stride, &sse, &sum );
+  return {{ sse, uint32_t( sum ), 0, 0 }};
+}
+
+Result sad16x16_x2_ref( const Blocks & b )
+{
+  return {{ sad_c<16>( b.src_0, stride, b.ref_0, stride ),
+            sad_c<16>( b.src_0, stride, b.ref_1, stride ), 0, 0 }};
+}
+
+Result var16x16_x2_ref( const Blocks & b )
+{
+  uint32_t sse[ 2 ];
+  int32_t sum[ 2 ];
+  get_var_c<16>( b.src_0, stride, b.ref_0, stride, &sse[ 0 ], &sum[ 0 ] );
+  get_var_c<16>( b.src_0, stride, b.ref_1, stride, &sse[ 1 ], &sum[ 1 ] );
+  return {{ sse[ 0 ], uint32_t( sum[ 0 ] ), sse[ 1 ], uint32_t( sum[ 1 ] ) }};
+}
+
+Result sse8x8_x2_ref( const Blocks & b )
+{
+  uint32_t sse[ 2 ];
+  get_var_c<8>( b.src_0, stride, b.ref_0, stride, &sse[ 0 ], nullptr );
+  get_var_c<8>( b.src_1, stride, b.ref_1, stride, &sse[ 1 ], nullptr );
+  return {{ sse[ 0 ], sse[ 1 ], 0, 0 }};
+}
+
+int main()
+{
+  default_random_engine gen( 0 );
+  const Planes planes( gen );
+
+#ifdef HAVE_SSE2
+  compare( planes, "sad16x16", "sse2", sad16x16_ref,
+           [] ( const Blocks & b ) -> Result
+           { return {{ vpx_sad16x16_sse2( b.src_0, stride, b.ref_0, stride ), 0, 0, 0 }}; } );
+
+  compare( planes, "var8x8", "sse2", var_ref<8>,
+           [] ( const Blocks & b ) -> Result
+           {
+             uint32_t sse; int32_t sum;
+             vpx_get8x8var_sse2( b.src_0, stride, b.ref_0, stride, &sse, &sum );
+             return {{ sse, uint32_t( sum ), 0, 0 }};
+           } );
+
+  compare( planes, "var16x16", "sse2", var_ref<16>,
+           [] ( const Blocks & b ) -> Result
+           {
+             uint32_t sse; int32_t sum;
+             vpx_get16x16var_sse2( b.src_0, stride, b.ref_0, stride, &sse, &sum );
+             return {{ sse, uint32_t( sum ), 0, 0 }};
+           } );
+
+  compare( planes, "sad16x16_x2", "sse2", sad16x16_x2_ref,
+           [] ( const Blocks & b ) -> Result
+           {
+             return {{ vpx_sad16x16_sse2( b.src_0, stride, b.ref_0, stride ),
+                       vpx_sad16x16_sse2( b.src_0, stride, b.ref_1, stride ), 0, 0 }};
+           } );
+
+  compare( planes, "var16x16_x2", "sse2", var16x16_x2_ref,
+           [] ( const Blocks & b ) -> Result
+           {
+             uint32_t sse[ 2 ]; int32_t sum[ 2 ];
+             vpx_get16x16var_sse2( b.src_0, stride, b.ref_0, stride, &sse[ 0 ], &sum[ 0 ] );
+             vpx_get16x16var_sse2( b.src_0, stride, b.ref_1, stride, &sse[ 1 ], &sum[ 1 ] );
+             return {{ sse[ 0 ], uint32_t( sum[ 0 ] ), sse[ 1 ], uint32_t( sum[ 1 ] ) }};
+           } );
+
+  compare( planes, "sse8x8_x2", "sse2", sse8x8_x2_ref,
+           [] ( const Blocks & b ) -> Result
+           {
+             uint32_t sse[ 2 ]; int32_t sum;
+             vpx_get8x8var_sse2( b.src_0, stride, b.ref_0, stride, &sse[ 0 ], &sum );
+             vpx_get8x8var_sse2( b.src_1, stride, b.ref_1, stride, &sse[ 1 ], &sum );
+             return {{ sse[ 0 ], sse[ 1 ], 0, 0 }};
+           } );
+#else
+  cout << "sse2: not built" << endl;
+#endif
+
+#ifdef HAVE_AVX2
+  if ( cpu_has_avx2() ) {
+    compare( planes, "var16x16", "avx2", var_ref<16>,
+             [] ( const Blocks & b ) -> Result
+             {
+               uint32_t sse; int32_t sum;
+               get16x16var_avx2( b.src_0, stride, b.ref_0, stride, &sse, &sum );
+               return {{ sse, uint32_t( sum ), 0, 0 }};
+             } );
+
+    compare( planes, "sad16x16_x2", "avx2", sad16x16_x2_ref,
+             [] ( const Blocks & b ) -> Result
+             {
+               uint32_t sad[ 2 ];
+               sad16x16_x2_avx2( b.src_0, stride, b.ref_0, stride, b.ref_1, stride, sad );
+               return {{ sad[ 0 ], sad[ 1 ], 0, 0 }};
+             } );
+
+    compare( planes, "var16x16_x2", "avx2", var16x16_x2_ref,
+             [] ( const Blocks & b ) -> Result
+             {
+               uint32_t sse[ 2 ]; int32_t sum[ 2 ];
+               get16x16var_x2_avx2( b.src_0, stride, b.ref_0, stride, b.ref_1, stride, sse, sum );
+               return {{ sse[ 0 ], uint32_t( sum[ 0 ] ), sse[ 1 ], uint32_t( sum[ 1 ] ) }};
+             } );
+
+    compare( planes, "sse8x8_x2", "avx2", sse8x8_x2_ref,
+             [] ( const Blocks & b ) -> Result
+             {
+               uint32_t sse[ 2 ];
+               get8x8sse_x2_avx2( b.src_0, stride, b.ref_0, stride,
+                                  b.src_1, stride, b.ref_1, stride, sse );
+               return {{ sse[ 0 ], sse[ 1 ], 0, 0 }};
+             } );
+  }
+  else {
+    cout << "avx2: not supported by this CPU" << endl;
+  }
+#else
+  cout << "avx2: not built" << endl;
+#endif
+
+  if ( failed ) {
+    cerr << "variance-benchmark: some kernels differ from the C reference" << endl;
+    return EXIT_FAILURE;
+  }
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,78 @@
+/* -*-mode:c++; tab-width: 2; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+
+/* Copyright 2013-2018 the Alfalfa authors
+                       and the Massachusetts Institute of Technology
+
+   Redistribution and use in source and binary forms, with or without
+   modification, are permitted provided that the following conditions are
+   met:
+
+      1. Redistributions of source code must retain the above copyright
+         notice, this list of conditions and the following disclaimer.
+
+      2. Redistributions in binary form must reproduce the above copyright
+         notice, this list of conditions and the following disclaimer in the
+         documentation and/or other materials provided with the distribution.
+
+   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+   "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+   LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+   A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+   HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+   SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+   LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+   DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+   THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+   (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+   OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE. */
+#include "buffer_arena.hh"
+
+using namespace std;
+
+BufferArena::BufferArena( const size_t max_free_buffers )
+  : max_free_buffers_( max_free_buffers )
+{}
+
+vector<uint8_t> BufferArena::take( const size_t capacity_hint )
+{
+  {
+    lock_guard<mutex> lock( mutex_ );
+
+    if ( not free_buffers_.empty() ) {
+      vector<uint8_t> buffer = move( free_buffers_.back() );
+      free_buffers_.pop_back();
+      return buffer;
+    }
+  }
+
+  vector<uint8_t> buffer;
+  buffer.reserve( capacity_hint );
+  return buffer;
+}
+
+void BufferArena::give( vector<uint8_t> && buffer )
+{
+  if ( buffer.capacity() == 0 ) {
+    return;
+  }
+
+  buffer.clear();
+
+  lock_guard<mutex> lock( mutex_ );
+
+  if ( free_buffers_.size() < max_free_buffers_ ) {
+    free_buffers_.emplace_back( move( buffer ) );
+  }
+}
+
+size_t BufferArena::free_buffers()
+{
+  lock_guard<mutex> lock( mutex_ );
+  return free_buffers_.size();
+}
+
+BufferArena & BufferArena::global()
+{
+  static BufferArena arena;
+  return arena;
+}
@@ -0,0 +1,117 @@
+/* -*-mode:c++; tab-width: 2; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+
+/* Copyright 2013-2018 the Alfalfa authors
+                       and the Massachusetts Institute of Technology
+
+   Redistribution and use in source and binary forms, with or without
+   modification, are permitted provided that the following conditions are
+   met:
+
+      1. Redistributions of source code must retain the above copyright
+         notice, this list of conditions and the following disclaimer.
+
+      2. Redistributions in binary form must reproduce the above copyright
+         notice, this list of conditions and the following disclaimer in the
+         documentation and/or other materials provided with the distribution.
+
+   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+   "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+   LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+   A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+   HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+   SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+   LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+   DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+   THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+   (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+   OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE. */
+#ifndef BUFFER_ARENA_HH
+#define BUFFER_ARENA_HH
+
+/* a pool of reusable byte buffers, so that short-lived output buffers
+   (e.g. one per BoolEncoder) keep their capacity across frames */
+
+#include <mutex>
+#include <vector>
+#include <cstdint>
+
+#include "chunk.hh"
+
+class BufferArena
+{
+private:
+  std::vector<std::vector<uint8_t>> free_buffers_ {};
+  size_t max_free_buffers_;
+
+  std::mutex mutex_ {};
+
+public:
+  static constexpr size_t DEFAULT_CAPACITY = 64 * 1024;
+
+  BufferArena( const size_t max_free_buffers = 64 );
+
+  /* returns an empty buffer, reusing a returned one if possible */
+  std::vector<uint8_t> take( const size_t capacity_hint = DEFAULT_CAPACITY );
+
+  void give( std::vector<uint8_t> && buffer );
+
+  size_t free_buffers();
+
+  static BufferArena & global();
+};
+
+/* a buffer borrowed from a BufferArena, returned to it on destruction */
+class ArenaBuffer
+{
+private:
+  BufferArena * arena_;
+  std::vector<uint8_t> buffer_;
+
+public:
+  ArenaBuffer( BufferArena & arena = BufferArena::global(),
+               const size_t capacity_hint = BufferArena::DEFAULT_CAPACITY )
+    : arena_( &arena ), buffer_( arena.take( capacity_hint ) )
+  {}
+
+  ~ArenaBuffer()
+  {
+    if ( arena_ ) {
+      arena_->give( std::move( buffer_ ) );
+    }
+  }
+
+  ArenaBuffer( ArenaBuffer && other ) noexcept
+    : arena_( other.arena_ ), buffer_( std::move( other.buffer_ ) )
+  {
+    other.arena_ = nullptr;
+  }
+
+  ArenaBuffer & operator=( ArenaBuffer && other ) noexcept
+  {
+    if ( this != &other ) {
+      if ( arena_ ) {
+        arena_->give( std::move( buffer_ ) );
+      }
+
+      arena_ = other.arena_;
+      buffer_ = std::move( other.buffer_ );
+      other.arena_ = nullptr;
+    }
+
+    return *this;
+  }
+
+  /* disallow copying */
+  ArenaBuffer( const ArenaBuffer & other ) = delete;
+  ArenaBuffer & operator=( const ArenaBuffer & other ) = delete;
+
+  BufferArena & arena() const { return *arena_; }
+
+  std::vector<uint8_t> & get() { return buffer_; }
+  const std::vector<uint8_t> & get() const { return buffer_; }
+
+  size_t size() const { return buffer_.size(); }
+  Chunk chunk() const { return Chunk( buffer_ ); }
+};
+
+#endif /* BUFFER_ARENA_HH */
@@ -32,9 +32,12 @@
 #include <iostream>
 #include <string>
 #include <unistd.h>
+#include <vector>
 #include <sys/stat.h>
+#include <sys/uio.h>
 #include <algorithm>
 #include <cstdio>
+#include <climits>
 #include <fcntl.h>
 #include <cassert>
 
@@ -160,6 +163,41 @@ public:
     register_write();
   }
 
+  /* gather-write the buffers, in order */
+  void write( const std::vector<Chunk> & buffers )
+  {
+    std::vector<iovec> iov;
+    iov.reserve( buffers.size() );
+
+    for ( const auto & buffer : buffers ) {
+      if ( buffer.size() > 0 ) {
+        iov.push_back( { const_cast<uint8_t *>( buffer.buffer() ), buffer.size() } );
+      }
+    }
+
+    size_t first = 0;
+    while ( first < iov.size() ) {
+      ssize_t bytes_written = SystemCall( "writev",
+        ::writev( fd_, &iov.at( first ), std::min<size_t>( iov.size() - first, IOV_MAX ) ) );
+      if ( bytes_written == 0 ) {
+        throw internal_error( "writev", "returned 0" );
+      }
+
+      /* skip what has been written, possibly stopping in the middle of a buffer */
+      while ( first < iov.size() and static_cast<size_t>( bytes_written ) >= iov.at( first ).iov_len ) {
+        bytes_written -= iov.at( first ).iov_len;
+        first++;
+      }
+
+      if ( first < iov.size() ) {
+        iov.at( first ).iov_base = static_cast<uint8_t *>( iov.at( first ).iov_base ) + bytes_written;
+        iov.at( first ).iov_len -= bytes_written;
+      }
+    }
+
+    register_write();
+  }
+
   std::string getline()
   {
     std::string ret;
@@ -0,0 +1,148 @@
+/* -*-mode:c++; tab-width: 2; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+
+/* Copyright 2013-2018 the Alfalfa authors
+                       and the Massachusetts Institute of Technology
+
+   Redistribution and use in source and binary forms, with or without
+   modification, are permitted provided that the following conditions are
+   met:
+
+      1. Redistributions of source code must retain the above copyright
+         notice, this list of conditions and the following disclaimer.
+
+      2. Redistributions in binary form must reproduce the above copyright
+         notice, this list of conditions and the following disclaimer in the
+         documentation and/or other materials provided with the distribution.
+
+   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+   "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+   LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+   A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+   HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+   SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+   LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+   DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+   THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+   (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+   OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE. */
+
+#include <chrono>
+#include <cstring>
+#include <thread>
+#include <fcntl.h>
+#include <sys/stat.h>
+
+#include "ivf_stream.hh"
+#include "ivf.hh"
+
+using namespace std;
+
+static FileDescriptor open_input( const string & filename )
+{
+  if ( filename == "-" ) {
+    return FileDescriptor( STDIN_FILENO );
+  }
+
+  return FileDescriptor( SystemCall( filename, open( filename.c_str(), O_RDONLY ) ) );
+}
+
+IVFStream::IVFStream( const string & filename, const bool follow )
+  : IVFStream( open_input( filename ), follow )
+{}
+
+IVFStream::IVFStream( FileDescriptor && fd, const bool follow )
+  : fd_( move( fd ) ), follow_( false ), buffer_( read_block )
+{
+  /* only a regular file can grow after its end has been read */
+  if ( follow ) {
+    struct stat info;
+    SystemCall( "fstat", fstat( fd_.fd_num(), &info ) );
+    follow_ = S_ISREG( info.st_mode );
+  }
+
+  if ( not fill( IVF::supported_header_len ) ) {
+    throw Invalid( "missing IVF file header" );
+  }
+
+  const Chunk header( &buffer_.at( start_ ), IVF::supported_header_len );
+
+  if ( header( 0, 4 ).to_string() != "DKIF" ) {
+    throw Invalid( "missing IVF file header" );
+  }
+
+  if ( header( 4, 2 ).le16() != 0 ) {
+    throw Unsupported( "not an IVF version 0 file" );
+  }
+
+  if ( header( 6, 2 ).le16() != IVF::supported_header_len ) {
+    throw Unsupported( "unsupported IVF header length" );
+  }
+
+  fourcc_ = header( 8, 4 ).to_string();
+  width_ = header( 12, 2 ).le16();
+  height_ = header( 14, 2 ).le16();
+  frame_rate_ = header( 16, 4 ).le32();
+  time_scale_ = header( 20, 4 ).le32();
+  frame_count_ = header( 24, 4 ).le32();
+  expected_decoder_minihash_ = header( 28, 4 ).le32();
+
+  start_ += IVF::supported_header_len;
+}
+
+bool IVFStream::fill( const size_t length )
+{
+  while ( end_ - start_ < length ) {
+    /* move the unread bytes to the front, growing the buffer only for a
+       frame larger than any before */
+    if ( start_ > 0 ) {
+      memmove( buffer_.data(), buffer_.data() + start_, end_ - start_ );
+      end_ -= start_;
+      start_ = 0;
+    }
+
+    if ( buffer_.size() < length ) {
+      buffer_.resize( length );
+    }
+
+    const ssize_t bytes_read = SystemCall( "read", ::read( fd_.fd_num(), buffer_.data() + end_,
+                                                           buffer_.size() - end_ ) );
+
+    if ( bytes_read > 0 ) {
+      end_ += bytes_read;
+    }
+    else if ( follow_ ) {
+      this_thread::sleep_for( chrono::milliseconds( follow_interval ) );
+    }
+    else if ( end_ == start_ ) {
+      return false;
+    }
+    else {
+      throw Invalid( "IVF file truncated" );
+    }
+  }
+
+  return true;
+}
+
+Optional<Chunk> IVFStream::next_frame()
+{
+  if ( not fill( IVF::frame_header_len ) ) {
+    return {};
+  }
+
+  const uint32_t frame_len = Chunk( &buffer_.at( start_ ), IVF::frame_header_len ).le32();
+
+  if ( frame_len > max_frame_len ) {
+    throw Invalid( "IVF frame length too large" );
+  }
+
+  if ( not fill( IVF::frame_header_len + frame_len ) ) {
+    throw Invalid( "IVF file truncated" );
+  }
+
+  Optional<Chunk> frame { true, buffer_.data() + start_ + IVF::frame_header_len, frame_len };
+  start_ += IVF::frame_header_len + frame_len;
+  frames_read_++;
+
+  return frame;
+}
@@ -0,0 +1,101 @@
+/* -*-mode:c++; tab-width: 2; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+
+/* Copyright 2013-2018 the Alfalfa authors
+                       and the Massachusetts Institute of Technology
+
+   Redistribution and use in source and binary forms, with or without
+   modification, are permitted provided that the following conditions are
+   met:
+
+      1. Redistributions of source code must retain the above copyright
+         notice, this list of conditions and the following disclaimer.
+
+      2. Redistributions in binary form must reproduce the above copyright
+         notice, this list of conditions and the following disclaimer in the
+         documentation and/or other materials provided with the distribution.
+
+   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+   "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+   LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+   A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+   HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+   SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+   LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+   DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+   THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+   (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+   OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE. */
+
+#ifndef IVF_STREAM_HH
+#define IVF_STREAM_HH
+
+#include <string>
+#include <cstdint>
+#include <vector>
+
+#include "chunk.hh"
+#include "file_descriptor.hh"
+#include "optional.hh"
+
+/* Reads an IVF file front to back, parsing each frame header as the bytes
+   arrive, so it works on pipes, sockets and files still being written, and
+   hands out a frame as soon as all of it has been read. Unlike IVF, it
+   neither maps the file nor indexes it first, and it buffers no more than
+   the larger of one read and one frame. */
+class IVFStream
+{
+private:
+  FileDescriptor fd_;
+  bool follow_;
+
+  std::vector<uint8_t> buffer_;
+  size_t start_ { 0 }, end_ { 0 };
+
+  std::string fourcc_ {};
+  uint16_t width_ { 0 }, height_ { 0 };
+  uint32_t frame_rate_ { 0 }, time_scale_ { 0 }, frame_count_ { 0 };
+  uint32_t expected_decoder_minihash_ { 0 };
+
+  uint32_t frames_read_ { 0 };
+
+  /* makes at least `length` unread bytes available; false at the end of
+     the input if none are left */
+  bool fill( const size_t length );
+
+public:
+  /* bytes asked of each read() */
+  static constexpr size_t read_block = 65536;
+
+  /* a frame header claiming more than this is taken as corruption */
+  static constexpr uint32_t max_frame_len = 64 << 20;
+
+  /* how often a followed file is checked for new data, in milliseconds */
+  static constexpr unsigned int follow_interval = 10;
+
+  /* with `follow`, reaching the end of a regular file waits for it to grow
+     (like tail -f) instead of ending the stream */
+  IVFStream( FileDescriptor && fd, const bool follow = false );
+
+  /* "-" is the standard input */
+  IVFStream( const std::string & filename, const bool follow = false );
+
+  const std::string & fourcc( void ) const { return fourcc_; }
+  uint16_t width( void ) const { return width_; }
+  uint16_t height( void ) const { return height_; }
+  uint32_t frame_rate( void ) const { return frame_rate_; }
+  uint32_t time_scale( void ) const { return time_scale_; }
+
+  /* as the header gave it when the stream was opened: a file still being
+     written may hold more */
+  uint32_t frame_count( void ) const { return frame_count_; }
+
+  uint32_t expected_decoder_minihash() const { return expected_decoder_minihash_; }
+
+  /* the next frame (valid until the following call), or nothing at the end
+     of the input */
+  Optional<Chunk> next_frame();
+
+  uint32_t frames_read() const { return frames_read_; }
+};
+
+#endif /* IVF_STREAM_HH */
@@ -26,7 +26,13 @@
    (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
    OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE. */
 
+#include <condition_variable>
 #include <cstring>
+#include <deque>
+#include <exception>
+#include <mutex>
+#include <thread>
+#include <unistd.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <fcntl.h>
@@ -52,6 +58,139 @@ static void memcpy_le32( uint8_t * dest, const uint32_t val )
   memcpy( dest, &swizzled, sizeof( swizzled ) );
 }
 
+/* the frames appended since the last hand-over, and the thread that
+   writes the batches handed over */
+class IVFWriter::Batcher
+{
+private:
+  /* how many batches may wait for the thread before append_frame() does */
+  static constexpr size_t max_pending = 4;
+
+  FileDescriptor & fd_;
+  const size_t batch_size_;
+  const bool sync_every_batch_;
+
+  vector<uint8_t> current_ {};
+
+  mutex mutex_ {};
+  condition_variable changed_ {};
+  deque<vector<uint8_t>> pending_ {};
+  bool writing_ { false };
+  bool stopping_ { false };
+  exception_ptr error_ {};
+
+  thread writer_ {};
+
+  void write_batches()
+  {
+    while ( true ) {
+      deque<vector<uint8_t>> batches;
+
+      {
+        unique_lock<mutex> lock { mutex_ };
+        changed_.wait( lock, [this] () { return stopping_ or not pending_.empty(); } );
+
+        if ( pending_.empty() ) {
+          return;
+        }
+
+        batches.swap( pending_ );
+        writing_ = true;
+        changed_.notify_all();
+      }
+
+      exception_ptr error;
+
+      try {
+        fd_.write( vector<Chunk>( batches.begin(), batches.end() ) );
+
+        if ( sync_every_batch_ ) {
+          SystemCall( "fdatasync", fdatasync( fd_.fd_num() ) );
+        }
+      }
+      catch ( ... ) {
+        error = current_exception();
+      }
+
+      unique_lock<mutex> lock { mutex_ };
+      writing_ = false;
+      if ( error and not error_ ) {
+        error_ = error;
+      }
+      changed_.notify_all();
+    }
+  }
+
+  /* with mutex_ held */
+  void check_error()
+  {
+    if ( error_ ) {
+      rethrow_exception( error_ );
+    }
+  }
+
+public:
+  Batcher( FileDescriptor & fd, const size_t batch_size, const bool sync_every_batch )
+    : fd_( fd ), batch_size_( batch_size ), sync_every_batch_( sync_every_batch )
+  {
+    current_.reserve( batch_size_ );
+    writer_ = thread( [this] () { write_batches(); } );
+  }
+
+  ~Batcher()
+  {
+    {
+      unique_lock<mutex> lock { mutex_ };
+      stopping_ = true;
+      changed_.notify_all();
+    }
+
+    writer_.join();
+  }
+
+  Batcher( const Batcher & ) = delete;
+  Batcher & operator=( const Batcher & ) = delete;
+
+  void append( const vector<Chunk> & buffers )
+  {
+    for ( const Chunk & buffer : buffers ) {
+      current_.insert( current_.end(), buffer.buffer(), buffer.buffer() + buffer.size() );
+    }
+
+    if ( current_.size() >= batch_size_ ) {
+      hand_over();
+    }
+  }
+
+  void hand_over()
+  {
+    if ( current_.empty() ) {
+      return;
+    }
+
+    unique_lock<mutex> lock { mutex_ };
+    changed_.wait( lock, [this] () { return pending_.size() < max_pending or error_; } );
+    check_error();
+
+    pending_.push_back( move( current_ ) );
+    changed_.notify_all();
+    lock.unlock();
+
+    current_ = vector<uint8_t>();
+    current_.reserve( batch_size_ );
+  }
+
+  /* returns once everything appended has been written */
+  void drain()
+  {
+    hand_over();
+
+    unique_lock<mutex> lock { mutex_ };
+    changed_.wait( lock, [this] () { return ( pending_.empty() and not writing_ ) or error_; } );
+    check_error();
+  }
+};
+
 IVFWriter::IVFWriter( FileDescriptor && fd,
                       const string & fourcc,
                       const uint16_t width,
@@ -100,6 +239,32 @@ void IVFWriter::set_expected_decoder_entry_hash( const uint32_t minihash ) /* Ex
 
 size_t IVFWriter::append_frame( const Chunk & chunk )
 {
+  return append_frame( vector<Chunk> { chunk }, chunk.size() );
+}
+
+size_t IVFWriter::append_frame( const SerializedFrame & frame )
+{
+  return append_frame( frame.slices(), frame.size() );
+}
+
+size_t IVFWriter::append_frame( const vector<Chunk> & slices, const uint32_t frame_size )
+{
+  if ( batcher_ ) {
+    SafeArray<uint8_t, IVF::frame_header_len> new_header;
+    zero( new_header );
+    memcpy_le32( &new_header.at( 0 ), frame_size );
+
+    batcher_->append( { Chunk( &new_header.at( 0 ), new_header.size() ) } );
+    batcher_->append( slices );
+
+    file_size_ += new_header.size();
+    const size_t written_offset = file_size_;
+    file_size_ += frame_size;
+    frame_count_++;
+
+    return written_offset;
+  }
+
   /* map the header into memory */
   MMap_Region header_in_mem( IVF::supported_header_len, PROT_READ | PROT_WRITE, MAP_SHARED, fd_.fd_num() );
   uint8_t * mutable_header_ptr = header_in_mem.addr();
@@ -115,18 +280,18 @@ size_t IVFWriter::append_frame( const Chunk & chunk )
   /* build the frame header */
   SafeArray<uint8_t, IVF::frame_header_len> new_header;
   zero( new_header );
-  memcpy_le32( &new_header.at( 0 ), chunk.size() );
+  memcpy_le32( &new_header.at( 0 ), frame_size );
 
   /* XXX does not include presentation timestamp */
 
-  /* append the frame header to the file */
-  fd_.write( Chunk( &new_header.at( 0 ), new_header.size() ) );
-  file_size_ += new_header .size();
-  size_t written_offset = file_size_;
+  /* append the frame header and the frame to the file */
+  vector<Chunk> buffers { Chunk( &new_header.at( 0 ), new_header.size() ) };
+  buffers.insert( buffers.end(), slices.begin(), slices.end() );
+  fd_.write( buffers );
 
-  /* append the frame to the file */
-  fd_.write( chunk );
-  file_size_ += chunk.size();
+  file_size_ += new_header.size();
+  size_t written_offset = file_size_;
+  file_size_ += frame_size;
 
   /* verify the new file size */
   assert( fd_.size() == file_size_ );
@@ -141,6 +306,54 @@ size_t IVFWriter::append_frame( const Chunk & chunk )
   return written_offset;
 }
 
+IVFWriter::~IVFWriter()
+{
+  if ( batcher_ ) {
+    try {
+      flush();
+    }
+    catch ( const exception & e ) {
+      print_exception( "IVFWriter", e );
+    }
+  }
+}
+
+void IVFWriter::set_buffered( const size_t batch_size, const Durability durability )
+{
+  flush();
+
+  batcher_.reset();
+  batcher_.reset( new Batcher( fd_, batch_size, durability == SYNC_EVERY_BATCH ) );
+  durability_ = durability;
+}
+
+void IVFWriter::write_frame_count()
+{
+  SafeArray<uint8_t, 4> frame_count;
+  memcpy_le32( &frame_count.at( 0 ), frame_count_ );
+
+  if ( SystemCall( "pwrite", pwrite( fd_.fd_num(), &frame_count.at( 0 ), frame_count.size(), 24 ) )
+       != static_cast<ssize_t>( frame_count.size() ) ) {
+    throw internal_error( "pwrite", "short write" );
+  }
+}
+
+void IVFWriter::flush()
+{
+  if ( not batcher_ ) {
+    return;
+  }
+
+  batcher_->drain();
+  write_frame_count();
+
+  assert( file_size_ == fd_.size() );
+
+  if ( durability_ != NO_SYNC ) {
+    SystemCall( "fdatasync", fdatasync( fd_.fd_num() ) );
+  }
+}
+
 IVFWriter::IVFWriter( const string & filename,
                       const string & fourcc,
                       const uint16_t width,
@@ -29,11 +29,22 @@
 #ifndef IVF_WRITER_HH
 #define IVF_WRITER_HH
 
+#include <memory>
+#include <vector>
+
 #include "ivf.hh"
+#include "serialized_frame.hh"
 
 class IVFWriter
 {
+public:
+  /* when a buffered writer makes the file durable with fdatasync() */
+  enum Durability { NO_SYNC, SYNC_ON_FLUSH, SYNC_EVERY_BATCH };
+
 private:
+  /* the buffered mode's batches and background thread */
+  class Batcher;
+
   FileDescriptor fd_;
   uint64_t file_size_;
   uint32_t frame_count_;
@@ -41,6 +52,13 @@ private:
   uint16_t width_;
   uint16_t height_;
 
+  std::unique_ptr<Batcher> batcher_ {};
+  Durability durability_ { NO_SYNC };
+
+  size_t append_frame( const std::vector<Chunk> & slices, const uint32_t frame_size );
+
+  void write_frame_count();
+
 public:
   IVFWriter( const std::string & filename,
              const std::string & fourcc,
@@ -56,8 +74,29 @@ public:
              const uint32_t frame_rate,
              const uint32_t time_scale );
 
+  ~IVFWriter();
+
+  /* forbid copying */
+  IVFWriter( const IVFWriter & other ) = delete;
+  IVFWriter & operator=( const IVFWriter & other ) = delete;
+
+  /* Switches to buffered mode: frames are copied into batches of about
+     `batch_size` bytes, which a background thread writes with one writev()
+     each (or several batches per writev() if it falls behind). The frame
+     count in the header is only updated by flush() and the destructor, so
+     until then the file can be read only as a stream. */
+  void set_buffered( const size_t batch_size = 1 << 20,
+                     const Durability durability = NO_SYNC );
+
+  /* writes out every appended frame and the frame count */
+  void flush();
+
+  /* returns the frame's offset in the file */
   size_t append_frame( const Chunk & chunk );
 
+  /* writes the frame's slices directly, without concatenating them */
+  size_t append_frame( const SerializedFrame & frame );
+
   void set_expected_decoder_entry_hash( const uint32_t minihash ); /* ExCamera invention */
 
   uint16_t width() const { return width_; }
@@ -0,0 +1,120 @@
+/* -*-mode:c++; tab-width: 2; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+
+/* Copyright 2013-2018 the Alfalfa authors
+                       and the Massachusetts Institute of Technology
+
+   Redistribution and use in source and binary forms, with or without
+   modification, are permitted provided that the following conditions are
+   met:
+
+      1. Redistributions of source code must retain the above copyright
+         notice, this list of conditions and the following disclaimer.
+
+      2. Redistributions in binary form must reproduce the above copyright
+         notice, this list of conditions and the following disclaimer in the
+         documentation and/or other materials provided with the distribution.
+
+   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+   "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+   LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+   A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+   HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+   SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+   LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+   DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+   THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+   (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+   OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE. */
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+#include "serialized_frame.hh"
+
+using namespace std;
+
+void SerializedFrame::append( ArenaBuffer && buffer )
+{
+  if ( buffer.size() == 0 ) {
+    return;
+  }
+
+  size_ += buffer.size();
+  buffers_.emplace_back( move( buffer ) );
+}
+
+vector<Chunk> SerializedFrame::slices() const
+{
+  vector<Chunk> ret;
+  ret.reserve( buffers_.size() );
+
+  for ( const auto & buffer : buffers_ ) {
+    ret.emplace_back( buffer.chunk() );
+  }
+
+  return ret;
+}
+
+vector<Chunk> SerializedFrame::slices( size_t offset, size_t length ) const
+{
+  if ( offset + length > size_ ) {
+    throw out_of_range( "attempted to read past end of serialized frame" );
+  }
+
+  vector<Chunk> ret;
+
+  for ( const auto & buffer : buffers_ ) {
+    if ( length == 0 ) {
+      break;
+    }
+
+    if ( offset >= buffer.size() ) {
+      offset -= buffer.size();
+      continue;
+    }
+
+    const size_t amount = min( length, buffer.size() - offset );
+    ret.emplace_back( buffer.chunk()( offset, amount ) );
+
+    length -= amount;
+    offset = 0;
+  }
+
+  return ret;
+}
+
+void SerializedFrame::copy_to( uint8_t * dest, size_t offset, size_t length ) const
+{
+  if ( offset + length > size_ ) {
+    throw out_of_range( "attempted to read past end of serialized frame" );
+  }
+
+  for ( const auto & buffer : buffers_ ) {
+    if ( length == 0 ) {
+      break;
+    }
+
+    if ( offset >= buffer.size() ) {
+      offset -= buffer.size();
+      continue;
+    }
+
+    const size_t amount = min( length, buffer.size() - offset );
+    memcpy( dest, buffer.get().data() + offset, amount );
+
+    dest += amount;
+    length -= amount;
+    offset = 0;
+  }
+}
+
+vector<uint8_t> SerializedFrame::to_vector() const
+{
+  vector<uint8_t> ret( size_ );
+
+  if ( size_ > 0 ) {
+    copy_to( ret.data(), 0, size_ );
+  }
+
+  return ret;
+}
@@ -0,0 +1,74 @@
+/* -*-mode:c++; tab-width: 2; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+
+/* Copyright 2013-2018 the Alfalfa authors
+                       and the Massachusetts Institute of Technology
+
+   Redistribution and use in source and binary forms, with or without
+   modification, are permitted provided that the following conditions are
+   met:
+
+      1. Redistributions of source code must retain the above copyright
+         notice, this list of conditions and the following disclaimer.
+
+      2. Redistributions in binary form must reproduce the above copyright
+         notice, this list of conditions and the following disclaimer in the
+         documentation and/or other materials provided with the distribution.
+
+   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+   "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+   LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+   A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+   HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+   SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+   LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+   DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+   THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+   (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+   OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE. */
+#ifndef SERIALIZED_FRAME_HH
+#define SERIALIZED_FRAME_HH
+
+/* a compressed frame kept as the list of buffers it was assembled from
+   (frame tag, first partition, partition sizes, DCT partitions), so that
+   writers can gather it without concatenating it first */
+
+#include <vector>
+#include <string>
+
+#include "buffer_arena.hh"
+#include "chunk.hh"
+
+class SerializedFrame
+{
+private:
+  std::vector<ArenaBuffer> buffers_ {};
+  size_t size_ { 0 };
+
+public:
+  SerializedFrame() {}
+
+  /* the buffers are owned by the frame; allow moving, disallow copying */
+  SerializedFrame( SerializedFrame && other ) noexcept = default;
+  SerializedFrame & operator=( SerializedFrame && other ) noexcept = default;
+
+  SerializedFrame( const SerializedFrame & other ) = delete;
+  SerializedFrame & operator=( const SerializedFrame & other ) = delete;
+
+  void append( ArenaBuffer && buffer );
+
+  size_t size() const { return size_; }
+  bool empty() const { return size_ == 0; }
+
+  /* iovec-style view of the frame */
+  std::vector<Chunk> slices() const;
+
+  /* iovec-style view of [offset, offset + length) of the frame */
+  std::vector<Chunk> slices( size_t offset, size_t length ) const;
+
+  /* copies [offset, offset + length) of the frame into dest */
+  void copy_to( uint8_t * dest, const size_t offset, const size_t length ) const;
+
+  std::vector<uint8_t> to_vector() const;
+};
+
+#endif /* SERIALIZED_FRAME_HH */
@@ -1,71 +1,343 @@
 /* -*-mode:c++; tab-width: 2; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
 
-/* Based on (and linked with) libx264 (GPL-2+) */
+/* Copyright 2013-2018 the Alfalfa authors
+                       and the Massachusetts Institute of Technology
 
-/* Copyright (C) 2015-2018 the Alfalfa authors
+   Redistribution and use in source and binary forms, with or without
+   modification, are permitted provided that the following conditions are
+   met:
 
-   This program is free software; you can redistribute it and/or
-   modify it under the terms of the GNU General Public License
-   as published by the Free Software Foundation; either version 2
-   of the License, or (at your option) any later version.
+      1. Redistributions of source code must retain the above copyright
+         notice, this list of conditions and the following disclaimer.
 
-   This program is distributed in the hope that it will be useful,
-   but WITHOUT ANY WARRANTY; without even the implied warranty of
-   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
-   GNU General Public License for more details.
+      2. Redistributions in binary form must reproduce the above copyright
+         notice, this list of conditions and the following disclaimer in the
+         documentation and/or other materials provided with the distribution.
 
-   You should have received a copy of the GNU General Public License
-   along with this program; if not, write to the Free Software
-   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
-   02110-1301, USA. */
+   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+   "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+   LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+   A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+   HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+   SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+   LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+   DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+   THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+   (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+   OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE. */
 
+#include <algorithm>
 #include <cstdint>
+#include <future>
+#include <thread>
 #include <vector>
-#include <x264.h>
 
+#include "config.h"
+#include "exception.hh"
 #include "ssim.hh"
 
-struct x264_pixel_function_t
+#ifdef HAVE_SSE2
+#include <emmintrin.h>
+#endif
+
+using namespace std;
+
+namespace {
+
+struct Plane
+{
+  const uint8_t * data;
+  size_t stride;
+  unsigned int width, height;
+
+  Plane( const uint8_t * data, const size_t stride,
+         const unsigned int width, const unsigned int height )
+    : data( data ), stride( stride ), width( width ), height( height )
+  {}
+
+  Plane( const TwoD<uint8_t> & image )
+    : Plane( &image.at( 0, 0 ), image.width(), image.width(), image.height() )
+  {}
+
+  /* the windows start every four pixels and span two 4x4 blocks */
+  unsigned int window_columns() const { return max( width / 4, 1u ) - 1; }
+  unsigned int window_rows() const { return max( height / 4, 1u ) - 1; }
+};
+
+/* sums of a, b, a^2 + b^2 and a * b over one 4x4 block */
+struct BlockSums
 {
-  // 158 is the number of pointers in this internal x264 struct
-  // this is obviously a bit fragile since x264 could add more
-  void * ptrs[ 158 ];
+  int32_t s1, s2, ss, s12;
 };
 
-// These are internal libx264 instructions so they aren't included in x264.h
-extern "C"
+/* the sums of the 4x4 blocks in one row of blocks */
+void block_row_sums( const Plane & a, const Plane & b, const unsigned int block_row,
+                     BlockSums * sums )
 {
-  float x264_pixel_ssim_wxh( const x264_pixel_function_t * func, const uint8_t *pix1,
-                             uintptr_t stride1, const uint8_t *pix2, uintptr_t stride2,
-                             int width, int height, void *buf, int *cnt );
+  const unsigned int blocks = a.width / 4;
+  const uint8_t * a_row = a.data + 4 * block_row * a.stride;
+  const uint8_t * b_row = b.data + 4 * block_row * b.stride;
+
+  unsigned int block = 0;
+
+#ifdef HAVE_SSE2
+  /* two blocks at a time */
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i ones = _mm_set1_epi16( 1 );
+
+  for ( ; block + 2 <= blocks; block += 2 ) {
+    __m128i s1 = zero, s2 = zero, ss = zero, s12 = zero;
+
+    for ( unsigned int i = 0; i < 4; i++ ) {
+      const __m128i pa = _mm_unpacklo_epi8( _mm_loadl_epi64( reinterpret_cast<const __m128i *>( a_row + i * a.stride + 4 * block ) ), zero );
+      const __m128i pb = _mm_unpacklo_epi8( _mm_loadl_epi64( reinterpret_cast<const __m128i *>( b_row + i * b.stride + 4 * block ) ), zero );
+
+      s1 = _mm_add_epi16( s1, pa );
+      s2 = _mm_add_epi16( s2, pb );
+      ss = _mm_add_epi32( ss, _mm_add_epi32( _mm_madd_epi16( pa, pa ), _mm_madd_epi16( pb, pb ) ) );
+      s12 = _mm_add_epi32( s12, _mm_madd_epi16( pa, pb ) );
+    }
+
+    /* every sum now has four lanes: two halves of each of the two blocks */
+    s1 = _mm_madd_epi16( s1, ones );
+    s2 = _mm_madd_epi16( s2, ones );
+
+    const __m128i s1_s2_lo = _mm_unpacklo_epi32( s1, s2 );
+    const __m128i s1_s2_hi = _mm_unpackhi_epi32( s1, s2 );
+    const __m128i ss_s12_lo = _mm_unpacklo_epi32( ss, s12 );
+    const __m128i ss_s12_hi = _mm_unpackhi_epi32( ss, s12 );
+
+    const __m128i first = _mm_add_epi32( _mm_unpacklo_epi64( s1_s2_lo, ss_s12_lo ),
+                                         _mm_unpackhi_epi64( s1_s2_lo, ss_s12_lo ) );
+    const __m128i second = _mm_add_epi32( _mm_unpacklo_epi64( s1_s2_hi, ss_s12_hi ),
+                                          _mm_unpackhi_epi64( s1_s2_hi, ss_s12_hi ) );
+
+    _mm_storeu_si128( reinterpret_cast<__m128i *>( &sums[ block ] ), first );
+    _mm_storeu_si128( reinterpret_cast<__m128i *>( &sums[ block + 1 ] ), second );
+  }
+#endif
+
+  for ( ; block < blocks; block++ ) {
+    BlockSums & s = sums[ block ];
+    s = { 0, 0, 0, 0 };
 
-  void x264_pixel_init( int cpu, x264_pixel_function_t *pixf );
+    for ( unsigned int i = 0; i < 4; i++ ) {
+      for ( unsigned int j = 0; j < 4; j++ ) {
+        const int32_t pa = a_row[ i * a.stride + 4 * block + j ];
+        const int32_t pb = b_row[ i * b.stride + 4 * block + j ];
 
-  uint32_t x264_cpu_detect( void );
+        s.s1 += pa;
+        s.s2 += pb;
+        s.ss += pa * pa + pb * pb;
+        s.s12 += pa * pb;
+      }
+    }
+  }
 }
 
-x264_pixel_function_t init_pixel_function( void )
+/* SSIM of the 8x8 window made of four blocks, in integer arithmetic as far
+   as it goes (the constants are x264's for 8-bit pixels) */
+inline float window_ssim( const BlockSums & top_left, const BlockSums & top_right,
+                          const BlockSums & bottom_left, const BlockSums & bottom_right )
 {
-  x264_pixel_function_t pix_func;
-  x264_pixel_init( x264_cpu_detect(), &pix_func );
+  const int32_t C1 = 416;    /* ( 0.01 * 255 )^2 * 64 */
+  const int32_t C2 = 235963; /* ( 0.03 * 255 )^2 * 64 * 63 */
 
-  return pix_func;
+  const int32_t s1 = top_left.s1 + top_right.s1 + bottom_left.s1 + bottom_right.s1;
+  const int32_t s2 = top_left.s2 + top_right.s2 + bottom_left.s2 + bottom_right.s2;
+  const int32_t ss = top_left.ss + top_right.ss + bottom_left.ss + bottom_right.ss;
+  const int32_t s12 = top_left.s12 + top_right.s12 + bottom_left.s12 + bottom_right.s12;
+
+  const int32_t vars = ss * 64 - s1 * s1 - s2 * s2;
+  const int32_t covar = s12 * 64 - s1 * s2;
+
+  return float( 2 * s1 * s2 + C1 ) * float( 2 * covar + C2 )
+         / ( float( s1 * s1 + s2 * s2 + C1 ) * float( vars + C2 ) );
+}
+
+/* calls f( column, row, ssim ) for every window in rows [first_row, last_row) */
+template<class Callback>
+void forall_windows( const Plane & a, const Plane & b,
+                     const unsigned int first_row, const unsigned int last_row,
+                     Callback && f )
+{
+  const unsigned int columns = a.window_columns();
+
+  vector<BlockSums> above( columns + 1 ), below( columns + 1 );
+  block_row_sums( a, b, first_row, above.data() );
+
+  for ( unsigned int row = first_row; row < last_row; row++ ) {
+    block_row_sums( a, b, row + 1, below.data() );
+
+    for ( unsigned int column = 0; column < columns; column++ ) {
+      f( column, row, window_ssim( above[ column ], above[ column + 1 ],
+                                   below[ column ], below[ column + 1 ] ) );
+    }
+
+    swap( above, below );
+  }
 }
 
-x264_pixel_function_t x264_funcs = init_pixel_function();
+/* runs f( first_row, last_row ) over window rows [0, rows) split into ranges
+   that start at multiples of `granularity`, one per worker */
+template<class Callback>
+void forall_row_ranges( const unsigned int rows, const unsigned int granularity,
+                        Callback && f )
+{
+  /* a worker costs about as much to start as a few rows of windows */
+  const unsigned int MIN_ROWS_PER_WORKER = 32;
+  static const unsigned int hardware_threads = max( 1u, thread::hardware_concurrency() );
+
+  const unsigned int workers = max( 1u, min( hardware_threads, rows / MIN_ROWS_PER_WORKER ) );
+
+  auto boundary = [&] ( const unsigned int worker )
+    {
+      const unsigned int row = worker * rows / workers;
+      return min( rows, ( row + granularity - 1 ) / granularity * granularity );
+    };
+
+  vector<future<void>> helpers;
+  for ( unsigned int worker = 1; worker < workers; worker++ ) {
+    helpers.emplace_back( async( launch::async, [&, worker] ()
+                                 { f( boundary( worker ), boundary( worker + 1 ) ); } ) );
+  }
+
+  f( 0, boundary( 1 ) );
+
+  for ( auto & helper : helpers ) {
+    helper.get();
+  }
+}
+
+void check_sizes( const TwoD<uint8_t> & image, const TwoD<uint8_t> & other_image )
+{
+  if ( image.width() != other_image.width() or image.height() != other_image.height() ) {
+    throw Invalid( "ssim: images differ in size" );
+  }
+}
+
+double mean_ssim( const Plane & a, const Plane & b )
+{
+  const unsigned int rows = a.window_rows();
+  const unsigned int columns = a.window_columns();
+
+  if ( rows == 0 or columns == 0 ) {
+    throw Invalid( "ssim: image is smaller than one window" );
+  }
+
+  /* sum each fixed band of rows separately and add the bands up in order,
+     so the result doesn't depend on how the rows were split among workers */
+  const unsigned int BAND_ROWS = 16;
+  vector<double> band_totals( ( rows + BAND_ROWS - 1 ) / BAND_ROWS, 0.0 );
+
+  forall_row_ranges( rows, BAND_ROWS,
+    [&] ( const unsigned int first_row, const unsigned int last_row )
+    {
+      forall_windows( a, b, first_row, last_row,
+                      [&band_totals] ( unsigned int, const unsigned int row, const float value )
+                      { band_totals[ row / BAND_ROWS ] += value; } );
+    } );
+
+  double total = 0;
+  for ( const double band_total : band_totals ) {
+    total += band_total;
+  }
+
+  return total / ( double( rows ) * columns );
+}
+
+/* 2x2 box average, rounding as pavgb does on each step */
+vector<uint8_t> downscale( const Plane & plane, const unsigned int width, const unsigned int height )
+{
+  vector<uint8_t> output( size_t( width ) * height );
+
+  for ( unsigned int row = 0; row < height; row++ ) {
+    const uint8_t * top = plane.data + 2 * row * plane.stride;
+    const uint8_t * bottom = top + plane.stride;
+    uint8_t * out = output.data() + size_t( row ) * width;
+
+    unsigned int column = 0;
+
+#ifdef HAVE_SSE2
+    const __m128i low_bytes = _mm_set1_epi16( 0x00FF );
+
+    for ( ; column + 8 <= width; column += 8 ) {
+      const __m128i rows_average = _mm_avg_epu8( _mm_loadu_si128( reinterpret_cast<const __m128i *>( top + 2 * column ) ),
+                                                 _mm_loadu_si128( reinterpret_cast<const __m128i *>( bottom + 2 * column ) ) );
+      const __m128i average = _mm_avg_epu16( _mm_and_si128( rows_average, low_bytes ),
+                                             _mm_srli_epi16( rows_average, 8 ) );
+      _mm_storel_epi64( reinterpret_cast<__m128i *>( out + column ), _mm_packus_epi16( average, average ) );
+    }
+#endif
+
+    for ( ; column < width; column++ ) {
+      const unsigned int left = ( top[ 2 * column ] + bottom[ 2 * column ] + 1 ) >> 1;
+      const unsigned int right = ( top[ 2 * column + 1 ] + bottom[ 2 * column + 1 ] + 1 ) >> 1;
+      out[ column ] = ( left + right + 1 ) >> 1;
+    }
+  }
+
+  return output;
+}
+
+}
 
 double ssim( const TwoD<uint8_t> & image, const TwoD<uint8_t> & other_image )
 {
-   int count;
-   std::vector<uint8_t> tmp_buffer;
-   // Buffer size calculation taken from x264
-   tmp_buffer.resize( 8 * ( image.width() / 4 + 3 ) * sizeof( int ) );
-
-   // No padding so stride = width
-   double ssim = x264_pixel_ssim_wxh( &x264_funcs, &image.at( 0, 0 ), image.width(),
-                                      &other_image.at( 0, 0 ), other_image.width(),
-                                      image.width(), image.height(),
-                                      tmp_buffer.data(), &count );
-
-   return ssim / count;
+  check_sizes( image, other_image );
+  return mean_ssim( image, other_image );
+}
+
+double fast_ssim( const TwoD<uint8_t> & image, const TwoD<uint8_t> & other_image )
+{
+  check_sizes( image, other_image );
+
+  const unsigned int width = image.width() / 2;
+  const unsigned int height = image.height() / 2;
+
+  if ( width < 8 or height < 8 ) {
+    return ssim( image, other_image );
+  }
+
+  const vector<uint8_t> a = downscale( image, width, height );
+  const vector<uint8_t> b = downscale( other_image, width, height );
+
+  return mean_ssim( { a.data(), width, width, height }, { b.data(), width, width, height } );
+}
+
+SSIMMap ssim_map( const TwoD<uint8_t> & image, const TwoD<uint8_t> & other_image )
+{
+  check_sizes( image, other_image );
+
+  const Plane a { image }, b { other_image };
+  const unsigned int rows = a.window_rows();
+  const unsigned int columns = a.window_columns();
+
+  if ( rows == 0 or columns == 0 ) {
+    throw Invalid( "ssim: image is smaller than one window" );
+  }
+
+  /* four windows to a macroblock side */
+  SSIMMap map { ( columns + 3 ) / 4, ( rows + 3 ) / 4, {} };
+  map.values.resize( map.width * map.height );
+  vector<unsigned int> counts( map.values.size() );
+
+  /* each worker takes whole rows of macroblocks, so writes never overlap */
+  forall_row_ranges( rows, 4,
+    [&] ( const unsigned int first_row, const unsigned int last_row )
+    {
+      forall_windows( a, b, first_row, last_row,
+                      [&] ( const unsigned int column, const unsigned int row, const float value )
+                      {
+                        const size_t i = ( row / 4 ) * map.width + column / 4;
+                        map.values[ i ] += value;
+                        counts[ i ]++;
+                      } );
+    } );
+
+  for ( size_t i = 0; i < map.values.size(); i++ ) {
+    map.values[ i ] /= counts[ i ];
+  }
+
+  return map;
 }
@@ -26,6 +26,37 @@
    (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
    OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE. */
 
+#ifndef SSIM_HH
+#define SSIM_HH
+
+#include <vector>
+
 #include "2d.hh"
 
+/* SSIM of two same-sized planes: the mean over 8x8 windows spaced four
+   pixels apart, with the constants and window layout of x264 (so the values
+   match what it used to compute for us). Large planes are split by rows
+   across threads. */
 double ssim( const TwoD<uint8_t> & image, const TwoD<uint8_t> & other_image );
+
+/* the same measure on both planes downscaled by two in each direction: a
+   quarter of the windows (every pixel is still read once, for the
+   downscaling). It tracks ssim() on natural images but forgives fine
+   noise, which the downscaling averages out. */
+double fast_ssim( const TwoD<uint8_t> & image, const TwoD<uint8_t> & other_image );
+
+/* the mean SSIM of the windows that start in each 16x16 macroblock */
+struct SSIMMap
+{
+  unsigned int width, height;
+  std::vector<double> values;
+
+  double at( const unsigned int column, const unsigned int row ) const
+  {
+    return values.at( row * width + column );
+  }
+};
+
+SSIMMap ssim_map( const TwoD<uint8_t> & image, const TwoD<uint8_t> & other_image );
+
+#endif /* SSIM_HH */